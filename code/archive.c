@@ -0,0 +1,530 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "archive.h"
+
+// NOTE(Ryan): Segment files are named by when they start, so sort oldest first by name too
+#define ARCHIVE_SEGMENT_PREFIX "archive-"
+#define ARCHIVE_SEGMENT_SUFFIX ".seg"
+
+INTERNAL u64
+archive_wall_clock_ns(void)
+{
+  struct timespec now = {0};
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (u64)now.tv_sec * 1000000000ULL + (u64)now.tv_nsec;
+}
+
+INTERNAL void
+archive_unmap_segment(ArchiveSegment *segment)
+{
+  if (segment->map != NULL)
+  {
+    munmap(segment->map, segment->map_size);
+  }
+  if (segment->fd >= 0)
+  {
+    close(segment->fd);
+  }
+  ArchiveSegment zero_segment = {0};
+  *segment = zero_segment;
+  segment->fd = -1;
+}
+
+// NOTE(Ryan): The segment owns fd either way, so archive_unmap_segment() closes it on failure
+INTERNAL b32
+archive_map_segment(ArchiveSegment *segment, int fd, u64 size)
+{
+  b32 result = false;
+
+  segment->fd = fd;
+  segment->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (segment->map != MAP_FAILED)
+  {
+    segment->map_size = size;
+    segment->header = (ArchiveSegmentHeader *)segment->map;
+    segment->index = (ArchiveIndexEntry *)(segment->map + sizeof(ArchiveSegmentHeader));
+    result = true;
+  }
+  else
+  {
+    segment->map = NULL;
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Only what the archive thread itself wrote,
+// so just checks a crash or another version did not leave it inconsistent
+INTERNAL b32
+archive_is_segment_valid(ArchiveSegment *segment)
+{
+  ArchiveSegmentHeader *header = segment->header;
+  u64 index_end = sizeof(ArchiveSegmentHeader) +
+                  (u64)header->index_capacity * sizeof(ArchiveIndexEntry);
+  return (header->magic == ARCHIVE_SEGMENT_MAGIC &&
+          header->frame_count <= header->index_capacity &&
+          header->data_offset >= index_end &&
+          (u64)header->data_offset + header->data_size <= segment->map_size);
+}
+
+INTERNAL int
+compare_archive_segments(const void *a, const void *b)
+{
+  const ArchiveSegment *segment_a = (const ArchiveSegment *)a;
+  const ArchiveSegment *segment_b = (const ArchiveSegment *)b;
+  return (segment_a->header->start_ns > segment_b->header->start_ns) -
+         (segment_a->header->start_ns < segment_b->header->start_ns);
+}
+
+INTERNAL void
+archive_delete_segment(Archive *archive, ArchiveSegment *segment)
+{
+  char path[512] = {0};
+  snprintf(path, sizeof(path), "%s/%s", archive->directory, segment->name);
+  archive_unmap_segment(segment);
+  if (unlink(path) == -1)
+  {
+    EBP();
+  }
+}
+
+// NOTE(Ryan): Picks up what an earlier run recorded, so a restart does not lose it.
+// Recording always carries on in a new segment
+INTERNAL void
+archive_load_segments(Archive *archive)
+{
+  DIR *directory = opendir(archive->directory);
+  if (directory == NULL)
+  {
+    BP_MSG(NULL, "No archive directory");
+    return;
+  }
+
+  struct dirent *entry = NULL;
+  while ((entry = readdir(directory)) != NULL &&
+         archive->segment_count < MAX_ARCHIVE_SEGMENT_COUNT)
+  {
+    u32 name_len = (u32)strlen(entry->d_name);
+    u32 prefix_len = sizeof(ARCHIVE_SEGMENT_PREFIX) - 1;
+    u32 suffix_len = sizeof(ARCHIVE_SEGMENT_SUFFIX) - 1;
+    if (name_len >= sizeof(archive->segments[0].name) || name_len < prefix_len + suffix_len ||
+        memcmp(entry->d_name, ARCHIVE_SEGMENT_PREFIX, prefix_len) != 0 ||
+        memcmp(entry->d_name + name_len - suffix_len, ARCHIVE_SEGMENT_SUFFIX, suffix_len) != 0)
+    {
+      continue;
+    }
+
+    int fd = openat(dirfd(directory), entry->d_name, O_RDWR | O_CLOEXEC);
+    struct stat file_stat = {0};
+    if (fd == -1 || fstat(fd, &file_stat) == -1 ||
+        (u64)file_stat.st_size < sizeof(ArchiveSegmentHeader))
+    {
+      EBP();
+      if (fd != -1)
+      {
+        close(fd);
+      }
+      continue;
+    }
+
+    ArchiveSegment *segment = archive->segments + archive->segment_count;
+    if (archive_map_segment(segment, fd, (u64)file_stat.st_size) &&
+        archive_is_segment_valid(segment))
+    {
+      memcpy(segment->name, entry->d_name, name_len + 1);
+      archive->segment_count++;
+    }
+    else
+    {
+      BP_MSG(NULL, "Archive segment left as is, not a segment");
+      archive_unmap_segment(segment);
+    }
+  }
+  closedir(directory);
+
+  qsort(archive->segments, archive->segment_count, sizeof(ArchiveSegment),
+        compare_archive_segments);
+}
+
+// NOTE(Ryan): Preallocated, so writing a frame never waits on the filesystem finding space,
+// and the segment is one extent where it supports that
+INTERNAL b32
+archive_create_segment(Archive *archive, ArchiveSegment *segment, u64 start_ns)
+{
+  b32 result = false;
+
+  time_t start_s = (time_t)(start_ns / 1000000000ULL);
+  struct tm start_utc = {0};
+  gmtime_r(&start_s, &start_utc);
+  char time_name[32] = {0};
+  strftime(time_name, sizeof(time_name), "%Y%m%d-%H%M%S", &start_utc);
+  snprintf(segment->name, sizeof(segment->name), ARCHIVE_SEGMENT_PREFIX "%s-%03lu"
+           ARCHIVE_SEGMENT_SUFFIX, time_name, (u64)((start_ns / 1000000ULL) % 1000ULL));
+  char path[512] = {0};
+  snprintf(path, sizeof(path), "%s/%s", archive->directory, segment->name);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1)
+  {
+    EBP();
+    return result;
+  }
+
+  int allocate_result = fallocate(fd, 0, 0, (off_t)archive->segment_size);
+  if (allocate_result == -1 && errno == EOPNOTSUPP)
+  {
+    // NOTE(Ryan): Sparse instead, so blocks are found as frames are written
+    allocate_result = ftruncate(fd, (off_t)archive->segment_size);
+  }
+
+  if (allocate_result == 0 && archive_map_segment(segment, fd, archive->segment_size))
+  {
+    ArchiveSegmentHeader *header = segment->header;
+    u64 index_end = sizeof(ArchiveSegmentHeader) +
+                    ARCHIVE_SEGMENT_INDEX_CAPACITY * sizeof(ArchiveIndexEntry);
+    header->index_capacity = ARCHIVE_SEGMENT_INDEX_CAPACITY;
+    header->frame_count = 0;
+    // NOTE(Ryan): Page aligned, so the frames can be mapped apart from the index
+    header->data_offset = (u32)((index_end + 4095) & ~4095ULL);
+    header->data_size = 0;
+    header->start_ns = start_ns;
+    __atomic_store_n(&header->magic, ARCHIVE_SEGMENT_MAGIC, __ATOMIC_RELEASE);
+    result = true;
+  }
+  else
+  {
+    EBP();
+    archive_unmap_segment(segment);
+    unlink(path);
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Deletes the oldest segment if the ring is full, then starts a new one.
+// Readers only ever take the lock to look up a frame, so are only held up
+// while the table is changed, never while files are made or deleted
+INTERNAL b32
+archive_rotate(Archive *archive, u64 start_ns)
+{
+  pthread_mutex_lock(&archive->mutex);
+  archive->is_last_segment_open = false;
+  ArchiveSegment oldest = {0};
+  oldest.fd = -1;
+  if (archive->segment_count == archive->max_segment_count)
+  {
+    oldest = archive->segments[0];
+    memmove(archive->segments, archive->segments + 1,
+            (archive->segment_count - 1) * sizeof(ArchiveSegment));
+    archive->segment_count--;
+  }
+  pthread_mutex_unlock(&archive->mutex);
+
+  // NOTE(Ryan): A frame still being sent from it keeps its own fd, so still goes out whole
+  if (oldest.map != NULL)
+  {
+    archive_delete_segment(archive, &oldest);
+  }
+
+  ArchiveSegment segment = {0};
+  segment.fd = -1;
+  b32 result = archive_create_segment(archive, &segment, start_ns);
+  if (result)
+  {
+    pthread_mutex_lock(&archive->mutex);
+    archive->segments[archive->segment_count++] = segment;
+    archive->is_last_segment_open = true;
+    pthread_mutex_unlock(&archive->mutex);
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Only ever called from the archive thread. A frame that does not fit
+// in what is left of the segment, or comes after its duration, starts the next
+INTERNAL void
+archive_append(Archive *archive, const u8 *data, u32 size, u64 timestamp_ns)
+{
+  ArchiveSegment *segment = archive->is_last_segment_open ?
+                            archive->segments + archive->segment_count - 1 : NULL;
+  if (segment != NULL)
+  {
+    ArchiveSegmentHeader *header = segment->header;
+    if (header->frame_count == header->index_capacity ||
+        (u64)header->data_offset + header->data_size + size > segment->map_size ||
+        timestamp_ns - header->start_ns >= archive->segment_duration_ns)
+    {
+      segment = NULL;
+    }
+  }
+
+  if (segment == NULL)
+  {
+    if (!archive_rotate(archive, timestamp_ns))
+    {
+      archive->failed_count++;
+      return;
+    }
+    segment = archive->segments + archive->segment_count - 1;
+  }
+
+  ArchiveSegmentHeader *header = segment->header;
+  if ((u64)header->data_offset + size > segment->map_size)
+  {
+    // NOTE(Ryan): Larger than a whole segment
+    archive->failed_count++;
+    return;
+  }
+
+  u32 offset = header->data_offset + header->data_size;
+  memcpy(segment->map + offset, data, size);
+  ArchiveIndexEntry *entry = segment->index + header->frame_count;
+  entry->timestamp_ns = timestamp_ns;
+  entry->offset = offset;
+  entry->size = size;
+  header->data_size += size;
+  __atomic_store_n(&header->frame_count, header->frame_count + 1, __ATOMIC_RELEASE);
+  archive->recorded_count++;
+}
+
+INTERNAL void *
+archive_run(void *arg)
+{
+  Archive *archive = (Archive *)arg;
+  Capture *capture = archive->capture;
+
+  u64 last_timestamp_ns = 0;
+  while (true)
+  {
+    if (archive->viewer_index < 0)
+    {
+      // NOTE(Ryan): As a viewer of the first stream, so the source is always open and encoded
+      u32 stream_index = 0;
+      archive->viewer_index = capture_add_viewer(capture, U32_MAX, 0, &stream_index);
+      if (archive->viewer_index < 0)
+      {
+        // NOTE(Ryan): The camera is missing, so try it again in a while
+        sleep(1);
+        continue;
+      }
+    }
+
+    struct pollfd frame_pollfd = {0};
+    frame_pollfd.fd = archive->frame_event_fd;
+    frame_pollfd.events = POLLIN;
+    if (poll(&frame_pollfd, 1, 1000) <= 0)
+    {
+      continue;
+    }
+    u64 frame_event_count = 0;
+    if (read(archive->frame_event_fd, &frame_event_count, sizeof(frame_event_count)) == -1 &&
+        errno != EAGAIN)
+    {
+      EBP();
+    }
+
+    Frame *frame = frame_ring_acquire_latest(&capture->streams[0].ring, archive->last_sequence);
+    if (frame != NULL)
+    {
+      u64 start_ns = get_ns();
+      if (archive->last_sequence != 0 && frame->sequence > archive->last_sequence + 1)
+      {
+        archive->skipped_count += frame->sequence - archive->last_sequence - 1;
+      }
+      archive->last_sequence = frame->sequence;
+
+      // NOTE(Ryan): Frames are stamped on the monotonic clock when captured.
+      // Kept in order, as the wall clock can be stepped back
+      u64 wall_clock_ns = archive_wall_clock_ns();
+      u64 timestamp_ns = wall_clock_ns;
+      if (frame->timestamp_ns != 0 && frame->timestamp_ns <= start_ns)
+      {
+        timestamp_ns = wall_clock_ns - (start_ns - frame->timestamp_ns);
+      }
+      if (timestamp_ns < last_timestamp_ns)
+      {
+        timestamp_ns = last_timestamp_ns;
+      }
+      last_timestamp_ns = timestamp_ns;
+
+      archive_append(archive, frame->data, frame->size, timestamp_ns);
+      frame_release(frame);
+      archive->write_ms = (r32)(get_ns() - start_ns) / 1000000.0f;
+    }
+  }
+
+  return NULL;
+}
+
+// NOTE(Ryan): Call before starting the capture thread, as this subscribes to its frames
+INTERNAL b32
+archive_init(Archive *archive, const char *directory, Capture *capture)
+{
+  b32 result = false;
+
+  archive->directory = directory;
+  archive->segment_size = ARCHIVE_SEGMENT_SIZE;
+  archive->max_segment_count = ARCHIVE_SEGMENT_COUNT;
+  archive->segment_duration_ns = ARCHIVE_SEGMENT_DURATION_MS * 1000000ULL;
+  archive->capture = capture;
+  archive->viewer_index = -1;
+  pthread_mutex_init(&archive->mutex, NULL);
+
+  archive->frame_event_fd = capture_subscribe(capture);
+  if (archive->frame_event_fd >= 0)
+  {
+    archive_load_segments(archive);
+    // NOTE(Ryan): Leaving room for the one about to be started
+    while (archive->segment_count >= archive->max_segment_count)
+    {
+      archive_delete_segment(archive, archive->segments + 0);
+      memmove(archive->segments, archive->segments + 1,
+              (archive->segment_count - 1) * sizeof(ArchiveSegment));
+      archive->segment_count--;
+    }
+    result = true;
+  }
+  else
+  {
+    archive->directory = NULL;
+  }
+
+  return result;
+}
+
+INTERNAL b32
+archive_start(Archive *archive)
+{
+  b32 result = (pthread_create(&archive->thread, NULL, archive_run, archive) == 0);
+  if (!result)
+  {
+    BP_MSG(NULL, "Failed to create archive thread");
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): The last entry at or before timestamp_ns, or the first after it when is_after.
+// Returns -1 if there is none
+INTERNAL s32
+archive_find_entry(ArchiveIndexEntry *index, u32 count, u64 timestamp_ns, b32 is_after)
+{
+  // NOTE(Ryan): First entry later than timestamp_ns
+  u32 low = 0;
+  u32 high = count;
+  while (low < high)
+  {
+    u32 middle = low + (high - low) / 2;
+    if (index[middle].timestamp_ns <= timestamp_ns)
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+
+  s32 result = is_after ? (s32)low : (s32)low - 1;
+  if (result >= (s32)count)
+  {
+    result = -1;
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Called by workers. The location's fd is a duplicate for the caller to close
+INTERNAL b32
+archive_find_frame(Archive *archive, u64 timestamp_ns, b32 is_after,
+                   ArchiveFrameLocation *location)
+{
+  b32 result = false;
+
+  pthread_mutex_lock(&archive->mutex);
+  for (u32 segment_i = 0;
+       segment_i < archive->segment_count && !result;
+       ++segment_i)
+  {
+    // NOTE(Ryan): Newest first when looking back, so the first match is the latest
+    u32 search_i = is_after ? segment_i : archive->segment_count - 1 - segment_i;
+    ArchiveSegment *segment = archive->segments + search_i;
+    u32 frame_count = __atomic_load_n(&segment->header->frame_count, __ATOMIC_ACQUIRE);
+    s32 entry_i = archive_find_entry(segment->index, frame_count, timestamp_ns, is_after);
+    if (entry_i >= 0)
+    {
+      ArchiveIndexEntry *entry = segment->index + entry_i;
+      location->fd = fcntl(segment->fd, F_DUPFD_CLOEXEC, 0);
+      location->offset = entry->offset;
+      location->size = entry->size;
+      location->timestamp_ns = entry->timestamp_ns;
+      result = (location->fd != -1);
+      if (!result)
+      {
+        EBP();
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&archive->mutex);
+
+  return result;
+}
+
+// NOTE(Ryan): buf is best ARCHIVE_STATE_JSON_SIZE. Times are in milliseconds since the epoch,
+// as looked up with ?t= or ?after=. Returns the length written
+INTERNAL u32
+archive_format_state(Archive *archive, char *buf, u32 buf_size)
+{
+  u32 result = 0;
+
+  pthread_mutex_lock(&archive->mutex);
+  s32 len = snprintf(buf, buf_size,
+                     "{\"recorded\":%lu,\"skipped\":%lu,\"failed\":%lu,\"write_ms\":%.2f,"
+                     "\"segment_bytes\":%lu,\"segments\":[",
+                     archive->recorded_count, archive->skipped_count, archive->failed_count,
+                     archive->write_ms, archive->segment_size);
+  result = (len > 0) ? (u32)len : 0;
+
+  b32 is_first = true;
+  for (u32 segment_i = 0;
+       segment_i < archive->segment_count && result < buf_size;
+       ++segment_i)
+  {
+    ArchiveSegment *segment = archive->segments + segment_i;
+    u32 frame_count = __atomic_load_n(&segment->header->frame_count, __ATOMIC_ACQUIRE);
+    if (frame_count == 0)
+    {
+      continue;
+    }
+    len = snprintf(buf + result, buf_size - result,
+                   "%s{\"name\":\"%s\",\"start\":%lu,\"end\":%lu,\"frames\":%u,\"bytes\":%u}",
+                   is_first ? "" : ",", segment->name,
+                   (u64)(segment->index[0].timestamp_ns / 1000000ULL),
+                   (u64)(segment->index[frame_count - 1].timestamp_ns / 1000000ULL),
+                   frame_count, segment->index[frame_count - 1].offset +
+                   segment->index[frame_count - 1].size - segment->header->data_offset);
+    result += (len > 0) ? (u32)len : 0;
+    is_first = false;
+  }
+  pthread_mutex_unlock(&archive->mutex);
+
+  if (result < buf_size)
+  {
+    len = snprintf(buf + result, buf_size - result, "]}\n");
+    result += (len > 0) ? (u32)len : 0;
+  }
+  if (result >= buf_size)
+  {
+    result = buf_size - 1;
+  }
+
+  return result;
+}
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#pragma once
+
+#include <pthread.h>
+
+#include "capture.h"
+
+#define MAX_ARCHIVE_SEGMENT_COUNT 64
+#define ARCHIVE_SEGMENT_COUNT 8
+#define ARCHIVE_SEGMENT_SIZE MEGABYTES(64)
+#define ARCHIVE_SEGMENT_DURATION_MS (60 * 1000)
+// NOTE(Ryan): A minute at 60 fps
+#define ARCHIVE_SEGMENT_INDEX_CAPACITY 4096
+#define ARCHIVE_SEGMENT_MAGIC 0x47455347
+#define ARCHIVE_STATE_JSON_SIZE (256 + MAX_ARCHIVE_SEGMENT_COUNT * 128)
+
+// NOTE(Ryan): A segment file is this header, then index_capacity entries,
+// then from data_offset the frames back to back. Entries are in timestamp order
+typedef struct ArchiveSegmentHeader
+{
+  u32 magic;
+  u32 index_capacity;
+  // NOTE(Ryan): Stored last for each frame, so a reader never sees an entry still being written,
+  // and a segment left by a crash is whole up to here
+  u32 frame_count;
+  u32 data_offset;
+  u32 data_size;
+  u32 reserved;
+  u64 start_ns;
+} ArchiveSegmentHeader;
+
+typedef struct ArchiveIndexEntry
+{
+  // NOTE(Ryan): Wall clock, so frames can be looked up by the time of an incident
+  u64 timestamp_ns;
+  u32 offset;
+  u32 size;
+} ArchiveIndexEntry;
+
+typedef struct ArchiveSegment
+{
+  int fd;
+  u8 *map;
+  u64 map_size;
+  ArchiveSegmentHeader *header;
+  ArchiveIndexEntry *index;
+  char name[64];
+} ArchiveSegment;
+
+// NOTE(Ryan): Where a looked up frame is, with its own fd so it can still be sent
+// after the segment is rotated out
+typedef struct ArchiveFrameLocation
+{
+  int fd;
+  u64 offset;
+  u32 size;
+  u64 timestamp_ns;
+} ArchiveFrameLocation;
+
+// NOTE(Ryan): A rolling recording of the first stream over a ring of segment files,
+// the oldest deleted as a new one is started. Its own thread takes frames from the
+// capture like any viewer, so the capture thread never waits on the disk, and a
+// recording that falls behind skips frames. Segment files are preallocated and mapped,
+// so a frame is one copy into the page cache, and sent back with sendfile()
+typedef struct Archive
+{
+  // NOTE(Ryan): NULL when not recording
+  const char *directory;
+  u64 segment_size;
+  u32 max_segment_count;
+  u64 segment_duration_ns;
+
+  pthread_t thread;
+  Capture *capture;
+  int frame_event_fd;
+  s32 viewer_index;
+  u64 last_sequence;
+
+  // NOTE(Ryan): Only the table is locked, as only the archive thread writes to the segments.
+  // Oldest first, the last being written to
+  pthread_mutex_t mutex;
+  ArchiveSegment segments[MAX_ARCHIVE_SEGMENT_COUNT];
+  u32 segment_count;
+  b32 is_last_segment_open;
+
+  u64 recorded_count;
+  // NOTE(Ryan): Frames published while the last was being written
+  u64 skipped_count;
+  // NOTE(Ryan): Frames lost as a segment could not be made
+  u64 failed_count;
+  r32 write_ms;
+} Archive;
@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#pragma once
+
+#include "jpeg_encoder.h"
+
+#define CAMERA_PREVIEW_DEVICE "/dev/video0"
+#define CAMERA_PREVIEW_WIDTH 640
+#define CAMERA_PREVIEW_HEIGHT 480
+#define CAMERA_PREVIEW_FPS 30
+#define CAMERA_PREVIEW_SLOT_COUNT 3
+// NOTE(Ryan): Set in CameraPreview.ready alongside a slot index the reader has not taken yet
+#define CAMERA_PREVIEW_FRESH_BIT 0x80000000u
+
+// NOTE(Ryan): One raw frame, rows packed together
+typedef struct CameraPreviewSlot
+{
+  u8 *data;
+  u32 size;
+  u32 sequence;
+} CameraPreviewSlot;
+
+// NOTE(Ryan): Captured by the platform layer's own thread, as the code drawing it is reloaded.
+// A triple buffer, so neither side ever waits: the capture thread fills the back slot and
+// swaps it with the ready one, and the renderer swaps the ready one for its front slot
+// when there is a fresh frame. Only ready is shared
+typedef struct CameraPreview
+{
+  // NOTE(Ryan): Written by the app from DEBUG_CAMERA_PANEL. The platform layer starts and stops
+  // the capture thread to match between frames, so the camera is only held while shown
+  b32 is_wanted;
+  // NOTE(Ryan): The platform layer's. wake_fd is in the capture thread's poll set, written
+  // along with setting is_stopping so the thread stops without waiting on a frame
+  pthread_t thread;
+  b32 is_running;
+  b32 has_start_failed;
+  b32 is_stopping;
+  int wake_fd;
+
+  // NOTE(Ryan): Set before the first frame is made ready, and fixed after
+  b32 is_open;
+  const char *source_name;
+  PIXEL_FORMAT format;
+  u32 width;
+  u32 height;
+
+  CameraPreviewSlot slots[CAMERA_PREVIEW_SLOT_COUNT];
+  u32 ready;
+  // NOTE(Ryan): The capture thread's alone
+  u32 back_index;
+  // NOTE(Ryan): The renderer's alone
+  u32 front_index;
+
+  u64 captured_count;
+  u64 dropped_count;
+} CameraPreview;
@@ -0,0 +1,755 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "capture.h"
+
+// NOTE(Ryan): A single thread captures from the frame source and publishes into a small ring
+// of reference counted frames. Any number of clients across the workers send the same 
+// frame memory, usually the source's own buffer, so a frame is copied at most once 
+// no matter the viewer count, and a client that cannot keep up only ever holds the frame 
+// it is sending. Raw YUYV or NV12 frames are JPEG encoded once, straight from the 
+// source's buffer, into the frame's own. They are also halved into smaller streams,
+// each with its own ring, which are only halved and encoded while they have viewers.
+// Motion detection runs here too, on the smallest of those.
+
+INTERNAL void
+frame_release(Frame *frame)
+{
+  if (frame != NULL)
+  {
+    __atomic_sub_fetch(&frame->ref_count, 1, __ATOMIC_ACQ_REL);
+  }
+}
+
+// NOTE(Ryan): Returns the latest frame with a reference taken, 
+// or NULL if there is nothing newer than after_sequence
+INTERNAL Frame *
+frame_ring_acquire_latest(FrameRing *ring, u64 after_sequence)
+{
+  Frame *result = NULL;
+
+  pthread_mutex_lock(&ring->mutex);
+  if (ring->latest != NULL && ring->latest->sequence > after_sequence)
+  {
+    result = ring->latest;
+    __atomic_add_fetch(&result->ref_count, 1, __ATOMIC_ACQ_REL);
+  }
+  pthread_mutex_unlock(&ring->mutex);
+
+  return result;
+}
+
+// NOTE(Ryan): Returns NULL when every frame is still referenced
+INTERNAL Frame *
+frame_ring_begin_write(FrameRing *ring)
+{
+  Frame *result = NULL;
+
+  pthread_mutex_lock(&ring->mutex);
+  for (u32 frame_i = 0;
+       frame_i < FRAME_RING_SIZE;
+       ++frame_i)
+  {
+    Frame *frame = ring->frames + frame_i;
+    if (__atomic_load_n(&frame->ref_count, __ATOMIC_ACQUIRE) == 0)
+    {
+      result = frame;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ring->mutex);
+
+  return result;
+}
+
+// NOTE(Ryan): A NULL frame clears the latest, so a stale frame is never sent to a new viewer
+INTERNAL void
+frame_ring_publish(FrameRing *ring, Frame *frame)
+{
+  pthread_mutex_lock(&ring->mutex);
+  Frame *previous = ring->latest;
+  if (frame != NULL)
+  {
+    frame->sequence = ++ring->sequence;
+    __atomic_store_n(&frame->ref_count, 1, __ATOMIC_RELEASE);
+  }
+  ring->latest = frame;
+  pthread_mutex_unlock(&ring->mutex);
+
+  frame_release(previous);
+}
+
+// NOTE(Ryan): Only the capture thread writes frames, and a frame at zero references 
+// is never the latest so cannot be picked up again
+INTERNAL void
+capture_reclaim_frame(Capture *capture, Frame *frame)
+{
+  if (frame->lent_buffer_index >= 0 && 
+      __atomic_load_n(&frame->ref_count, __ATOMIC_ACQUIRE) == 0)
+  {
+    frame_source_return(&capture->source, (u32)frame->lent_buffer_index);
+    frame->lent_buffer_index = -1;
+  }
+}
+
+INTERNAL void
+capture_reclaim_frames(Capture *capture)
+{
+  for (u32 stream_i = 0;
+       stream_i < capture->stream_count;
+       ++stream_i)
+  {
+    for (u32 frame_i = 0;
+         frame_i < FRAME_RING_SIZE;
+         ++frame_i)
+    {
+      capture_reclaim_frame(capture, capture->streams[stream_i].ring.frames + frame_i);
+    }
+  }
+}
+
+// NOTE(Ryan): Returns false if the buffer cannot be grown
+INTERNAL b32
+frame_reserve_copy(Frame *frame, u32 size)
+{
+  if (frame->copy_capacity < size)
+  {
+    // NOTE(Ryan): Some headroom, as compressed frames vary in size
+    free(frame->copy_buffer);
+    frame->copy_capacity = size + size / 4;
+    frame->copy_buffer = malloc(frame->copy_capacity);
+    frame->copy_capacity = (frame->copy_buffer != NULL) ? frame->copy_capacity : 0;
+  }
+
+  return (frame->copy_buffer != NULL);
+}
+
+// NOTE(Ryan): Raw frames are encoded from image, the stream's own size, into the frame's buffer.
+// Otherwise uses the source's buffer in place if it can spare it, or copies it out
+INTERNAL b32
+capture_fill_frame(Capture *capture, CaptureStream *stream, Frame *frame, const u8 *image)
+{
+  b32 result = false;
+
+  SourceFrame *held = &capture->source.held;
+  u32 size = held->size;
+  if (capture->source.format != PIXEL_FORMAT_MJPEG)
+  {
+    u64 start_ns = get_ns();
+    size = jpeg_encode(&stream->encoder, image);
+    if (frame_reserve_copy(frame, size))
+    {
+      jpeg_encoder_write(&stream->encoder, frame->copy_buffer);
+      frame->data = frame->copy_buffer;
+      stream->encode_ms = (r32)(get_ns() - start_ns) / 1000000.0f;
+      result = true;
+    }
+    else
+    {
+      EBP();
+    }
+  }
+  else if (frame_source_lend(&capture->source))
+  {
+    frame->data = held->data;
+    frame->lent_buffer_index = (s32)held->buffer_index;
+    capture->lent_frame_count++;
+    result = true;
+  }
+  else
+  {
+    if (frame_reserve_copy(frame, held->size))
+    {
+      memcpy(frame->copy_buffer, held->data, held->size);
+      frame->data = frame->copy_buffer;
+      capture->copied_frame_count++;
+      result = true;
+    }
+    else
+    {
+      EBP();
+    }
+  }
+
+  if (result)
+  {
+    frame->size = size;
+    frame->device_sequence = held->sequence;
+    frame->timestamp_ns = held->timestamp_ns;
+    s32 header_len = snprintf((char *)frame->header, sizeof(frame->header),
+                              "--myboundary\r\nContent-Type: image/jpeg\r\n"
+                              "Content-length: %u\r\nX-Timestamp: %lu.%06lu\r\n\r\n", 
+                              frame->size, (u64)(frame->timestamp_ns / 1000000000ULL),
+                              (u64)((frame->timestamp_ns / 1000ULL) % 1000000ULL));
+    frame->header_len = (u32)header_len;
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Publishes the held frame to every stream with a viewer, halving it down the 
+// ladder only as far as the smallest of those. Motion detection needs the smallest stream
+// and recording the first, so both are always made while enabled.
+// Returns whether anything was published
+INTERNAL b32
+capture_publish_streams(Capture *capture, u32 *stream_viewer_counts)
+{
+  b32 result = false;
+
+  FrameSource *source = &capture->source;
+  MotionDetector *motion = &capture->motion;
+  b32 is_recording = (motion->is_enabled && motion->recorder.directory != NULL);
+  b32 is_encoded[CAPTURE_STREAM_COUNT] = {0};
+  u32 halved_stream_count = 0;
+  for (u32 stream_i = 0;
+       stream_i < capture->stream_count;
+       ++stream_i)
+  {
+    is_encoded[stream_i] = (stream_viewer_counts[stream_i] > 0) || 
+                           (stream_i == 0 && is_recording);
+    if (is_encoded[stream_i] || motion->is_enabled)
+    {
+      halved_stream_count = stream_i + 1;
+    }
+  }
+
+  // NOTE(Ryan): A driver may hand back a partly filled buffer after an error
+  if (source->format != PIXEL_FORMAT_MJPEG && 
+      source->held.size < capture->streams[0].encoder.image_size)
+  {
+    capture->short_frame_count++;
+    halved_stream_count = 0;
+    memset(is_encoded, 0, sizeof(is_encoded));
+  }
+
+  const u8 *image = source->held.data;
+  u32 stride = source->stride;
+  for (u32 stream_i = 0;
+       stream_i < halved_stream_count;
+       ++stream_i)
+  {
+    CaptureStream *stream = capture->streams + stream_i;
+    if (stream_i > 0)
+    {
+      CaptureStream *previous = stream - 1;
+      frame_halve(source->format, image, previous->width, previous->height, stride, 
+                  stream->image);
+      image = stream->image;
+      stride = stream->encoder.stride;
+    }
+
+    if (is_encoded[stream_i])
+    {
+      Frame *frame = frame_ring_begin_write(&stream->ring);
+      if (frame != NULL)
+      {
+        capture_reclaim_frame(capture, frame);
+        if (capture_fill_frame(capture, stream, frame, image))
+        {
+          if (stream_i == 0 && is_recording)
+          {
+            motion_recorder_push(&motion->recorder, frame->data, frame->size);
+          }
+          frame_ring_publish(&stream->ring, frame);
+          stream->published_count++;
+          result = true;
+        }
+      }
+      else
+      {
+        stream->ring_full_count++;
+        capture->ring_full_count++;
+      }
+    }
+  }
+
+  if (motion->is_enabled && halved_stream_count > 0)
+  {
+    CaptureStream *smallest = capture->streams + halved_stream_count - 1;
+    motion_detect(motion, source->format, image, smallest->width, smallest->height, stride, 
+                  get_ns());
+  }
+
+  // NOTE(Ryan): So a stream's next viewer never starts on a frame from its last watcher.
+  // Only this thread publishes, so latest can be looked at without the lock
+  for (u32 stream_i = 0;
+       stream_i < capture->stream_count;
+       ++stream_i)
+  {
+    FrameRing *ring = &capture->streams[stream_i].ring;
+    if (!is_encoded[stream_i] && ring->latest != NULL)
+    {
+      frame_ring_publish(ring, NULL);
+    }
+  }
+
+  return result;
+}
+
+INTERNAL void
+capture_notify_subscribers(Capture *capture)
+{
+  u64 one = 1;
+  for (u32 subscriber_i = 0;
+       subscriber_i < capture->subscriber_count;
+       ++subscriber_i)
+  {
+    // NOTE(Ryan): Only fails when the counter is saturated, which still wakes the worker
+    if (write(capture->subscriber_fds[subscriber_i], &one, sizeof(one)) == -1 && errno != EAGAIN)
+    {
+      EBP();
+    }
+  }
+}
+
+// NOTE(Ryan): The first stream is the source as is. A raw source also gets each halving
+// that comes out whole, up to CAPTURE_STREAM_COUNT streams.
+// Returns false if the source cannot be encoded at all
+INTERNAL b32
+capture_configure_streams(Capture *capture)
+{
+  b32 result = true;
+
+  FrameSource *source = &capture->source;
+  CaptureStream *first_stream = capture->streams + 0;
+  first_stream->width = source->width;
+  first_stream->height = source->height;
+  capture->stream_count = 1;
+  if (source->format != PIXEL_FORMAT_MJPEG)
+  {
+    result = jpeg_encoder_configure(&first_stream->encoder, source->format, source->width, 
+                                    source->height, source->stride, source->is_video_range, 
+                                    capture->quality);
+    while (result && capture->stream_count < CAPTURE_STREAM_COUNT)
+    {
+      CaptureStream *previous = capture->streams + capture->stream_count - 1;
+      if (!frame_can_halve(source->format, previous->width, previous->height))
+      {
+        break;
+      }
+
+      CaptureStream *stream = previous + 1;
+      stream->width = previous->width / 2;
+      stream->height = previous->height / 2;
+      u32 image_size = frame_image_size(source->format, stream->width, stream->height);
+      if (stream->image_capacity < image_size)
+      {
+        free(stream->image);
+        stream->image = malloc(image_size);
+        stream->image_capacity = (stream->image != NULL) ? image_size : 0;
+      }
+
+      u32 stride = (source->format == PIXEL_FORMAT_YUYV) ? stream->width * 2 : stream->width;
+      if (stream->image == NULL ||
+          !jpeg_encoder_configure(&stream->encoder, source->format, stream->width, 
+                                  stream->height, stride, source->is_video_range, 
+                                  capture->quality))
+      {
+        BP_MSG(NULL, "Smaller stream left out");
+        break;
+      }
+      capture->stream_count++;
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): With the mutex held. Returns false if the source is missing or cannot be encoded
+INTERNAL b32
+capture_open_source(Capture *capture)
+{
+  if (!frame_source_open(&capture->source))
+  {
+    if (capture->source.error != NULL)
+    {
+      BP_MSG(NULL, capture->source.error);
+    }
+  }
+  else if (!capture_configure_streams(capture))
+  {
+    BP_MSG(NULL, "Frame size cannot be JPEG encoded");
+    frame_source_close(&capture->source);
+  }
+
+  return (capture->source.fd >= 0);
+}
+
+// NOTE(Ryan): With the mutex held, until a viewer comes or timeout_ms passes
+INTERNAL void
+capture_wait_for_viewer(Capture *capture, u32 timeout_ms)
+{
+  struct timespec deadline = {0};
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000)
+  {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  pthread_cond_timedwait(&capture->viewer_cond, &capture->mutex, &deadline);
+}
+
+INTERNAL void *
+capture_run(void *arg)
+{
+  Capture *capture = (Capture *)arg;
+
+  pthread_mutex_lock(&capture->mutex);
+  while (!capture->is_stopping)
+  {
+    while (capture->viewer_count == 0 && !capture->motion.is_enabled && !capture->is_stopping)
+    {
+      if (capture->source.fd >= 0)
+      {
+        for (u32 stream_i = 0;
+             stream_i < capture->stream_count;
+             ++stream_i)
+        {
+          frame_ring_publish(&capture->streams[stream_i].ring, NULL);
+        }
+        capture_reclaim_frames(capture);
+        if (capture->source.lent_count == 0)
+        {
+          frame_source_close(&capture->source);
+        }
+        else
+        {
+          // NOTE(Ryan): A client is still sending from the source's memory
+          capture_wait_for_viewer(capture, 10);
+        }
+      }
+      else
+      {
+        pthread_cond_wait(&capture->viewer_cond, &capture->mutex);
+      }
+    }
+    if (capture->is_stopping)
+    {
+      break;
+    }
+    // NOTE(Ryan): Only without viewers while detecting motion, as a viewer opens it
+    if (capture->source.fd < 0 && !capture_open_source(capture))
+    {
+      capture_wait_for_viewer(capture, 1000);
+      continue;
+    }
+
+    u32 stream_viewer_counts[CAPTURE_STREAM_COUNT] = {0};
+    for (u32 stream_i = 0;
+         stream_i < capture->stream_count;
+         ++stream_i)
+    {
+      stream_viewer_counts[stream_i] = capture->streams[stream_i].viewer_count;
+    }
+    pthread_mutex_unlock(&capture->mutex);
+
+    // NOTE(Ryan): Wakes periodically to notice the last viewer leaving
+    struct pollfd source_pollfd = {0};
+    source_pollfd.fd = capture->source.fd;
+    source_pollfd.events = POLLIN;
+    int poll_result = poll(&source_pollfd, 1, 100);
+    if (poll_result > 0 && frame_source_dequeue(&capture->source))
+    {
+      // NOTE(Ryan): Before filling, so the source has as many buffers back as it can
+      capture_reclaim_frames(capture);
+      u64 timestamp_ns = capture->source.held.timestamp_ns;
+      if (capture_publish_streams(capture, stream_viewer_counts))
+      {
+        capture->captured_count++;
+        if (timestamp_ns != 0)
+        {
+          capture->capture_latency_ms = (r32)(get_ns() - timestamp_ns) / 1000000.0f;
+        }
+        capture_notify_subscribers(capture);
+      }
+      frame_source_release(&capture->source);
+    }
+    else if (poll_result == -1 && errno != EINTR)
+    {
+      EBP();
+    }
+
+    pthread_mutex_lock(&capture->mutex);
+  }
+  pthread_mutex_unlock(&capture->mutex);
+
+  return NULL;
+}
+
+// NOTE(Ryan): source_path is a V4L2 device, an MJPEG recording or "synthetic".
+// Raw formats are encoded at quality
+INTERNAL void
+capture_init(Capture *capture, const char *source_path, PIXEL_FORMAT format, 
+             u32 width, u32 height, u32 fps, u32 quality)
+{
+  frame_source_init(&capture->source, source_path, format, width, height, fps);
+  capture->quality = quality;
+  pthread_mutex_init(&capture->mutex, NULL);
+  pthread_cond_init(&capture->viewer_cond, NULL);
+  for (u32 stream_i = 0;
+       stream_i < CAPTURE_STREAM_COUNT;
+       ++stream_i)
+  {
+    FrameRing *ring = &capture->streams[stream_i].ring;
+    pthread_mutex_init(&ring->mutex, NULL);
+    for (u32 frame_i = 0;
+         frame_i < FRAME_RING_SIZE;
+         ++frame_i)
+    {
+      ring->frames[frame_i].lent_buffer_index = -1;
+    }
+  }
+}
+
+// NOTE(Ryan): Frames are compared as raw luma, which an MJPEG source does not give.
+// clip_directory may be NULL to only detect. Call before starting the capture thread
+INTERNAL b32
+capture_enable_motion(Capture *capture, const char *clip_directory)
+{
+  b32 result = (capture->source.format != PIXEL_FORMAT_MJPEG);
+
+  if (result)
+  {
+    motion_init(&capture->motion, clip_directory);
+  }
+  else
+  {
+    BP_MSG(NULL, "Motion detection needs a raw YUYV or NV12 source");
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Returns an eventfd that is written on every frame published, or -1.
+// Subscribe every worker before starting the capture thread
+INTERNAL int
+capture_subscribe(Capture *capture)
+{
+  int result = -1;
+
+  if (capture->subscriber_count < MAX_CAPTURE_SUBSCRIBER_COUNT)
+  {
+    result = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (result != -1)
+    {
+      capture->subscriber_fds[capture->subscriber_count++] = result;
+    }
+    else
+    {
+      EBP();
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): encode_thread_count includes the capture thread itself, and is for the first
+// stream. Each after has a quarter of the pixels, so a quarter of the threads
+INTERNAL b32
+capture_start(Capture *capture, u32 encode_thread_count)
+{
+  for (u32 stream_i = 0;
+       stream_i < CAPTURE_STREAM_COUNT;
+       ++stream_i)
+  {
+    u32 thread_count = encode_thread_count >> (2 * stream_i);
+    jpeg_encoder_start(&capture->streams[stream_i].encoder, 
+                       (thread_count > 0) ? thread_count : 1);
+  }
+  if (capture->motion.is_enabled)
+  {
+    motion_start(&capture->motion);
+  }
+  b32 result = (pthread_create(&capture->thread, NULL, capture_run, capture) == 0);
+  if (!result)
+  {
+    BP_MSG(NULL, "Failed to create capture thread");
+  }
+  capture->is_running = result;
+
+  return result;
+}
+
+// NOTE(Ryan): Call once the workers have stopped, as they may still be adding viewers.
+// The encoders are only used by the capture thread, so are stopped after it
+INTERNAL void
+capture_stop(Capture *capture)
+{
+  if (capture->is_running)
+  {
+    pthread_mutex_lock(&capture->mutex);
+    capture->is_stopping = true;
+    pthread_cond_broadcast(&capture->viewer_cond);
+    pthread_mutex_unlock(&capture->mutex);
+
+    pthread_join(capture->thread, NULL);
+    capture->is_running = false;
+  }
+
+  for (u32 stream_i = 0;
+       stream_i < CAPTURE_STREAM_COUNT;
+       ++stream_i)
+  {
+    jpeg_encoder_stop(&capture->streams[stream_i].encoder);
+  }
+}
+
+// NOTE(Ryan): Opens the source for the first viewer, so a missing camera 
+// is known while the request can still be answered with a 404.
+// The viewer gets the smallest stream at least height tall, or the first for a height of 0.
+// Returns the viewer's stats slot, or -1, with the stream in stream_index
+INTERNAL s32
+capture_add_viewer(Capture *capture, u32 worker_index, u32 height, u32 *stream_index)
+{
+  s32 result = -1;
+
+  pthread_mutex_lock(&capture->mutex);
+  if (capture->source.fd >= 0 || capture_open_source(capture))
+  {
+    *stream_index = 0;
+    for (u32 stream_i = 1;
+         stream_i < capture->stream_count && height > 0;
+         ++stream_i)
+    {
+      if (capture->streams[stream_i].height >= height)
+      {
+        *stream_index = stream_i;
+      }
+    }
+
+    for (u32 viewer_i = 0;
+         viewer_i < MAX_CAPTURE_VIEWER_COUNT;
+         ++viewer_i)
+    {
+      CaptureViewerStats *stats = capture->viewer_stats + viewer_i;
+      if (!stats->is_active)
+      {
+        CaptureViewerStats zero_stats = {0};
+        *stats = zero_stats;
+        stats->is_active = true;
+        stats->worker_index = worker_index;
+        stats->stream_index = *stream_index;
+
+        capture->viewer_count++;
+        capture->streams[*stream_index].viewer_count++;
+        pthread_cond_signal(&capture->viewer_cond);
+        result = (s32)viewer_i;
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&capture->mutex);
+
+  return result;
+}
+
+INTERNAL void
+capture_remove_viewer(Capture *capture, s32 viewer_index)
+{
+  pthread_mutex_lock(&capture->mutex);
+  if (viewer_index >= 0 && capture->viewer_stats[viewer_index].is_active)
+  {
+    CaptureViewerStats *stats = capture->viewer_stats + viewer_index;
+    stats->is_active = false;
+    capture->viewer_count--;
+    capture->streams[stats->stream_index].viewer_count--;
+  }
+  pthread_mutex_unlock(&capture->mutex);
+}
+
+INTERNAL void
+capture_update_viewer_stats(Capture *capture, s32 viewer_index, CaptureViewerStats *stats)
+{
+  pthread_mutex_lock(&capture->mutex);
+  if (viewer_index >= 0 && capture->viewer_stats[viewer_index].is_active)
+  {
+    stats->is_active = true;
+    stats->stream_index = capture->viewer_stats[viewer_index].stream_index;
+    capture->viewer_stats[viewer_index] = *stats;
+  }
+  pthread_mutex_unlock(&capture->mutex);
+}
+
+// NOTE(Ryan): buf is best CAPTURE_STATS_JSON_SIZE, anything past buf_size is cut off. 
+// Returns the length written
+INTERNAL u32
+capture_format_stats(Capture *capture, char *buf, u32 buf_size)
+{
+  u32 result = 0;
+
+  pthread_mutex_lock(&capture->mutex);
+  s32 len = snprintf(buf, buf_size, 
+                     "{\"source\":\"%s\",\"captured\":%lu,\"ring_full\":%lu,"
+                     "\"source_dropped\":%lu,\"skipped\":%lu,\"capture_latency_ms\":%.2f,"
+                     "\"lent\":%lu,\"copied\":%lu,\"dmabufs\":%u,"
+                     "\"format\":\"%s\",\"quality\":%u,\"short\":%lu,"
+                     "\"viewer_count\":%u,\"streams\":[", 
+                     frame_source_type_name(&capture->source), capture->captured_count, 
+                     capture->ring_full_count, capture->source.dropped_count, 
+                     capture->source.skipped_count, capture->capture_latency_ms, 
+                     capture->lent_frame_count, capture->copied_frame_count, 
+                     capture->source.camera.dmabuf_count, 
+                     global_pixel_format_names[capture->source.format], capture->quality,
+                     capture->short_frame_count, capture->viewer_count);
+  result = (len > 0) ? (u32)len : 0;
+
+  for (u32 stream_i = 0;
+       stream_i < capture->stream_count && result < buf_size;
+       ++stream_i)
+  {
+    CaptureStream *stream = capture->streams + stream_i;
+    len = snprintf(buf + result, buf_size - result,
+                   "%s{\"stream\":%u,\"width\":%u,\"height\":%u,\"viewer_count\":%u,"
+                   "\"published\":%lu,\"ring_full\":%lu,\"encode_ms\":%.2f,"
+                   "\"encode_threads\":%u}",
+                   (stream_i > 0) ? "," : "", stream_i, stream->width, stream->height, 
+                   stream->viewer_count, stream->published_count, stream->ring_full_count, 
+                   stream->encode_ms, stream->encoder.thread_count);
+    result += (len > 0) ? (u32)len : 0;
+  }
+  if (result < buf_size)
+  {
+    len = snprintf(buf + result, buf_size - result, "],\"viewers\":[");
+    result += (len > 0) ? (u32)len : 0;
+  }
+
+  b32 is_first = true;
+  for (u32 viewer_i = 0;
+       viewer_i < MAX_CAPTURE_VIEWER_COUNT && result < buf_size;
+       ++viewer_i)
+  {
+    CaptureViewerStats *stats = capture->viewer_stats + viewer_i;
+    if (stats->is_active)
+    {
+      len = snprintf(buf + result, buf_size - result,
+                     "%s{\"viewer\":%u,\"worker\":%d,\"stream\":%u,\"fps\":%.1f,"
+                     "\"sent\":%lu,\"dropped\":%lu,\"paced\":%lu,\"queue_bytes\":%u,"
+                     "\"queue_ms\":%.1f,\"drain_bytes_per_sec\":%.0f,"
+                     "\"zero_copy_sends\":%lu,\"copied_sends\":%lu}",
+                     is_first ? "" : ",", viewer_i, (s32)stats->worker_index, stats->stream_index, 
+                     stats->fps, stats->sent_frame_count, stats->dropped_frame_count, 
+                     stats->paced_frame_count, stats->queue_depth, stats->queue_latency_ms, 
+                     stats->drain_rate, stats->zero_copy_send_count, stats->copied_send_count);
+      result += (len > 0) ? (u32)len : 0;
+      is_first = false;
+    }
+  }
+  pthread_mutex_unlock(&capture->mutex);
+
+  if (result < buf_size)
+  {
+    len = snprintf(buf + result, buf_size - result, "]}\n");
+    result += (len > 0) ? (u32)len : 0;
+  }
+  if (result >= buf_size)
+  {
+    result = buf_size - 1;
+  }
+
+  return result;
+}
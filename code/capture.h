@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#pragma once
+
+#include <pthread.h>
+
+#include "frame_source.h"
+#include "motion.h"
+
+#define FRAME_RING_SIZE 8
+#define FRAME_HEADER_SIZE 128
+#define MAX_CAPTURE_SUBSCRIBER_COUNT 64
+#define MAX_CAPTURE_VIEWER_COUNT 256
+#define CAPTURE_VIEWER_STATS_JSON_SIZE 256
+// NOTE(Ryan): The source's own size, then each halving of a raw source, e.g. 1280x720,
+// 640x360 and 320x180
+#define CAPTURE_STREAM_COUNT 3
+#define CAPTURE_STREAM_STATS_JSON_SIZE 192
+#define CAPTURE_STATS_JSON_SIZE (512 + CAPTURE_STREAM_COUNT * CAPTURE_STREAM_STATS_JSON_SIZE + \
+                                 MAX_CAPTURE_VIEWER_COUNT * CAPTURE_VIEWER_STATS_JSON_SIZE)
+
+// NOTE(Ryan): One captured frame, shared by every client sending it.
+// header is this frame's multipart boundary, so a client sends header then data as is
+typedef struct Frame
+{
+  // NOTE(Ryan): One per client sending it, plus one held by the ring while it is the latest
+  u32 ref_count;
+  u64 sequence;
+  u32 device_sequence;
+  u64 timestamp_ns;
+
+  u8 header[FRAME_HEADER_SIZE];
+  u32 header_len;
+
+  // NOTE(Ryan): Either the source's own buffer, lent until nobody references the frame,
+  // or copy_buffer when the source could not spare it
+  u8 *data;
+  u32 size;
+  s32 lent_buffer_index;
+  u8 *copy_buffer;
+  u32 copy_capacity;
+} Frame;
+
+// NOTE(Ryan): The capture thread only ever writes a frame nobody references,
+// and clients only ever take a reference on the latest, so a frame is never
+// written while being sent
+typedef struct FrameRing
+{
+  pthread_mutex_t mutex;
+  Frame frames[FRAME_RING_SIZE];
+  Frame *latest;
+  u64 sequence;
+} FrameRing;
+
+// NOTE(Ryan): Published by the worker sending to the viewer, about once a second
+typedef struct CaptureViewerStats
+{
+  b32 is_active;
+  u32 worker_index;
+  u32 stream_index;
+  r32 fps;
+  u64 sent_frame_count;
+  u64 dropped_frame_count;
+  // NOTE(Ryan): Frames held back as the socket was already over the target latency
+  u64 paced_frame_count;
+  u32 queue_depth;
+  r32 queue_latency_ms;
+  r32 drain_rate;
+  u64 zero_copy_send_count;
+  u64 copied_send_count;
+} CaptureViewerStats;
+
+// NOTE(Ryan): One rung of the ladder, only encoded while someone is watching it
+typedef struct CaptureStream
+{
+  u32 width;
+  u32 height;
+  u32 viewer_count;
+  FrameRing ring;
+  JPEGEncoder encoder;
+  // NOTE(Ryan): The halved raw frame, so unused by the first stream
+  u8 *image;
+  u32 image_capacity;
+
+  u64 published_count;
+  u64 ring_full_count;
+  r32 encode_ms;
+} CaptureStream;
+
+// NOTE(Ryan): Owns the frame source, opened while there is at least one viewer,
+// or always while detecting motion. Workers are woken through their eventfd for every
+// frame published
+typedef struct Capture
+{
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t viewer_cond;
+  u32 viewer_count;
+  CaptureViewerStats viewer_stats[MAX_CAPTURE_VIEWER_COUNT];
+  FrameSource source;
+  // NOTE(Ryan): An MJPEG source only has the first. Raw frames are compressed by the capture
+  // thread along with the encoders' own
+  CaptureStream streams[CAPTURE_STREAM_COUNT];
+  u32 stream_count;
+  u32 quality;
+
+  int subscriber_fds[MAX_CAPTURE_SUBSCRIBER_COUNT];
+  u32 subscriber_count;
+
+  b32 is_running;
+  b32 is_stopping;
+
+  u64 captured_count;
+  // NOTE(Ryan): Captures thrown away by a stream as every frame was still being sent
+  u64 ring_full_count;
+  // NOTE(Ryan): Published without the CPU touching them, and those copied once
+  u64 lent_frame_count;
+  u64 copied_frame_count;
+  // NOTE(Ryan): Raw frames smaller than the configured size, which are not encoded
+  u64 short_frame_count;
+  // NOTE(Ryan): From the driver filling the buffer to the frame being published
+  r32 capture_latency_ms;
+
+  // NOTE(Ryan): Run on the smallest stream of every frame when enabled
+  MotionDetector motion;
+} Capture;
@@ -0,0 +1,292 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+
+#include <zlib.h>
+#if defined(SERVER_HAS_BROTLI)
+#include <brotli/encode.h>
+#endif
+
+#include "compress.h"
+
+GLOBAL const char *global_content_encoding_names[CONTENT_ENCODING_COUNT] = {
+  [CONTENT_ENCODING_IDENTITY] = "identity",
+  [CONTENT_ENCODING_GZIP] = "gzip",
+  [CONTENT_ENCODING_DEFLATE] = "deflate",
+  [CONTENT_ENCODING_BROTLI] = "br",
+};
+
+// NOTE(Ryan): Returns a bit per CONTENT_ENCODING the client takes, identity always among them.
+// q-values only matter as to whether they are 0, i.e. refused, as every variant sent is
+// already the smallest on offer. Unknown codings are ignored
+INTERNAL u32
+parse_accept_encoding(HTTPSlice accept_encoding)
+{
+  u32 accepted = (1 << CONTENT_ENCODING_IDENTITY);
+  u32 refused = 0;
+  b32 is_any_accepted = false;
+
+  u8 *at = accept_encoding.str;
+  u8 *end = accept_encoding.str + accept_encoding.size;
+  while (at < end)
+  {
+    consume_whitespace(&at, end);
+    HTTPSlice coding = {at, 0};
+    while (at < end && at[0] != ',' && at[0] != ';' && at[0] != ' ' && at[0] != '\t')
+    {
+      at++;
+    }
+    coding.size = (u32)(at - coding.str);
+
+    b32 is_refused = false;
+    while (at < end && at[0] != ',')
+    {
+      if (at[0] == ';')
+      {
+        at++;
+        consume_whitespace(&at, end);
+        if (end - at >= 2 && http_to_lower(at[0]) == 'q' && at[1] == '=')
+        {
+          at += 2;
+          // NOTE(Ryan): "0", "0.0" and "0.000" all refuse
+          is_refused = true;
+          while (at < end && at[0] != ',' && at[0] != ';')
+          {
+            if (at[0] >= '1' && at[0] <= '9')
+            {
+              is_refused = false;
+            }
+            at++;
+          }
+        }
+      }
+      else
+      {
+        at++;
+      }
+    }
+
+    u32 coding_bit = 0;
+    if (http_slice_equals_ignore_case(coding, "gzip") ||
+        http_slice_equals_ignore_case(coding, "x-gzip"))
+    {
+      coding_bit = (1 << CONTENT_ENCODING_GZIP);
+    }
+    else if (http_slice_equals_ignore_case(coding, "deflate"))
+    {
+      coding_bit = (1 << CONTENT_ENCODING_DEFLATE);
+    }
+    else if (http_slice_equals_ignore_case(coding, "br"))
+    {
+      coding_bit = (1 << CONTENT_ENCODING_BROTLI);
+    }
+    else if (http_slice_equals(coding, "*"))
+    {
+      is_any_accepted = !is_refused;
+    }
+
+    if (is_refused)
+    {
+      refused |= coding_bit;
+    }
+    else
+    {
+      accepted |= coding_bit;
+    }
+
+    at++;
+  }
+
+  if (is_any_accepted)
+  {
+    accepted |= ((1 << CONTENT_ENCODING_COUNT) - 1) & ~refused;
+  }
+
+  return accepted;
+}
+
+// NOTE(Ryan): Already compressed formats, e.g. JPEG, only grow
+INTERNAL b32
+is_compressible_content_type(const char *content_type)
+{
+  return (strncmp(content_type, "text/", 5) == 0 ||
+          strncmp(content_type, "application/json", 16) == 0 ||
+          strncmp(content_type, "application/javascript", 22) == 0 ||
+          strncmp(content_type, "application/wasm", 16) == 0 ||
+          strncmp(content_type, "image/svg+xml", 13) == 0);
+}
+
+// NOTE(Ryan): For gzip the header and trailer come from zlib itself,
+// with windowBits past 15 asking for them
+INTERNAL b32
+init_deflate_stream(z_stream *stream, CONTENT_ENCODING encoding, s32 level)
+{
+  memset(stream, 0, sizeof(*stream));
+  s32 window_bits = (encoding == CONTENT_ENCODING_GZIP) ? (MAX_WBITS + 16) : MAX_WBITS;
+  return (deflateInit2(stream, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+}
+
+// NOTE(Ryan): stream is fresh or reset. Output is malloc()ed,
+// false if it would come out no smaller, when it is left NULL
+INTERNAL b32
+deflate_body(z_stream *stream, u8 *body, u32 body_size, u8 **out, u32 *out_size)
+{
+  b32 result = false;
+  *out = NULL;
+  *out_size = 0;
+
+  u32 bound = (u32)deflateBound(stream, body_size);
+  u8 *buf = malloc(bound);
+  if (buf != NULL)
+  {
+    stream->next_in = body;
+    stream->avail_in = body_size;
+    stream->next_out = buf;
+    stream->avail_out = bound;
+    if (deflate(stream, Z_FINISH) == Z_STREAM_END && stream->total_out < body_size)
+    {
+      *out = buf;
+      *out_size = (u32)stream->total_out;
+      result = true;
+    }
+    else
+    {
+      free(buf);
+    }
+  }
+  else
+  {
+    EBP();
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): For responses made once and sent many times,
+// so the slowest settings are worth it
+INTERNAL b32
+compress_once(CONTENT_ENCODING encoding, u8 *body, u32 body_size, u8 **out, u32 *out_size)
+{
+  b32 result = false;
+  *out = NULL;
+  *out_size = 0;
+
+  if (body_size >= COMPRESSION_MIN_SIZE)
+  {
+    if (encoding == CONTENT_ENCODING_GZIP || encoding == CONTENT_ENCODING_DEFLATE)
+    {
+      z_stream stream;
+      if (init_deflate_stream(&stream, encoding, COMPRESSION_STATIC_LEVEL))
+      {
+        result = deflate_body(&stream, body, body_size, out, out_size);
+        deflateEnd(&stream);
+      }
+      else
+      {
+        BP_MSG(NULL, "deflateInit2() failed");
+      }
+    }
+#if defined(SERVER_HAS_BROTLI)
+    else if (encoding == CONTENT_ENCODING_BROTLI)
+    {
+      size_t buf_size = BrotliEncoderMaxCompressedSize(body_size);
+      u8 *buf = (buf_size > 0) ? malloc(buf_size) : NULL;
+      if (buf != NULL)
+      {
+        if (BrotliEncoderCompress(COMPRESSION_BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW,
+                                  BROTLI_MODE_TEXT, body_size, body, &buf_size, buf) &&
+            buf_size < body_size)
+        {
+          *out = buf;
+          *out_size = (u32)buf_size;
+          result = true;
+        }
+        else
+        {
+          free(buf);
+        }
+      }
+    }
+#endif
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): For responses made as they are asked for. Only gzip and deflate,
+// brotli at a level worth it costing more than sending the bytes
+INTERNAL CONTENT_ENCODING
+choose_dynamic_encoding(u32 accepted_encodings)
+{
+  CONTENT_ENCODING result = CONTENT_ENCODING_IDENTITY;
+
+  if (accepted_encodings & (1 << CONTENT_ENCODING_GZIP))
+  {
+    result = CONTENT_ENCODING_GZIP;
+  }
+  else if (accepted_encodings & (1 << CONTENT_ENCODING_DEFLATE))
+  {
+    result = CONTENT_ENCODING_DEFLATE;
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Output is malloc()ed. False to send the body as is
+INTERNAL b32
+compress_dynamic(Compressor *compressor, CONTENT_ENCODING encoding,
+                 u8 *body, u32 body_size, u8 **out, u32 *out_size)
+{
+  b32 result = false;
+  *out = NULL;
+  *out_size = 0;
+
+  if (body_size >= COMPRESSION_MIN_SIZE &&
+      (encoding == CONTENT_ENCODING_GZIP || encoding == CONTENT_ENCODING_DEFLATE))
+  {
+    z_stream *stream = &compressor->streams[encoding];
+    if (!compressor->is_stream_ready[encoding])
+    {
+      compressor->is_stream_ready[encoding] =
+        init_deflate_stream(stream, encoding, COMPRESSION_DYNAMIC_LEVEL);
+      if (!compressor->is_stream_ready[encoding])
+      {
+        BP_MSG(NULL, "deflateInit2() failed");
+      }
+    }
+
+    if (compressor->is_stream_ready[encoding])
+    {
+      result = deflate_body(stream, body, body_size, out, out_size);
+      deflateReset(stream);
+
+      if (result)
+      {
+        compressor->compressed_count++;
+        compressor->bytes_in += body_size;
+        compressor->bytes_out += *out_size;
+      }
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): For responses compressed ahead of time, variants not made being left empty.
+// Whichever is smallest of those the client takes, so brotli where there is one
+INTERNAL CONTENT_ENCODING
+choose_precompressed_encoding(u32 accepted_encodings, HTTPResponse *variants)
+{
+  CONTENT_ENCODING result = CONTENT_ENCODING_IDENTITY;
+
+  for (u32 encoding_i = CONTENT_ENCODING_IDENTITY + 1;
+       encoding_i < CONTENT_ENCODING_COUNT;
+       ++encoding_i)
+  {
+    if ((accepted_encodings & (1 << encoding_i)) && variants[encoding_i].data != NULL &&
+        variants[encoding_i].size < variants[result].size)
+    {
+      result = (CONTENT_ENCODING)encoding_i;
+    }
+  }
+
+  return result;
+}
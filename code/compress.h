@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#pragma once
+
+#include <zlib.h>
+
+// NOTE(Ryan): Below this the headers cost more than compressing saves
+#define COMPRESSION_MIN_SIZE 256
+// NOTE(Ryan): Responses made once, e.g. cached files, get the slowest and smallest
+#define COMPRESSION_STATIC_LEVEL 9
+#define COMPRESSION_DYNAMIC_LEVEL 6
+#define COMPRESSION_BROTLI_QUALITY 11
+#define CONTENT_ENCODING_HEADERS_SIZE 64
+
+typedef enum CONTENT_ENCODING
+{
+  CONTENT_ENCODING_IDENTITY,
+  CONTENT_ENCODING_GZIP,
+  // NOTE(Ryan): As HTTP names it, i.e. zlib wrapped
+  CONTENT_ENCODING_DEFLATE,
+  // NOTE(Ryan): Only built with SERVER_HAS_BROTLI, and only ahead of time, being slow to compress
+  CONTENT_ENCODING_BROTLI,
+  CONTENT_ENCODING_COUNT,
+} CONTENT_ENCODING;
+
+// NOTE(Ryan): One per worker. A deflate state is a few hundred KiB, set up with several
+// allocations, so one per encoding is kept and reset between responses rather than made
+// for each. A response is built whole within one event, so never holds one for longer
+typedef struct Compressor
+{
+  z_stream streams[CONTENT_ENCODING_COUNT];
+  b32 is_stream_ready[CONTENT_ENCODING_COUNT];
+
+  u64 compressed_count;
+  u64 bytes_in;
+  u64 bytes_out;
+} Compressor;
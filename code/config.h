@@ -1,53 +1,471 @@
 // SPDX-License-Identifier: zlib-acknowledgement
 #pragma once
 
-// call when activate menu item
+typedef enum DEBUG_VARIABLE_TYPE
+{
+  DEBUG_VARIABLE_TYPE_BOOL,
+  DEBUG_VARIABLE_TYPE_S32,
+  DEBUG_VARIABLE_TYPE_R32,
+  DEBUG_VARIABLE_TYPE_COLOUR,
+  DEBUG_VARIABLE_TYPE_ENUM,
+} DEBUG_VARIABLE_TYPE;
+
+// NOTE(Ryan): Only variables that alter what code is compiled (e.g. whether timed blocks
+// exist at all) should be compile time. Everything else is changed in place
+#define DEBUG_VARIABLE_FLAG_COMPILE_TIME (1 << 0)
+
+typedef struct DebugVariable
+{
+  DEBUG_VARIABLE_TYPE type;
+  const char *name;
+  u32 flags;
+
+  union
+  {
+    b32 bool_value;
+    s32 s32_value;
+    r32 r32_value;
+    V4 colour_value;
+    u32 enum_value;
+  };
+
+  union
+  {
+    struct
+    {
+      s32 s32_min, s32_max, s32_step;
+    };
+    struct
+    {
+      r32 r32_min, r32_max, r32_step;
+    };
+    struct
+    {
+      const char **enum_names;
+      u32 enum_count;
+    };
+  };
+} DebugVariable;
+
+// NOTE(Ryan): A DEBUG_VARIABLE_FLAG_COMPILE_TIME entry starts at its own macro, i.e. the value
+// built with, from build/debug_config.h or else the default beside DEBUG_PROFILER's in debug.h
+#define DEBUG_VARIABLE_LISTING(X) \
+  X(DEBUG_PROFILER, BOOL, DEBUG_VARIABLE_FLAG_COMPILE_TIME, .bool_value = DEBUG_PROFILER) \
+  X(DEBUG_PROFILER_OVERLAY, BOOL, 0, .bool_value = true) \
+  X(DEBUG_CONSOLE, BOOL, 0, .bool_value = false) \
+  X(DEBUG_CAMERA_PANEL, BOOL, 0, .bool_value = true) \
+  X(DEBUG_SNAPSHOT_WINDOW, S32, 0, .s32_value = DEBUG_SNAPSHOT_MAX_COUNT, \
+    .s32_min = 8, .s32_max = DEBUG_SNAPSHOT_MAX_COUNT, .s32_step = 8) \
+  X(DEBUG_OVERLAY_FONT_SCALE, R32, 0, .r32_value = 0.12f, \
+    .r32_min = 0.06f, .r32_max = 0.3f, .r32_step = 0.02f) \
+  X(DEBUG_OVERLAY_TEXT_COLOUR, COLOUR, 0, .colour_value = {{0.8f, 0.8f, 0.8f, 1.0f}}) \
+  X(DEBUG_SPARKLINE_METRIC, ENUM, 0, .enum_value = 0, \
+    .enum_names = (const char *[]){"CY/H", "CY", "H"}, .enum_count = 3) \
+  X(DEBUG_SPIKE_CAPTURE, BOOL, 0, .bool_value = true) \
+  X(DEBUG_SPIKE_BUDGET_MS, R32, 0, .r32_value = 20.0f, \
+    .r32_min = 1.0f, .r32_max = 100.0f, .r32_step = 1.0f) \
+  X(DEBUG_SPIKE_FRAMES_BEFORE, S32, 0, .s32_value = 8, \
+    .s32_min = 0, .s32_max = (MAX_DEBUG_FRAME_COUNT / 2) - 1, .s32_step = 1) \
+  X(DEBUG_SPIKE_FRAMES_AFTER, S32, 0, .s32_value = 4, \
+    .s32_min = 0, .s32_max = (MAX_DEBUG_FRAME_COUNT / 2) - 1, .s32_step = 1)
+
+#define DEBUG_VARIABLE_ID_ENTRY(name, var_type, var_flags, ...) \
+  DEBUG_VARIABLE_##name,
+typedef enum DEBUG_VARIABLE
+{
+  DEBUG_VARIABLE_LISTING(DEBUG_VARIABLE_ID_ENTRY)
+  DEBUG_VARIABLE_COUNT
+} DEBUG_VARIABLE;
+
+#define DEBUG_VARIABLE_DEFAULT_ENTRY(var_name, var_type, var_flags, ...) \
+  [DEBUG_VARIABLE_##var_name] = { \
+    .type = DEBUG_VARIABLE_TYPE_##var_type, .name = #var_name, .flags = var_flags, __VA_ARGS__ \
+  },
+GLOBAL DebugVariable global_debug_variable_defaults[DEBUG_VARIABLE_COUNT] = {
+  DEBUG_VARIABLE_LISTING(DEBUG_VARIABLE_DEFAULT_ENTRY)
+};
+
+#define DEBUG_VARIABLE(variables, name) \
+  ((variables)[DEBUG_VARIABLE_##name])
+
+#define DEBUG_VARIABLES_FILE_NAME "debug_variables.txt"
+#define DEBUG_CONFIG_FILE_NAME "../build/debug_config.h"
+#define DEBUG_REBUILD_DIRECTORY ".."
+#define DEBUG_REBUILD_COMMAND "bash misc/build.gui reload"
+
 INTERNAL void
-write_config(b32 val)
+save_debug_variables(DebugVariable *variables, const char *file_name)
+{
+  FILE *file = fopen(file_name, "w");
+  if (file != NULL)
+  {
+    for (u32 variable_i = 0;
+         variable_i < DEBUG_VARIABLE_COUNT;
+         ++variable_i)
+    {
+      DebugVariable *variable = variables + variable_i;
+      switch (variable->type)
+      {
+        case DEBUG_VARIABLE_TYPE_BOOL:
+        {
+          fprintf(file, "%s %d\n", variable->name, variable->bool_value);
+        } break;
+        case DEBUG_VARIABLE_TYPE_S32:
+        {
+          fprintf(file, "%s %d\n", variable->name, variable->s32_value);
+        } break;
+        case DEBUG_VARIABLE_TYPE_R32:
+        {
+          fprintf(file, "%s %f\n", variable->name, variable->r32_value);
+        } break;
+        case DEBUG_VARIABLE_TYPE_COLOUR:
+        {
+          fprintf(file, "%s %f %f %f %f\n", variable->name, variable->colour_value.r,
+                  variable->colour_value.g, variable->colour_value.b, variable->colour_value.a);
+        } break;
+        case DEBUG_VARIABLE_TYPE_ENUM:
+        {
+          fprintf(file, "%s %u\n", variable->name, variable->enum_value);
+        } break;
+        INVALID_DEFAULT_CASE
+      }
+    }
+
+    fclose(file);
+  }
+  else
+  {
+    EBP();
+  }
+}
+
+INTERNAL DebugVariable *
+find_debug_variable(DebugVariable *variables, const char *name)
 {
-  char buf[256] = {0};
-  char *at = buf;
+  DebugVariable *result = NULL;
+
   for (u32 variable_i = 0;
-       variable_i < ARRAY_COUNT(variables);
+       variable_i < DEBUG_VARIABLE_COUNT;
        ++variable_i)
   {
-    at += snprintf(at, sizeof(buf) - at, "#define %s %d // b32", var->name, var->value, var->type);
+    if (strcmp(variables[variable_i].name, name) == 0)
+    {
+      result = variables + variable_i;
+      break;
+    }
   }
 
-  write_entire_file("../config.h", buf, sizeof(buf));
-
-  execute_system_command("../code", "bash ../build");
-  // FILE *file = popen("../code/build", "r");
-  // if (file != NULL)
-  // {
-  //   if (fgets(temp, sizeof(temp), file) == NULL)
-  //   {
-  //      process has finished running, so close handle
-  //      therefore, require check state function to be called every frame
-  //      perhaps printf("compiling...\n")?
-  //      s32 return_code = (s32)pclose(file);
-  //   }
-  // }
+  return result;
 }
 
-typedef enum DEBUG_VARIABLE_TYPE
+// NOTE(Ryan): Unknown or malformed lines are skipped, so the file survives variables
+// being added or removed between builds
+INTERNAL void
+load_debug_variables(DebugVariable *variables, const char *file_name)
 {
-  DEBUG_VARIABLE_TYPE_BOOL,
-} DEBUG_VARIABLE_TYPE;
+  memcpy(variables, global_debug_variable_defaults, sizeof(global_debug_variable_defaults));
+
+  FILE *file = fopen(file_name, "r");
+  if (file != NULL)
+  {
+    char line[256] = {0};
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+      char name[128] = {0};
+      s32 name_len = 0;
+      if (sscanf(line, "%127s%n", name, &name_len) != 1)
+      {
+        continue;
+      }
+
+      DebugVariable *variable = find_debug_variable(variables, name);
+      if (variable == NULL)
+      {
+        continue;
+      }
+
+      char *value = line + name_len;
+      switch (variable->type)
+      {
+        case DEBUG_VARIABLE_TYPE_BOOL:
+        {
+          s32 bool_value = 0;
+          if (sscanf(value, "%d", &bool_value) == 1)
+          {
+            variable->bool_value = (bool_value != 0);
+          }
+        } break;
+        case DEBUG_VARIABLE_TYPE_S32:
+        {
+          s32 s32_value = 0;
+          if (sscanf(value, "%d", &s32_value) == 1)
+          {
+            variable->s32_value = CLAMP(s32_value, variable->s32_min, variable->s32_max);
+          }
+        } break;
+        case DEBUG_VARIABLE_TYPE_R32:
+        {
+          r32 r32_value = 0.0f;
+          if (sscanf(value, "%f", &r32_value) == 1)
+          {
+            variable->r32_value = CLAMP(r32_value, variable->r32_min, variable->r32_max);
+          }
+        } break;
+        case DEBUG_VARIABLE_TYPE_COLOUR:
+        {
+          V4 colour_value = {0};
+          if (sscanf(value, "%f %f %f %f", &colour_value.r, &colour_value.g,
+                     &colour_value.b, &colour_value.a) == 4)
+          {
+            variable->colour_value = colour_value;
+          }
+        } break;
+        case DEBUG_VARIABLE_TYPE_ENUM:
+        {
+          u32 enum_value = 0;
+          if (sscanf(value, "%u", &enum_value) == 1 && enum_value < variable->enum_count)
+          {
+            variable->enum_value = enum_value;
+          }
+        } break;
+        INVALID_DEFAULT_CASE
+      }
+    }
 
-typedef struct Variable
+    fclose(file);
+  }
+}
+
+// NOTE(Ryan): Names and limits held in State point into the shared object that set them,
+// so are taken again from this one's after a reload. Values are kept
+INTERNAL void
+rebind_debug_variables(DebugVariable *variables)
 {
-  DEBUG_VARIABLE_TYPE type;
-  char *name;
-  union
+  for (u32 variable_i = 0;
+       variable_i < DEBUG_VARIABLE_COUNT;
+       ++variable_i)
   {
-    b32 value;
+    DebugVariable *variable = variables + variable_i;
+    DebugVariable *variable_default = global_debug_variable_defaults + variable_i;
+    if (variable->type == variable_default->type)
+    {
+      variable->name = variable_default->name;
+      variable->flags = variable_default->flags;
+      switch (variable->type)
+      {
+        case DEBUG_VARIABLE_TYPE_S32:
+        {
+          variable->s32_min = variable_default->s32_min;
+          variable->s32_max = variable_default->s32_max;
+          variable->s32_step = variable_default->s32_step;
+          variable->s32_value = CLAMP(variable->s32_value, variable->s32_min, variable->s32_max);
+        } break;
+        case DEBUG_VARIABLE_TYPE_R32:
+        {
+          variable->r32_min = variable_default->r32_min;
+          variable->r32_max = variable_default->r32_max;
+          variable->r32_step = variable_default->r32_step;
+          variable->r32_value = CLAMP(variable->r32_value, variable->r32_min, variable->r32_max);
+        } break;
+        case DEBUG_VARIABLE_TYPE_ENUM:
+        {
+          variable->enum_names = variable_default->enum_names;
+          variable->enum_count = variable_default->enum_count;
+          if (variable->enum_value >= variable->enum_count)
+          {
+            variable->enum_value = variable_default->enum_value;
+          }
+        } break;
+        default:
+        {
+        } break;
+      }
+    }
+    else
+    {
+      // NOTE(Ryan): The listing changed under it between builds
+      *variable = *variable_default;
+    }
   }
-} Variable;
+}
+
+INTERNAL void
+write_config(DebugVariable *variables, const char *file_name)
+{
+  FILE *file = fopen(file_name, "w");
+  if (file != NULL)
+  {
+    fprintf(file, "// SPDX-License-Identifier: zlib-acknowledgement\n");
+    fprintf(file, "// NOTE(Ryan): Generated by write_config(), change through the debug menu\n");
+    fprintf(file, "#pragma once\n\n");
 
-#define VARIABLE_LISTING(name) \
-  {DEBUG_VARIABLE_TYPE_BOOL, #name, 1}
+    for (u32 variable_i = 0;
+         variable_i < DEBUG_VARIABLE_COUNT;
+         ++variable_i)
+    {
+      DebugVariable *variable = variables + variable_i;
+      if (variable->flags & DEBUG_VARIABLE_FLAG_COMPILE_TIME)
+      {
+        switch (variable->type)
+        {
+          case DEBUG_VARIABLE_TYPE_BOOL:
+          {
+            fprintf(file, "#define %s %d // b32\n", variable->name, variable->bool_value);
+          } break;
+          case DEBUG_VARIABLE_TYPE_S32:
+          {
+            fprintf(file, "#define %s %d // s32\n", variable->name, variable->s32_value);
+          } break;
+          case DEBUG_VARIABLE_TYPE_R32:
+          {
+            // NOTE(Ryan): '#' keeps the decimal point, so the f suffix is valid
+            fprintf(file, "#define %s %#.9gf // r32\n", variable->name, variable->r32_value);
+          } break;
+          case DEBUG_VARIABLE_TYPE_COLOUR:
+          {
+            fprintf(file, "#define %s {{%#.9gf, %#.9gf, %#.9gf, %#.9gf}} // V4\n", 
+                    variable->name, variable->colour_value.r, variable->colour_value.g, 
+                    variable->colour_value.b, variable->colour_value.a);
+          } break;
+          case DEBUG_VARIABLE_TYPE_ENUM:
+          {
+            fprintf(file, "#define %s %u // enum\n", variable->name, variable->enum_value);
+          } break;
+          INVALID_DEFAULT_CASE
+        }
+      }
+    }
+
+    fclose(file);
+  }
+  else
+  {
+    EBP();
+  }
+}
 
-Variable variable_listing[] = {
-  VARIABLE_LISTING(DEBUG_PROFILER),
+GLOBAL V4 global_debug_colour_palette[] =
+{
+  // primaries and secondaries
+  {{1, 0, 0, 1}},
+  {{0, 1, 0, 1}},
+  {{0, 0, 1, 1}},
+  {{1, 1, 0, 1}},
+  {{1, 0, 1, 1}},
+  {{0, 1, 1, 1}},
+  {{0.8f, 0.8f, 0.8f, 1}},
 };
+
+// NOTE(Ryan): direction is +1 or -1. Values wrap around at their limits so a single
+// mouse button is enough to reach any value
+INTERNAL void
+step_debug_variable(DebugVariable *variable, s32 direction)
+{
+  switch (variable->type)
+  {
+    case DEBUG_VARIABLE_TYPE_BOOL:
+    {
+      variable->bool_value = !variable->bool_value;
+    } break;
+    case DEBUG_VARIABLE_TYPE_S32:
+    {
+      s32 s32_value = variable->s32_value + direction * variable->s32_step;
+      if (s32_value > variable->s32_max)
+      {
+        s32_value = variable->s32_min;
+      }
+      else if (s32_value < variable->s32_min)
+      {
+        s32_value = variable->s32_max;
+      }
+      variable->s32_value = s32_value;
+    } break;
+    case DEBUG_VARIABLE_TYPE_R32:
+    {
+      r32 r32_value = variable->r32_value + direction * variable->r32_step;
+      if (r32_value > variable->r32_max + 0.5f * variable->r32_step)
+      {
+        r32_value = variable->r32_min;
+      }
+      else if (r32_value < variable->r32_min - 0.5f * variable->r32_step)
+      {
+        r32_value = variable->r32_max;
+      }
+      variable->r32_value = r32_value;
+    } break;
+    case DEBUG_VARIABLE_TYPE_COLOUR:
+    {
+      u32 palette_count = ARRAY_COUNT(global_debug_colour_palette);
+      u32 palette_i = 0;
+      for (u32 test_i = 0;
+           test_i < palette_count;
+           ++test_i)
+      {
+        V4 test = global_debug_colour_palette[test_i];
+        if (test.r == variable->colour_value.r && test.g == variable->colour_value.g &&
+            test.b == variable->colour_value.b)
+        {
+          palette_i = test_i;
+          break;
+        }
+      }
+      palette_i = (palette_i + palette_count + direction) % palette_count;
+      variable->colour_value = global_debug_colour_palette[palette_i];
+    } break;
+    case DEBUG_VARIABLE_TYPE_ENUM:
+    {
+      variable->enum_value = \
+        (variable->enum_value + variable->enum_count + direction) % variable->enum_count;
+    } break;
+    INVALID_DEFAULT_CASE
+  }
+}
+
+INTERNAL void
+format_debug_variable(DebugVariable *variable, char *buf, u32 buf_size)
+{
+  switch (variable->type)
+  {
+    case DEBUG_VARIABLE_TYPE_BOOL:
+    {
+      snprintf(buf, buf_size, "%s: %s", variable->name, variable->bool_value ? "ON" : "OFF");
+    } break;
+    case DEBUG_VARIABLE_TYPE_S32:
+    {
+      snprintf(buf, buf_size, "%s: %d", variable->name, variable->s32_value);
+    } break;
+    case DEBUG_VARIABLE_TYPE_R32:
+    {
+      snprintf(buf, buf_size, "%s: %.2f", variable->name, variable->r32_value);
+    } break;
+    case DEBUG_VARIABLE_TYPE_COLOUR:
+    {
+      snprintf(buf, buf_size, "%s: (%.1f, %.1f, %.1f)", variable->name,
+               variable->colour_value.r, variable->colour_value.g, variable->colour_value.b);
+    } break;
+    case DEBUG_VARIABLE_TYPE_ENUM:
+    {
+      snprintf(buf, buf_size, "%s: %s", variable->name,
+               variable->enum_names[variable->enum_value]);
+    } break;
+    INVALID_DEFAULT_CASE
+  }
+}
+
+// NOTE(Ryan): Returns whether a rebuild is required for the change to take effect
+INTERNAL b32
+edit_debug_variable(DebugVariable *variables, DebugVariable *variable, s32 direction)
+{
+  b32 result = false;
+
+  step_debug_variable(variable, direction);
+  save_debug_variables(variables, DEBUG_VARIABLES_FILE_NAME);
+
+  if (variable->flags & DEBUG_VARIABLE_FLAG_COMPILE_TIME)
+  {
+    write_config(variables, DEBUG_CONFIG_FILE_NAME);
+    result = true;
+  }
+
+  return result;
+}
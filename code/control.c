@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "control.h"
+
+INTERNAL void
+control_init(ControlState *state)
+{
+  pthread_mutex_init(&state->mutex, NULL);
+  state->version = 1;
+}
+
+INTERNAL void
+control_add(ControlState *state, const char *name, s32 min_value, s32 max_value)
+{
+  if (state->control_count < MAX_CONTROL_COUNT && strlen(name) < CONTROL_NAME_SIZE)
+  {
+    Control *control = state->controls + state->control_count++;
+    strcpy(control->name, name);
+    control->value = min_value;
+    control->min_value = min_value;
+    control->max_value = max_value;
+  }
+}
+
+// NOTE(Ryan): Returns an eventfd that is written on every change, or -1.
+// Subscribe every worker before serving
+INTERNAL int
+control_subscribe(ControlState *state)
+{
+  int result = -1;
+
+  if (state->subscriber_count < MAX_CONTROL_SUBSCRIBER_COUNT)
+  {
+    result = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (result != -1)
+    {
+      state->subscriber_fds[state->subscriber_count++] = result;
+    }
+    else
+    {
+      EBP();
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Parses "LED1=1&PWM1=128", the same as a form post.
+// Unknown names and malformed pairs are skipped. Returns true if anything changed
+INTERNAL b32
+control_apply_command(ControlState *state, HTTPSlice command)
+{
+  b32 result = false;
+
+  pthread_mutex_lock(&state->mutex);
+  u8 *at = command.str;
+  u8 *end = command.str + command.size;
+  while (at < end)
+  {
+    HTTPSlice name = {at, 0};
+    while (at < end && at[0] != '=' && at[0] != '&')
+    {
+      at++;
+    }
+    name.size = (u32)(at - name.str);
+
+    b32 has_value = false;
+    b32 is_negative = false;
+    s64 value = 0;
+    if (at < end && at[0] == '=')
+    {
+      at++;
+      if (at < end && at[0] == '-')
+      {
+        is_negative = true;
+        at++;
+      }
+      while (at < end && at[0] >= '0' && at[0] <= '9' && value < 0x7fffffff)
+      {
+        value = value * 10 + (at[0] - '0');
+        has_value = true;
+        at++;
+      }
+    }
+    has_value = has_value && (at == end || at[0] == '&');
+    while (at < end && at[0] != '&')
+    {
+      at++;
+    }
+    at++;
+
+    for (u32 control_i = 0;
+         has_value && control_i < state->control_count;
+         ++control_i)
+    {
+      Control *control = state->controls + control_i;
+      if (http_slice_equals(name, control->name))
+      {
+        s32 new_value = (s32)(is_negative ? -value : value);
+        if (new_value < control->min_value)
+        {
+          new_value = control->min_value;
+        }
+        if (new_value > control->max_value)
+        {
+          new_value = control->max_value;
+        }
+
+        if (new_value != control->value)
+        {
+          // NOTE(Ryan): Where the pin would be driven
+          printf("%s=%d\n", control->name, new_value);
+          control->value = new_value;
+          result = true;
+        }
+        break;
+      }
+    }
+  }
+
+  if (result)
+  {
+    state->version++;
+  }
+  pthread_mutex_unlock(&state->mutex);
+
+  if (result)
+  {
+    u64 increment = 1;
+    for (u32 subscriber_i = 0;
+         subscriber_i < state->subscriber_count;
+         ++subscriber_i)
+    {
+      if (write(state->subscriber_fds[subscriber_i], &increment, sizeof(increment)) == -1 &&
+          errno != EAGAIN)
+      {
+        EBP();
+      }
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Returns false for an unknown name
+INTERNAL b32
+control_get_value(ControlState *state, HTTPSlice name, s32 *value)
+{
+  b32 result = false;
+
+  pthread_mutex_lock(&state->mutex);
+  for (u32 control_i = 0;
+       control_i < state->control_count;
+       ++control_i)
+  {
+    if (http_slice_equals(name, state->controls[control_i].name))
+    {
+      *value = state->controls[control_i].value;
+      result = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&state->mutex);
+
+  return result;
+}
+
+// NOTE(Ryan): buf is best CONTROL_STATE_JSON_SIZE. Returns the length written
+INTERNAL u32
+control_format_state(ControlState *state, char *buf, u32 buf_size, u64 *version)
+{
+  u32 result = 0;
+
+  pthread_mutex_lock(&state->mutex);
+  *version = state->version;
+  s32 len = snprintf(buf, buf_size, "{\"type\":\"state\",\"version\":%lu,\"controls\":{",
+                     state->version);
+  result = (len > 0) ? (u32)len : 0;
+  for (u32 control_i = 0;
+       control_i < state->control_count && result < buf_size;
+       ++control_i)
+  {
+    Control *control = state->controls + control_i;
+    len = snprintf(buf + result, buf_size - result, "%s\"%s\":%d",
+                   (control_i == 0) ? "" : ",", control->name, control->value);
+    result += (len > 0) ? (u32)len : 0;
+  }
+  pthread_mutex_unlock(&state->mutex);
+
+  if (result < buf_size)
+  {
+    len = snprintf(buf + result, buf_size - result, "}}");
+    result += (len > 0) ? (u32)len : 0;
+  }
+  if (result >= buf_size)
+  {
+    result = buf_size - 1;
+  }
+
+  return result;
+}
@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#pragma once
+
+#include <pthread.h>
+
+#define MAX_CONTROL_COUNT 16
+#define CONTROL_NAME_SIZE 16
+#define MAX_CONTROL_SUBSCRIBER_COUNT 64
+#define CONTROL_STATE_JSON_SIZE (64 + MAX_CONTROL_COUNT * (CONTROL_NAME_SIZE + 16))
+
+// NOTE(Ryan): An output pin or PWM channel, set from the browser
+typedef struct Control
+{
+  char name[CONTROL_NAME_SIZE];
+  s32 value;
+  s32 min_value;
+  s32 max_value;
+} Control;
+
+// NOTE(Ryan): Shared by every worker. version is bumped on every change,
+// and subscribers woken through their eventfd so they can push the new state
+typedef struct ControlState
+{
+  pthread_mutex_t mutex;
+  u64 version;
+  Control controls[MAX_CONTROL_COUNT];
+  u32 control_count;
+
+  int subscriber_fds[MAX_CONTROL_SUBSCRIBER_COUNT];
+  u32 subscriber_count;
+} ControlState;
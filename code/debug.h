@@ -3,6 +3,16 @@
 
 #include <x86intrin.h>
 
+// NOTE(Ryan): Generated into build/ by write_config() once a compile time variable is changed
+// through the debug menu. Until then each takes the default below, which is the only one,
+// as the variable listing in config.h starts each at whatever value it was built with
+#if __has_include("debug_config.h")
+#include "debug_config.h"
+#endif
+#if !defined(DEBUG_PROFILER)
+#define DEBUG_PROFILER 1
+#endif
+
 #if defined(GUI_INTERNAL)
   INTERNAL void __bp(char const *file_name, char const *func_name, int line_num,
                      char const *optional_message)
@@ -36,45 +46,138 @@
 #define INVALID_CODE_PATH ASSERT(!"InvalidCodePath");
 #define INVALID_DEFAULT_CASE default: { INVALID_CODE_PATH }
 
-typedef struct TimedBlock
+// NOTE(Ryan): Everything known at compile time about a timed block. Each instance is 
+// placed in the debug_block_info section, so the linker gathers those of every 
+// translation unit in a module into a single contiguous array
+typedef struct DebugBlockStaticInfo
 {
-  u32 counter;
   const char *file_name;
   const char *block_name;
-  u32 line_num;
-  u64 starting_ticks;
+  u32 line_number;
+} DebugBlockStaticInfo;
+
+// IMPORTANT(Ryan): The explicit alignment stops the compiler padding larger statics 
+// out to vector alignment, which would leave gaps between entries in the section
+#define DEBUG_BLOCK_STATIC_INFO_SECTION \
+  __attribute__((section("debug_block_info"), used, aligned(8)))
+
+// IMPORTANT(Ryan): Defined by the linker for the module being linked. 
+// Weak so a module without any timed blocks still links
+extern DebugBlockStaticInfo __start_debug_block_info[] __attribute__((weak));
+extern DebugBlockStaticInfo __stop_debug_block_info[] __attribute__((weak));
+
+INTERNAL u32
+get_debug_block_static_info_count(void)
+{
+  u32 result = 0;
+
+  if (__start_debug_block_info != NULL)
+  {
+    result = (u32)(__stop_debug_block_info - __start_debug_block_info);
+  }
+
+  return result;
+}
+
+typedef struct TimedBlock
+{
+  u16 static_info_index;
 } TimedBlock;
 
-typedef struct TimedRecord
+typedef enum DEBUG_EVENT_TYPE
 {
-  const char *file_name;
-  const char *block_name;
-  u32 line_number;
-  r64 seconds;
-} TimedRecord;
+  DEBUG_EVENT_BEGIN_BLOCK,
+  DEBUG_EVENT_END_BLOCK,
+} DEBUG_EVENT_TYPE;
+
+typedef struct DebugEvent
+{
+  u64 clock;
+  u16 static_info_index;
+  u16 type;
+} DebugEvent;
+
+typedef struct DebugFrameInfo
+{
+  u64 begin_clock, end_clock;
+  r32 seconds;
+  u32 event_count;
+} DebugFrameInfo;
+
+// IMPORTANT(Ryan): A spike capture must fit in the ring, 
+// i.e. spike_frames_before + 1 + spike_frames_after <= MAX_DEBUG_FRAME_COUNT
+#define MAX_DEBUG_FRAME_COUNT 64
+#define MAX_DEBUG_EVENTS_PER_FRAME 4096
+// NOTE(Ryan): How deeply timed blocks can nest and still be paired when collating
+#define MAX_DEBUG_BLOCK_DEPTH 64
+
+// NOTE(Ryan): Owned by the platform layer so it survives hot reloads
+typedef struct DebugEventTable
+{
+  u64 frame_counter;
+  DebugFrameInfo frames[MAX_DEBUG_FRAME_COUNT];
+  DebugEvent events[MAX_DEBUG_FRAME_COUNT][MAX_DEBUG_EVENTS_PER_FRAME];
+
+  // NOTE(Ryan): Events only carry an index, so the app publishes its static info table
+  DebugBlockStaticInfo *block_static_infos;
+  u32 block_static_info_count;
+
+  // NOTE(Ryan): Written by the app from its debug variables
+  b32 spike_capture_on;
+  r32 spike_budget_seconds;
+  u32 spike_frames_before, spike_frames_after;
 
-TimedRecord *global_timed_records;
+  b32 is_capturing_spike;
+  u64 spike_frame_counter;
+  u32 spike_frames_remaining;
+  u32 spike_count;
+} DebugEventTable;
+
+// NOTE(Ryan): Weak so every translation unit in a module shares the one pointer
+DebugEventTable *global_debug_event_table __attribute__((weak));
+
+INTERNAL void
+record_debug_event(u16 static_info_index, DEBUG_EVENT_TYPE type)
+{
+  DebugEventTable *debug_event_table = global_debug_event_table;
+  if (debug_event_table != NULL)
+  {
+    u32 frame_index = debug_event_table->frame_counter % MAX_DEBUG_FRAME_COUNT;
+    DebugFrameInfo *frame = debug_event_table->frames + frame_index;
+    // NOTE(Ryan): Events past the limit are dropped rather than wrapping into older frames
+    if (frame->event_count < MAX_DEBUG_EVENTS_PER_FRAME)
+    {
+      DebugEvent *event = debug_event_table->events[frame_index] + frame->event_count++;
+      event->clock = __rdtsc();
+      event->static_info_index = static_info_index;
+      event->type = (u16)type;
+    }
+  }
+}
+
+INTERNAL TimedBlock
+open_timed_block(DebugBlockStaticInfo *static_info)
+{
+  TimedBlock result = {0};
+
+  result.static_info_index = (u16)(static_info - __start_debug_block_info);
+  record_debug_event(result.static_info_index, DEBUG_EVENT_BEGIN_BLOCK);
+
+  return result;
+}
 
 INTERNAL void
 close_timed_block(TimedBlock *timed_block)
 {
-  TimedRecord *timed_record = global_timed_records + timed_block->counter;
-  timed_record->file_name = timed_block->file_name;
-  timed_record->block_name = timed_block->block_name;
-  timed_record->line_number = timed_block->line_num;
-  timed_record->seconds = \
-    (r64)(SDL_GetPerformanceCounter() - timed_block->starting_ticks) / (r64)SDL_GetPerformanceFrequency(); 
+  record_debug_event(timed_block->static_info_index, DEBUG_EVENT_END_BLOCK);
 }
 
-#if defined(GUI_INTERNAL)
+#if defined(GUI_INTERNAL) && DEBUG_PROFILER
 #define TIMED_FUNCTION__(line_number) \
-  TimedBlock timed_block##line_number __attribute__((__cleanup__(close_timed_block))) = { \
-    .counter = __COUNTER__, \
-    .file_name = __FILE__, \
-    .block_name = __func__, \
-    .line_num = line_number, \
-    .starting_ticks = SDL_GetPerformanceCounter() \
-  }; \
+  DEBUG_BLOCK_STATIC_INFO_SECTION static DebugBlockStaticInfo \
+    debug_block_static_info##line_number = {__FILE__, __func__, line_number}; \
+  TimedBlock timed_block##line_number __attribute__((__cleanup__(close_timed_block))) = \
+    open_timed_block(&debug_block_static_info##line_number);
 
 #define TIMED_FUNCTION_(line_number) \
   TIMED_FUNCTION__(line_number)
@@ -82,12 +185,15 @@ close_timed_block(TimedBlock *timed_block)
 #define TIMED_FUNCTION() \
   TIMED_FUNCTION_(__LINE__)
 
+// NOTE(Ryan): For part of a function. The pair must be in the same scope,
+// with nothing jumping out between them as the end is not automatic
 #define TIMED_BLOCK_START(name) \
-  u32 counter##name = __COUNTER__; \
-  TimedBlock
+  DEBUG_BLOCK_STATIC_INFO_SECTION static DebugBlockStaticInfo \
+    debug_block_static_info_##name = {__FILE__, #name, __LINE__}; \
+  TimedBlock timed_block_##name = open_timed_block(&debug_block_static_info_##name);
 
 #define TIMED_BLOCK_END(name) \
-  TimedRecord record = records + counter##name; \
+  close_timed_block(&timed_block_##name);
 
 #else
 #define TIMED_FUNCTION()
@@ -95,35 +201,43 @@ close_timed_block(TimedBlock *timed_block)
 #define TIMED_BLOCK_END(name)
 #endif
 
-#if 0
-struct DebugBlockStaticInfo
+// NOTE(Ryan): Statistics are taken over the most recent snapshot_window frames,
+// so a spike remains visible in the percentiles until it scrolls out of the window
+#define DEBUG_SNAPSHOT_MAX_COUNT 128
+#define MAX_DEBUG_COUNTER_COUNT 64
+
+typedef struct DebugCounterSnapshot
 {
-  const char *file_name;
-  const char *block_name;
-  u32 line_number;
-};
-extern DebugBlockStaticInfo global_debug_block_static_infos[];
+  u64 cycle_count;
+  u32 hit_count;
+} DebugCounterSnapshot;
 
-enum DEBUG_EVENT_TYPE
+typedef struct DebugCounterState
 {
-  DEBUG_EVENT_BEGIN_BLOCK,
-  DEBUG_EVENT_END_BLOCK,
-  DEBUG_EVENT_FRAME_MARKER,
-};
-struct DebugEvent
+  DebugBlockStaticInfo *static_info;
+
+  DebugCounterSnapshot snapshots[DEBUG_SNAPSHOT_MAX_COUNT];
+} DebugCounterState;
+
+typedef struct DebugStatistic
 {
-  u64 clock;
-  u16 static_info_index;
-  DEBUG_EVENT_TYPE type;
-};
-struct DebugEventTable
+  u32 count;
+  r64 min, max;
+  r64 mean, std_dev;
+  r64 p50, p95, p99;
+} DebugStatistic;
+
+typedef struct DebugState
 {
-  DebugEvent per_frame_events[][];
-  u32 per_frame_event_index;
-  u32 per_frame_event_count[];
-  u32 frame_index;
-};
+  u32 snapshot_index;
+  u32 snapshot_count;
+  u32 snapshot_window;
 
+  u32 counter_count;
+  DebugCounterState counter_states[MAX_DEBUG_COUNTER_COUNT];
+} DebugState;
+
+#if 0
 // TODO(Ryan): Look in handmade_platform.h (day183) for macro definitions
 
 // TIMED_FUNCTION() instead so don't have to provide name
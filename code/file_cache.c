@@ -0,0 +1,437 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "file_cache.h"
+
+// NOTE(Ryan): Small files are kept as complete responses, so a hit is a single write
+// with no syscalls beforehand. Each cached file has an inotify watch, and the first event
+// for it drops the entry, so the next request reads the new version.
+
+INTERNAL u32
+hash_file_path(const char *path)
+{
+  // NOTE(Ryan): FNV-1a
+  u32 result = 2166136261u;
+  for (const char *at = path;
+       *at != '\0';
+       ++at)
+  {
+    result = (result ^ (u8)*at) * 16777619u;
+  }
+  return result;
+}
+
+// NOTE(Ryan): Maps a request path onto a path relative to the root,
+// refusing anything that could step outside of it
+INTERNAL b32
+file_path_from_request(HTTPSlice request_path, char *file_path, u32 file_path_size)
+{
+  if (request_path.size == 0 || request_path.str[0] != '/' ||
+      request_path.size + sizeof("index.html") > file_path_size)
+  {
+    return false;
+  }
+
+  u32 segment_start = 1;
+  for (u32 ch_i = 1;
+       ch_i <= request_path.size;
+       ++ch_i)
+  {
+    if (ch_i == request_path.size || request_path.str[ch_i] == '/')
+    {
+      u32 segment_len = ch_i - segment_start;
+      if (segment_len == 2 && memcmp(request_path.str + segment_start, "..", 2) == 0)
+      {
+        return false;
+      }
+      segment_start = ch_i + 1;
+    }
+    else if (request_path.str[ch_i] < ' ' || request_path.str[ch_i] == '\\')
+    {
+      return false;
+    }
+  }
+
+  u32 file_path_len = request_path.size - 1;
+  memcpy(file_path, request_path.str + 1, file_path_len);
+  if (file_path_len == 0 || file_path[file_path_len - 1] == '/')
+  {
+    memcpy(file_path + file_path_len, "index.html", sizeof("index.html") - 1);
+    file_path_len += sizeof("index.html") - 1;
+  }
+  file_path[file_path_len] = '\0';
+
+  return true;
+}
+
+INTERNAL const char *
+content_type_for_path(const char *path)
+{
+  LOCAL_PERSIST const char *content_types[][2] = {
+    {".html", "text/html; charset=UTF-8"},
+    {".css", "text/css; charset=UTF-8"},
+    {".js", "text/javascript; charset=UTF-8"},
+    {".json", "application/json"},
+    {".txt", "text/plain; charset=UTF-8"},
+    {".svg", "image/svg+xml"},
+    {".png", "image/png"},
+    {".jpg", "image/jpeg"},
+    {".jpeg", "image/jpeg"},
+    {".ico", "image/x-icon"},
+    {".wasm", "application/wasm"},
+  };
+
+  const char *result = "application/octet-stream";
+
+  const char *extension = strrchr(path, '.');
+  if (extension != NULL && strchr(extension, '/') == NULL)
+  {
+    for (u32 content_type_i = 0;
+         content_type_i < sizeof(content_types) / sizeof(content_types[0]);
+         ++content_type_i)
+    {
+      if (strcasecmp(extension, content_types[content_type_i][0]) == 0)
+      {
+        result = content_types[content_type_i][1];
+        break;
+      }
+    }
+  }
+
+  return result;
+}
+
+INTERNAL void
+file_validators_from_stat(FileValidators *validators, struct stat *file_stat)
+{
+  u64 modified_ns = (u64)file_stat->st_mtim.tv_sec * 1000000000ULL +
+                    (u64)file_stat->st_mtim.tv_nsec;
+  snprintf(validators->etag, sizeof(validators->etag), "\"%lx-%lx-%lx\"",
+           (u64)file_stat->st_ino, (u64)file_stat->st_size, modified_ns);
+
+  struct tm modified_tm = {0};
+  gmtime_r(&file_stat->st_mtim.tv_sec, &modified_tm);
+  strftime(validators->last_modified, sizeof(validators->last_modified),
+           "%a, %d %b %Y %H:%M:%S GMT", &modified_tm);
+
+  snprintf(validators->headers, sizeof(validators->headers),
+           "ETag: %s\r\nLast-Modified: %s\r\n", validators->etag, validators->last_modified);
+}
+
+// NOTE(Ryan): If-None-Match takes precedence when present. If-Modified-Since is only
+// compared for equality, as browsers echo back the Last-Modified they were given
+INTERNAL b32
+is_file_not_modified(HTTPRequest *request, FileValidators *validators)
+{
+  b32 result = false;
+
+  HTTPSlice if_none_match = http_find_header(request, "If-None-Match");
+  if (if_none_match.str != NULL)
+  {
+    u8 *at = if_none_match.str;
+    u8 *end = if_none_match.str + if_none_match.size;
+    while (at < end && !result)
+    {
+      consume_whitespace(&at, end);
+      HTTPSlice etag = {at, 0};
+      while (at < end && at[0] != ',')
+      {
+        at++;
+      }
+      etag.size = (u32)(at - etag.str);
+      while (etag.size > 0 && (etag.str[etag.size - 1] == ' ' || etag.str[etag.size - 1] == '\t'))
+      {
+        etag.size--;
+      }
+      // NOTE(Ryan): Weak comparison, so a weak validator from a proxy still matches
+      if (etag.size >= 2 && etag.str[0] == 'W' && etag.str[1] == '/')
+      {
+        etag.str += 2;
+        etag.size -= 2;
+      }
+
+      result = http_slice_equals(etag, "*") || http_slice_equals(etag, validators->etag);
+      at++;
+    }
+  }
+  else
+  {
+    HTTPSlice if_modified_since = http_find_header(request, "If-Modified-Since");
+    result = http_slice_equals(if_modified_since, validators->last_modified);
+  }
+
+  return result;
+}
+
+INTERNAL void
+file_cache_init(FileCache *cache, int root_fd)
+{
+  cache->root_fd = root_fd;
+  cache->watch_fd = -1;
+  for (u32 entry_i = 0;
+       entry_i < FILE_CACHE_ENTRY_COUNT;
+       ++entry_i)
+  {
+    cache->entries[entry_i].watch_descriptor = -1;
+  }
+
+  if (root_fd >= 0)
+  {
+    cache->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  }
+}
+
+INTERNAL void
+file_cache_release(CachedFile *file)
+{
+  if (file != NULL && --file->ref_count == 0)
+  {
+    for (u32 is_keep_alive = 0;
+         is_keep_alive < 2;
+         ++is_keep_alive)
+    {
+      for (u32 encoding_i = 0;
+           encoding_i < CONTENT_ENCODING_COUNT;
+           ++encoding_i)
+      {
+        free(file->responses[is_keep_alive][encoding_i].data);
+        free(file->not_modified_responses[is_keep_alive][encoding_i].data);
+      }
+    }
+    free(file);
+  }
+}
+
+INTERNAL void
+file_cache_evict(FileCacheEntry *entry)
+{
+  file_cache_release(entry->file);
+
+  FileCacheEntry zero_entry = {0};
+  *entry = zero_entry;
+  entry->watch_descriptor = -1;
+}
+
+INTERNAL CachedFile *
+file_cache_find(FileCache *cache, const char *path)
+{
+  CachedFile *result = NULL;
+
+  u32 path_hash = hash_file_path(path);
+  for (u32 entry_i = 0;
+       entry_i < FILE_CACHE_ENTRY_COUNT;
+       ++entry_i)
+  {
+    FileCacheEntry *entry = cache->entries + entry_i;
+    if (entry->file != NULL && entry->path_hash == path_hash && strcmp(entry->path, path) == 0)
+    {
+      entry->last_used = ++cache->use_counter;
+      result = entry->file;
+      break;
+    }
+  }
+
+  if (result != NULL)
+  {
+    cache->hit_count++;
+  }
+  else
+  {
+    cache->miss_count++;
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): fd is an open regular file no larger than MAX_CACHED_FILE_SIZE.
+// Returns NULL if it could not be cached, leaving the caller to send it from fd
+INTERNAL CachedFile *
+file_cache_load(FileCache *cache, const char *path, int fd, struct stat *file_stat)
+{
+  if (cache->watch_fd < 0 || file_stat->st_size < 0 ||
+      (u64)file_stat->st_size > MAX_CACHED_FILE_SIZE)
+  {
+    return NULL;
+  }
+
+  // NOTE(Ryan): Watched before reading, so a write racing the read still invalidates.
+  // Going through /proc watches exactly the file that was opened
+  char fd_path[64] = {0};
+  snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fd);
+  int watch_descriptor = inotify_add_watch(cache->watch_fd, fd_path,
+                                           IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+                                           IN_DELETE_SELF | IN_MOVE_SELF);
+  if (watch_descriptor < 0)
+  {
+    return NULL;
+  }
+
+  u32 file_size = (u32)file_stat->st_size;
+  u8 *body = malloc(file_size + 1);
+  CachedFile *result = calloc(1, sizeof(CachedFile));
+  if (body == NULL || result == NULL)
+  {
+    free(body);
+    free(result);
+    return NULL;
+  }
+
+  u32 bytes_read = 0;
+  while (bytes_read < file_size)
+  {
+    ssize_t read_result = pread(fd, body + bytes_read, file_size - bytes_read, bytes_read);
+    if (read_result > 0)
+    {
+      bytes_read += (u32)read_result;
+    }
+    else if (read_result == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  b32 is_built = (bytes_read == file_size);
+  if (is_built)
+  {
+    file_validators_from_stat(&result->validators, file_stat);
+    const char *content_type = content_type_for_path(path);
+    b32 is_compressible = is_compressible_content_type(content_type);
+    for (u32 encoding_i = 0;
+         is_built && encoding_i < CONTENT_ENCODING_COUNT;
+         ++encoding_i)
+    {
+      u8 *encoded_body = body;
+      u32 encoded_size = file_size;
+      char headers[sizeof(result->validators.headers) + CONTENT_ENCODING_HEADERS_SIZE] = {0};
+      if (encoding_i == CONTENT_ENCODING_IDENTITY)
+      {
+        snprintf(headers, sizeof(headers), "%s%s", result->validators.headers,
+                 is_compressible ? "Vary: Accept-Encoding\r\n" : "");
+      }
+      else if (is_compressible &&
+               compress_once((CONTENT_ENCODING)encoding_i, body, file_size,
+                             &encoded_body, &encoded_size))
+      {
+        // NOTE(Ryan): Weak, as the bytes differ from the file's, though it is the same version.
+        // is_file_not_modified() compares weakly, so any variant's tag revalidates
+        snprintf(headers, sizeof(headers), 
+                 "ETag: W/%s\r\nLast-Modified: %s\r\n"
+                 "Content-Encoding: %s\r\nVary: Accept-Encoding\r\n",
+                 result->validators.etag, result->validators.last_modified,
+                 global_content_encoding_names[encoding_i]);
+      }
+      else
+      {
+        continue;
+      }
+
+      for (u32 is_keep_alive = 0;
+           is_keep_alive < 2;
+           ++is_keep_alive)
+      {
+        HTTPResponse *response = &result->responses[is_keep_alive][encoding_i];
+        HTTPResponse *not_modified_response = 
+          &result->not_modified_responses[is_keep_alive][encoding_i];
+        *response = http_build_response("200 OK", headers, content_type, encoded_body, 
+                                        encoded_size, is_keep_alive);
+        *not_modified_response = http_build_response("304 Not Modified", headers, NULL, NULL, 0,
+                                                     is_keep_alive);
+        is_built = is_built && (response->data != NULL) && (not_modified_response->data != NULL);
+      }
+
+      if (encoded_body != body)
+      {
+        free(encoded_body);
+      }
+    }
+  }
+  free(body);
+
+  result->ref_count = 1;
+  if (!is_built)
+  {
+    file_cache_release(result);
+    return NULL;
+  }
+
+  FileCacheEntry *victim = cache->entries;
+  for (u32 entry_i = 0;
+       entry_i < FILE_CACHE_ENTRY_COUNT;
+       ++entry_i)
+  {
+    FileCacheEntry *entry = cache->entries + entry_i;
+    if (entry->file == NULL)
+    {
+      victim = entry;
+      break;
+    }
+    if (entry->last_used < victim->last_used)
+    {
+      victim = entry;
+    }
+  }
+  // NOTE(Ryan): The watch is left in place, as another entry may be the same file
+  file_cache_evict(victim);
+
+  strcpy(victim->path, path);
+  victim->path_hash = hash_file_path(path);
+  victim->watch_descriptor = watch_descriptor;
+  victim->last_used = ++cache->use_counter;
+  victim->file = result;
+
+  return result;
+}
+
+// NOTE(Ryan): Call once watch_fd is readable
+INTERNAL void
+file_cache_handle_events(FileCache *cache)
+{
+  u8 event_buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  while (true)
+  {
+    ssize_t bytes_read = read(cache->watch_fd, event_buf, sizeof(event_buf));
+    if (bytes_read <= 0)
+    {
+      if (bytes_read == -1 && errno == EINTR)
+      {
+        continue;
+      }
+      break;
+    }
+
+    for (u8 *at = event_buf;
+         at < event_buf + bytes_read;
+         at += sizeof(struct inotify_event) + ((struct inotify_event *)at)->len)
+    {
+      struct inotify_event *event = (struct inotify_event *)at;
+
+      for (u32 entry_i = 0;
+           entry_i < FILE_CACHE_ENTRY_COUNT;
+           ++entry_i)
+      {
+        FileCacheEntry *entry = cache->entries + entry_i;
+        if (entry->file != NULL && entry->watch_descriptor == event->wd)
+        {
+          file_cache_evict(entry);
+          cache->invalidation_count++;
+        }
+      }
+
+      // NOTE(Ryan): Also clears out watches left behind by evicted entries
+      if (!(event->mask & IN_IGNORED))
+      {
+        inotify_rm_watch(cache->watch_fd, event->wd);
+      }
+    }
+  }
+}
@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#pragma once
+
+#define FILE_CACHE_ENTRY_COUNT 64
+#define MAX_CACHED_FILE_SIZE KILOBYTES(64)
+#define MAX_FILE_PATH_SIZE 256
+#define FILE_ETAG_SIZE 64
+#define HTTP_DATE_SIZE 32
+
+// NOTE(Ryan): What a client echoes back to ask whether its copy is still current
+typedef struct FileValidators
+{
+  char etag[FILE_ETAG_SIZE];
+  char last_modified[HTTP_DATE_SIZE];
+  // NOTE(Ryan): Both as response header lines, ready to be pasted in
+  char headers[FILE_ETAG_SIZE + HTTP_DATE_SIZE + 32];
+} FileValidators;
+
+// NOTE(Ryan): Complete responses for one version of a small file, indexed by is_keep_alive
+// then CONTENT_ENCODING. Compressed variants are only made for text, and left empty otherwise.
+// Reference counted, as a connection may still be sending it after it is invalidated
+typedef struct CachedFile
+{
+  u32 ref_count;
+  FileValidators validators;
+  HTTPResponse responses[2][CONTENT_ENCODING_COUNT];
+  HTTPResponse not_modified_responses[2][CONTENT_ENCODING_COUNT];
+} CachedFile;
+
+typedef struct FileCacheEntry
+{
+  char path[MAX_FILE_PATH_SIZE];
+  u32 path_hash;
+  int watch_descriptor;
+  u64 last_used;
+  CachedFile *file;
+} FileCacheEntry;
+
+// NOTE(Ryan): One per worker, each with its own inotify instance,
+// so entries are only ever touched by one thread
+typedef struct FileCache
+{
+  int root_fd;
+  int watch_fd;
+  u64 use_counter;
+  FileCacheEntry entries[FILE_CACHE_ENTRY_COUNT];
+
+  u64 hit_count;
+  u64 miss_count;
+  u64 invalidation_count;
+} FileCache;
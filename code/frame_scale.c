@@ -0,0 +1,307 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+
+#include "jpeg_encoder.h"
+
+// NOTE(Ryan): Halves raw YUYV or NV12 frames for the smaller streams of the capture ladder.
+// Every output sample is the rounded mean of the 2x2 it covers, chroma included, so the
+// result is the same format and halving again stays centred. The SSE2 and NEON versions
+// do the same integer sums as the scalar one, so give the same bytes.
+// The level is the encoder's, picked by jpeg_init_simd()
+
+// NOTE(Ryan): A row of one byte per sample, e.g. NV12 luma
+INTERNAL void
+frame_halve_plane_row_scalar(const u8 *first_row, const u8 *second_row, u8 *out,
+                             u32 out_start, u32 out_size)
+{
+  for (u32 out_i = out_start;
+       out_i < out_size;
+       ++out_i)
+  {
+    u32 sum = first_row[out_i * 2] + first_row[out_i * 2 + 1] +
+              second_row[out_i * 2] + second_row[out_i * 2 + 1];
+    out[out_i] = (u8)((sum + 2) >> 2);
+  }
+}
+
+// NOTE(Ryan): A row of Cb Cr pairs, i.e. NV12 chroma
+INTERNAL void
+frame_halve_pair_row_scalar(const u8 *first_row, const u8 *second_row, u8 *out,
+                            u32 out_start, u32 out_size)
+{
+  for (u32 out_i = out_start;
+       out_i < out_size;
+       ++out_i)
+  {
+    u32 in_i = (out_i / 2) * 4 + (out_i % 2);
+    u32 sum = first_row[in_i] + first_row[in_i + 2] + second_row[in_i] + second_row[in_i + 2];
+    out[out_i] = (u8)((sum + 2) >> 2);
+  }
+}
+
+// NOTE(Ryan): Y0 Cb Y1 Cr from the 4 pixels Y0 Cb Y1 Cr Y2 Cb Y3 Cr, luma pairs and
+// chroma pairs averaged
+INTERNAL void
+frame_halve_yuyv_row_scalar(const u8 *first_row, const u8 *second_row, u8 *out,
+                            u32 out_start, u32 out_size)
+{
+  LOCAL_PERSIST const u8 first_offsets[4] = {0, 1, 4, 3};
+  LOCAL_PERSIST const u8 second_offsets[4] = {2, 5, 6, 7};
+  for (u32 out_i = out_start;
+       out_i < out_size;
+       ++out_i)
+  {
+    u32 group = (out_i / 4) * 8;
+    u32 first_i = group + first_offsets[out_i % 4];
+    u32 second_i = group + second_offsets[out_i % 4];
+    u32 sum = first_row[first_i] + first_row[second_i] +
+              second_row[first_i] + second_row[second_i];
+    out[out_i] = (u8)((sum + 2) >> 2);
+  }
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// NOTE(Ryan): Each takes 16 bytes of both rows and gives 8 output samples as words, rounded
+
+INTERNAL __m128i
+frame_halve_plane_sse2(__m128i first, __m128i second)
+{
+  __m128i low_mask = _mm_set1_epi16(0x00ff);
+  __m128i sums = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(first, low_mask),
+                                             _mm_srli_epi16(first, 8)),
+                               _mm_add_epi16(_mm_and_si128(second, low_mask),
+                                             _mm_srli_epi16(second, 8)));
+  return _mm_srli_epi16(_mm_add_epi16(sums, _mm_set1_epi16(2)), 2);
+}
+
+INTERNAL __m128i
+frame_halve_pairs_sse2(__m128i first, __m128i second)
+{
+  __m128i low_mask = _mm_set1_epi16(0x00ff);
+  __m128i ones = _mm_set1_epi16(1);
+  __m128i cb = _mm_add_epi16(_mm_and_si128(first, low_mask), _mm_and_si128(second, low_mask));
+  __m128i cr = _mm_add_epi16(_mm_srli_epi16(first, 8), _mm_srli_epi16(second, 8));
+  // NOTE(Ryan): Neighbouring pairs summed into 32 bit lanes, then Cr moved to the high word
+  __m128i sums = _mm_or_si128(_mm_madd_epi16(cb, ones),
+                              _mm_slli_epi32(_mm_madd_epi16(cr, ones), 16));
+  return _mm_srli_epi16(_mm_add_epi16(sums, _mm_set1_epi16(2)), 2);
+}
+
+INTERNAL __m128i
+frame_halve_yuyv_sse2(__m128i first, __m128i second)
+{
+  __m128i low_mask = _mm_set1_epi16(0x00ff);
+  __m128i luma = _mm_add_epi16(_mm_and_si128(first, low_mask), _mm_and_si128(second, low_mask));
+  __m128i chroma = _mm_add_epi16(_mm_srli_epi16(first, 8), _mm_srli_epi16(second, 8));
+  // NOTE(Ryan): Luma pairs into 32 bit lanes and narrowed again.
+  // Chroma is a Cb Cr pair every 32 bits, so the neighbouring pair is the next lane
+  luma = _mm_madd_epi16(luma, _mm_set1_epi16(1));
+  luma = _mm_packs_epi32(luma, luma);
+  chroma = _mm_add_epi16(_mm_shuffle_epi32(chroma, _MM_SHUFFLE(2, 0, 2, 0)),
+                         _mm_shuffle_epi32(chroma, _MM_SHUFFLE(3, 1, 3, 1)));
+  __m128i sums = _mm_unpacklo_epi16(luma, chroma);
+  return _mm_srli_epi16(_mm_add_epi16(sums, _mm_set1_epi16(2)), 2);
+}
+
+// NOTE(Ryan): Returns how many output bytes were written, a multiple of 16
+INTERNAL u32
+frame_halve_row_sse2(PIXEL_FORMAT format, b32 is_chroma, const u8 *first_row,
+                     const u8 *second_row, u8 *out, u32 out_size)
+{
+  u32 out_i = 0;
+  for (;
+       out_i + 16 <= out_size;
+       out_i += 16)
+  {
+    __m128i first_low = _mm_loadu_si128((const __m128i *)(first_row + out_i * 2));
+    __m128i first_high = _mm_loadu_si128((const __m128i *)(first_row + out_i * 2 + 16));
+    __m128i second_low = _mm_loadu_si128((const __m128i *)(second_row + out_i * 2));
+    __m128i second_high = _mm_loadu_si128((const __m128i *)(second_row + out_i * 2 + 16));
+    __m128i low, high;
+    if (format == PIXEL_FORMAT_YUYV)
+    {
+      low = frame_halve_yuyv_sse2(first_low, second_low);
+      high = frame_halve_yuyv_sse2(first_high, second_high);
+    }
+    else if (is_chroma)
+    {
+      low = frame_halve_pairs_sse2(first_low, second_low);
+      high = frame_halve_pairs_sse2(first_high, second_high);
+    }
+    else
+    {
+      low = frame_halve_plane_sse2(first_low, second_low);
+      high = frame_halve_plane_sse2(first_high, second_high);
+    }
+    _mm_storeu_si128((__m128i *)(out + out_i), _mm_packus_epi16(low, high));
+  }
+
+  return out_i;
+}
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+
+// NOTE(Ryan): The structure loads split the samples by kind, so pairwise adds do the rest.
+// Returns how many output bytes were written
+INTERNAL u32
+frame_halve_row_neon(PIXEL_FORMAT format, b32 is_chroma, const u8 *first_row,
+                     const u8 *second_row, u8 *out, u32 out_size)
+{
+  u32 out_i = 0;
+  if (format == PIXEL_FORMAT_YUYV)
+  {
+    for (;
+         out_i + 32 <= out_size;
+         out_i += 32)
+    {
+      // NOTE(Ryan): Y0, Cb, Y1 and Cr of 16 pixel pairs
+      uint8x16x4_t first = vld4q_u8(first_row + out_i * 2);
+      uint8x16x4_t second = vld4q_u8(second_row + out_i * 2);
+      uint16x8_t luma_low = vaddq_u16(vaddl_u8(vget_low_u8(first.val[0]),
+                                               vget_low_u8(first.val[2])),
+                                      vaddl_u8(vget_low_u8(second.val[0]),
+                                               vget_low_u8(second.val[2])));
+      uint16x8_t luma_high = vaddq_u16(vaddl_u8(vget_high_u8(first.val[0]),
+                                                vget_high_u8(first.val[2])),
+                                       vaddl_u8(vget_high_u8(second.val[0]),
+                                                vget_high_u8(second.val[2])));
+      uint16x8x2_t luma = vuzpq_u16(luma_low, luma_high);
+      uint16x8_t cb = vpadalq_u8(vpaddlq_u8(first.val[1]), second.val[1]);
+      uint16x8_t cr = vpadalq_u8(vpaddlq_u8(first.val[3]), second.val[3]);
+      uint8x8x4_t result = {{
+        vrshrn_n_u16(luma.val[0], 2), vrshrn_n_u16(cb, 2),
+        vrshrn_n_u16(luma.val[1], 2), vrshrn_n_u16(cr, 2)
+      }};
+      vst4_u8(out + out_i, result);
+    }
+  }
+  else if (is_chroma)
+  {
+    for (;
+         out_i + 16 <= out_size;
+         out_i += 16)
+    {
+      uint8x16x2_t first = vld2q_u8(first_row + out_i * 2);
+      uint8x16x2_t second = vld2q_u8(second_row + out_i * 2);
+      uint16x8_t cb = vpadalq_u8(vpaddlq_u8(first.val[0]), second.val[0]);
+      uint16x8_t cr = vpadalq_u8(vpaddlq_u8(first.val[1]), second.val[1]);
+      uint8x8x2_t result = {{vrshrn_n_u16(cb, 2), vrshrn_n_u16(cr, 2)}};
+      vst2_u8(out + out_i, result);
+    }
+  }
+  else
+  {
+    for (;
+         out_i + 16 <= out_size;
+         out_i += 16)
+    {
+      uint16x8_t low = vpadalq_u8(vpaddlq_u8(vld1q_u8(first_row + out_i * 2)),
+                                  vld1q_u8(second_row + out_i * 2));
+      uint16x8_t high = vpadalq_u8(vpaddlq_u8(vld1q_u8(first_row + out_i * 2 + 16)),
+                                   vld1q_u8(second_row + out_i * 2 + 16));
+      vst1q_u8(out + out_i, vcombine_u8(vrshrn_n_u16(low, 2), vrshrn_n_u16(high, 2)));
+    }
+  }
+
+  return out_i;
+}
+#endif
+
+// NOTE(Ryan): out_size is the output row in bytes, reading twice that from each row
+INTERNAL void
+frame_halve_row(PIXEL_FORMAT format, b32 is_chroma, const u8 *first_row, const u8 *second_row,
+                u8 *out, u32 out_size)
+{
+  u32 out_i = 0;
+#if defined(__x86_64__)
+  if (global_jpeg_simd_level >= JPEG_SIMD_LEVEL_SSE2)
+  {
+    // NOTE(Ryan): Bound by memory, so AVX2 would gain little here
+    out_i = frame_halve_row_sse2(format, is_chroma, first_row, second_row, out, out_size);
+  }
+#elif defined(__aarch64__)
+  if (global_jpeg_simd_level == JPEG_SIMD_LEVEL_NEON)
+  {
+    out_i = frame_halve_row_neon(format, is_chroma, first_row, second_row, out, out_size);
+  }
+#endif
+
+  if (format == PIXEL_FORMAT_YUYV)
+  {
+    frame_halve_yuyv_row_scalar(first_row, second_row, out, out_i, out_size);
+  }
+  else if (is_chroma)
+  {
+    frame_halve_pair_row_scalar(first_row, second_row, out, out_i, out_size);
+  }
+  else
+  {
+    frame_halve_plane_row_scalar(first_row, second_row, out, out_i, out_size);
+  }
+}
+
+// NOTE(Ryan): Whether a width x height frame can be halved into whole pixel pairs
+// and, for NV12, whole chroma rows
+INTERNAL b32
+frame_can_halve(PIXEL_FORMAT format, u32 width, u32 height)
+{
+  b32 result = false;
+
+  switch (format)
+  {
+    case PIXEL_FORMAT_YUYV:
+    {
+      result = (width % 4 == 0 && height % 2 == 0 && width >= 4 && height >= 2);
+    } break;
+    case PIXEL_FORMAT_NV12:
+    {
+      result = (width % 4 == 0 && height % 4 == 0 && width >= 4 && height >= 4);
+    } break;
+    default:
+    {
+    } break;
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Returns the bytes a tightly packed frame of the format and size takes
+INTERNAL u32
+frame_image_size(PIXEL_FORMAT format, u32 width, u32 height)
+{
+  return (format == PIXEL_FORMAT_YUYV) ? width * 2 * height : width * height + width * height / 2;
+}
+
+// NOTE(Ryan): image is width x height with rows stride bytes apart. out is tightly packed,
+// frame_image_size() of half the width and height. Check frame_can_halve() first
+INTERNAL void
+frame_halve(PIXEL_FORMAT format, const u8 *image, u32 width, u32 height, u32 stride, u8 *out)
+{
+  u32 out_height = height / 2;
+  u32 out_row_size = (format == PIXEL_FORMAT_YUYV) ? width : width / 2;
+  for (u32 out_y = 0;
+       out_y < out_height;
+       ++out_y)
+  {
+    const u8 *first_row = image + out_y * 2 * stride;
+    frame_halve_row(format, false, first_row, first_row + stride, out + out_y * out_row_size,
+                    out_row_size);
+  }
+
+  if (format == PIXEL_FORMAT_NV12)
+  {
+    const u8 *chroma_plane = image + stride * height;
+    u8 *out_chroma_plane = out + out_row_size * out_height;
+    for (u32 out_y = 0;
+         out_y < out_height / 2;
+         ++out_y)
+    {
+      const u8 *first_row = chroma_plane + out_y * 2 * stride;
+      frame_halve_row(format, true, first_row, first_row + stride,
+                      out_chroma_plane + out_y * out_row_size, out_row_size);
+    }
+  }
+}
@@ -0,0 +1,1131 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "frame_source.h"
+#include "jpeg_bits.h"
+
+// NOTE(Ryan): A camera, or a stand-in so the streaming path can be exercised and 
+// benchmarked on a machine without one. Each source hands out one frame at a time,
+// which stays valid until released.
+
+INTERNAL void
+camera_queue_buffer(Camera *camera, u32 buffer_index)
+{
+  struct v4l2_buffer camera_capture_buffer = {0};
+  camera_capture_buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  camera_capture_buffer.index = buffer_index;
+  if (camera->memory == CAMERA_MEMORY_USERPTR)
+  {
+    camera_capture_buffer.memory = V4L2_MEMORY_USERPTR;
+    camera_capture_buffer.m.userptr = (unsigned long)camera->buffers[buffer_index].data;
+    camera_capture_buffer.length = camera->buffers[buffer_index].size;
+  }
+  else
+  {
+    camera_capture_buffer.memory = V4L2_MEMORY_MMAP;
+  }
+  int camera_queue_capture_buffer_status = ioctl(camera->fd, VIDIOC_QBUF, 
+                                                 &camera_capture_buffer);
+  if (camera_queue_capture_buffer_status >= 0)
+  {
+    camera->queued_count++;
+  }
+  else
+  {
+    EBP();
+  }
+}
+
+INTERNAL void
+camera_close(Camera *camera)
+{
+  if (camera->fd >= 0)
+  {
+    enum v4l2_buf_type camera_buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ioctl(camera->fd, VIDIOC_STREAMOFF, &camera_buffer_type);
+    for (u32 buffer_i = 0;
+         buffer_i < camera->buffer_count;
+         ++buffer_i)
+    {
+      CameraBuffer *buffer = camera->buffers + buffer_i;
+      if (buffer->dmabuf_fd >= 0)
+      {
+        close(buffer->dmabuf_fd);
+      }
+      munmap(buffer->data, buffer->size);
+    }
+    close(camera->fd);
+  }
+
+  Camera zero_camera = {0};
+  *camera = zero_camera;
+  camera->fd = -1;
+}
+
+// NOTE(Ryan): Returns false if the driver only hands out its own buffers
+INTERNAL b32
+camera_allocate_userptr_buffers(Camera *camera, u32 image_size)
+{
+  b32 result = false;
+
+  struct v4l2_requestbuffers camera_buffer_request = {0};
+  camera_buffer_request.count = CAMERA_BUFFER_COUNT;
+  camera_buffer_request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  camera_buffer_request.memory = V4L2_MEMORY_USERPTR;
+  int camera_buffer_request_status = ioctl(camera->fd, VIDIOC_REQBUFS, &camera_buffer_request);
+  if (camera_buffer_request_status >= 0 && camera_buffer_request.count > 0 && image_size > 0)
+  {
+    u32 buffer_count = camera_buffer_request.count;
+    if (buffer_count > MAX_CAMERA_BUFFER_COUNT)
+    {
+      buffer_count = MAX_CAMERA_BUFFER_COUNT;
+    }
+
+    camera->memory = CAMERA_MEMORY_USERPTR;
+    u32 hugepage_size = MEGABYTES(2);
+    for (u32 buffer_i = 0;
+         buffer_i < buffer_count;
+         ++buffer_i)
+    {
+      u32 size = (image_size + hugepage_size - 1) & ~(hugepage_size - 1);
+      u8 *data = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (data == MAP_FAILED)
+      {
+        // NOTE(Ryan): Page aligned either way, which is all the driver asks for
+        size = (image_size + 4095) & ~4095u;
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      }
+
+      if (data != MAP_FAILED)
+      {
+        camera->buffers[buffer_i].data = data;
+        camera->buffers[buffer_i].size = size;
+        camera->buffers[buffer_i].dmabuf_fd = -1;
+        camera->buffer_count++;
+      }
+      else
+      {
+        EBP();
+        break;
+      }
+    }
+    result = (camera->buffer_count == buffer_count);
+  }
+
+  return result;
+}
+
+INTERNAL b32
+camera_map_mmap_buffers(Camera *camera)
+{
+  b32 result = false;
+
+  struct v4l2_requestbuffers camera_buffer_request = {0};
+  camera_buffer_request.count = CAMERA_BUFFER_COUNT;
+  camera_buffer_request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  camera_buffer_request.memory = V4L2_MEMORY_MMAP;
+  int camera_buffer_request_status = ioctl(camera->fd, VIDIOC_REQBUFS, &camera_buffer_request);
+  if (camera_buffer_request_status >= 0 && camera_buffer_request.count > 0)
+  {
+    u32 buffer_count = camera_buffer_request.count;
+    if (buffer_count > MAX_CAMERA_BUFFER_COUNT)
+    {
+      buffer_count = MAX_CAMERA_BUFFER_COUNT;
+    }
+
+    camera->memory = CAMERA_MEMORY_MMAP;
+    for (u32 buffer_i = 0;
+         buffer_i < buffer_count;
+         ++buffer_i)
+    {
+      struct v4l2_buffer camera_buffer_info = {0};
+      camera_buffer_info.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      camera_buffer_info.memory = V4L2_MEMORY_MMAP;
+      camera_buffer_info.index = buffer_i;
+      int camera_buffer_info_status = ioctl(camera->fd, VIDIOC_QUERYBUF, &camera_buffer_info);
+      if (camera_buffer_info_status >= 0)
+      {
+        u8 *data = mmap(NULL, camera_buffer_info.length, PROT_READ | PROT_WRITE, 
+                        MAP_SHARED, camera->fd, camera_buffer_info.m.offset);
+        if (data != MAP_FAILED)
+        {
+          CameraBuffer *buffer = camera->buffers + buffer_i;
+          buffer->data = data;
+          buffer->size = camera_buffer_info.length;
+          buffer->dmabuf_fd = -1;
+          camera->buffer_count++;
+
+          // NOTE(Ryan): Not every driver can export, which only matters to other devices
+          struct v4l2_exportbuffer camera_export = {0};
+          camera_export.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+          camera_export.index = buffer_i;
+          camera_export.flags = O_RDONLY | O_CLOEXEC;
+          if (ioctl(camera->fd, VIDIOC_EXPBUF, &camera_export) >= 0)
+          {
+            buffer->dmabuf_fd = camera_export.fd;
+            camera->dmabuf_count++;
+          }
+        }
+        else
+        {
+          EBP();
+          break;
+        }
+      }
+      else
+      {
+        EBP();
+        break;
+      }
+    }
+    result = (camera->buffer_count == buffer_count);
+  }
+  else
+  {
+    EBP();
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Captures into buffers we own where the driver allows it, otherwise its own.
+// Every buffer is queued, so the driver can fill the next while we are still using the last.
+// Returns with fd -1 on failure, setting error if errno does not say why
+INTERNAL Camera
+camera_init(const char *camera_path, u32 aperture_width, u32 aperture_height, 
+            PIXEL_FORMAT format, const char **error)
+{
+  Camera result = {0};
+
+  result.fd = open(camera_path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (result.fd >= 0)
+  {
+    LOCAL_PERSIST const u32 camera_pixel_formats[PIXEL_FORMAT_COUNT] = {
+      V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_NV12
+    };
+    struct v4l2_format camera_format = {0};
+    camera_format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    camera_format.fmt.pix.width = aperture_width;
+    camera_format.fmt.pix.height = aperture_height;
+    // NOTE(Ryan): Determine with $(v4l2-ctl --list-formats-ext) 
+    camera_format.fmt.pix.pixelformat = camera_pixel_formats[format];
+    camera_format.fmt.pix.field = V4L2_FIELD_NONE;
+    int camera_format_status = ioctl(result.fd, VIDIOC_S_FMT, &camera_format);
+    // NOTE(Ryan): A driver substitutes a format it has rather than failing
+    b32 has_format = (camera_format_status >= 0 && 
+                      camera_format.fmt.pix.pixelformat == camera_pixel_formats[format]);
+    if (has_format)
+    {
+      result.width = camera_format.fmt.pix.width;
+      result.height = camera_format.fmt.pix.height;
+      result.stride = camera_format.fmt.pix.bytesperline;
+      result.is_video_range = (camera_format.fmt.pix.quantization != 
+                               V4L2_QUANTIZATION_FULL_RANGE);
+
+      b32 has_buffers = camera_allocate_userptr_buffers(&result, camera_format.fmt.pix.sizeimage);
+      if (!has_buffers)
+      {
+        // NOTE(Ryan): Buffers must be released before asking for another kind
+        for (u32 buffer_i = 0;
+             buffer_i < result.buffer_count;
+             ++buffer_i)
+        {
+          munmap(result.buffers[buffer_i].data, result.buffers[buffer_i].size);
+        }
+        result.buffer_count = 0;
+        struct v4l2_requestbuffers camera_buffer_release = {0};
+        camera_buffer_release.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        camera_buffer_release.memory = V4L2_MEMORY_USERPTR;
+        ioctl(result.fd, VIDIOC_REQBUFS, &camera_buffer_release);
+
+        has_buffers = camera_map_mmap_buffers(&result);
+      }
+
+      if (has_buffers)
+      {
+        for (u32 buffer_i = 0;
+             buffer_i < result.buffer_count;
+             ++buffer_i)
+        {
+          camera_queue_buffer(&result, buffer_i);
+        }
+
+        enum v4l2_buf_type camera_buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        int camera_streamon_status = ioctl(result.fd, VIDIOC_STREAMON, &camera_buffer_type);
+        if (camera_streamon_status == -1)
+        {
+          EBP();
+          camera_close(&result);
+        }
+      }
+      else
+      {
+        camera_close(&result);
+      }
+    }
+    else
+    {
+      if (camera_format_status >= 0)
+      {
+        *error = "Camera does not offer the pixel format";
+      }
+      else
+      {
+        EBP();
+      }
+      camera_close(&result);
+    }
+  }
+  else
+  {
+    EBP();
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Call once the camera fd is readable, so this never waits.
+// Drains every filled buffer and keeps only the newest, as anything older is already stale.
+// Returns false if there was nothing to dequeue
+INTERNAL b32
+camera_dequeue_latest(Camera *camera, SourceFrame *frame, u32 *skipped_count)
+{
+  b32 result = false;
+
+  while (true)
+  {
+    struct v4l2_buffer camera_capture_buffer = {0};
+    camera_capture_buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    camera_capture_buffer.memory = (camera->memory == CAMERA_MEMORY_USERPTR) ? 
+                                   V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+    int camera_dequeue_capture_buffer_status = ioctl(camera->fd, VIDIOC_DQBUF, 
+                                                     &camera_capture_buffer);
+    if (camera_dequeue_capture_buffer_status < 0)
+    {
+      if (errno != EAGAIN)
+      {
+        EBP();
+      }
+      break;
+    }
+    camera->queued_count--;
+
+    if (result)
+    {
+      camera_queue_buffer(camera, frame->buffer_index);
+      *skipped_count += 1;
+    }
+
+    result = true;
+    frame->buffer_index = camera_capture_buffer.index;
+    frame->data = camera->buffers[camera_capture_buffer.index].data;
+    frame->size = camera_capture_buffer.bytesused;
+    frame->sequence = camera_capture_buffer.sequence;
+    frame->timestamp_ns = 0;
+    if ((camera_capture_buffer.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == 
+        V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+    {
+      frame->timestamp_ns = (u64)camera_capture_buffer.timestamp.tv_sec * 1000000000ULL + 
+                            (u64)camera_capture_buffer.timestamp.tv_usec * 1000ULL;
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Returns the offset just past the JPEG starting at start, or 0 if it is cut off.
+// Walks the segments rather than searching for an end marker, 
+// as an embedded thumbnail has its own
+INTERNAL u64
+jpeg_find_end(const u8 *data, u64 size, u64 start)
+{
+  u64 at = start + 2;
+  while (at + 2 <= size)
+  {
+    u8 marker = data[at + 1];
+    if (data[at] != 0xff)
+    {
+      break;
+    }
+    else if (marker == 0xff)
+    {
+      // NOTE(Ryan): Fill byte
+      at++;
+    }
+    else if (marker == 0xd9)
+    {
+      return at + 2;
+    }
+    else if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8))
+    {
+      at += 2;
+    }
+    else if (at + 4 <= size)
+    {
+      u32 segment_len = ((u32)data[at + 2] << 8) | data[at + 3];
+      at += 2 + segment_len;
+
+      // NOTE(Ryan): Entropy coded data runs to the next marker that is not a
+      // stuffed 0xff or a restart
+      if (marker == 0xda)
+      {
+        while (at + 1 < size && 
+               !(data[at] == 0xff && data[at + 1] != 0x00 && 
+                 (data[at + 1] < 0xd0 || data[at + 1] > 0xd7)))
+        {
+          at++;
+        }
+      }
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  return 0;
+}
+
+// NOTE(Ryan): The size the JPEG starting at start decodes to, from its start of frame.
+// False if it has none before its scan
+INTERNAL b32
+jpeg_find_frame_size(const u8 *data, u64 size, u64 start, u32 *width, u32 *height)
+{
+  u64 at = start + 2;
+  while (at + 4 <= size && data[at] == 0xff)
+  {
+    u8 marker = data[at + 1];
+    if (marker == 0xff)
+    {
+      at++;
+    }
+    else if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8))
+    {
+      at += 2;
+    }
+    else if (marker == 0xda || marker == 0xd9)
+    {
+      break;
+    }
+    else if (marker >= 0xc0 && marker <= 0xcf &&
+             marker != 0xc4 && marker != 0xc8 && marker != 0xcc)
+    {
+      // NOTE(Ryan): Length, precision, then height before width
+      if (at + 9 <= size)
+      {
+        *height = ((u32)data[at + 5] << 8) | data[at + 6];
+        *width = ((u32)data[at + 7] << 8) | data[at + 8];
+        return (*width > 0 && *height > 0);
+      }
+      break;
+    }
+    else
+    {
+      u32 segment_len = ((u32)data[at + 2] << 8) | data[at + 3];
+      at += 2 + segment_len;
+    }
+  }
+
+  return false;
+}
+
+INTERNAL void
+frame_replay_close(FrameReplay *replay)
+{
+  if (replay->data != NULL)
+  {
+    munmap(replay->data, replay->size);
+  }
+  free(replay->frames);
+
+  FrameReplay zero_replay = {0};
+  *replay = zero_replay;
+}
+
+// NOTE(Ryan): Maps the whole file and indexes every JPEG in it up front.
+// Sets error on failure if errno does not say why
+INTERNAL b32
+frame_replay_open(FrameReplay *replay, const char *path, const char **error)
+{
+  b32 result = false;
+
+  int file_fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (file_fd != -1)
+  {
+    struct stat file_stat = {0};
+    if (fstat(file_fd, &file_stat) == 0 && file_stat.st_size > 0)
+    {
+      replay->size = (u64)file_stat.st_size;
+      replay->data = mmap(NULL, replay->size, PROT_READ, MAP_PRIVATE, file_fd, 0);
+      if (replay->data != MAP_FAILED)
+      {
+        u32 frame_capacity = 0;
+        u64 at = 0;
+        while (at + 3 <= replay->size)
+        {
+          if (replay->data[at] == 0xff && replay->data[at + 1] == 0xd8 && 
+              replay->data[at + 2] == 0xff)
+          {
+            u64 end = jpeg_find_end(replay->data, replay->size, at);
+            if (end == 0 || end - at > 0xffffffff)
+            {
+              break;
+            }
+
+            if (replay->frame_count == frame_capacity)
+            {
+              frame_capacity = (frame_capacity == 0) ? 64 : frame_capacity * 2;
+              ReplayFrame *frames = realloc(replay->frames, frame_capacity * sizeof(ReplayFrame));
+              if (frames == NULL)
+              {
+                EBP();
+                break;
+              }
+              replay->frames = frames;
+            }
+            replay->frames[replay->frame_count].offset = at;
+            replay->frames[replay->frame_count].size = (u32)(end - at);
+            replay->frame_count++;
+            at = end;
+          }
+          else
+          {
+            at++;
+          }
+        }
+
+        if (replay->frame_count > 0)
+        {
+          result = true;
+        }
+        else
+        {
+          *error = "No JPEG frames in replay file";
+        }
+      }
+      else
+      {
+        replay->data = NULL;
+        EBP();
+      }
+    }
+    else
+    {
+      EBP();
+    }
+    close(file_fd);
+  }
+  else
+  {
+    EBP();
+  }
+
+  if (!result)
+  {
+    frame_replay_close(replay);
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Colour bars, a block moving 2 blocks a frame, and the sequence along the bottom
+// in binary, most significant bit first and white for a set bit. Every 8x8 block is one colour
+INTERNAL void
+synthetic_block_colour(u32 block_x, u32 block_y, u32 blocks_x, u32 blocks_y, u32 sequence,
+                       s32 *rgb)
+{
+  LOCAL_PERSIST const u8 bar_colours[8][3] = {
+    {192, 192, 192}, {192, 192, 0}, {0, 192, 192}, {0, 192, 0},
+    {192, 0, 192}, {192, 0, 0}, {0, 0, 192}, {16, 16, 16}
+  };
+
+  u32 box_size = (blocks_y / 4 > 0) ? blocks_y / 4 : 1;
+  u32 box_x = (sequence * 2) % blocks_x;
+  u32 box_y = blocks_y / 3;
+  u32 bit_width = (blocks_x / 32 > 0) ? blocks_x / 32 : 1;
+  if (block_y == blocks_y - 1)
+  {
+    u32 bit_i = block_x / bit_width;
+    b32 is_set = (bit_i < 32) && ((sequence >> (31 - bit_i)) & 1);
+    rgb[0] = rgb[1] = rgb[2] = is_set ? 255 : 0;
+  }
+  else if (block_x - box_x < box_size && block_y - box_y < box_size)
+  {
+    rgb[0] = rgb[1] = rgb[2] = 128;
+  }
+  else
+  {
+    const u8 *bar_colour = bar_colours[block_x * 8 / blocks_x];
+    rgb[0] = bar_colour[0];
+    rgb[1] = bar_colour[1];
+    rgb[2] = bar_colour[2];
+  }
+}
+
+// NOTE(Ryan): As only DC coefficients need coding, the whole frame is a few bits a block. 
+// That keeps the pattern cheap at any size without the encoder. Returns the size written
+INTERNAL u32
+synthetic_render(u8 *buffer, u32 width, u32 height, u32 sequence)
+{
+  // NOTE(Ryan): Annex K luminance DC table, and an AC table holding only end of block.
+  // The codes are the canonical ones those lengths give
+  LOCAL_PERSIST const u8 dc_lengths[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+  LOCAL_PERSIST const u16 dc_codes[12] = {
+    0x000, 0x002, 0x003, 0x004, 0x005, 0x006, 0x00e, 0x01e, 0x03e, 0x07e, 0x0fe, 0x1fe
+  };
+  LOCAL_PERSIST const u8 dc_code_lens[12] = {2, 3, 3, 3, 3, 3, 4, 5, 6, 7, 8, 9};
+
+  u32 blocks_x = (width + 7) / 8;
+  u32 blocks_y = (height + 7) / 8;
+
+  u8 *at = buffer;
+  *at++ = 0xff; *at++ = 0xd8;
+
+  // NOTE(Ryan): A quantiser of 8 makes a flat block's DC its level less 128
+  *at++ = 0xff; *at++ = 0xdb;
+  at = jpeg_put_u16(at, 67);
+  *at++ = 0x00;
+  memset(at, 8, 64);
+  at += 64;
+
+  *at++ = 0xff; *at++ = 0xc0;
+  at = jpeg_put_u16(at, 17);
+  *at++ = 8;
+  at = jpeg_put_u16(at, height);
+  at = jpeg_put_u16(at, width);
+  *at++ = 3;
+  for (u32 component_i = 1;
+       component_i <= 3;
+       ++component_i)
+  {
+    *at++ = (u8)component_i; *at++ = 0x11; *at++ = 0x00;
+  }
+
+  *at++ = 0xff; *at++ = 0xc4;
+  at = jpeg_put_u16(at, 2 + 17 + 12 + 17 + 1);
+  *at++ = 0x00;
+  memcpy(at, dc_lengths, 16);
+  at += 16;
+  for (u32 symbol_i = 0;
+       symbol_i < 12;
+       ++symbol_i)
+  {
+    *at++ = (u8)symbol_i;
+  }
+  *at++ = 0x10;
+  memset(at, 0, 16);
+  at[0] = 1;
+  at += 16;
+  *at++ = 0x00;
+
+  *at++ = 0xff; *at++ = 0xda;
+  at = jpeg_put_u16(at, 12);
+  *at++ = 3;
+  for (u32 component_i = 1;
+       component_i <= 3;
+       ++component_i)
+  {
+    *at++ = (u8)component_i; *at++ = 0x00;
+  }
+  *at++ = 0; *at++ = 63; *at++ = 0;
+
+  JPEGBitWriter writer = {at, 0, 0};
+  s32 previous_dc[3] = {0};
+  for (u32 block_y = 0;
+       block_y < blocks_y;
+       ++block_y)
+  {
+    for (u32 block_x = 0;
+         block_x < blocks_x;
+         ++block_x)
+    {
+      s32 rgb[3];
+      synthetic_block_colour(block_x, block_y, blocks_x, blocks_y, sequence, rgb);
+      s32 r = rgb[0], g = rgb[1], b = rgb[2];
+
+      s32 levels[3] = {
+        (77 * r + 150 * g + 29 * b) >> 8,
+        ((-43 * r - 85 * g + 128 * b) >> 8) + 128,
+        ((128 * r - 107 * g - 21 * b) >> 8) + 128,
+      };
+      for (u32 component_i = 0;
+           component_i < 3;
+           ++component_i)
+      {
+        s32 dc = levels[component_i] - 128;
+        s32 diff = dc - previous_dc[component_i];
+        previous_dc[component_i] = dc;
+
+        u32 magnitude = (u32)((diff < 0) ? -diff : diff);
+        u32 category = 0;
+        while (magnitude >> category)
+        {
+          category++;
+        }
+        jpeg_put_bits(&writer, dc_codes[category], dc_code_lens[category]);
+        if (category > 0)
+        {
+          jpeg_put_bits(&writer, (u32)((diff < 0) ? diff - 1 : diff), category);
+        }
+        // NOTE(Ryan): End of block
+        jpeg_put_bits(&writer, 0, 1);
+      }
+    }
+  }
+  jpeg_flush_bits(&writer);
+  at = writer.at;
+  *at++ = 0xff; *at++ = 0xd9;
+
+  return (u32)(at - buffer);
+}
+
+// NOTE(Ryan): The same pattern as a camera would give it raw, in video range.
+// The size must be even. Returns the size written
+INTERNAL u32
+synthetic_render_raw(u8 *buffer, PIXEL_FORMAT format, u32 width, u32 height, u32 sequence)
+{
+  u32 blocks_x = (width + 7) / 8;
+  u32 blocks_y = (height + 7) / 8;
+  u32 stride = (format == PIXEL_FORMAT_YUYV) ? width * 2 : width;
+  u8 *chroma_plane = buffer + stride * height;
+
+  for (u32 block_y = 0;
+       block_y < blocks_y;
+       ++block_y)
+  {
+    for (u32 block_x = 0;
+         block_x < blocks_x;
+         ++block_x)
+    {
+      s32 rgb[3];
+      synthetic_block_colour(block_x, block_y, blocks_x, blocks_y, sequence, rgb);
+      s32 r = rgb[0], g = rgb[1], b = rgb[2];
+      u8 y_level = (u8)(16 + ((66 * r + 129 * g + 25 * b + 128) >> 8));
+      u8 cb_level = (u8)(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+      u8 cr_level = (u8)(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+
+      u32 end_y = (block_y * 8 + 8 < height) ? block_y * 8 + 8 : height;
+      u32 end_x = (block_x * 8 + 8 < width) ? block_x * 8 + 8 : width;
+      for (u32 y = block_y * 8;
+           y < end_y;
+           ++y)
+      {
+        for (u32 x = block_x * 8;
+             x < end_x;
+             ++x)
+        {
+          if (format == PIXEL_FORMAT_YUYV)
+          {
+            u8 *pixel = buffer + y * stride + x * 2;
+            pixel[0] = y_level;
+            pixel[1] = (x % 2 == 0) ? cb_level : cr_level;
+          }
+          else
+          {
+            buffer[y * stride + x] = y_level;
+            if (x % 2 == 0 && y % 2 == 0)
+            {
+              u8 *pair = chroma_plane + (y / 2) * stride + x;
+              pair[0] = cb_level;
+              pair[1] = cr_level;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return (format == PIXEL_FORMAT_YUYV) ? stride * height : stride * height + stride * height / 2;
+}
+
+GLOBAL const char *global_pixel_format_names[PIXEL_FORMAT_COUNT] = {
+  "mjpeg", "yuyv", "nv12"
+};
+
+INTERNAL b32
+pixel_format_from_name(const char *name, PIXEL_FORMAT *format)
+{
+  b32 result = false;
+
+  for (u32 format_i = 0;
+       format_i < PIXEL_FORMAT_COUNT;
+       ++format_i)
+  {
+    if (strcmp(name, global_pixel_format_names[format_i]) == 0)
+    {
+      *format = (PIXEL_FORMAT)format_i;
+      result = true;
+      break;
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Keeps the same size, so it can be reopened without reading the flags again
+INTERNAL void
+frame_source_init(FrameSource *source, const char *path, PIXEL_FORMAT format, 
+                  u32 width, u32 height, u32 fps)
+{
+  // NOTE(Ryan): A regular file is a recording, anything else is taken to be a device,
+  // which may well not be plugged in yet
+  source->type = FRAME_SOURCE_TYPE_V4L2;
+  struct stat path_stat = {0};
+  if (strcmp(path, "synthetic") == 0)
+  {
+    source->type = FRAME_SOURCE_TYPE_SYNTHETIC;
+  }
+  else if (stat(path, &path_stat) == 0 && S_ISREG(path_stat.st_mode))
+  {
+    source->type = FRAME_SOURCE_TYPE_FILE;
+  }
+
+  source->path = path;
+  source->format = (source->type == FRAME_SOURCE_TYPE_FILE) ? PIXEL_FORMAT_MJPEG : format;
+  source->width = width;
+  source->height = height;
+  source->fps = (fps > 0) ? fps : FRAME_SOURCE_DEFAULT_FPS;
+  source->fd = -1;
+  source->camera.fd = -1;
+}
+
+INTERNAL const char *
+frame_source_type_name(FrameSource *source)
+{
+  const char *result = "v4l2";
+
+  if (source->type == FRAME_SOURCE_TYPE_FILE)
+  {
+    result = "file";
+  }
+  else if (source->type == FRAME_SOURCE_TYPE_SYNTHETIC)
+  {
+    result = "synthetic";
+  }
+
+  return result;
+}
+
+INTERNAL void
+frame_source_close(FrameSource *source)
+{
+  switch (source->type)
+  {
+    case FRAME_SOURCE_TYPE_V4L2:
+    {
+      camera_close(&source->camera);
+    } break;
+    case FRAME_SOURCE_TYPE_FILE:
+    {
+      frame_replay_close(&source->replay);
+      close(source->fd);
+    } break;
+    case FRAME_SOURCE_TYPE_SYNTHETIC:
+    {
+      for (u32 buffer_i = 0;
+           buffer_i < SYNTHETIC_BUFFER_COUNT;
+           ++buffer_i)
+      {
+        free(source->synthetic.buffers[buffer_i]);
+      }
+      SyntheticPattern zero_synthetic = {0};
+      source->synthetic = zero_synthetic;
+      close(source->fd);
+    } break;
+  }
+
+  source->fd = -1;
+  source->is_held = false;
+  source->has_sequence = false;
+}
+
+INTERNAL int
+frame_source_create_timer(u32 fps)
+{
+  int result = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (result != -1)
+  {
+    struct itimerspec interval = {0};
+    interval.it_interval.tv_sec = (fps == 1) ? 1 : 0;
+    interval.it_interval.tv_nsec = (fps == 1) ? 0 : 1000000000L / fps;
+    interval.it_value = interval.it_interval;
+    if (timerfd_settime(result, 0, &interval, NULL) == -1)
+    {
+      EBP();
+      close(result);
+      result = -1;
+    }
+  }
+  else
+  {
+    EBP();
+  }
+
+  return result;
+}
+
+INTERNAL b32
+frame_source_open(FrameSource *source)
+{
+  source->error = NULL;
+  switch (source->type)
+  {
+    case FRAME_SOURCE_TYPE_V4L2:
+    {
+      source->camera = camera_init(source->path, source->width, source->height, 
+                                   source->format, &source->error);
+      source->fd = source->camera.fd;
+      if (source->fd >= 0)
+      {
+        source->width = source->camera.width;
+        source->height = source->camera.height;
+        source->stride = source->camera.stride;
+        source->is_video_range = source->camera.is_video_range;
+      }
+    } break;
+    case FRAME_SOURCE_TYPE_FILE:
+    {
+      if (frame_replay_open(&source->replay, source->path, &source->error))
+      {
+        // NOTE(Ryan): The recording's size, not the one asked for.
+        // Frames are sent as recorded, so the first speaks for the rest
+        u32 width = 0;
+        u32 height = 0;
+        if (jpeg_find_frame_size(source->replay.data, source->replay.size,
+                                 source->replay.frames[0].offset, &width, &height))
+        {
+          source->width = width;
+          source->height = height;
+        }
+
+        source->fd = frame_source_create_timer(source->fps);
+        if (source->fd == -1)
+        {
+          frame_replay_close(&source->replay);
+        }
+      }
+    } break;
+    case FRAME_SOURCE_TYPE_SYNTHETIC:
+    {
+      b32 is_raw = (source->format != PIXEL_FORMAT_MJPEG);
+      if (source->width > 0 && source->width <= SYNTHETIC_MAX_DIMENSION &&
+          source->height > 0 && source->height <= SYNTHETIC_MAX_DIMENSION &&
+          (!is_raw || (source->width % 2 == 0 && source->height % 2 == 0)))
+      {
+        SyntheticPattern *synthetic = &source->synthetic;
+        if (is_raw)
+        {
+          source->stride = (source->format == PIXEL_FORMAT_YUYV) ? source->width * 2 : 
+                                                                   source->width;
+          source->is_video_range = true;
+          synthetic->capacity = source->stride * source->height;
+          if (source->format == PIXEL_FORMAT_NV12)
+          {
+            synthetic->capacity += source->stride * source->height / 2;
+          }
+        }
+        else
+        {
+          // NOTE(Ryan): At most 15 bits for each of a block's three components, 
+          // doubled in case every byte is stuffed
+          u32 block_count = ((source->width + 7) / 8) * ((source->height + 7) / 8);
+          synthetic->capacity = 1024 + block_count * 12;
+        }
+        b32 has_buffers = true;
+        for (u32 buffer_i = 0;
+             buffer_i < SYNTHETIC_BUFFER_COUNT;
+             ++buffer_i)
+        {
+          synthetic->buffers[buffer_i] = malloc(synthetic->capacity);
+          has_buffers &= (synthetic->buffers[buffer_i] != NULL);
+        }
+
+        if (has_buffers)
+        {
+          source->fd = frame_source_create_timer(source->fps);
+        }
+        else
+        {
+          EBP();
+        }
+
+        if (source->fd == -1)
+        {
+          for (u32 buffer_i = 0;
+               buffer_i < SYNTHETIC_BUFFER_COUNT;
+               ++buffer_i)
+          {
+            free(synthetic->buffers[buffer_i]);
+            synthetic->buffers[buffer_i] = NULL;
+          }
+        }
+      }
+      else
+      {
+        source->error = "Synthetic pattern size out of range, or odd for raw frames";
+      }
+    } break;
+  }
+
+  return (source->fd >= 0);
+}
+
+// NOTE(Ryan): Call once fd is readable. Returns false if there was no new frame,
+// otherwise the frame is held until frame_source_release
+INTERNAL b32
+frame_source_dequeue(FrameSource *source)
+{
+  u32 skipped_count = 0;
+
+  switch (source->type)
+  {
+    case FRAME_SOURCE_TYPE_V4L2:
+    {
+      source->is_held = camera_dequeue_latest(&source->camera, &source->held, &skipped_count);
+    } break;
+    case FRAME_SOURCE_TYPE_FILE:
+    case FRAME_SOURCE_TYPE_SYNTHETIC:
+    {
+      u64 tick_count = 0;
+      if (read(source->fd, &tick_count, sizeof(tick_count)) == sizeof(tick_count))
+      {
+        // NOTE(Ryan): Missed ticks count as dropped, the same as a driver's gaps
+        SourceFrame *held = &source->held;
+        held->sequence = source->last_sequence + (u32)tick_count;
+        held->timestamp_ns = get_ns();
+        if (source->type == FRAME_SOURCE_TYPE_FILE)
+        {
+          FrameReplay *replay = &source->replay;
+          ReplayFrame *replay_frame = replay->frames + replay->frame_i;
+          held->buffer_index = replay->frame_i;
+          held->data = replay->data + replay_frame->offset;
+          held->size = replay_frame->size;
+          replay->frame_i = (replay->frame_i + 1) % replay->frame_count;
+          source->is_held = true;
+        }
+        else
+        {
+          // NOTE(Ryan): A buffer still lent out is never drawn over,
+          // so with none free the tick is missed
+          SyntheticPattern *synthetic = &source->synthetic;
+          for (u32 buffer_i = 0;
+               buffer_i < SYNTHETIC_BUFFER_COUNT;
+               ++buffer_i)
+          {
+            if (!(synthetic->lent_mask & (1u << buffer_i)))
+            {
+              held->buffer_index = buffer_i;
+              held->data = synthetic->buffers[buffer_i];
+              if (source->format == PIXEL_FORMAT_MJPEG)
+              {
+                held->size = synthetic_render(held->data, source->width, source->height, 
+                                              held->sequence);
+              }
+              else
+              {
+                held->size = synthetic_render_raw(held->data, source->format, source->width,
+                                                  source->height, held->sequence);
+              }
+              source->is_held = true;
+              break;
+            }
+          }
+        }
+      }
+      else if (errno != EAGAIN)
+      {
+        EBP();
+      }
+    } break;
+  }
+
+  if (source->is_held)
+  {
+    // NOTE(Ryan): Unsigned, so the difference survives the sequence wrapping.
+    // Frames we skipped ourselves are in the gap too
+    if (source->has_sequence)
+    {
+      u32 gap = source->held.sequence - source->last_sequence - 1;
+      source->dropped_count += (gap > skipped_count) ? gap - skipped_count : 0;
+    }
+    source->skipped_count += skipped_count;
+    source->has_sequence = true;
+    source->last_sequence = source->held.sequence;
+  }
+
+  return source->is_held;
+}
+
+// NOTE(Ryan): Gives the held frame straight back, once it has been copied out
+INTERNAL void
+frame_source_release(FrameSource *source)
+{
+  if (source->is_held && source->type == FRAME_SOURCE_TYPE_V4L2)
+  {
+    camera_queue_buffer(&source->camera, source->held.buffer_index);
+  }
+  source->is_held = false;
+}
+
+// NOTE(Ryan): Hands the held frame over to be used in place, until frame_source_return.
+// Returns false, leaving it held, if that would leave the source short of buffers
+INTERNAL b32
+frame_source_lend(FrameSource *source)
+{
+  b32 result = false;
+
+  if (source->is_held)
+  {
+    switch (source->type)
+    {
+      case FRAME_SOURCE_TYPE_V4L2:
+      {
+        result = (source->camera.queued_count >= CAMERA_MIN_QUEUED_COUNT);
+      } break;
+      case FRAME_SOURCE_TYPE_FILE:
+      {
+        result = true;
+      } break;
+      case FRAME_SOURCE_TYPE_SYNTHETIC:
+      {
+        // NOTE(Ryan): Keeps one free to draw the next tick into
+        u32 lent_mask = source->synthetic.lent_mask | (1u << source->held.buffer_index);
+        result = (lent_mask != (1u << SYNTHETIC_BUFFER_COUNT) - 1);
+        if (result)
+        {
+          source->synthetic.lent_mask = lent_mask;
+        }
+      } break;
+    }
+  }
+
+  if (result)
+  {
+    source->is_held = false;
+    source->lent_count++;
+  }
+
+  return result;
+}
+
+INTERNAL void
+frame_source_return(FrameSource *source, u32 buffer_index)
+{
+  if (source->type == FRAME_SOURCE_TYPE_V4L2)
+  {
+    camera_queue_buffer(&source->camera, buffer_index);
+  }
+  else if (source->type == FRAME_SOURCE_TYPE_SYNTHETIC)
+  {
+    source->synthetic.lent_mask &= ~(1u << buffer_index);
+  }
+  source->lent_count--;
+}
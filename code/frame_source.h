@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#pragma once
+
+#include "jpeg_encoder.h"
+
+// NOTE(Ryan): The driver may grant more or fewer than asked for
+#define CAMERA_BUFFER_COUNT 6
+#define MAX_CAMERA_BUFFER_COUNT 8
+// NOTE(Ryan): A frame is only lent out while this many buffers stay with the driver
+#define CAMERA_MIN_QUEUED_COUNT 2
+#define SYNTHETIC_BUFFER_COUNT 4
+#define FRAME_SOURCE_DEFAULT_FPS 30
+#define SYNTHETIC_MAX_DIMENSION 8192
+
+typedef enum FRAME_SOURCE_TYPE
+{
+  FRAME_SOURCE_TYPE_V4L2,
+  // NOTE(Ryan): A recorded MJPEG file, i.e. JPEGs back to back as from $(ffmpeg -f mjpeg)
+  FRAME_SOURCE_TYPE_FILE,
+  // NOTE(Ryan): Colour bars, a moving block and the frame number in binary along the bottom
+  FRAME_SOURCE_TYPE_SYNTHETIC,
+} FRAME_SOURCE_TYPE;
+
+// NOTE(Ryan): A filled buffer, valid until released or, if lent, returned
+typedef struct SourceFrame
+{
+  u32 buffer_index;
+  u8 *data;
+  u32 size;
+  u32 sequence;
+  // NOTE(Ryan): CLOCK_MONOTONIC when filled, 0 if the driver uses another clock
+  u64 timestamp_ns;
+} SourceFrame;
+
+typedef enum CAMERA_MEMORY
+{
+  // NOTE(Ryan): Buffers we allocate, hugepages if there are any, which the driver fills
+  CAMERA_MEMORY_USERPTR,
+  // NOTE(Ryan): Driver allocated buffers, mapped in and exported as DMABUFs
+  CAMERA_MEMORY_MMAP,
+} CAMERA_MEMORY;
+
+typedef struct CameraBuffer
+{
+  u8 *data;
+  u32 size;
+  // NOTE(Ryan): Lets another device, e.g. a hardware encoder, take the frame
+  // without the CPU touching it. -1 if not exported
+  int dmabuf_fd;
+} CameraBuffer;
+
+// NOTE(Ryan): Buffers are queued with the driver unless dequeued and not yet given back
+typedef struct Camera
+{
+  int fd;
+  CAMERA_MEMORY memory;
+  // NOTE(Ryan): As the driver settled on, which may not be what was asked for
+  u32 width;
+  u32 height;
+  u32 stride;
+  b32 is_video_range;
+  CameraBuffer buffers[MAX_CAMERA_BUFFER_COUNT];
+  u32 buffer_count;
+  u32 queued_count;
+  u32 dmabuf_count;
+} Camera;
+
+typedef struct ReplayFrame
+{
+  u64 offset;
+  u32 size;
+} ReplayFrame;
+
+// NOTE(Ryan): Frames are handed out straight from the mapping, so are never copied
+typedef struct FrameReplay
+{
+  u8 *data;
+  u64 size;
+  ReplayFrame *frames;
+  u32 frame_count;
+  u32 frame_i;
+} FrameReplay;
+
+typedef struct SyntheticPattern
+{
+  u8 *buffers[SYNTHETIC_BUFFER_COUNT];
+  u32 capacity;
+  u32 lent_mask;
+} SyntheticPattern;
+
+// NOTE(Ryan): Where frames come from. The stand-ins tick a timerfd at fps,
+// so the capture thread waits on them exactly as it would on a device
+typedef struct FrameSource
+{
+  FRAME_SOURCE_TYPE type;
+  // NOTE(Ryan): The device or file
+  const char *path;
+  // NOTE(Ryan): A recording is always MJPEG, the others can give raw frames to be encoded
+  PIXEL_FORMAT format;
+  u32 width;
+  u32 height;
+  u32 fps;
+  // NOTE(Ryan): Of raw frames, once open
+  u32 stride;
+  b32 is_video_range;
+
+  // NOTE(Ryan): Readable once there is a frame, -1 while closed
+  int fd;
+  SourceFrame held;
+  b32 is_held;
+  // NOTE(Ryan): Frames lent out by frame_source_lend and not yet returned.
+  // The source cannot close while there are any
+  u32 lent_count;
+
+  b32 has_sequence;
+  u32 last_sequence;
+  // NOTE(Ryan): Gaps in the sequence, i.e. frames the driver had no free buffer for,
+  // or ticks a stand-in missed
+  u64 dropped_count;
+  // NOTE(Ryan): Frames dequeued together with a newer one, so never used
+  u64 skipped_count;
+
+  Camera camera;
+  FrameReplay replay;
+  SyntheticPattern synthetic;
+
+  // NOTE(Ryan): Why the last open failed, for the includer to report, 
+  // or NULL if a call failed and errno says why
+  const char *error;
+} FrameSource;
@@ -1,16 +1,41 @@
 // SPDX-License-Identifier: zlib-acknowledgement
+// NOTE(Ryan): For pipe2() and posix_spawn_file_actions_addchdir_np()
+#define _GNU_SOURCE
 #include "SDL.h"
 #include <SDL2/SDL_ttf.h>
 
 #include <ctype.h>
+#include <stdarg.h>
+#include <time.h>
 
 #include "types.h"
 #include "debug.h"
 #include "math.h"
 #include "vector.h"
+#include "camera_preview.h"
 #include "platform.h"
 
+INTERNAL u64
+get_ns(void)
+{
+  u64 result = 0;
+
+  struct timespec cur_timespec = {0};
+  if (clock_gettime(CLOCK_MONOTONIC, &cur_timespec) != -1)
+  {
+    result = (u64)cur_timespec.tv_nsec + ((u64)cur_timespec.tv_sec * 1000000000ULL);
+  }
+  else
+  {
+    EBP();
+  }
+
+  return result;
+}
+
 #include "mem.c"
+#include "process.c"
+#include "config.h"
 #include "gui.h"
 
 typedef struct U32HashItem
@@ -412,9 +437,296 @@ draw_two_number_sum(TwoNumberSumState *state)
 #endif
 
 INTERNAL void
-overlay_timed_records(SDL_Renderer *renderer, CapitalMonospacedFont *font);
+collate_debug_events(DebugState *debug_state, DebugEventTable *debug_event_table);
+
+INTERNAL r32
+overlay_debug_statistics(SDL_Renderer *renderer, CapitalMonospacedFont *font, 
+                         DebugState *debug_state, DebugVariable *debug_variables,
+                         V2 render_dim);
+
 
 
+INTERNAL char *
+get_console_line(DebugConsole *console, u32 line_index)
+{
+  return console->lines[line_index % DEBUG_CONSOLE_LINE_COUNT];
+}
+
+INTERNAL void
+end_console_line(DebugConsole *console)
+{
+  console->next_line_index = (console->next_line_index + 1) % DEBUG_CONSOLE_LINE_COUNT;
+  // NOTE(Ryan): One slot is always reserved for the line currently being written
+  if (console->line_count < DEBUG_CONSOLE_LINE_COUNT - 1)
+  {
+    console->line_count++;
+  }
+  console->partial_line_length = 0;
+  memset(get_console_line(console, console->next_line_index), 0, DEBUG_CONSOLE_LINE_LENGTH);
+}
+
+// NOTE(Ryan): Text arrives in arbitrary chunks from the pipe, so a line is only 
+// committed once its newline arrives. Overlong lines are wrapped
+INTERNAL void
+append_console_text(DebugConsole *console, char *text, u32 text_len)
+{
+  for (u32 text_i = 0;
+       text_i < text_len;
+       ++text_i)
+  {
+    char ch = text[text_i];
+    if (ch == '\n')
+    {
+      end_console_line(console);
+    }
+    else if (ch != '\r')
+    {
+      char *line = get_console_line(console, console->next_line_index);
+      line[console->partial_line_length++] = (ch == '\t') ? ' ' : ch;
+      if (console->partial_line_length == DEBUG_CONSOLE_LINE_LENGTH - 1)
+      {
+        end_console_line(console);
+      }
+    }
+  }
+}
+
+INTERNAL void
+print_console(DebugConsole *console, const char *format, ...)
+{
+  char buf[DEBUG_CONSOLE_LINE_LENGTH] = {0};
+
+  va_list args;
+  va_start(args, format);
+  s32 buf_len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+
+  append_console_text(console, buf, MIN((u32)buf_len, (u32)sizeof(buf) - 1));
+}
+
+INTERNAL void
+draw_console(SDL_Renderer *renderer, CapitalMonospacedFont *font, DebugConsole *console,
+             r32 font_scale, V4 text_colour, V2 render_dim)
+{
+  r32 line_height = font->height * font_scale;
+  u32 visible_line_count = console->line_count + (console->partial_line_length > 0 ? 1 : 0);
+  V2 console_dim = v2(render_dim.w, line_height * DEBUG_CONSOLE_LINE_COUNT);
+  V2 console_pos = v2(0.0f, render_dim.h - console_dim.h);
+  draw_rect(renderer, console_pos, console_dim, v4(0, 0, 0, 0.8f));
+
+  r32 at_y = render_dim.h - (visible_line_count * line_height);
+  u32 line_index = console->next_line_index + DEBUG_CONSOLE_LINE_COUNT - console->line_count;
+  for (u32 line_i = 0;
+       line_i < visible_line_count;
+       ++line_i)
+  {
+    char *line = get_console_line(console, line_index + line_i);
+    draw_text(renderer, font, line, v2(0.0f, at_y), font_scale, text_colour);
+    at_y += line_height;
+  }
+}
+
+INTERNAL void
+begin_rebuild(State *state)
+{
+  if (state->rebuild_process.is_running)
+  {
+    // NOTE(Ryan): The running build may have read the old config, so go again after
+    state->rebuild_pending = true;
+  }
+  else
+  {
+    print_console(&state->console, "COMPILING: %s\n", DEBUG_REBUILD_COMMAND);
+    state->rebuild_process = execute_system_command(DEBUG_REBUILD_DIRECTORY, DEBUG_REBUILD_COMMAND,
+                                                    0);
+    state->rebuild_pending = false;
+  }
+}
+
+// IMPORTANT(Ryan): Called every frame. Never blocks, so the UI keeps running while compiling. 
+// On success the platform layer sees the new shared object and hot reloads it
+INTERNAL void
+update_rebuild(State *state)
+{
+  ExecutingProcess *rebuild_process = &state->rebuild_process;
+
+  char output_buf[4096] = {0};
+  u32 output_len = 0;
+  while ((output_len = read_process_output(rebuild_process, output_buf, sizeof(output_buf))) > 0)
+  {
+    append_console_text(&state->console, output_buf, output_len);
+  }
+
+  if (rebuild_process->is_running && !update_process_state(rebuild_process))
+  {
+    // NOTE(Ryan): Drain whatever was written between the last read and the exit
+    while ((output_len = read_process_output(rebuild_process, output_buf, sizeof(output_buf))) > 0)
+    {
+      append_console_text(&state->console, output_buf, output_len);
+    }
+    if (rebuild_process->output_fd != -1)
+    {
+      close(rebuild_process->output_fd);
+      rebuild_process->output_fd = -1;
+    }
+
+    r64 elapsed_seconds = (r64)rebuild_process->elapsed_ns / 1000000000.0;
+    if (rebuild_process->exit_code == 0)
+    {
+      print_console(&state->console, "BUILD SUCCEEDED IN %.2fS\n", elapsed_seconds);
+    }
+    else if (rebuild_process->exit_signal != 0)
+    {
+      print_console(&state->console, "BUILD KILLED (SIGNAL %d) AFTER %.2fS\n", 
+                    rebuild_process->exit_signal, elapsed_seconds);
+      DEBUG_VARIABLE(state->debug_variables, DEBUG_CONSOLE).bool_value = true;
+    }
+    else
+    {
+      print_console(&state->console, "BUILD FAILED (EXIT %d) AFTER %.2fS\n", 
+                    rebuild_process->exit_code, elapsed_seconds);
+      // NOTE(Ryan): Failures are easy to miss with the console hidden
+      DEBUG_VARIABLE(state->debug_variables, DEBUG_CONSOLE).bool_value = true;
+    }
+
+    if (state->rebuild_pending)
+    {
+      begin_rebuild(state);
+    }
+  }
+}
+
+// NOTE(Ryan): Swaps the ready slot for the one last drawn if the capture thread has filled it
+// since. NULL if not, so a frame is only ever uploaded once
+INTERNAL CameraPreviewSlot *
+take_camera_preview_frame(CameraPreview *preview)
+{
+  CameraPreviewSlot *result = NULL;
+
+  if (__atomic_load_n(&preview->ready, __ATOMIC_RELAXED) & CAMERA_PREVIEW_FRESH_BIT)
+  {
+    u32 previous = __atomic_exchange_n(&preview->ready, preview->front_index, __ATOMIC_ACQ_REL);
+    preview->front_index = previous & ~CAMERA_PREVIEW_FRESH_BIT;
+    result = &preview->slots[preview->front_index];
+  }
+
+  return result;
+}
+
+INTERNAL void
+update_camera_texture(SDL_Renderer *renderer, State *state, CameraPreview *preview)
+{
+  if (preview != NULL && __atomic_load_n(&preview->is_open, __ATOMIC_ACQUIRE))
+  {
+    if (state->camera_texture == NULL || state->camera_texture_format != preview->format ||
+        state->camera_texture_width != preview->width ||
+        state->camera_texture_height != preview->height)
+    {
+      if (state->camera_texture != NULL)
+      {
+        SDL_DestroyTexture(state->camera_texture);
+      }
+      u32 texture_format = (preview->format == PIXEL_FORMAT_NV12) ? SDL_PIXELFORMAT_NV12 :
+                                                                    SDL_PIXELFORMAT_YUY2;
+      // NOTE(Ryan): The renderer converts to RGB as it draws, on the GPU where it can
+      state->camera_texture = SDL_CreateTexture(renderer, texture_format,
+                                                SDL_TEXTUREACCESS_STREAMING,
+                                                (int)preview->width, (int)preview->height);
+      if (state->camera_texture == NULL)
+      {
+        BP_MSG(SDL_GetError());
+      }
+      state->camera_texture_format = preview->format;
+      state->camera_texture_width = preview->width;
+      state->camera_texture_height = preview->height;
+      state->has_camera_frame = false;
+    }
+
+    CameraPreviewSlot *slot = take_camera_preview_frame(preview);
+    if (slot != NULL && state->camera_texture != NULL)
+    {
+      if (preview->format == PIXEL_FORMAT_NV12)
+      {
+        u8 *y_plane = slot->data;
+        u8 *uv_plane = slot->data + preview->width * preview->height;
+        if (SDL_UpdateNVTexture(state->camera_texture, NULL, y_plane, (int)preview->width,
+                                uv_plane, (int)preview->width) != 0)
+        {
+          BP_MSG(SDL_GetError());
+        }
+      }
+      else
+      {
+        // NOTE(Ryan): Written straight into the texture's memory, row by row as its pitch
+        // may be wider than the frame's
+        void *pixels = NULL;
+        int pitch = 0;
+        if (SDL_LockTexture(state->camera_texture, NULL, &pixels, &pitch) == 0)
+        {
+          u32 row_size = preview->width * 2;
+          for (u32 row_i = 0;
+               row_i < preview->height;
+               ++row_i)
+          {
+            memcpy((u8 *)pixels + row_i * pitch, slot->data + row_i * row_size, row_size);
+          }
+          SDL_UnlockTexture(state->camera_texture);
+        }
+        else
+        {
+          BP_MSG(SDL_GetError());
+        }
+      }
+      state->has_camera_frame = true;
+    }
+  }
+}
+
+// NOTE(Ryan): Against the right edge between min_y and max_y, i.e. below the overlays above
+// and above the console. Shrunk to fit, keeping the frame's aspect ratio, or left out
+// if there is too little room
+INTERNAL void
+draw_camera_panel(SDL_Renderer *renderer, State *state, CameraPreview *preview,
+                  r32 font_scale, V4 text_colour, V2 render_dim, r32 min_y, r32 max_y)
+{
+  if (preview == NULL || !__atomic_load_n(&preview->is_open, __ATOMIC_ACQUIRE) ||
+      !state->has_camera_frame || preview->width == 0)
+  {
+    return;
+  }
+
+  r32 label_height = state->font.height * font_scale;
+  r32 aspect_ratio = (r32)preview->height / (r32)preview->width;
+  r32 panel_width = MIN(CAMERA_PANEL_MAX_WIDTH, render_dim.w);
+  r32 panel_height = panel_width * aspect_ratio;
+  r32 available_height = max_y - min_y - label_height;
+  if (panel_height > available_height)
+  {
+    panel_height = available_height;
+    panel_width = panel_height / aspect_ratio;
+  }
+
+  if (panel_width >= CAMERA_PANEL_MIN_WIDTH)
+  {
+    V2 panel_pos = v2(render_dim.w - panel_width, min_y);
+
+    SDL_Rect dst_rect = {0};
+    dst_rect.x = (int)panel_pos.x;
+    dst_rect.y = (int)panel_pos.y;
+    dst_rect.w = (int)panel_width;
+    dst_rect.h = (int)panel_height;
+    SDL_RenderCopy(renderer, state->camera_texture, NULL, &dst_rect);
+
+    char label_buf[64] = {0};
+    snprintf(label_buf, sizeof(label_buf), "CAMERA: %s %ux%u", preview->source_name,
+             preview->width, preview->height);
+    draw_text(renderer, &state->font, label_buf,
+              v2(panel_pos.x, panel_pos.y + panel_height), font_scale, text_colour);
+  }
+}
+
+// NOTE(Ryan): Zero every time this shared object is (re)loaded
+GLOBAL b32 global_is_code_loaded;
 
 INTERNAL void 
 generate_random_u32_array(u32 *random_series, u32 *arr, u32 len)
@@ -442,35 +754,125 @@ update_and_render(SDL_Renderer *renderer, Input *input, Memory *memory)
     state->font = \
       load_capital_monospace_font(renderer, 
                                   "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf");
+    state->rebuild_process.output_fd = -1;
+    state->rebuild_process.exit_fd = -1;
+    load_debug_variables(state->debug_variables, DEBUG_VARIABLES_FILE_NAME);
     state->is_initialised = true;
   }
-  
-  char *menu_items[] = 
+
+  if (!global_is_code_loaded)
   {
-    "TOGGLE PROFILER",
-    "TOGGLE CONSOLE",
-    "MARK LOOP POINT1",
-    "MARK LOOP POINT2",
-    "MARK LOOP POINT3",
-  };
+    // IMPORTANT(Ryan): Names held in State point into the previous shared object,
+    // so rebind them against this one's
+    rebind_debug_variables(state->debug_variables);
+    memset(&state->debug_state, 0, sizeof(state->debug_state));
+    global_is_code_loaded = true;
+  }
 
-  r32 hot_menu_index = 0;
-  r32 best_distance_sq = R32_MAX;
-  // if (length_sq(mouse_p - origin) > radius)
+  update_rebuild(state);
+
+  DebugVariable *debug_variables = state->debug_variables;
+  state->debug_state.snapshot_window = \
+    (u32)DEBUG_VARIABLE(debug_variables, DEBUG_SNAPSHOT_WINDOW).s32_value;
 
-  r32 angle_step = TAU32 / (r32)ARRAY_COUNT(menu_items);
+  DebugEventTable *debug_event_table = memory->debug_event_table;
+  global_debug_event_table = debug_event_table;
+  if (debug_event_table != NULL)
+  {
+    debug_event_table->block_static_infos = __start_debug_block_info;
+    debug_event_table->block_static_info_count = get_debug_block_static_info_count();
+    debug_event_table->spike_capture_on = \
+      DEBUG_VARIABLE(debug_variables, DEBUG_SPIKE_CAPTURE).bool_value;
+    debug_event_table->spike_budget_seconds = \
+      DEBUG_VARIABLE(debug_variables, DEBUG_SPIKE_BUDGET_MS).r32_value / 1000.0f;
+    debug_event_table->spike_frames_before = \
+      (u32)DEBUG_VARIABLE(debug_variables, DEBUG_SPIKE_FRAMES_BEFORE).s32_value;
+    debug_event_table->spike_frames_after = \
+      (u32)DEBUG_VARIABLE(debug_variables, DEBUG_SPIKE_FRAMES_AFTER).s32_value;
+  }
+  if (memory->camera_preview != NULL)
+  {
+    memory->camera_preview->is_wanted = \
+      DEBUG_VARIABLE(debug_variables, DEBUG_CAMERA_PANEL).bool_value;
+  }
+
+  collate_debug_events(&state->debug_state, debug_event_table);
+
+  r32 angle_step = TAU32 / (r32)DEBUG_VARIABLE_COUNT;
   V2 menu_origin = v2(400, 400);
   r32 menu_radius = 200.0f;
+  r32 menu_font_scale = 0.12f;
+  V2 mouse_pos = v2(input->mouse_x, input->mouse_y);
+
+  s32 hot_menu_index = -1;
+  r32 best_distance_sq = R32_MAX;
   r32 angle = 0.0f;
-  V2 centre_dim = v2(8, 8);
-  //V2 centred = v2_centred(menu_origin, centre_dim);
+  for (u32 menu_item_i = 0;
+       menu_item_i < DEBUG_VARIABLE_COUNT;
+       menu_item_i++)
+  {
+    V2 menu_item_pos = {menu_origin.vec + menu_radius * v2_arm(angle).vec};
+    V2 mouse_to_item = {menu_item_pos.vec - mouse_pos.vec};
+    r32 distance_sq = v2_length_sq(mouse_to_item);
+    if (distance_sq < best_distance_sq)
+    {
+      best_distance_sq = distance_sq;
+      hot_menu_index = menu_item_i;
+    }
+    angle += angle_step;
+  }
+
+  // NOTE(Ryan): Only hot when close enough that the user is clearly aiming for an item
+  r32 hot_radius = 0.5f * menu_radius * angle_step;
+  if (best_distance_sq > square(hot_radius))
+  {
+    hot_menu_index = -1;
+  }
+
+  if (hot_menu_index != -1)
+  {
+    s32 direction = 0;
+    if (input->mouse_left.was_down)
+    {
+      direction = 1;
+    }
+    else if (input->mouse_right.was_down)
+    {
+      direction = -1;
+    }
+
+    if (direction != 0)
+    {
+      if (edit_debug_variable(debug_variables, debug_variables + hot_menu_index, direction))
+      {
+        begin_rebuild(state);
+      }
+    }
+  }
+
   draw_rect(renderer, menu_origin, v2(8, 8), v4(1, 1, 1, 1));
+  angle = 0.0f;
   for (u32 menu_item_i = 0;
-       menu_item_i < ARRAY_COUNT(menu_items);
+       menu_item_i < DEBUG_VARIABLE_COUNT;
        menu_item_i++)
   {
+    DebugVariable *variable = debug_variables + menu_item_i;
+    char menu_item_buf[256] = {0};
+    format_debug_variable(variable, menu_item_buf, sizeof(menu_item_buf));
+
+    V4 menu_item_colour = v4(1, 1, 1, 1);
+    if ((s32)menu_item_i == hot_menu_index)
+    {
+      menu_item_colour = v4(1, 1, 0, 1);
+    }
+    else if (variable->flags & DEBUG_VARIABLE_FLAG_COMPILE_TIME)
+    {
+      menu_item_colour = v4(1, 0.5f, 0.5f, 1);
+    }
+
     V2 menu_item_pos = {menu_origin.vec + menu_radius * v2_arm(angle).vec};
-    draw_text(renderer, &state->font, menu_items[menu_item_i], menu_item_pos, 0.25f, v4(1, 1, 1, 1));
+    draw_text(renderer, &state->font, menu_item_buf, menu_item_pos, menu_font_scale, 
+              menu_item_colour);
     angle += angle_step;
   }
 
@@ -484,7 +886,57 @@ update_and_render(SDL_Renderer *renderer, Input *input, Memory *memory)
   //TwoNumberSumResult quadratic_result = two_number_sum_quadratic(arr, arr_count, target_sum);
   //TwoNumberSumResult linear_result = two_number_sum_linear(&state->mem_arena, arr, arr_count, target_sum);
   
-  overlay_timed_records(renderer, &state->font);
+  r32 overlay_bottom = 2.0f * menu_font_scale * state->font.height;
+  if (DEBUG_VARIABLE(debug_variables, DEBUG_PROFILER_OVERLAY).bool_value)
+  {
+    r32 statistics_bottom = \
+      overlay_debug_statistics(renderer, &state->font, &state->debug_state, debug_variables,
+                               input->render_dim);
+    overlay_bottom = MAX(overlay_bottom, statistics_bottom);
+  }
+
+  if (state->rebuild_process.is_running)
+  {
+    r64 compile_seconds = \
+      (r64)(get_ns() - state->rebuild_process.start_ns) / 1000000000.0;
+    char compile_buf[64] = {0};
+    snprintf(compile_buf, sizeof(compile_buf), "COMPILING... %.1fS", compile_seconds);
+    draw_text(renderer, &state->font, compile_buf, 
+              v2(input->render_dim.w - DEBUG_STATUS_INSET, 0.0f), menu_font_scale, 
+              v4(1, 1, 0, 1));
+  }
+
+  if (debug_event_table != NULL && debug_event_table->spike_count > 0)
+  {
+    char spike_buf[64] = {0};
+    snprintf(spike_buf, sizeof(spike_buf), "SPIKES CAPTURED: %u", debug_event_table->spike_count);
+    draw_text(renderer, &state->font, spike_buf, 
+              v2(input->render_dim.w - DEBUG_STATUS_INSET, menu_font_scale * state->font.height),
+              menu_font_scale, v4(1, 0.5f, 0, 1));
+  }
+
+  if (DEBUG_VARIABLE(debug_variables, DEBUG_CAMERA_PANEL).bool_value)
+  {
+    r32 font_scale = DEBUG_VARIABLE(debug_variables, DEBUG_OVERLAY_FONT_SCALE).r32_value;
+    r32 panel_max_y = input->render_dim.h;
+    if (DEBUG_VARIABLE(debug_variables, DEBUG_CONSOLE).bool_value)
+    {
+      panel_max_y -= state->font.height * font_scale * DEBUG_CONSOLE_LINE_COUNT;
+    }
+
+    update_camera_texture(renderer, state, memory->camera_preview);
+    draw_camera_panel(renderer, state, memory->camera_preview, font_scale,
+                      DEBUG_VARIABLE(debug_variables, DEBUG_OVERLAY_TEXT_COLOUR).colour_value,
+                      input->render_dim, overlay_bottom, panel_max_y);
+  }
+
+  if (DEBUG_VARIABLE(debug_variables, DEBUG_CONSOLE).bool_value)
+  {
+    draw_console(renderer, &state->font, &state->console, 
+                 DEBUG_VARIABLE(debug_variables, DEBUG_OVERLAY_FONT_SCALE).r32_value,
+                 DEBUG_VARIABLE(debug_variables, DEBUG_OVERLAY_TEXT_COLOUR).colour_value,
+                 input->render_dim);
+  }
 
   reset_mem_arena(&state->mem_arena);
 
@@ -536,122 +988,341 @@ update_and_render(SDL_Renderer *renderer, Input *input, Memory *memory)
 #endif
 }
 
-__extension__ TimedRecord global_timed_record_table[__COUNTER__];
-TimedRecord *global_timed_records = global_timed_record_table;
+// NOTE(Ryan): open_depths is how many instances of each block are open, this one included.
+// Every instance is a hit, but only the outermost adds its cycles,
+// as those of a block recursing into itself are already within it
+INTERNAL void
+add_debug_block_hit(DebugState *debug_state, u32 *open_depths, u16 static_info_index, 
+                    u64 cycle_count)
+{
+  if (static_info_index < debug_state->counter_count)
+  {
+    DebugCounterState *counter_state = debug_state->counter_states + static_info_index;
+    DebugCounterSnapshot *snapshot = counter_state->snapshots + debug_state->snapshot_index;
+    snapshot->hit_count++;
+
+    open_depths[static_info_index]--;
+    if (open_depths[static_info_index] == 0)
+    {
+      snapshot->cycle_count += cycle_count;
+    }
+  }
+}
 
+// NOTE(Ryan): Cycles and hits are derived from the previous frame's events here, 
+// so a timed block itself only ever writes an index and a timestamp
 INTERNAL void
-overlay_timed_records(SDL_Renderer *renderer, CapitalMonospacedFont *font)
+collate_debug_events(DebugState *debug_state, DebugEventTable *debug_event_table)
 {
-  r32 at_y = 0.0f;
-  r32 font_scale = 0.25f;
-  for (u32 timed_record_i = 0;
-       timed_record_i < __COUNTER__ - 1;
-       ++timed_record_i)
+  u32 static_info_count = get_debug_block_static_info_count();
+  ASSERT(static_info_count <= MAX_DEBUG_COUNTER_COUNT);
+  debug_state->counter_count = MIN(static_info_count, (u32)MAX_DEBUG_COUNTER_COUNT);
+
+  for (u32 counter_i = 0;
+       counter_i < debug_state->counter_count;
+       ++counter_i)
+  {
+    DebugCounterState *counter_state = debug_state->counter_states + counter_i;
+    counter_state->static_info = __start_debug_block_info + counter_i;
+
+    DebugCounterSnapshot *snapshot = counter_state->snapshots + debug_state->snapshot_index;
+    snapshot->cycle_count = 0;
+    snapshot->hit_count = 0;
+  }
+
+  if (debug_event_table != NULL && debug_event_table->frame_counter > 0)
+  {
+    u32 frame_index = (debug_event_table->frame_counter - 1) % MAX_DEBUG_FRAME_COUNT;
+    DebugFrameInfo *frame = debug_event_table->frames + frame_index;
+
+    // NOTE(Ryan): Events are dropped once a frame has MAX_DEBUG_EVENTS_PER_FRAME, so those
+    // kept are nested properly but may stop with blocks still open. Pairing through a stack
+    // means an END only ever closes its own BEGIN, and whatever is left open is closed out
+    // at the end of the frame rather than pairing with a later block's END
+    u16 open_indices[MAX_DEBUG_BLOCK_DEPTH];
+    u64 open_clocks[MAX_DEBUG_BLOCK_DEPTH];
+    u32 open_count = 0;
+    u32 overflow_count = 0;
+    u32 open_depths[MAX_DEBUG_COUNTER_COUNT] = {0};
+
+    for (u32 event_i = 0;
+         event_i < frame->event_count;
+         ++event_i)
+    {
+      DebugEvent *event = debug_event_table->events[frame_index] + event_i;
+      if (event->type == DEBUG_EVENT_BEGIN_BLOCK)
+      {
+        if (open_count < MAX_DEBUG_BLOCK_DEPTH)
+        {
+          open_indices[open_count] = event->static_info_index;
+          open_clocks[open_count] = event->clock;
+          open_count++;
+          if (event->static_info_index < debug_state->counter_count)
+          {
+            open_depths[event->static_info_index]++;
+          }
+        }
+        else
+        {
+          overflow_count++;
+        }
+      }
+      else if (overflow_count > 0)
+      {
+        overflow_count--;
+      }
+      else if (open_count > 0 && open_indices[open_count - 1] == event->static_info_index)
+      {
+        open_count--;
+        add_debug_block_hit(debug_state, open_depths, open_indices[open_count], 
+                            event->clock - open_clocks[open_count]);
+      }
+      // NOTE(Ryan): Otherwise an END whose BEGIN was before the frame, so is not counted
+    }
+
+    while (open_count > 0)
+    {
+      open_count--;
+      u64 end_clock = MAX(frame->end_clock, open_clocks[open_count]);
+      add_debug_block_hit(debug_state, open_depths, open_indices[open_count], 
+                          end_clock - open_clocks[open_count]);
+    }
+  }
+
+  debug_state->snapshot_index++;
+  if (debug_state->snapshot_index >= DEBUG_SNAPSHOT_MAX_COUNT)
   {
-    TimedRecord timed_record = global_timed_records[timed_record_i];
-    char timed_record_buf[256] = {0};
-    snprintf(timed_record_buf, sizeof(timed_record_buf), "%s(%d): %f",
-             timed_record.block_name, timed_record.line_number, timed_record.seconds);
-    draw_text(renderer, font, timed_record_buf, v2(0.0f, at_y), font_scale, v4(1, 1, 1, 1));
-    at_y += (font->height * font_scale * 1.5f);
+    debug_state->snapshot_index = 0;
+  }
+  if (debug_state->snapshot_count < DEBUG_SNAPSHOT_MAX_COUNT)
+  {
+    debug_state->snapshot_count++;
   }
 }
 
+INTERNAL int
+compare_r64(const void *a, const void *b)
+{
+  r64 val_a = *(const r64 *)a;
+  r64 val_b = *(const r64 *)b;
 
-#if 0
+  return (val_a > val_b) - (val_a < val_b);
+}
 
+INTERNAL r64
+get_sorted_percentile(r64 *sorted_values, u32 count, r64 percentile)
+{
+  r64 result = 0.0;
 
+  // NOTE(Ryan): Nearest-rank, so the reported value is always one that actually occurred
+  u32 rank = (u32)ceil(percentile * (r64)count);
+  if (rank > 0)
+  {
+    rank--;
+  }
+  result = sorted_values[MIN(rank, count - 1)];
 
-INTERNAL void
-debug_overlay_snapshots(BackBuffer *back_buffer, MonospaceFont *font, DebugState *debug_state)
+  return result;
+}
+
+// IMPORTANT(Ryan): Sorts values in place
+INTERNAL DebugStatistic
+compute_debug_statistic(r64 *values, u32 count)
 {
-  for (u32 debug_counter = 0;
-       debug_counter < debug_state->counter_count;
-       ++debug_counter)
+  DebugStatistic result = {0};
+
+  if (count > 0)
   {
-    DebugCounterState counter_state = debug_state->counters[debug_counter];
+    // NOTE(Ryan): The window is at most DEBUG_SNAPSHOT_MAX_COUNT values, so an exact sort 
+    // is cheaper than maintaining a quantile sketch and has no approximation error
+    qsort(values, count, sizeof(r64), compare_r64);
+
+    r64 sum = 0.0;
+    for (u32 value_i = 0;
+         value_i < count;
+         ++value_i)
+    {
+      sum += values[value_i];
+    }
+
+    result.count = count;
+    result.min = values[0];
+    result.max = values[count - 1];
+    result.mean = sum / (r64)count;
 
-    DebugStatistic hit_count_statistic = begin_debug_statistic();
-    DebugStatistic cycle_count_statistic = begin_debug_statistic();
-    DebugStatistic cycles_over_hits_statistic = begin_debug_statistic();
-    for (u32 snapshot_i = 0;
-         snapshot_i < DEBUG_SNAPSHOT_MAX_COUNT;
-         ++snapshot_i)
+    r64 variance = 0.0;
+    for (u32 value_i = 0;
+         value_i < count;
+         ++value_i)
     {
-      DebugCounterSnapshot counter_snapshot = counter_state.snapshots[snapshot_i]; 
-      update_debug_statistic(&hit_count_statistic, counter_snapshot.hit_count); 
-      if (counter_snapshot.hit_count > 0)
-      {
-        update_debug_statistic(&cycles_over_hits_statistic, 
-                               counter_snapshot.cycles / counter_snapshot.hit_count); 
-      }
+      r64 deviation = values[value_i] - result.mean;
+      variance += deviation * deviation;
     }
+    result.std_dev = sqrt(variance / (r64)count);
+
+    result.p50 = get_sorted_percentile(values, count, 0.50);
+    result.p95 = get_sorted_percentile(values, count, 0.95);
+    result.p99 = get_sorted_percentile(values, count, 0.99);
+  }
+
+  return result;
+}
 
-    if (cycle_count_statistic.max > 0.0f)
+INTERNAL void
+draw_debug_statistic(SDL_Renderer *renderer, CapitalMonospacedFont *font, char *label,
+                     DebugStatistic *statistic, V2 pos, r32 font_scale, V4 colour)
+{
+  char statistic_buf[256] = {0};
+  snprintf(statistic_buf, sizeof(statistic_buf), 
+           "%4s MIN %10.0f P50 %10.0f P95 %10.0f P99 %10.0f MAX %10.0f MEAN %10.0f SD %10.0f",
+           label, statistic->min, statistic->p50, statistic->p95, statistic->p99, 
+           statistic->max, statistic->mean, statistic->std_dev);
+  draw_text(renderer, font, statistic_buf, pos, font_scale, colour);
+}
+
+INTERNAL void
+draw_sparkline(SDL_Renderer *renderer, r64 *values, u32 count, DebugStatistic *statistic,
+               V2 pos, V2 dim)
+{
+  draw_rect(renderer, pos, dim, v4(0.1f, 0.1f, 0.1f, 1));
+
+  if (statistic->max > 0.0)
+  {
+    r32 bar_width = dim.w / (r32)DEBUG_SNAPSHOT_MAX_COUNT;
+    r32 scale = dim.h / (r32)statistic->max;
+
+    // NOTE(Ryan): Right-aligned so the most recent frame is always at the same place
+    r32 at_x = pos.x + dim.w - (count * bar_width);
+    for (u32 value_i = 0;
+         value_i < count;
+         ++value_i)
     {
-      for (u32 snapshot_i = 0;
-          snapshot_i < DEBUG_SNAPSHOT_MAX_COUNT;
-          ++snapshot_i)
+      r32 bar_height = scale * (r32)values[value_i];
+      V4 bar_colour = v4(0, 1, 0, 1);
+      if (values[value_i] >= statistic->p99)
+      {
+        bar_colour = v4(1, 0, 0, 1);
+      }
+      else if (values[value_i] >= statistic->p95)
       {
-        DebugCounterSnapshot counter_snapshot = counter_state.snapshots[snapshot_i]; 
+        bar_colour = v4(1, 1, 0, 1);
+      }
 
-        r32 chart_height = debug_font->height * font_scale;
-        r32 scale = 1.0f / counter_snapshot[snapshot_i].cycle_count;
+      draw_rect(renderer, v2(at_x, pos.y + dim.h - bar_height), v2(MAX(bar_width, 1.0f), bar_height), 
+                bar_colour);
+      at_x += bar_width;
+    }
+  }
+}
 
-        r32 this_height = scale * chart_height;
-        r32 chart_min_y = at_y;
+// NOTE(Ryan): Returns how far down it drew, so other overlays can stay clear
+INTERNAL r32
+overlay_debug_statistics(SDL_Renderer *renderer, CapitalMonospacedFont *font, 
+                         DebugState *debug_state, DebugVariable *debug_variables,
+                         V2 render_dim)
+{
+  r32 at_y = 0.0f;
+  r32 font_scale = DEBUG_VARIABLE(debug_variables, DEBUG_OVERLAY_FONT_SCALE).r32_value;
+  V4 text_colour = DEBUG_VARIABLE(debug_variables, DEBUG_OVERLAY_TEXT_COLOUR).colour_value;
+  u32 sparkline_metric = DEBUG_VARIABLE(debug_variables, DEBUG_SPARKLINE_METRIC).enum_value;
+  r32 line_height = font->height * font_scale;
 
-        r32 chart_left = 0.0f;
+  u32 window_count = MIN(debug_state->snapshot_window, debug_state->snapshot_count);
+
+  for (u32 counter_i = 0;
+       counter_i < debug_state->counter_count;
+       ++counter_i)
+  {
+    DebugCounterState *counter_state = debug_state->counter_states + counter_i;
+    DebugBlockStaticInfo *static_info = counter_state->static_info;
+
+    r64 cycle_values[DEBUG_SNAPSHOT_MAX_COUNT] = {0};
+    r64 hit_values[DEBUG_SNAPSHOT_MAX_COUNT] = {0};
+    r64 cycles_over_hits_values[DEBUG_SNAPSHOT_MAX_COUNT] = {0};
+    u32 cycles_over_hits_count = 0;
+    r64 sparkline_values[DEBUG_SNAPSHOT_MAX_COUNT] = {0};
+    r64 cycles_over_hits_sparkline_values[DEBUG_SNAPSHOT_MAX_COUNT] = {0};
+
+    // IMPORTANT(Ryan): Visit in temporal order, i.e. oldest to most recent
+    u32 snapshot_i = (debug_state->snapshot_index + DEBUG_SNAPSHOT_MAX_COUNT - window_count) % 
+                      DEBUG_SNAPSHOT_MAX_COUNT;
+    for (u32 window_i = 0;
+         window_i < window_count;
+         ++window_i)
+    {
+      DebugCounterSnapshot *snapshot = counter_state->snapshots + snapshot_i;
 
-        V2 origin = v2(chart_left, chart_min_y);
-        // have separate routine for drawing rotated
-        draw_rect(back_buffer, origin, origin + v2(1, 0), origin + v2(0, this_height) , v4(scale, 1, 0, 1));
+      cycle_values[window_i] = (r64)snapshot->cycle_count;
+      hit_values[window_i] = (r64)snapshot->hit_count;
+      if (snapshot->hit_count > 0)
+      {
+        r64 cycles_over_hits = (r64)snapshot->cycle_count / (r64)snapshot->hit_count;
+        cycles_over_hits_values[cycles_over_hits_count++] = cycles_over_hits;
+        cycles_over_hits_sparkline_values[window_i] = cycles_over_hits;
       }
+
+      snapshot_i = (snapshot_i + 1) % DEBUG_SNAPSHOT_MAX_COUNT;
     }
 
-    if (hit_count_statistic.max)
+    // NOTE(Ryan): Statistics sort in place, so take the chronological copy first
+    if (sparkline_metric == 0)
     {
-      char buf[256] = {};
-      snprintf(buf, sizeof(buf), "%32s(%4d): %10ldcy | %4dh | %10ldcy/h", 
-          counter_state.function_name, counter_state.line_number, 
-          counter_snapshot.cycle_count, counter_snapshot.hit_count, 
-          counter_snapshot.cycle_count / counter_snapshot.hit_count);
-      draw_debug_text(back_buffer, buf, font);
+      memcpy(sparkline_values, cycles_over_hits_sparkline_values, sizeof(sparkline_values));
     }
-
-    V4 colors[] =
+    else if (sparkline_metric == 1)
     {
-      // primaries and secondaries
-      {1, 0, 0, 0},
-      {0, 1, 0, 0},
-      {0, 0, 1, 0},
-      {1, 1, 0, 0},
-      {1, 0, 1, 0},
-      {0, 1, 1, 0}
-    };
+      memcpy(sparkline_values, cycle_values, sizeof(sparkline_values));
+    }
+    else
+    {
+      memcpy(sparkline_values, hit_values, sizeof(sparkline_values));
+    }
+
+    DebugStatistic cycle_statistic = compute_debug_statistic(cycle_values, window_count);
+    DebugStatistic hit_statistic = compute_debug_statistic(hit_values, window_count);
+    DebugStatistic cycles_over_hits_statistic = \
+      compute_debug_statistic(cycles_over_hits_values, cycles_over_hits_count);
 
-    r32 prev_seconds = 0.0f;
-    r32 prev_min_y;
-    r32 chart_height = 300.0f;
-    // We want the chart to be 33.3ms
-    r32 scale = root_debug_info->total_seconds / 0.0333f; 
-    for (u32 timer_i = 0;
-         timer_i < root_debug_info->timer_count;
-         ++timer_i)
+    if (hit_statistic.max > 0.0)
     {
-      V4 active_colour = colours[timer_i % ARRAY_COUNT(colours)];
-      DebugTimer debug_timer = root_debug_info->timers[timer_i];
-      r32 this_seconds = debug_timer.seconds - prev_seconds;
-      prev_seconds = this_seconds;
-      r32 this_scale = scale / this_seconds;
+      char name_buf[256] = {0};
+      snprintf(name_buf, sizeof(name_buf), "%s(%u): %u FRAMES", static_info->block_name, 
+               static_info->line_number, window_count);
+      draw_text(renderer, font, name_buf, v2(0.0f, at_y), font_scale, text_colour);
 
-      r32 bar_height = chart_height * this_scale;
+      DebugStatistic *sparkline_statistic = &cycles_over_hits_statistic;
+      if (sparkline_metric == 1)
+      {
+        sparkline_statistic = &cycle_statistic;
+      }
+      else if (sparkline_metric == 2)
+      {
+        sparkline_statistic = &hit_statistic;
+      }
 
+      V2 sparkline_dim = v2(2.0f * DEBUG_SNAPSHOT_MAX_COUNT, 3.0f * line_height);
+      draw_sparkline(renderer, sparkline_values, window_count, sparkline_statistic,
+                     v2(render_dim.w - sparkline_dim.w, at_y + line_height), sparkline_dim);
+      at_y += line_height;
+
+      draw_debug_statistic(renderer, font, "CY", &cycle_statistic, v2(0.0f, at_y), font_scale,
+                           text_colour);
+      at_y += line_height;
+      draw_debug_statistic(renderer, font, "H", &hit_statistic, v2(0.0f, at_y), font_scale,
+                           text_colour);
+      at_y += line_height;
+      draw_debug_statistic(renderer, font, "CY/H", &cycles_over_hits_statistic, v2(0.0f, at_y), 
+                           font_scale, text_colour);
+      at_y += (line_height * 1.5f);
     }
-
   }
+
+  return at_y;
 }
 
+
+#if 0
+
 void
 debug_frame_end(Memory *memory, PlatformDebugInfo *platform_debug_info)
 {
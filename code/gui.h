@@ -18,6 +18,20 @@ typedef struct CapitalMonospacedFont
   s32 width, height;
 } CapitalMonospacedFont;
 
+// NOTE(Ryan): Status lines, e.g. COMPILING, sit this far in from the right edge
+#define DEBUG_STATUS_INSET 280.0f
+#define CAMERA_PANEL_MAX_WIDTH 320.0f
+#define CAMERA_PANEL_MIN_WIDTH 64.0f
+#define DEBUG_CONSOLE_LINE_COUNT 32
+#define DEBUG_CONSOLE_LINE_LENGTH 160
+typedef struct DebugConsole
+{
+  char lines[DEBUG_CONSOLE_LINE_COUNT][DEBUG_CONSOLE_LINE_LENGTH];
+  u32 next_line_index;
+  u32 line_count;
+  u32 partial_line_length;
+} DebugConsole;
+
 typedef struct State
 {
   b32 is_initialised;
@@ -28,5 +42,19 @@ typedef struct State
 
   CapitalMonospacedFont font;
 
+  DebugState debug_state;
+  DebugVariable debug_variables[DEBUG_VARIABLE_COUNT];
+
+  DebugConsole console;
+  ExecutingProcess rebuild_process;
+  b32 rebuild_pending;
+
+  // NOTE(Ryan): Made once the camera is open, and made again if its format or size changes
+  SDL_Texture *camera_texture;
+  PIXEL_FORMAT camera_texture_format;
+  u32 camera_texture_width;
+  u32 camera_texture_height;
+  b32 has_camera_frame;
+
   r32 time; 
 } State;
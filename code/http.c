@@ -0,0 +1,1018 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+
+#include "http.h"
+
+// NOTE(Ryan):
+//  GET /path?query_string HTTP/1.1\r\n
+//  Host: example\r\n
+//  \r\n
+//  POST /path HTTP/1.1\r\n
+//  Content-Type: text/plain\r\n
+//  Content-Length: 12\r\n
+//  \r\n
+//  query_string
+//
+// The parser is fed the whole connection buffer each time more bytes arrive and
+// resumes from where it stopped. Lines are only consumed once complete, so nothing
+// is copied out; slices point straight into the buffer.
+
+INTERNAL b32
+is_http_token_char(u8 ch)
+{
+  b32 result = false;
+
+  if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9'))
+  {
+    result = true;
+  }
+  else
+  {
+    switch (ch)
+    {
+      case '!': case '#': case '$': case '%': case '&': case '\'': case '*':
+      case '+': case '-': case '.': case '^': case '_': case '`': case '|': case '~':
+      {
+        result = true;
+      } break;
+    }
+  }
+
+  return result;
+}
+
+INTERNAL void
+consume_whitespace(u8 **at, u8 *end)
+{
+  while (*at < end && ((*at)[0] == ' ' || (*at)[0] == '\t'))
+  {
+    (*at)++;
+  }
+}
+
+// NOTE(Ryan): Each scan returns the first byte at or after at that stops it, or end.
+// The SIMD versions classify 32 then 16 bytes at a time and finish with the scalar loop,
+// so all levels give byte-identical results. Most header fields are shorter than 32 bytes,
+// hence AVX2 still going through the 16 byte step.
+
+INTERNAL u8 *
+scan_token_scalar(u8 *at, u8 *end)
+{
+  while (at < end && is_http_token_char(at[0]))
+  {
+    at++;
+  }
+  return at;
+}
+
+INTERNAL b32
+is_http_visible_char(u8 ch)
+{
+  return (ch > ' ' && ch != 0x7f);
+}
+
+INTERNAL u8 *
+scan_visible_scalar(u8 *at, u8 *end)
+{
+  while (at < end && is_http_visible_char(at[0]))
+  {
+    at++;
+  }
+  return at;
+}
+
+INTERNAL u8 *
+scan_line_content_scalar(u8 *at, u8 *end)
+{
+  while (at < end && at[0] != '\r' && at[0] != '\n')
+  {
+    at++;
+  }
+  return at;
+}
+
+INTERNAL u8 *
+scan_newline_scalar(u8 *at, u8 *end)
+{
+  while (at < end && at[0] != '\n')
+  {
+    at++;
+  }
+  return at;
+}
+
+GLOBAL HTTP_SCAN_LEVEL global_http_scan_level = HTTP_SCAN_LEVEL_SCALAR;
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// NOTE(Ryan): Byte class lookup by nibble. A byte is in the class when
+// lo_table[byte & 0xf] & hi_table[byte >> 4] is non-zero.
+// High nibbles whose rows hold the same set of low nibbles share a bit,
+// so any class with at most 8 distinct rows fits, e.g. visible chars include 0x80-0xff
+typedef struct HTTPByteClass
+{
+  u8 lo_table[16];
+  u8 hi_table[16];
+} HTTPByteClass;
+
+GLOBAL HTTPByteClass global_http_token_class;
+GLOBAL HTTPByteClass global_http_visible_class;
+
+INTERNAL b32
+build_http_byte_class(HTTPByteClass *byte_class, b32 (*is_in_class)(u8))
+{
+  memset(byte_class, 0, sizeof(*byte_class));
+
+  u16 row_patterns[8] = {0};
+  u32 row_pattern_count = 0;
+  for (u32 hi = 0;
+       hi < 16;
+       ++hi)
+  {
+    u16 row_pattern = 0;
+    for (u32 lo = 0;
+         lo < 16;
+         ++lo)
+    {
+      if (is_in_class((u8)((hi << 4) | lo)))
+      {
+        row_pattern |= (u16)(1 << lo);
+      }
+    }
+    if (row_pattern == 0)
+    {
+      continue;
+    }
+
+    u32 bit_i = 0;
+    while (bit_i < row_pattern_count && row_patterns[bit_i] != row_pattern)
+    {
+      bit_i++;
+    }
+    if (bit_i == row_pattern_count)
+    {
+      if (row_pattern_count == 8)
+      {
+        return false;
+      }
+      row_patterns[row_pattern_count++] = row_pattern;
+    }
+
+    byte_class->hi_table[hi] = (u8)(1 << bit_i);
+    for (u32 lo = 0;
+         lo < 16;
+         ++lo)
+    {
+      if (row_pattern & (1 << lo))
+      {
+        byte_class->lo_table[lo] |= (u8)(1 << bit_i);
+      }
+    }
+  }
+
+  return true;
+}
+
+// NOTE(Ryan): Returns a mask with a bit set for every byte NOT in the class
+__attribute__((target("sse4.2"))) INTERNAL u32
+classify_bytes_sse42(__m128i data, HTTPByteClass *byte_class)
+{
+  __m128i lo_table = _mm_loadu_si128((__m128i *)byte_class->lo_table);
+  __m128i hi_table = _mm_loadu_si128((__m128i *)byte_class->hi_table);
+  __m128i nibble_mask = _mm_set1_epi8(0x0f);
+
+  __m128i lo_bits = _mm_shuffle_epi8(lo_table, _mm_and_si128(data, nibble_mask));
+  __m128i hi_bits = _mm_shuffle_epi8(hi_table, 
+                                     _mm_and_si128(_mm_srli_epi16(data, 4), nibble_mask));
+  __m128i in_class = _mm_and_si128(lo_bits, hi_bits);
+
+  return (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(in_class, _mm_setzero_si128()));
+}
+
+__attribute__((target("sse4.2"))) INTERNAL u8 *
+scan_byte_class_sse42(u8 *at, u8 *end, HTTPByteClass *byte_class)
+{
+  while (end - at >= 16)
+  {
+    u32 stop_mask = classify_bytes_sse42(_mm_loadu_si128((__m128i *)at), byte_class);
+    if (stop_mask != 0)
+    {
+      return at + __builtin_ctz(stop_mask);
+    }
+    at += 16;
+  }
+  return at;
+}
+
+// NOTE(Ryan): PCMPESTRI in equal-any mode gives the index of the first needle byte, or 16
+__attribute__((target("sse4.2"))) INTERNAL u8 *
+scan_any_of_sse42(u8 *at, u8 *end, const char *needles, s32 needle_count)
+{
+  __m128i needle = _mm_loadu_si128((__m128i *)needles);
+  while (end - at >= 16)
+  {
+    __m128i data = _mm_loadu_si128((__m128i *)at);
+    s32 index = _mm_cmpestri(needle, needle_count, data, 16, 
+                             _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+    if (index < 16)
+    {
+      return at + index;
+    }
+    at += 16;
+  }
+  return at;
+}
+
+__attribute__((target("avx2"))) INTERNAL u8 *
+scan_byte_class_avx2(u8 *at, u8 *end, HTTPByteClass *byte_class)
+{
+  __m256i lo_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)byte_class->lo_table));
+  __m256i hi_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)byte_class->hi_table));
+  __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+
+  while (end - at >= 32)
+  {
+    __m256i data = _mm256_loadu_si256((__m256i *)at);
+    __m256i lo_bits = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(data, nibble_mask));
+    __m256i hi_bits = _mm256_shuffle_epi8(hi_table, 
+                                          _mm256_and_si256(_mm256_srli_epi16(data, 4), nibble_mask));
+    __m256i in_class = _mm256_and_si256(lo_bits, hi_bits);
+    u32 stop_mask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(in_class, 
+                                                                _mm256_setzero_si256()));
+    if (stop_mask != 0)
+    {
+      return at + __builtin_ctz(stop_mask);
+    }
+    at += 32;
+  }
+  return at;
+}
+
+__attribute__((target("avx2"))) INTERNAL u8 *
+scan_line_content_avx2(u8 *at, u8 *end)
+{
+  __m256i cr = _mm256_set1_epi8('\r');
+  __m256i lf = _mm256_set1_epi8('\n');
+  while (end - at >= 32)
+  {
+    __m256i data = _mm256_loadu_si256((__m256i *)at);
+    __m256i is_stop = _mm256_or_si256(_mm256_cmpeq_epi8(data, cr), _mm256_cmpeq_epi8(data, lf));
+    u32 stop_mask = (u32)_mm256_movemask_epi8(is_stop);
+    if (stop_mask != 0)
+    {
+      return at + __builtin_ctz(stop_mask);
+    }
+    at += 32;
+  }
+  return at;
+}
+
+__attribute__((target("avx2"))) INTERNAL u8 *
+scan_newline_avx2(u8 *at, u8 *end)
+{
+  __m256i lf = _mm256_set1_epi8('\n');
+  while (end - at >= 32)
+  {
+    __m256i data = _mm256_loadu_si256((__m256i *)at);
+    u32 stop_mask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(data, lf));
+    if (stop_mask != 0)
+    {
+      return at + __builtin_ctz(stop_mask);
+    }
+    at += 32;
+  }
+  return at;
+}
+#endif
+
+INTERNAL b32
+is_http_scan_level_supported(HTTP_SCAN_LEVEL level)
+{
+  b32 result = (level == HTTP_SCAN_LEVEL_SCALAR);
+
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (level == HTTP_SCAN_LEVEL_SSE42)
+  {
+    result = __builtin_cpu_supports("sse4.2");
+  }
+  else if (level == HTTP_SCAN_LEVEL_AVX2)
+  {
+    result = __builtin_cpu_supports("avx2");
+  }
+#endif
+
+  return result;
+}
+
+// NOTE(Ryan): Selects the widest level the CPU supports. Until called, scanning is scalar
+INTERNAL void
+http_init_scanning(void)
+{
+#if defined(__x86_64__)
+  if (!build_http_byte_class(&global_http_token_class, is_http_token_char) ||
+      !build_http_byte_class(&global_http_visible_class, is_http_visible_char))
+  {
+    return;
+  }
+#endif
+
+  for (u32 level = HTTP_SCAN_LEVEL_SCALAR;
+       level < HTTP_SCAN_LEVEL_COUNT;
+       ++level)
+  {
+    if (is_http_scan_level_supported((HTTP_SCAN_LEVEL)level))
+    {
+      global_http_scan_level = (HTTP_SCAN_LEVEL)level;
+    }
+  }
+}
+
+INTERNAL u8 *
+scan_token(u8 *at, u8 *end)
+{
+#if defined(__x86_64__)
+  if (global_http_scan_level == HTTP_SCAN_LEVEL_AVX2)
+  {
+    at = scan_byte_class_avx2(at, end, &global_http_token_class);
+  }
+  if (global_http_scan_level >= HTTP_SCAN_LEVEL_SSE42)
+  {
+    at = scan_byte_class_sse42(at, end, &global_http_token_class);
+  }
+#endif
+  return scan_token_scalar(at, end);
+}
+
+INTERNAL u8 *
+scan_visible(u8 *at, u8 *end)
+{
+#if defined(__x86_64__)
+  if (global_http_scan_level == HTTP_SCAN_LEVEL_AVX2)
+  {
+    at = scan_byte_class_avx2(at, end, &global_http_visible_class);
+  }
+  if (global_http_scan_level >= HTTP_SCAN_LEVEL_SSE42)
+  {
+    at = scan_byte_class_sse42(at, end, &global_http_visible_class);
+  }
+#endif
+  return scan_visible_scalar(at, end);
+}
+
+INTERNAL u8 *
+scan_line_content(u8 *at, u8 *end)
+{
+#if defined(__x86_64__)
+  if (global_http_scan_level == HTTP_SCAN_LEVEL_AVX2)
+  {
+    at = scan_line_content_avx2(at, end);
+  }
+  if (global_http_scan_level >= HTTP_SCAN_LEVEL_SSE42)
+  {
+    at = scan_any_of_sse42(at, end, "\r\n\0\0\0\0\0\0\0\0\0\0\0\0\0", 2);
+  }
+#endif
+  return scan_line_content_scalar(at, end);
+}
+
+INTERNAL u8 *
+scan_newline(u8 *at, u8 *end)
+{
+#if defined(__x86_64__)
+  if (global_http_scan_level == HTTP_SCAN_LEVEL_AVX2)
+  {
+    at = scan_newline_avx2(at, end);
+  }
+  if (global_http_scan_level >= HTTP_SCAN_LEVEL_SSE42)
+  {
+    at = scan_any_of_sse42(at, end, "\n\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 1);
+  }
+#endif
+  return scan_newline_scalar(at, end);
+}
+
+INTERNAL u32
+consume_identifier(u8 **at, u8 *end)
+{
+  u8 *start = *at;
+  *at = scan_token(start, end);
+  return (u32)(*at - start);
+}
+
+// NOTE(Ryan): Request target, i.e. any visible character
+INTERNAL u32
+consume_target(u8 **at, u8 *end)
+{
+  u8 *start = *at;
+  *at = scan_visible(start, end);
+  return (u32)(*at - start);
+}
+
+INTERNAL u32
+consume_value(u8 **at, u8 *end)
+{
+  u8 *start = *at;
+  *at = scan_line_content(start, end);
+  return (u32)(*at - start);
+}
+
+INTERNAL u8 *
+find_line_end(u8 *at, u8 *end)
+{
+  u8 *result = scan_newline(at, end);
+  return (result < end) ? result : NULL;
+}
+
+INTERNAL u8
+http_to_lower(u8 ch)
+{
+  return (ch >= 'A' && ch <= 'Z') ? (u8)(ch + ('a' - 'A')) : ch;
+}
+
+INTERNAL b32
+http_slice_equals(HTTPSlice slice, const char *str)
+{
+  u32 str_len = (u32)strlen(str);
+  return (slice.size == str_len) && (memcmp(slice.str, str, str_len) == 0);
+}
+
+INTERNAL b32
+http_slice_equals_ignore_case(HTTPSlice slice, const char *str)
+{
+  b32 result = (slice.size == (u32)strlen(str));
+
+  for (u32 ch_i = 0;
+       result && ch_i < slice.size;
+       ++ch_i)
+  {
+    result = (http_to_lower(slice.str[ch_i]) == http_to_lower((u8)str[ch_i]));
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): For comma separated header values, e.g. "Connection: keep-alive, Upgrade"
+INTERNAL b32
+http_slice_has_token(HTTPSlice slice, const char *token)
+{
+  b32 result = false;
+
+  u8 *at = slice.str;
+  u8 *end = slice.str + slice.size;
+  while (at < end && !result)
+  {
+    consume_whitespace(&at, end);
+    HTTPSlice element = {at, 0};
+    while (at < end && at[0] != ',')
+    {
+      at++;
+    }
+    element.size = (u32)(at - element.str);
+    while (element.size > 0 &&
+           (element.str[element.size - 1] == ' ' || element.str[element.size - 1] == '\t'))
+    {
+      element.size--;
+    }
+
+    result = http_slice_equals_ignore_case(element, token);
+    at++;
+  }
+
+  return result;
+}
+
+INTERNAL HTTPSlice
+http_find_header(HTTPRequest *request, const char *key)
+{
+  HTTPSlice result = {0};
+
+  for (u32 header_i = 0;
+       header_i < request->header_count;
+       ++header_i)
+  {
+    if (http_slice_equals_ignore_case(request->headers[header_i].key, key))
+    {
+      result = request->headers[header_i].value;
+      break;
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): The value of key=value in the query string, as is without percent decoding.
+// A key with no value gives an empty slice, and one not there a NULL one
+INTERNAL HTTPSlice
+http_find_query_param(HTTPRequest *request, const char *key)
+{
+  HTTPSlice result = {0};
+
+  u32 key_len = (u32)strlen(key);
+  u8 *at = request->query.str;
+  u8 *end = request->query.str + request->query.size;
+  while (at < end)
+  {
+    u8 *param_end = memchr(at, '&', (size_t)(end - at));
+    if (param_end == NULL)
+    {
+      param_end = end;
+    }
+
+    u32 param_len = (u32)(param_end - at);
+    if (param_len >= key_len && memcmp(at, key, key_len) == 0 &&
+        (param_len == key_len || at[key_len] == '='))
+    {
+      result.str = at + key_len + ((param_len > key_len) ? 1 : 0);
+      result.size = (u32)(param_end - result.str);
+      break;
+    }
+    at = param_end + 1;
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Returns false unless the whole slice is decimal digits that fit
+INTERNAL b32
+http_slice_to_u32(HTTPSlice slice, u32 *value)
+{
+  b32 result = (slice.size > 0 && slice.size <= 9);
+
+  u32 parsed = 0;
+  for (u32 ch_i = 0;
+       ch_i < slice.size && result;
+       ++ch_i)
+  {
+    u8 ch = slice.str[ch_i];
+    result = (ch >= '0' && ch <= '9');
+    parsed = parsed * 10 + (u32)(ch - '0');
+  }
+
+  if (result)
+  {
+    *value = parsed;
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): As http_slice_to_u32(), for values such as millisecond timestamps
+INTERNAL b32
+http_slice_to_u64(HTTPSlice slice, u64 *value)
+{
+  b32 result = (slice.size > 0 && slice.size <= 19);
+
+  u64 parsed = 0;
+  for (u32 ch_i = 0;
+       ch_i < slice.size && result;
+       ++ch_i)
+  {
+    u8 ch = slice.str[ch_i];
+    result = (ch >= '0' && ch <= '9');
+    parsed = parsed * 10 + (u64)(ch - '0');
+  }
+
+  if (result)
+  {
+    *value = parsed;
+  }
+
+  return result;
+}
+
+INTERNAL void
+http_parser_reset(HTTPParser *parser)
+{
+  HTTPParser zero_parser = {0};
+  *parser = zero_parser;
+}
+
+INTERNAL HTTP_PARSE_RESULT
+http_parse_error(HTTPParser *parser, u32 status)
+{
+  parser->error_status = status;
+  return HTTP_PARSE_RESULT_ERROR;
+}
+
+INTERNAL HTTP_PARSE_RESULT
+parse_request_line(HTTPParser *parser, u8 *at, u8 *end)
+{
+  HTTPRequest *request = &parser->request;
+
+  request->method_name.str = at;
+  request->method_name.size = consume_identifier(&at, end);
+  if (request->method_name.size == 0 || at >= end || at[0] != ' ')
+  {
+    return http_parse_error(parser, 400);
+  }
+  at++;
+
+  request->target.str = at;
+  request->target.size = consume_target(&at, end);
+  if (request->target.size == 0 || at >= end || at[0] != ' ')
+  {
+    return http_parse_error(parser, 400);
+  }
+  at++;
+
+  u8 *version = at;
+  if (end - version != 8 || memcmp(version, "HTTP/", 5) != 0)
+  {
+    return http_parse_error(parser, 400);
+  }
+  if (version[5] != '1' || version[6] != '.' || version[7] < '0' || version[7] > '9')
+  {
+    return http_parse_error(parser, 505);
+  }
+  request->version_minor = (u32)(version[7] - '0');
+  request->is_keep_alive = (request->version_minor >= 1);
+
+  if (http_slice_equals(request->method_name, "GET"))
+  {
+    request->method = HTTP_METHOD_GET;
+  }
+  else if (http_slice_equals(request->method_name, "POST"))
+  {
+    request->method = HTTP_METHOD_POST;
+  }
+  else
+  {
+    return http_parse_error(parser, 501);
+  }
+
+  request->path = request->target;
+  for (u32 ch_i = 0;
+       ch_i < request->target.size;
+       ++ch_i)
+  {
+    if (request->target.str[ch_i] == '?')
+    {
+      request->path.size = ch_i;
+      request->query.str = request->target.str + ch_i + 1;
+      request->query.size = request->target.size - ch_i - 1;
+      break;
+    }
+  }
+
+  parser->state = HTTP_PARSE_STATE_HEADERS;
+
+  return HTTP_PARSE_RESULT_INCOMPLETE;
+}
+
+INTERNAL HTTP_PARSE_RESULT
+parse_header_line(HTTPParser *parser, u8 *at, u8 *end)
+{
+  HTTPRequest *request = &parser->request;
+
+  // NOTE(Ryan): Obsolete line folding is rejected, as RFC 9112 allows
+  if (at[0] == ' ' || at[0] == '\t')
+  {
+    return http_parse_error(parser, 400);
+  }
+
+  HTTPHeader header = {0};
+  header.key.str = at;
+  header.key.size = consume_identifier(&at, end);
+  if (header.key.size == 0 || at >= end || at[0] != ':')
+  {
+    return http_parse_error(parser, 400);
+  }
+  at++;
+
+  consume_whitespace(&at, end);
+  header.value.str = at;
+  header.value.size = consume_value(&at, end);
+  if (at < end)
+  {
+    // NOTE(Ryan): A bare CR inside a field value
+    return http_parse_error(parser, 400);
+  }
+  while (header.value.size > 0 &&
+         (header.value.str[header.value.size - 1] == ' ' ||
+          header.value.str[header.value.size - 1] == '\t'))
+  {
+    header.value.size--;
+  }
+
+  if (request->header_count == MAX_HTTP_HEADER_COUNT)
+  {
+    return http_parse_error(parser, 431);
+  }
+  request->headers[request->header_count++] = header;
+
+  if (http_slice_equals_ignore_case(header.key, "Content-Length"))
+  {
+    if (header.value.size == 0)
+    {
+      return http_parse_error(parser, 400);
+    }
+
+    u64 content_length = 0;
+    for (u32 ch_i = 0;
+         ch_i < header.value.size;
+         ++ch_i)
+    {
+      u8 ch = header.value.str[ch_i];
+      if (ch < '0' || ch > '9' || content_length > (U32_MAX / 10))
+      {
+        return http_parse_error(parser, 400);
+      }
+      content_length = (content_length * 10) + (ch - '0');
+    }
+
+    if (request->has_content_length && request->content_length != content_length)
+    {
+      return http_parse_error(parser, 400);
+    }
+    request->has_content_length = true;
+    request->content_length = content_length;
+  }
+  else if (http_slice_equals_ignore_case(header.key, "Transfer-Encoding"))
+  {
+    // NOTE(Ryan): Only chunked is understood, so any other coding cannot be decoded
+    if (!http_slice_equals_ignore_case(header.value, "chunked"))
+    {
+      return http_parse_error(parser, 501);
+    }
+    request->is_chunked = true;
+  }
+  else if (http_slice_equals_ignore_case(header.key, "Connection"))
+  {
+    if (http_slice_has_token(header.value, "close"))
+    {
+      request->is_keep_alive = false;
+    }
+    else if (http_slice_has_token(header.value, "keep-alive"))
+    {
+      request->is_keep_alive = true;
+    }
+  }
+
+  return HTTP_PARSE_RESULT_INCOMPLETE;
+}
+
+INTERNAL HTTP_PARSE_RESULT
+parse_chunk_size_line(HTTPParser *parser, u8 *at, u8 *end)
+{
+  u64 chunk_size = 0;
+  u32 digit_count = 0;
+  while (at < end)
+  {
+    u8 ch = http_to_lower(at[0]);
+    u32 digit = 0;
+    if (ch >= '0' && ch <= '9')
+    {
+      digit = ch - '0';
+    }
+    else if (ch >= 'a' && ch <= 'f')
+    {
+      digit = 10 + (ch - 'a');
+    }
+    else
+    {
+      break;
+    }
+
+    if (chunk_size > (U32_MAX >> 4))
+    {
+      return http_parse_error(parser, 413);
+    }
+    chunk_size = (chunk_size << 4) | digit;
+    digit_count++;
+    at++;
+  }
+
+  // NOTE(Ryan): Chunk extensions are ignored
+  consume_whitespace(&at, end);
+  if (digit_count == 0 || (at < end && at[0] != ';'))
+  {
+    return http_parse_error(parser, 400);
+  }
+
+  if (chunk_size == 0)
+  {
+    parser->state = HTTP_PARSE_STATE_TRAILERS;
+  }
+  else
+  {
+    parser->chunk_remaining = chunk_size;
+    parser->state = HTTP_PARSE_STATE_CHUNK_DATA;
+  }
+
+  return HTTP_PARSE_RESULT_INCOMPLETE;
+}
+
+// NOTE(Ryan): buf holds len bytes with room for capacity, and must not move between calls
+// for the same request. Returns HTTP_PARSE_RESULT_INCOMPLETE until more bytes are needed,
+// and an error when the request cannot fit in capacity.
+INTERNAL HTTP_PARSE_RESULT
+http_parse_request(HTTPParser *parser, u8 *buf, u32 len, u32 capacity)
+{
+  HTTPRequest *request = &parser->request;
+
+  while (true)
+  {
+    switch (parser->state)
+    {
+      case HTTP_PARSE_STATE_BODY:
+      {
+        if (len - parser->cursor < request->content_length)
+        {
+          return (len == capacity) ? http_parse_error(parser, 413) : HTTP_PARSE_RESULT_INCOMPLETE;
+        }
+
+        request->body.size = (u32)request->content_length;
+        parser->cursor += (u32)request->content_length;
+        parser->state = HTTP_PARSE_STATE_COMPLETE;
+      } break;
+      case HTTP_PARSE_STATE_CHUNK_DATA:
+      {
+        u32 available = len - parser->cursor;
+        u32 take = (available < parser->chunk_remaining) ? available : (u32)parser->chunk_remaining;
+
+        // NOTE(Ryan): Slide the data back over the chunk framing, so the body stays contiguous
+        memmove(request->body.str + request->body.size, buf + parser->cursor, take);
+        request->body.size += take;
+        parser->cursor += take;
+        parser->scanned = parser->cursor;
+        parser->chunk_remaining -= take;
+
+        if (parser->chunk_remaining > 0)
+        {
+          return (len == capacity) ? http_parse_error(parser, 413) : HTTP_PARSE_RESULT_INCOMPLETE;
+        }
+        parser->state = HTTP_PARSE_STATE_CHUNK_DATA_END;
+      } break;
+      case HTTP_PARSE_STATE_COMPLETE:
+      {
+        request->size = parser->cursor;
+        return HTTP_PARSE_RESULT_COMPLETE;
+      } break;
+      default:
+      {
+        u32 scan_start = (parser->scanned > parser->cursor) ? parser->scanned : parser->cursor;
+        u8 *line_end = find_line_end(buf + scan_start, buf + len);
+        if (line_end == NULL)
+        {
+          parser->scanned = len;
+
+          b32 is_in_header = (parser->state == HTTP_PARSE_STATE_REQUEST_LINE ||
+                              parser->state == HTTP_PARSE_STATE_HEADERS);
+          if (is_in_header && len > MAX_HTTP_HEADER_SIZE)
+          {
+            return http_parse_error(parser, 431);
+          }
+          if (len == capacity)
+          {
+            return http_parse_error(parser, is_in_header ? 431 : 413);
+          }
+          return HTTP_PARSE_RESULT_INCOMPLETE;
+        }
+
+        u8 *line = buf + parser->cursor;
+        u8 *line_content_end = line_end;
+        if (line_content_end > line && line_content_end[-1] == '\r')
+        {
+          line_content_end--;
+        }
+        parser->cursor = (u32)(line_end + 1 - buf);
+        parser->scanned = parser->cursor;
+
+        HTTP_PARSE_RESULT line_result = HTTP_PARSE_RESULT_INCOMPLETE;
+        b32 is_empty_line = (line == line_content_end);
+        switch (parser->state)
+        {
+          case HTTP_PARSE_STATE_REQUEST_LINE:
+          {
+            // NOTE(Ryan): Stray empty lines before a request are allowed
+            if (!is_empty_line)
+            {
+              line_result = parse_request_line(parser, line, line_content_end);
+            }
+          } break;
+          case HTTP_PARSE_STATE_HEADERS:
+          {
+            if (parser->cursor > MAX_HTTP_HEADER_SIZE)
+            {
+              return http_parse_error(parser, 431);
+            }
+
+            if (!is_empty_line)
+            {
+              line_result = parse_header_line(parser, line, line_content_end);
+            }
+            else
+            {
+              // NOTE(Ryan): Both framings at once is a request smuggling vector
+              if (request->is_chunked && request->has_content_length)
+              {
+                return http_parse_error(parser, 400);
+              }
+
+              request->body.str = buf + parser->cursor;
+              request->body.size = 0;
+              if (request->is_chunked)
+              {
+                parser->state = HTTP_PARSE_STATE_CHUNK_SIZE;
+              }
+              else if (request->content_length > 0)
+              {
+                if (parser->cursor + request->content_length > capacity)
+                {
+                  return http_parse_error(parser, 413);
+                }
+                parser->state = HTTP_PARSE_STATE_BODY;
+              }
+              else
+              {
+                parser->state = HTTP_PARSE_STATE_COMPLETE;
+              }
+            }
+          } break;
+          case HTTP_PARSE_STATE_CHUNK_SIZE:
+          {
+            line_result = parse_chunk_size_line(parser, line, line_content_end);
+          } break;
+          case HTTP_PARSE_STATE_CHUNK_DATA_END:
+          {
+            if (!is_empty_line)
+            {
+              return http_parse_error(parser, 400);
+            }
+            parser->state = HTTP_PARSE_STATE_CHUNK_SIZE;
+          } break;
+          case HTTP_PARSE_STATE_TRAILERS:
+          {
+            // NOTE(Ryan): Trailer fields are ignored
+            if (is_empty_line)
+            {
+              parser->state = HTTP_PARSE_STATE_COMPLETE;
+            }
+          } break;
+          default:
+          {
+          } break;
+        }
+
+        if (line_result == HTTP_PARSE_RESULT_ERROR)
+        {
+          return line_result;
+        }
+      } break;
+    }
+  }
+}
+
+// NOTE(Ryan): A NULL content_type leaves out the body headers, as for 304 Not Modified.
+// Returns the length the header needs, which may be more than buf_size
+INTERNAL u32
+http_format_response_header(u8 *buf, u32 buf_size, const char *status, const char *extra_headers,
+                            const char *content_type, u64 content_length, b32 is_keep_alive)
+{
+  const char *connection = is_keep_alive ? "keep-alive" : "close";
+
+  s32 result = 0;
+  if (content_type != NULL)
+  {
+    result = snprintf((char *)buf, buf_size, 
+                      "HTTP/1.1 %s\r\n"
+                      "%s"
+                      "Content-Type: %s\r\n"
+                      "Content-Length: %lu\r\n"
+                      "Connection: %s\r\n\r\n", 
+                      status, extra_headers, content_type, content_length, connection);
+  }
+  else
+  {
+    result = snprintf((char *)buf, buf_size, 
+                      "HTTP/1.1 %s\r\n"
+                      "%s"
+                      "Connection: %s\r\n\r\n", 
+                      status, extra_headers, connection);
+  }
+
+  return (result > 0) ? (u32)result : 0;
+}
+
+// NOTE(Ryan): Headers and body in one allocation, so sending it is a single write.
+// Returns an empty response if out of memory
+INTERNAL HTTPResponse
+http_build_response(const char *status, const char *extra_headers, const char *content_type, 
+                    const u8 *body, u32 body_len, b32 is_keep_alive)
+{
+  HTTPResponse result = {0};
+
+  u32 header_len = http_format_response_header(NULL, 0, status, extra_headers, content_type, 
+                                               body_len, is_keep_alive);
+  result.data = malloc(header_len + body_len + 1);
+  if (result.data != NULL)
+  {
+    http_format_response_header(result.data, header_len + 1, status, extra_headers, content_type, 
+                                body_len, is_keep_alive);
+    memcpy(result.data + header_len, body, body_len);
+    result.size = header_len + body_len;
+  }
+
+  return result;
+}
@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#pragma once
+
+#define MAX_HTTP_HEADER_COUNT 32
+#define MAX_HTTP_HEADER_SIZE KILOBYTES(8)
+
+// NOTE(Ryan): Points into the connection buffer, valid until the request is retired
+typedef struct HTTPSlice
+{
+  u8 *str;
+  u32 size;
+} HTTPSlice;
+
+typedef struct HTTPHeader
+{
+  HTTPSlice key;
+  HTTPSlice value;
+} HTTPHeader;
+
+typedef enum HTTP_METHOD
+{
+  HTTP_METHOD_UNKNOWN,
+  HTTP_METHOD_GET,
+  HTTP_METHOD_POST,
+  HTTP_METHOD_COUNT,
+} HTTP_METHOD;
+
+typedef struct HTTPRequest
+{
+  HTTP_METHOD method;
+  HTTPSlice method_name;
+  HTTPSlice target;
+  HTTPSlice path;
+  HTTPSlice query;
+  u32 version_minor;
+
+  HTTPHeader headers[MAX_HTTP_HEADER_COUNT];
+  u32 header_count;
+
+  b32 has_content_length;
+  u64 content_length;
+  b32 is_chunked;
+  b32 is_keep_alive;
+
+  // NOTE(Ryan): Chunked bodies are decoded in place, so this is always contiguous
+  HTTPSlice body;
+  // NOTE(Ryan): Bytes of the buffer the request occupied, including framing
+  u32 size;
+} HTTPRequest;
+
+// NOTE(Ryan): Status line, headers and body ready to be written as is
+typedef struct HTTPResponse
+{
+  u8 *data;
+  u32 size;
+} HTTPResponse;
+
+// NOTE(Ryan): How many bytes the header scanners classify per step.
+// Everything besides x86-64 stays scalar
+typedef enum HTTP_SCAN_LEVEL
+{
+  HTTP_SCAN_LEVEL_SCALAR,
+  HTTP_SCAN_LEVEL_SSE42,
+  HTTP_SCAN_LEVEL_AVX2,
+  HTTP_SCAN_LEVEL_COUNT,
+} HTTP_SCAN_LEVEL;
+
+typedef enum HTTP_PARSE_STATE
+{
+  HTTP_PARSE_STATE_REQUEST_LINE,
+  HTTP_PARSE_STATE_HEADERS,
+  HTTP_PARSE_STATE_BODY,
+  HTTP_PARSE_STATE_CHUNK_SIZE,
+  HTTP_PARSE_STATE_CHUNK_DATA,
+  HTTP_PARSE_STATE_CHUNK_DATA_END,
+  HTTP_PARSE_STATE_TRAILERS,
+  HTTP_PARSE_STATE_COMPLETE,
+} HTTP_PARSE_STATE;
+
+typedef enum HTTP_PARSE_RESULT
+{
+  HTTP_PARSE_RESULT_INCOMPLETE,
+  HTTP_PARSE_RESULT_COMPLETE,
+  HTTP_PARSE_RESULT_ERROR,
+} HTTP_PARSE_RESULT;
+
+typedef struct HTTPParser
+{
+  HTTP_PARSE_STATE state;
+  // NOTE(Ryan): Start of the first line not yet consumed
+  u32 cursor;
+  // NOTE(Ryan): How far past the cursor has been searched for a line end,
+  // so a line arriving in pieces is not rescanned from its start
+  u32 scanned;
+  u64 chunk_remaining;
+  // NOTE(Ryan): Status code to respond with on HTTP_PARSE_RESULT_ERROR
+  u32 error_status;
+
+  HTTPRequest request;
+} HTTPParser;
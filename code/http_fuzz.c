@@ -0,0 +1,215 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#include "types.h"
+
+#include "http.c"
+
+// NOTE(Ryan): libFuzzer target for the HTTP request parser. The first two bytes seed where
+// the rest is split into the pieces it arrives in, so the fuzzer explores the splits too.
+// Each request is parsed whole with every scan level and again in pieces, all of which
+// must stop in the same place, with every slice inside the buffer.
+// Built with HTTP_FUZZ_STANDALONE it instead replays the files it is given, e.g. a crash
+// input libFuzzer saved, so a finding can be reproduced without clang.
+
+#define HTTP_FUZZ_MAX_PIPELINED 16
+
+typedef struct FuzzParse
+{
+  HTTP_PARSE_RESULT result;
+  HTTPParser parser;
+} FuzzParse;
+
+INTERNAL void
+check_slice_in_buf(HTTPSlice slice, u8 *buf, u32 len)
+{
+  if (slice.size > 0 && (slice.str < buf || slice.str + slice.size > buf + len))
+  {
+    abort();
+  }
+}
+
+INTERNAL void
+check_fuzz_parse(FuzzParse *parse, u8 *buf, u32 len)
+{
+  HTTPRequest *request = &parse->parser.request;
+  if (parse->parser.cursor > len || request->header_count > MAX_HTTP_HEADER_COUNT)
+  {
+    abort();
+  }
+
+  if (parse->result == HTTP_PARSE_RESULT_COMPLETE)
+  {
+    if (request->size == 0 || request->size > len)
+    {
+      abort();
+    }
+
+    check_slice_in_buf(request->method_name, buf, len);
+    check_slice_in_buf(request->target, buf, len);
+    check_slice_in_buf(request->path, buf, len);
+    check_slice_in_buf(request->query, buf, len);
+    check_slice_in_buf(request->body, buf, len);
+    for (u32 header_i = 0;
+         header_i < request->header_count;
+         ++header_i)
+    {
+      check_slice_in_buf(request->headers[header_i].key, buf, len);
+      check_slice_in_buf(request->headers[header_i].value, buf, len);
+    }
+  }
+  else if (parse->result == HTTP_PARSE_RESULT_ERROR && parse->parser.error_status == 0)
+  {
+    abort();
+  }
+}
+
+// NOTE(Ryan): buf is exactly len bytes so any read past it is caught.
+// split_seed of 0 hands the parser the whole request at once
+INTERNAL void
+fuzz_parse(FuzzParse *parse, u8 *buf, u32 len, u32 split_seed)
+{
+  http_parser_reset(&parse->parser);
+
+  if (split_seed == 0)
+  {
+    parse->result = http_parse_request(&parse->parser, buf, len, len);
+  }
+  else
+  {
+    u32 random_state = split_seed;
+    u32 available = 0;
+    do
+    {
+      random_state = random_state * 1664525 + 1013904223;
+      available += 1 + ((random_state >> 16) % 64);
+      if (available > len)
+      {
+        available = len;
+      }
+      parse->result = http_parse_request(&parse->parser, buf, available, len);
+    } while (parse->result == HTTP_PARSE_RESULT_INCOMPLETE && available < len);
+  }
+
+  check_fuzz_parse(parse, buf, len);
+}
+
+INTERNAL b32
+fuzz_parses_agree(FuzzParse *a, FuzzParse *b)
+{
+  return (a->result == b->result &&
+          a->parser.state == b->parser.state &&
+          a->parser.error_status == b->parser.error_status &&
+          a->parser.request.size == b->parser.request.size &&
+          a->parser.request.header_count == b->parser.request.header_count &&
+          a->parser.request.target.size == b->parser.request.target.size &&
+          a->parser.request.body.size == b->parser.request.body.size &&
+          a->parser.request.is_keep_alive == b->parser.request.is_keep_alive);
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  LOCAL_PERSIST HTTP_SCAN_LEVEL max_level = HTTP_SCAN_LEVEL_COUNT;
+  if (max_level == HTTP_SCAN_LEVEL_COUNT)
+  {
+    http_init_scanning();
+    max_level = global_http_scan_level;
+  }
+
+  if (size <= 2 || size - 2 > MAX_HTTP_HEADER_SIZE * 4)
+  {
+    return 0;
+  }
+  u32 split_seed = (((u32)data[0] << 8) | data[1]) + 1;
+  const u8 *input = data + 2;
+  u32 input_len = (u32)(size - 2);
+
+  // NOTE(Ryan): Chunked bodies are decoded in place, so every parse gets a fresh copy
+  u8 *whole_buf = malloc(input_len);
+  u8 *split_buf = malloc(input_len);
+  if (whole_buf == NULL || split_buf == NULL)
+  {
+    abort();
+  }
+
+  // NOTE(Ryan): Pipelined requests follow one another in the buffer,
+  // each parsed from where the last ended
+  u32 start = 0;
+  for (u32 request_i = 0;
+       request_i < HTTP_FUZZ_MAX_PIPELINED && start < input_len;
+       ++request_i)
+  {
+    u32 len = input_len - start;
+    FuzzParse whole = {0};
+    FuzzParse split = {0};
+
+    global_http_scan_level = HTTP_SCAN_LEVEL_SCALAR;
+    memcpy(whole_buf, input + start, len);
+    fuzz_parse(&whole, whole_buf, len, 0);
+
+    for (u32 level = HTTP_SCAN_LEVEL_SCALAR;
+         level <= max_level;
+         ++level)
+    {
+      global_http_scan_level = (HTTP_SCAN_LEVEL)level;
+
+      if (level != HTTP_SCAN_LEVEL_SCALAR)
+      {
+        FuzzParse level_whole = {0};
+        memcpy(split_buf, input + start, len);
+        fuzz_parse(&level_whole, split_buf, len, 0);
+        if (!fuzz_parses_agree(&whole, &level_whole))
+        {
+          abort();
+        }
+      }
+
+      memcpy(split_buf, input + start, len);
+      fuzz_parse(&split, split_buf, len, split_seed + level);
+      if (!fuzz_parses_agree(&whole, &split) ||
+          (whole.result == HTTP_PARSE_RESULT_COMPLETE &&
+           memcmp(whole_buf, split_buf, whole.parser.request.size) != 0))
+      {
+        abort();
+      }
+    }
+
+    if (whole.result != HTTP_PARSE_RESULT_COMPLETE)
+    {
+      break;
+    }
+    start += whole.parser.request.size;
+  }
+
+  free(whole_buf);
+  free(split_buf);
+
+  return 0;
+}
+
+#if defined(HTTP_FUZZ_STANDALONE)
+int
+main(int argc, char *argv[])
+{
+  for (s32 arg_i = 1;
+       arg_i < argc;
+       ++arg_i)
+  {
+    FILE *file = fopen(argv[arg_i], "rb");
+    if (file == NULL)
+    {
+      printf("Unable to open %s\n", argv[arg_i]);
+      return 1;
+    }
+
+    u8 *data = malloc(MAX_HTTP_HEADER_SIZE * 4 + 2);
+    size_t size = fread(data, 1, MAX_HTTP_HEADER_SIZE * 4 + 2, file);
+    fclose(file);
+
+    LLVMFuzzerTestOneInput(data, size);
+    printf("%s: ok\n", argv[arg_i]);
+    free(data);
+  }
+
+  return 0;
+}
+#endif
@@ -0,0 +1,374 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#include "types.h"
+
+#include <time.h>
+#include <unistd.h>
+
+#include "jpeg_encoder.c"
+#include "frame_scale.c"
+
+// NOTE(Ryan): Megapixels a second the JPEG encoder sustains on camera-like frames,
+// for each input format at every SIMD level the CPU supports and across thread counts,
+// and the same for halving frames down the stream ladder
+
+typedef struct BenchImage
+{
+  const char *name;
+  PIXEL_FORMAT format;
+  u32 width;
+  u32 height;
+  u32 stride;
+  u8 *data;
+} BenchImage;
+
+GLOBAL const char *global_jpeg_simd_level_names[JPEG_SIMD_LEVEL_COUNT] = {
+  "scalar", "sse2", "avx2", "neon"
+};
+
+INTERNAL u64
+get_monotonic_ns(void)
+{
+  struct timespec ts = {0};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
+INTERNAL u8
+clamp_level(s32 value, s32 min, s32 max)
+{
+  return (u8)((value < min) ? min : (value > max) ? max : value);
+}
+
+// NOTE(Ryan): Gradients, hard edged tiles, a disc and sensor noise in video range,
+// which is about what a camera sees. Odd rows of tiles are offset so edges cross MCUs
+INTERNAL b32
+bench_image_init(BenchImage *image, const char *name, PIXEL_FORMAT format,
+                 u32 width, u32 height)
+{
+  image->name = name;
+  image->format = format;
+  image->width = width;
+  image->height = height;
+  // NOTE(Ryan): Padded like a driver might, so the stride is not assumed to be the width
+  image->stride = ((format == PIXEL_FORMAT_YUYV) ? width * 2 : width) + 64;
+  u32 size = image->stride * height * ((format == PIXEL_FORMAT_YUYV) ? 1 : 2);
+  image->data = calloc(size, 1);
+  if (image->data == NULL)
+  {
+    return false;
+  }
+
+  u32 noise = 1234;
+  s32 disc_x = (s32)width / 3;
+  s32 disc_y = (s32)height / 2;
+  s32 disc_radius = (s32)height / 4;
+  for (u32 y = 0;
+       y < height;
+       ++y)
+  {
+    for (u32 x = 0;
+         x < width;
+         ++x)
+    {
+      s32 luma = 40 + (s32)((x * 150) / width + (y * 40) / height);
+      if ((((x + (y / 48) * 24) / 64) + (y / 48)) % 5 == 0)
+      {
+        luma += 60;
+      }
+      s32 dx = (s32)x - disc_x;
+      s32 dy = (s32)y - disc_y;
+      if (dx * dx + dy * dy < disc_radius * disc_radius)
+      {
+        luma = 220;
+      }
+      noise = noise * 1103515245u + 12345u;
+      luma += (s32)((noise >> 16) & 15) - 8;
+
+      u8 y_level = clamp_level(16 + luma * 219 / 255, 16, 235);
+      u8 cb_level = clamp_level(98 + (s32)((x * 60) / width), 16, 240);
+      u8 cr_level = clamp_level(98 + (s32)((y * 60) / height), 16, 240);
+      if (format == PIXEL_FORMAT_YUYV)
+      {
+        u8 *pixel = image->data + y * image->stride + x * 2;
+        pixel[0] = y_level;
+        pixel[1] = (x % 2 == 0) ? cb_level : cr_level;
+      }
+      else
+      {
+        image->data[y * image->stride + x] = y_level;
+        if (x % 2 == 0 && y % 2 == 0)
+        {
+          u8 *pair = image->data + image->stride * height + (y / 2) * image->stride + x;
+          pair[0] = cb_level;
+          pair[1] = cr_level;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// NOTE(Ryan): Every level must produce the same bytes as scalar, whatever the thread count.
+// Sizes that are not whole MCUs go through the scalar loads at the edges
+INTERNAL b32
+check_simd_levels_agree(BenchImage *images, u32 image_count, JPEG_SIMD_LEVEL max_level)
+{
+  b32 result = true;
+
+  JPEGEncoder scalar_encoder = {0};
+  JPEGEncoder encoder = {0};
+  jpeg_encoder_start(&scalar_encoder, 1);
+  jpeg_encoder_start(&encoder, 3);
+  u8 *scalar_out = NULL;
+  u8 *out = NULL;
+
+  for (u32 image_i = 0;
+       image_i < image_count && result;
+       ++image_i)
+  {
+    BenchImage *image = images + image_i;
+    if (!jpeg_encoder_configure(&scalar_encoder, image->format, image->width, image->height,
+                                image->stride, true, JPEG_DEFAULT_QUALITY) ||
+        !jpeg_encoder_configure(&encoder, image->format, image->width, image->height,
+                                image->stride, true, JPEG_DEFAULT_QUALITY))
+    {
+      printf("%s: failed to configure\n", image->name);
+      result = false;
+      break;
+    }
+
+    global_jpeg_simd_level = JPEG_SIMD_LEVEL_SCALAR;
+    u32 scalar_size = jpeg_encode(&scalar_encoder, image->data);
+    scalar_out = realloc(scalar_out, scalar_size);
+    jpeg_encoder_write(&scalar_encoder, scalar_out);
+
+    for (u32 level = JPEG_SIMD_LEVEL_SCALAR;
+         level <= max_level;
+         ++level)
+    {
+      if (!is_jpeg_simd_level_supported((JPEG_SIMD_LEVEL)level))
+      {
+        continue;
+      }
+
+      global_jpeg_simd_level = (JPEG_SIMD_LEVEL)level;
+      u32 size = jpeg_encode(&encoder, image->data);
+      out = realloc(out, size);
+      jpeg_encoder_write(&encoder, out);
+      if (size != scalar_size || memcmp(out, scalar_out, size) != 0)
+      {
+        printf("%s disagrees with scalar on %s (%u vs %u bytes)\n",
+               global_jpeg_simd_level_names[level], image->name, size, scalar_size);
+        result = false;
+        break;
+      }
+    }
+  }
+
+  jpeg_encoder_stop(&scalar_encoder);
+  jpeg_encoder_stop(&encoder);
+  free(scalar_out);
+  free(out);
+
+  return result;
+}
+
+// NOTE(Ryan): Halving must also agree with scalar at every level, 
+// including widths that leave a scalar tail
+INTERNAL b32
+check_halving_agrees(BenchImage *images, u32 image_count, JPEG_SIMD_LEVEL max_level)
+{
+  b32 result = true;
+
+  for (u32 image_i = 0;
+       image_i < image_count && result;
+       ++image_i)
+  {
+    BenchImage *image = images + image_i;
+    // NOTE(Ryan): Trimmed to the largest size that halves
+    u32 width = image->width & ~3u;
+    u32 height = image->height & ~3u;
+    u32 size = frame_image_size(image->format, width / 2, height / 2);
+    u8 *scalar_out = malloc(size);
+    u8 *out = malloc(size);
+    if (scalar_out == NULL || out == NULL)
+    {
+      result = false;
+    }
+    else
+    {
+      global_jpeg_simd_level = JPEG_SIMD_LEVEL_SCALAR;
+      frame_halve(image->format, image->data, width, height, image->stride, scalar_out);
+      for (u32 level = JPEG_SIMD_LEVEL_SCALAR;
+           level <= max_level;
+           ++level)
+      {
+        if (!is_jpeg_simd_level_supported((JPEG_SIMD_LEVEL)level))
+        {
+          continue;
+        }
+
+        global_jpeg_simd_level = (JPEG_SIMD_LEVEL)level;
+        memset(out, 0, size);
+        frame_halve(image->format, image->data, width, height, image->stride, out);
+        if (memcmp(out, scalar_out, size) != 0)
+        {
+          printf("%s halving disagrees with scalar on %s\n", 
+                 global_jpeg_simd_level_names[level], image->name);
+          result = false;
+          break;
+        }
+      }
+    }
+    free(scalar_out);
+    free(out);
+  }
+
+  return result;
+}
+
+INTERNAL void
+bench_halve(BenchImage *image, JPEG_SIMD_LEVEL level, u32 iteration_count)
+{
+  u8 *out = malloc(frame_image_size(image->format, image->width / 2, image->height / 2));
+  if (out != NULL)
+  {
+    global_jpeg_simd_level = level;
+
+    u64 start_ns = get_monotonic_ns();
+    for (u32 iteration_i = 0;
+         iteration_i < iteration_count;
+         ++iteration_i)
+    {
+      frame_halve(image->format, image->data, image->width, image->height, image->stride, out);
+    }
+    r64 elapsed_seconds = (r64)(get_monotonic_ns() - start_ns) / 1000000000.0;
+
+    r64 megapixels = (r64)image->width * image->height * iteration_count / 1000000.0;
+    printf("  %-7s halve    %8.1f MP/s\n", global_jpeg_simd_level_names[level], 
+           megapixels / elapsed_seconds);
+  }
+  free(out);
+}
+
+INTERNAL void
+bench_encode(BenchImage *image, JPEG_SIMD_LEVEL level, u32 thread_count, u32 iteration_count)
+{
+  JPEGEncoder encoder = {0};
+  jpeg_encoder_start(&encoder, thread_count);
+  if (jpeg_encoder_configure(&encoder, image->format, image->width, image->height,
+                             image->stride, true, JPEG_DEFAULT_QUALITY))
+  {
+    global_jpeg_simd_level = level;
+
+    u32 size = 0;
+    u64 start_ns = get_monotonic_ns();
+    for (u32 iteration_i = 0;
+         iteration_i < iteration_count;
+         ++iteration_i)
+    {
+      size = jpeg_encode(&encoder, image->data);
+    }
+    r64 elapsed_seconds = (r64)(get_monotonic_ns() - start_ns) / 1000000000.0;
+
+    r64 megapixels = (r64)image->width * image->height * iteration_count / 1000000.0;
+    printf("  %-7s %2u threads %8.1f MP/s %7.1f fps %6u KB\n",
+           global_jpeg_simd_level_names[level], encoder.thread_count,
+           megapixels / elapsed_seconds, iteration_count / elapsed_seconds, size / 1024);
+  }
+  jpeg_encoder_stop(&encoder);
+}
+
+int
+main(int argc, char *argv[])
+{
+  u32 iteration_count = 200;
+  if (argc > 1)
+  {
+    iteration_count = (u32)atoi(argv[1]);
+  }
+
+  jpeg_init_simd();
+  JPEG_SIMD_LEVEL max_level = global_jpeg_simd_level;
+
+  BenchImage images[4] = {0};
+  if (!bench_image_init(images + 0, "yuyv 1280x720", PIXEL_FORMAT_YUYV, 1280, 720) ||
+      !bench_image_init(images + 1, "nv12 1280x720", PIXEL_FORMAT_NV12, 1280, 720) ||
+      !bench_image_init(images + 2, "yuyv 642x362", PIXEL_FORMAT_YUYV, 642, 362) ||
+      !bench_image_init(images + 3, "nv12 642x362", PIXEL_FORMAT_NV12, 642, 362))
+  {
+    printf("out of memory\n");
+    return 1;
+  }
+
+  if (!check_simd_levels_agree(images, 4, max_level) ||
+      !check_halving_agrees(images, 4, max_level))
+  {
+    return 1;
+  }
+  printf("simd levels up to %s agree with scalar\n\n", global_jpeg_simd_level_names[max_level]);
+
+  // NOTE(Ryan): Optionally keep a frame, to look at
+  if (argc > 2)
+  {
+    JPEGEncoder encoder = {0};
+    jpeg_encoder_start(&encoder, 1);
+    if (jpeg_encoder_configure(&encoder, images[0].format, images[0].width, images[0].height,
+                               images[0].stride, true, JPEG_DEFAULT_QUALITY))
+    {
+      u32 size = jpeg_encode(&encoder, images[0].data);
+      u8 *out = malloc(size);
+      FILE *file = fopen(argv[2], "wb");
+      if (out != NULL && file != NULL)
+      {
+        jpeg_encoder_write(&encoder, out);
+        fwrite(out, 1, size, file);
+      }
+      if (file != NULL)
+      {
+        fclose(file);
+      }
+      free(out);
+    }
+    jpeg_encoder_stop(&encoder);
+  }
+
+  s32 cpu_count = (s32)sysconf(_SC_NPROCESSORS_ONLN);
+  for (u32 image_i = 0;
+       image_i < 2;
+       ++image_i)
+  {
+    BenchImage *image = images + image_i;
+    printf("%s, quality %u\n", image->name, JPEG_DEFAULT_QUALITY);
+
+    for (u32 level = JPEG_SIMD_LEVEL_SCALAR;
+         level <= max_level;
+         ++level)
+    {
+      if (is_jpeg_simd_level_supported((JPEG_SIMD_LEVEL)level))
+      {
+        bench_encode(image, (JPEG_SIMD_LEVEL)level, 1, iteration_count);
+      }
+    }
+
+    for (u32 thread_count = 2;
+         thread_count <= MAX_JPEG_THREAD_COUNT && (s32)thread_count <= cpu_count;
+         thread_count *= 2)
+    {
+      bench_encode(image, max_level, thread_count, iteration_count);
+    }
+
+    for (u32 level = JPEG_SIMD_LEVEL_SCALAR;
+         level <= max_level;
+         ++level)
+    {
+      if (is_jpeg_simd_level_supported((JPEG_SIMD_LEVEL)level))
+      {
+        bench_halve(image, (JPEG_SIMD_LEVEL)level, iteration_count);
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#pragma once
+
+// NOTE(Ryan): Entropy coded data is written MSB first, 0xff bytes being stuffed.
+// Shared by the encoder and the synthetic frame source, which codes only DC coefficients
+
+typedef struct JPEGBitWriter
+{
+  u8 *at;
+  u64 bits;
+  u32 bit_count;
+} JPEGBitWriter;
+
+INTERNAL void
+jpeg_emit_byte(JPEGBitWriter *writer, u8 byte)
+{
+  *writer->at++ = byte;
+  // NOTE(Ryan): Stuffed, so it is not taken for a marker
+  if (byte == 0xff)
+  {
+    *writer->at++ = 0x00;
+  }
+}
+
+// NOTE(Ryan): code_len is 1 to 16. Whole bytes are only written out 4 at a time
+INTERNAL void
+jpeg_put_bits(JPEGBitWriter *writer, u32 code, u32 code_len)
+{
+  writer->bits = (writer->bits << code_len) | (code & ((1u << code_len) - 1));
+  writer->bit_count += code_len;
+  if (writer->bit_count >= 32)
+  {
+    writer->bit_count -= 32;
+    u32 word = (u32)(writer->bits >> writer->bit_count);
+
+    // NOTE(Ryan): Any 0xff byte is a zero byte in the inverse
+    u32 inverse = ~word;
+    if (((inverse - 0x01010101u) & ~inverse & 0x80808080u) == 0)
+    {
+      writer->at[0] = (u8)(word >> 24);
+      writer->at[1] = (u8)(word >> 16);
+      writer->at[2] = (u8)(word >> 8);
+      writer->at[3] = (u8)word;
+      writer->at += 4;
+    }
+    else
+    {
+      jpeg_emit_byte(writer, (u8)(word >> 24));
+      jpeg_emit_byte(writer, (u8)(word >> 16));
+      jpeg_emit_byte(writer, (u8)(word >> 8));
+      jpeg_emit_byte(writer, (u8)word);
+    }
+  }
+}
+
+// NOTE(Ryan): Pads the last byte with ones, as the standard asks
+INTERNAL void
+jpeg_flush_bits(JPEGBitWriter *writer)
+{
+  u32 pad_len = (8 - (writer->bit_count & 7)) & 7;
+  if (pad_len > 0)
+  {
+    writer->bits = (writer->bits << pad_len) | ((1u << pad_len) - 1);
+    writer->bit_count += pad_len;
+  }
+
+  while (writer->bit_count >= 8)
+  {
+    writer->bit_count -= 8;
+    jpeg_emit_byte(writer, (u8)(writer->bits >> writer->bit_count));
+  }
+}
+
+INTERNAL u8 *
+jpeg_put_u16(u8 *at, u32 value)
+{
+  at[0] = (u8)(value >> 8);
+  at[1] = (u8)value;
+  return at + 2;
+}
@@ -0,0 +1,1374 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+
+#include "jpeg_encoder.h"
+#include "jpeg_bits.h"
+
+// NOTE(Ryan): Baseline JPEG from raw YUYV or NV12, so quality and frame rate are ours
+// rather than the camera's onboard encoder. Each MCU is loaded and level shifted,
+// transformed with the AAN integer DCT, quantised and Huffman coded with the Annex K tables.
+// The first three stages have SSE2, AVX2 (two blocks at a time) and NEON versions that
+// give output byte-identical to the scalar one, as they all do the same 16 bit arithmetic.
+// Every MCU row is a restart interval, so rows are coded independently by a pool of threads
+// and joined with RST markers.
+
+// NOTE(Ryan): Index into the natural order for each zigzag position
+GLOBAL const u8 global_jpeg_zigzag[64] = {
+   0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+GLOBAL const u8 global_jpeg_luma_quant_table[64] = {
+  16,  11,  10,  16,  24,  40,  51,  61,
+  12,  12,  14,  19,  26,  58,  60,  55,
+  14,  13,  16,  24,  40,  57,  69,  56,
+  14,  17,  22,  29,  51,  87,  80,  62,
+  18,  22,  37,  56,  68, 109, 103,  77,
+  24,  35,  55,  64,  81, 104, 113,  92,
+  49,  64,  78,  87, 103, 121, 120, 101,
+  72,  92,  95,  98, 112, 100, 103,  99
+};
+
+GLOBAL const u8 global_jpeg_chroma_quant_table[64] = {
+  17,  18,  24,  47,  99,  99,  99,  99,
+  18,  21,  26,  66,  99,  99,  99,  99,
+  24,  26,  56,  99,  99,  99,  99,  99,
+  47,  66,  99,  99,  99,  99,  99,  99,
+  99,  99,  99,  99,  99,  99,  99,  99,
+  99,  99,  99,  99,  99,  99,  99,  99,
+  99,  99,  99,  99,  99,  99,  99,  99,
+  99,  99,  99,  99,  99,  99,  99,  99
+};
+
+// NOTE(Ryan): Code counts for each length 1 to 16, then the symbols in code order
+GLOBAL const u8 global_jpeg_luma_dc_lengths[16] = {
+  0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0
+};
+GLOBAL const u8 global_jpeg_chroma_dc_lengths[16] = {
+  0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0
+};
+GLOBAL const u8 global_jpeg_dc_symbols[12] = {
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
+};
+
+GLOBAL const u8 global_jpeg_luma_ac_lengths[16] = {
+  0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d
+};
+GLOBAL const u8 global_jpeg_luma_ac_symbols[162] = {
+  0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+  0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+  0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+  0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+  0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+  0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+  0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+  0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+  0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+  0xf9, 0xfa
+};
+
+GLOBAL const u8 global_jpeg_chroma_ac_lengths[16] = {
+  0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77
+};
+GLOBAL const u8 global_jpeg_chroma_ac_symbols[162] = {
+  0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+  0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+  0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+  0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+  0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+  0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+  0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+  0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+  0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+  0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+  0xf9, 0xfa
+};
+
+// NOTE(Ryan): cos(k * pi / 16) * sqrt(2), k > 0, in 2.14 fixed point.
+// The AAN DCT leaves coefficient (u, v) scaled by 8 times the u and v entries,
+// which is taken out by the quantiser rather than by extra multiplies
+GLOBAL const u32 global_jpeg_aan_scales[8] = {
+  16384, 22725, 21407, 19266, 16384, 12873, 8867, 4520
+};
+
+// NOTE(Ryan): Multipliers in 2.14 fixed point
+#define JPEG_FIX_0_382683433 6270
+#define JPEG_FIX_0_541196100 8867
+#define JPEG_FIX_0_707106781 11585
+#define JPEG_FIX_1_306562965 21407
+
+// NOTE(Ryan): Enough for any block at any quality, stuffing included
+#define JPEG_MAX_BLOCK_CODED_SIZE 512
+
+GLOBAL JPEG_SIMD_LEVEL global_jpeg_simd_level = JPEG_SIMD_LEVEL_SCALAR;
+
+INTERNAL b32
+is_jpeg_simd_level_supported(JPEG_SIMD_LEVEL level)
+{
+  b32 result = (level == JPEG_SIMD_LEVEL_SCALAR);
+
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (level == JPEG_SIMD_LEVEL_SSE2)
+  {
+    result = true;
+  }
+  else if (level == JPEG_SIMD_LEVEL_AVX2)
+  {
+    result = __builtin_cpu_supports("avx2");
+  }
+#elif defined(__aarch64__)
+  if (level == JPEG_SIMD_LEVEL_NEON)
+  {
+    result = true;
+  }
+#endif
+
+  return result;
+}
+
+// NOTE(Ryan): Selects the widest level the CPU supports. Until called, encoding is scalar
+INTERNAL void
+jpeg_init_simd(void)
+{
+  for (u32 level = JPEG_SIMD_LEVEL_SCALAR;
+       level < JPEG_SIMD_LEVEL_COUNT;
+       ++level)
+  {
+    if (is_jpeg_simd_level_supported((JPEG_SIMD_LEVEL)level))
+    {
+      global_jpeg_simd_level = (JPEG_SIMD_LEVEL)level;
+    }
+  }
+}
+
+INTERNAL s16
+jpeg_map_level(JPEGLevelMap *map, s32 value)
+{
+  s32 result = value - map->offset;
+  result += (result * map->gain) >> 8;
+  result += map->bias;
+  return (s16)((result < -128) ? -128 : (result > 127) ? 127 : result);
+}
+
+// NOTE(Ryan): Past the right or bottom edge the last pixel is repeated
+INTERNAL void
+jpeg_load_mcu_scalar(JPEGEncoder *encoder, const u8 *image, u32 mcu_x, u32 mcu_y,
+                     s16 (*blocks)[64])
+{
+  JPEGLevelMap *luma_map = encoder->level_maps + 0;
+  JPEGLevelMap *chroma_map = encoder->level_maps + 1;
+  u32 max_x = encoder->width - 1;
+  u32 max_y = encoder->height - 1;
+  u32 max_chroma_x = max_x / 2;
+
+  if (encoder->format == PIXEL_FORMAT_YUYV)
+  {
+    for (u32 y = 0;
+         y < 8;
+         ++y)
+    {
+      u32 image_y = mcu_y * 8 + y;
+      const u8 *row = image + ((image_y < max_y) ? image_y : max_y) * encoder->stride;
+      for (u32 x = 0;
+           x < 16;
+           ++x)
+      {
+        u32 image_x = mcu_x * 16 + x;
+        image_x = (image_x < max_x) ? image_x : max_x;
+        blocks[x / 8][y * 8 + (x % 8)] = jpeg_map_level(luma_map, row[image_x * 2]);
+      }
+      for (u32 x = 0;
+           x < 8;
+           ++x)
+      {
+        u32 chroma_x = mcu_x * 8 + x;
+        chroma_x = (chroma_x < max_chroma_x) ? chroma_x : max_chroma_x;
+        blocks[2][y * 8 + x] = jpeg_map_level(chroma_map, row[chroma_x * 4 + 1]);
+        blocks[3][y * 8 + x] = jpeg_map_level(chroma_map, row[chroma_x * 4 + 3]);
+      }
+    }
+  }
+  else
+  {
+    for (u32 y = 0;
+         y < 16;
+         ++y)
+    {
+      u32 image_y = mcu_y * 16 + y;
+      const u8 *row = image + ((image_y < max_y) ? image_y : max_y) * encoder->stride;
+      for (u32 x = 0;
+           x < 16;
+           ++x)
+      {
+        u32 image_x = mcu_x * 16 + x;
+        image_x = (image_x < max_x) ? image_x : max_x;
+        blocks[(y / 8) * 2 + x / 8][(y % 8) * 8 + (x % 8)] =
+          jpeg_map_level(luma_map, row[image_x]);
+      }
+    }
+
+    const u8 *chroma_plane = image + encoder->stride * encoder->height;
+    u32 max_chroma_y = max_y / 2;
+    for (u32 y = 0;
+         y < 8;
+         ++y)
+    {
+      u32 chroma_y = mcu_y * 8 + y;
+      const u8 *row = chroma_plane +
+                      ((chroma_y < max_chroma_y) ? chroma_y : max_chroma_y) * encoder->stride;
+      for (u32 x = 0;
+           x < 8;
+           ++x)
+      {
+        u32 chroma_x = mcu_x * 8 + x;
+        chroma_x = (chroma_x < max_chroma_x) ? chroma_x : max_chroma_x;
+        blocks[4][y * 8 + x] = jpeg_map_level(chroma_map, row[chroma_x * 2]);
+        blocks[5][y * 8 + x] = jpeg_map_level(chroma_map, row[chroma_x * 2 + 1]);
+      }
+    }
+  }
+}
+
+INTERNAL s32
+jpeg_mul_scalar(s32 value, s32 constant)
+{
+  return (value * constant) >> 14;
+}
+
+// NOTE(Ryan): One dimensional DCT down each of the 8 columns
+INTERNAL void
+jpeg_fdct_pass_scalar(s32 (*rows)[8])
+{
+  for (u32 lane = 0;
+       lane < 8;
+       ++lane)
+  {
+    s32 tmp0 = rows[0][lane] + rows[7][lane];
+    s32 tmp7 = rows[0][lane] - rows[7][lane];
+    s32 tmp1 = rows[1][lane] + rows[6][lane];
+    s32 tmp6 = rows[1][lane] - rows[6][lane];
+    s32 tmp2 = rows[2][lane] + rows[5][lane];
+    s32 tmp5 = rows[2][lane] - rows[5][lane];
+    s32 tmp3 = rows[3][lane] + rows[4][lane];
+    s32 tmp4 = rows[3][lane] - rows[4][lane];
+
+    s32 tmp10 = tmp0 + tmp3;
+    s32 tmp13 = tmp0 - tmp3;
+    s32 tmp11 = tmp1 + tmp2;
+    s32 tmp12 = tmp1 - tmp2;
+    rows[0][lane] = tmp10 + tmp11;
+    rows[4][lane] = tmp10 - tmp11;
+    s32 z1 = jpeg_mul_scalar(tmp12 + tmp13, JPEG_FIX_0_707106781);
+    rows[2][lane] = tmp13 + z1;
+    rows[6][lane] = tmp13 - z1;
+
+    tmp10 = tmp4 + tmp5;
+    tmp11 = tmp5 + tmp6;
+    tmp12 = tmp6 + tmp7;
+    // NOTE(Ryan): Each term multiplied separately, as their difference can overflow 16 bits
+    s32 z5 = jpeg_mul_scalar(tmp10, JPEG_FIX_0_382683433) -
+             jpeg_mul_scalar(tmp12, JPEG_FIX_0_382683433);
+    s32 z2 = jpeg_mul_scalar(tmp10, JPEG_FIX_0_541196100) + z5;
+    s32 z4 = jpeg_mul_scalar(tmp12, JPEG_FIX_1_306562965) + z5;
+    s32 z3 = jpeg_mul_scalar(tmp11, JPEG_FIX_0_707106781);
+    s32 z11 = tmp7 + z3;
+    s32 z13 = tmp7 - z3;
+    rows[5][lane] = z13 + z2;
+    rows[3][lane] = z13 - z2;
+    rows[1][lane] = z11 + z4;
+    rows[7][lane] = z11 - z4;
+  }
+}
+
+// NOTE(Ryan): Rounds to nearest through a reciprocal, so agrees with the SIMD versions
+INTERNAL s16
+jpeg_quantise_scalar(s32 value, u32 divisor, u32 reciprocal)
+{
+  u32 magnitude = (u32)((value < 0) ? -value : value);
+  s32 result = (s32)(((magnitude + (divisor >> 1)) * reciprocal) >> 16);
+  return (s16)((value < 0) ? -result : result);
+}
+
+// NOTE(Ryan): Down the columns, then the rows by way of a transpose, which leaves
+// coefficient (u, v) at u * 8 + v rather than the natural v * 8 + u
+INTERNAL void
+jpeg_transform_block_scalar(const s16 *block, const u16 *divisors, const u16 *reciprocals,
+                            s16 *coefficients)
+{
+  s32 rows[8][8];
+  for (u32 i = 0;
+       i < 64;
+       ++i)
+  {
+    rows[i / 8][i % 8] = block[i];
+  }
+
+  jpeg_fdct_pass_scalar(rows);
+  for (u32 y = 0;
+       y < 8;
+       ++y)
+  {
+    for (u32 x = y + 1;
+         x < 8;
+         ++x)
+    {
+      s32 swap = rows[y][x];
+      rows[y][x] = rows[x][y];
+      rows[x][y] = swap;
+    }
+  }
+  jpeg_fdct_pass_scalar(rows);
+
+  for (u32 i = 0;
+       i < 64;
+       ++i)
+  {
+    coefficients[i] = jpeg_quantise_scalar(rows[i / 8][i % 8], divisors[i], reciprocals[i]);
+  }
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+INTERNAL __m128i
+jpeg_map_level_sse2(__m128i value, JPEGLevelMap *map)
+{
+  __m128i result = _mm_sub_epi16(value, _mm_set1_epi16(map->offset));
+  result = _mm_add_epi16(result,
+                         _mm_srai_epi16(_mm_mullo_epi16(result, _mm_set1_epi16(map->gain)), 8));
+  result = _mm_add_epi16(result, _mm_set1_epi16(map->bias));
+  return _mm_min_epi16(_mm_max_epi16(result, _mm_set1_epi16(-128)), _mm_set1_epi16(127));
+}
+
+// NOTE(Ryan): The MCU must lie wholly inside the image
+INTERNAL void
+jpeg_load_mcu_sse2(JPEGEncoder *encoder, const u8 *image, u32 mcu_x, u32 mcu_y,
+                   s16 (*blocks)[64])
+{
+  JPEGLevelMap *luma_map = encoder->level_maps + 0;
+  JPEGLevelMap *chroma_map = encoder->level_maps + 1;
+  __m128i low_byte_mask = _mm_set1_epi16(0x00ff);
+
+  if (encoder->format == PIXEL_FORMAT_YUYV)
+  {
+    __m128i low_word_mask = _mm_set1_epi32(0x0000ffff);
+    for (u32 y = 0;
+         y < 8;
+         ++y)
+    {
+      const u8 *at = image + (mcu_y * 8 + y) * encoder->stride + mcu_x * 32;
+      __m128i left = _mm_loadu_si128((const __m128i *)at);
+      __m128i right = _mm_loadu_si128((const __m128i *)(at + 16));
+      _mm_store_si128((__m128i *)(blocks[0] + y * 8),
+                      jpeg_map_level_sse2(_mm_and_si128(left, low_byte_mask), luma_map));
+      _mm_store_si128((__m128i *)(blocks[1] + y * 8),
+                      jpeg_map_level_sse2(_mm_and_si128(right, low_byte_mask), luma_map));
+
+      // NOTE(Ryan): Cb Cr pairs as 16 bit lanes, then pulled apart
+      __m128i chroma_left = _mm_srli_epi16(left, 8);
+      __m128i chroma_right = _mm_srli_epi16(right, 8);
+      __m128i cb = _mm_packs_epi32(_mm_and_si128(chroma_left, low_word_mask),
+                                   _mm_and_si128(chroma_right, low_word_mask));
+      __m128i cr = _mm_packs_epi32(_mm_srli_epi32(chroma_left, 16),
+                                   _mm_srli_epi32(chroma_right, 16));
+      _mm_store_si128((__m128i *)(blocks[2] + y * 8), jpeg_map_level_sse2(cb, chroma_map));
+      _mm_store_si128((__m128i *)(blocks[3] + y * 8), jpeg_map_level_sse2(cr, chroma_map));
+    }
+  }
+  else
+  {
+    __m128i zero = _mm_setzero_si128();
+    for (u32 y = 0;
+         y < 16;
+         ++y)
+    {
+      const u8 *at = image + (mcu_y * 16 + y) * encoder->stride + mcu_x * 16;
+      __m128i pixels = _mm_loadu_si128((const __m128i *)at);
+      s16 *left_block = blocks[(y / 8) * 2] + (y % 8) * 8;
+      s16 *right_block = blocks[(y / 8) * 2 + 1] + (y % 8) * 8;
+      _mm_store_si128((__m128i *)left_block,
+                      jpeg_map_level_sse2(_mm_unpacklo_epi8(pixels, zero), luma_map));
+      _mm_store_si128((__m128i *)right_block,
+                      jpeg_map_level_sse2(_mm_unpackhi_epi8(pixels, zero), luma_map));
+    }
+
+    const u8 *chroma_plane = image + encoder->stride * encoder->height;
+    for (u32 y = 0;
+         y < 8;
+         ++y)
+    {
+      const u8 *at = chroma_plane + (mcu_y * 8 + y) * encoder->stride + mcu_x * 16;
+      __m128i pairs = _mm_loadu_si128((const __m128i *)at);
+      _mm_store_si128((__m128i *)(blocks[4] + y * 8),
+                      jpeg_map_level_sse2(_mm_and_si128(pairs, low_byte_mask), chroma_map));
+      _mm_store_si128((__m128i *)(blocks[5] + y * 8),
+                      jpeg_map_level_sse2(_mm_srli_epi16(pairs, 8), chroma_map));
+    }
+  }
+}
+
+// NOTE(Ryan): (value * constant) >> 14, as the high half of a 16 bit multiply
+INTERNAL __m128i
+jpeg_mul_sse2(__m128i value, s16 constant)
+{
+  return _mm_mulhi_epi16(_mm_slli_epi16(value, 2), _mm_set1_epi16(constant));
+}
+
+INTERNAL void
+jpeg_fdct_pass_sse2(__m128i *rows)
+{
+  __m128i tmp0 = _mm_add_epi16(rows[0], rows[7]);
+  __m128i tmp7 = _mm_sub_epi16(rows[0], rows[7]);
+  __m128i tmp1 = _mm_add_epi16(rows[1], rows[6]);
+  __m128i tmp6 = _mm_sub_epi16(rows[1], rows[6]);
+  __m128i tmp2 = _mm_add_epi16(rows[2], rows[5]);
+  __m128i tmp5 = _mm_sub_epi16(rows[2], rows[5]);
+  __m128i tmp3 = _mm_add_epi16(rows[3], rows[4]);
+  __m128i tmp4 = _mm_sub_epi16(rows[3], rows[4]);
+
+  __m128i tmp10 = _mm_add_epi16(tmp0, tmp3);
+  __m128i tmp13 = _mm_sub_epi16(tmp0, tmp3);
+  __m128i tmp11 = _mm_add_epi16(tmp1, tmp2);
+  __m128i tmp12 = _mm_sub_epi16(tmp1, tmp2);
+  rows[0] = _mm_add_epi16(tmp10, tmp11);
+  rows[4] = _mm_sub_epi16(tmp10, tmp11);
+  __m128i z1 = jpeg_mul_sse2(_mm_add_epi16(tmp12, tmp13), JPEG_FIX_0_707106781);
+  rows[2] = _mm_add_epi16(tmp13, z1);
+  rows[6] = _mm_sub_epi16(tmp13, z1);
+
+  tmp10 = _mm_add_epi16(tmp4, tmp5);
+  tmp11 = _mm_add_epi16(tmp5, tmp6);
+  tmp12 = _mm_add_epi16(tmp6, tmp7);
+  __m128i z5 = _mm_sub_epi16(jpeg_mul_sse2(tmp10, JPEG_FIX_0_382683433),
+                             jpeg_mul_sse2(tmp12, JPEG_FIX_0_382683433));
+  __m128i z2 = _mm_add_epi16(jpeg_mul_sse2(tmp10, JPEG_FIX_0_541196100), z5);
+  __m128i z4 = _mm_add_epi16(jpeg_mul_sse2(tmp12, JPEG_FIX_1_306562965), z5);
+  __m128i z3 = jpeg_mul_sse2(tmp11, JPEG_FIX_0_707106781);
+  __m128i z11 = _mm_add_epi16(tmp7, z3);
+  __m128i z13 = _mm_sub_epi16(tmp7, z3);
+  rows[5] = _mm_add_epi16(z13, z2);
+  rows[3] = _mm_sub_epi16(z13, z2);
+  rows[1] = _mm_add_epi16(z11, z4);
+  rows[7] = _mm_sub_epi16(z11, z4);
+}
+
+INTERNAL void
+jpeg_transpose_sse2(__m128i *rows)
+{
+  __m128i a0 = _mm_unpacklo_epi16(rows[0], rows[1]);
+  __m128i a1 = _mm_unpackhi_epi16(rows[0], rows[1]);
+  __m128i a2 = _mm_unpacklo_epi16(rows[2], rows[3]);
+  __m128i a3 = _mm_unpackhi_epi16(rows[2], rows[3]);
+  __m128i a4 = _mm_unpacklo_epi16(rows[4], rows[5]);
+  __m128i a5 = _mm_unpackhi_epi16(rows[4], rows[5]);
+  __m128i a6 = _mm_unpacklo_epi16(rows[6], rows[7]);
+  __m128i a7 = _mm_unpackhi_epi16(rows[6], rows[7]);
+
+  __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+  __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+  __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+  __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+  __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+  __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+  __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+  __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+  rows[0] = _mm_unpacklo_epi64(b0, b4);
+  rows[1] = _mm_unpackhi_epi64(b0, b4);
+  rows[2] = _mm_unpacklo_epi64(b1, b5);
+  rows[3] = _mm_unpackhi_epi64(b1, b5);
+  rows[4] = _mm_unpacklo_epi64(b2, b6);
+  rows[5] = _mm_unpackhi_epi64(b2, b6);
+  rows[6] = _mm_unpacklo_epi64(b3, b7);
+  rows[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+INTERNAL __m128i
+jpeg_quantise_sse2(__m128i value, __m128i divisor, __m128i reciprocal)
+{
+  __m128i sign = _mm_srai_epi16(value, 15);
+  __m128i magnitude = _mm_sub_epi16(_mm_xor_si128(value, sign), sign);
+  magnitude = _mm_add_epi16(magnitude, _mm_srli_epi16(divisor, 1));
+  __m128i result = _mm_mulhi_epu16(magnitude, reciprocal);
+  return _mm_sub_epi16(_mm_xor_si128(result, sign), sign);
+}
+
+INTERNAL void
+jpeg_transform_block_sse2(const s16 *block, const u16 *divisors, const u16 *reciprocals,
+                          s16 *coefficients)
+{
+  __m128i rows[8];
+  for (u32 row_i = 0;
+       row_i < 8;
+       ++row_i)
+  {
+    rows[row_i] = _mm_load_si128((const __m128i *)(block + row_i * 8));
+  }
+
+  jpeg_fdct_pass_sse2(rows);
+  jpeg_transpose_sse2(rows);
+  jpeg_fdct_pass_sse2(rows);
+
+  for (u32 row_i = 0;
+       row_i < 8;
+       ++row_i)
+  {
+    __m128i divisor = _mm_loadu_si128((const __m128i *)(divisors + row_i * 8));
+    __m128i reciprocal = _mm_loadu_si128((const __m128i *)(reciprocals + row_i * 8));
+    _mm_store_si128((__m128i *)(coefficients + row_i * 8),
+                    jpeg_quantise_sse2(rows[row_i], divisor, reciprocal));
+  }
+}
+
+// NOTE(Ryan): The AVX2 versions work on two blocks at once, one per 128 bit lane,
+// which the unpacks used to transpose keep apart anyway
+
+__attribute__((target("avx2"))) INTERNAL __m256i
+jpeg_mul_avx2(__m256i value, s16 constant)
+{
+  return _mm256_mulhi_epi16(_mm256_slli_epi16(value, 2), _mm256_set1_epi16(constant));
+}
+
+__attribute__((target("avx2"))) INTERNAL void
+jpeg_fdct_pass_avx2(__m256i *rows)
+{
+  __m256i tmp0 = _mm256_add_epi16(rows[0], rows[7]);
+  __m256i tmp7 = _mm256_sub_epi16(rows[0], rows[7]);
+  __m256i tmp1 = _mm256_add_epi16(rows[1], rows[6]);
+  __m256i tmp6 = _mm256_sub_epi16(rows[1], rows[6]);
+  __m256i tmp2 = _mm256_add_epi16(rows[2], rows[5]);
+  __m256i tmp5 = _mm256_sub_epi16(rows[2], rows[5]);
+  __m256i tmp3 = _mm256_add_epi16(rows[3], rows[4]);
+  __m256i tmp4 = _mm256_sub_epi16(rows[3], rows[4]);
+
+  __m256i tmp10 = _mm256_add_epi16(tmp0, tmp3);
+  __m256i tmp13 = _mm256_sub_epi16(tmp0, tmp3);
+  __m256i tmp11 = _mm256_add_epi16(tmp1, tmp2);
+  __m256i tmp12 = _mm256_sub_epi16(tmp1, tmp2);
+  rows[0] = _mm256_add_epi16(tmp10, tmp11);
+  rows[4] = _mm256_sub_epi16(tmp10, tmp11);
+  __m256i z1 = jpeg_mul_avx2(_mm256_add_epi16(tmp12, tmp13), JPEG_FIX_0_707106781);
+  rows[2] = _mm256_add_epi16(tmp13, z1);
+  rows[6] = _mm256_sub_epi16(tmp13, z1);
+
+  tmp10 = _mm256_add_epi16(tmp4, tmp5);
+  tmp11 = _mm256_add_epi16(tmp5, tmp6);
+  tmp12 = _mm256_add_epi16(tmp6, tmp7);
+  __m256i z5 = _mm256_sub_epi16(jpeg_mul_avx2(tmp10, JPEG_FIX_0_382683433),
+                                jpeg_mul_avx2(tmp12, JPEG_FIX_0_382683433));
+  __m256i z2 = _mm256_add_epi16(jpeg_mul_avx2(tmp10, JPEG_FIX_0_541196100), z5);
+  __m256i z4 = _mm256_add_epi16(jpeg_mul_avx2(tmp12, JPEG_FIX_1_306562965), z5);
+  __m256i z3 = jpeg_mul_avx2(tmp11, JPEG_FIX_0_707106781);
+  __m256i z11 = _mm256_add_epi16(tmp7, z3);
+  __m256i z13 = _mm256_sub_epi16(tmp7, z3);
+  rows[5] = _mm256_add_epi16(z13, z2);
+  rows[3] = _mm256_sub_epi16(z13, z2);
+  rows[1] = _mm256_add_epi16(z11, z4);
+  rows[7] = _mm256_sub_epi16(z11, z4);
+}
+
+__attribute__((target("avx2"))) INTERNAL void
+jpeg_transpose_avx2(__m256i *rows)
+{
+  __m256i a0 = _mm256_unpacklo_epi16(rows[0], rows[1]);
+  __m256i a1 = _mm256_unpackhi_epi16(rows[0], rows[1]);
+  __m256i a2 = _mm256_unpacklo_epi16(rows[2], rows[3]);
+  __m256i a3 = _mm256_unpackhi_epi16(rows[2], rows[3]);
+  __m256i a4 = _mm256_unpacklo_epi16(rows[4], rows[5]);
+  __m256i a5 = _mm256_unpackhi_epi16(rows[4], rows[5]);
+  __m256i a6 = _mm256_unpacklo_epi16(rows[6], rows[7]);
+  __m256i a7 = _mm256_unpackhi_epi16(rows[6], rows[7]);
+
+  __m256i b0 = _mm256_unpacklo_epi32(a0, a2);
+  __m256i b1 = _mm256_unpackhi_epi32(a0, a2);
+  __m256i b2 = _mm256_unpacklo_epi32(a1, a3);
+  __m256i b3 = _mm256_unpackhi_epi32(a1, a3);
+  __m256i b4 = _mm256_unpacklo_epi32(a4, a6);
+  __m256i b5 = _mm256_unpackhi_epi32(a4, a6);
+  __m256i b6 = _mm256_unpacklo_epi32(a5, a7);
+  __m256i b7 = _mm256_unpackhi_epi32(a5, a7);
+
+  rows[0] = _mm256_unpacklo_epi64(b0, b4);
+  rows[1] = _mm256_unpackhi_epi64(b0, b4);
+  rows[2] = _mm256_unpacklo_epi64(b1, b5);
+  rows[3] = _mm256_unpackhi_epi64(b1, b5);
+  rows[4] = _mm256_unpacklo_epi64(b2, b6);
+  rows[5] = _mm256_unpackhi_epi64(b2, b6);
+  rows[6] = _mm256_unpacklo_epi64(b3, b7);
+  rows[7] = _mm256_unpackhi_epi64(b3, b7);
+}
+
+__attribute__((target("avx2"))) INTERNAL __m256i
+jpeg_quantise_avx2(__m256i value, __m256i divisor, __m256i reciprocal)
+{
+  __m256i sign = _mm256_srai_epi16(value, 15);
+  __m256i magnitude = _mm256_sub_epi16(_mm256_xor_si256(value, sign), sign);
+  magnitude = _mm256_add_epi16(magnitude, _mm256_srli_epi16(divisor, 1));
+  __m256i result = _mm256_mulhi_epu16(magnitude, reciprocal);
+  return _mm256_sub_epi16(_mm256_xor_si256(result, sign), sign);
+}
+
+// NOTE(Ryan): Both blocks must use the same quantiser
+__attribute__((target("avx2"))) INTERNAL void
+jpeg_transform_block_pair_avx2(const s16 *first_block, const s16 *second_block,
+                               const u16 *divisors, const u16 *reciprocals,
+                               s16 *first_coefficients, s16 *second_coefficients)
+{
+  __m256i rows[8];
+  for (u32 row_i = 0;
+       row_i < 8;
+       ++row_i)
+  {
+    __m128i first = _mm_load_si128((const __m128i *)(first_block + row_i * 8));
+    __m128i second = _mm_load_si128((const __m128i *)(second_block + row_i * 8));
+    rows[row_i] = _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1);
+  }
+
+  jpeg_fdct_pass_avx2(rows);
+  jpeg_transpose_avx2(rows);
+  jpeg_fdct_pass_avx2(rows);
+
+  for (u32 row_i = 0;
+       row_i < 8;
+       ++row_i)
+  {
+    __m256i divisor = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)(divisors + row_i * 8)));
+    __m256i reciprocal = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)(reciprocals + row_i * 8)));
+    __m256i coefficients = jpeg_quantise_avx2(rows[row_i], divisor, reciprocal);
+    _mm_store_si128((__m128i *)(first_coefficients + row_i * 8),
+                    _mm256_castsi256_si128(coefficients));
+    _mm_store_si128((__m128i *)(second_coefficients + row_i * 8),
+                    _mm256_extracti128_si256(coefficients, 1));
+  }
+}
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+
+INTERNAL int16x8_t
+jpeg_map_level_neon(int16x8_t value, JPEGLevelMap *map)
+{
+  int16x8_t result = vsubq_s16(value, vdupq_n_s16(map->offset));
+  result = vaddq_s16(result, vshrq_n_s16(vmulq_s16(result, vdupq_n_s16(map->gain)), 8));
+  result = vaddq_s16(result, vdupq_n_s16(map->bias));
+  return vminq_s16(vmaxq_s16(result, vdupq_n_s16(-128)), vdupq_n_s16(127));
+}
+
+INTERNAL int16x8_t
+jpeg_widen_neon(uint8x8_t value)
+{
+  return vreinterpretq_s16_u16(vmovl_u8(value));
+}
+
+// NOTE(Ryan): The MCU must lie wholly inside the image
+INTERNAL void
+jpeg_load_mcu_neon(JPEGEncoder *encoder, const u8 *image, u32 mcu_x, u32 mcu_y,
+                   s16 (*blocks)[64])
+{
+  JPEGLevelMap *luma_map = encoder->level_maps + 0;
+  JPEGLevelMap *chroma_map = encoder->level_maps + 1;
+
+  if (encoder->format == PIXEL_FORMAT_YUYV)
+  {
+    for (u32 y = 0;
+         y < 8;
+         ++y)
+    {
+      // NOTE(Ryan): Y apart from the Cb Cr pairs, then the pairs apart
+      const u8 *at = image + (mcu_y * 8 + y) * encoder->stride + mcu_x * 32;
+      uint8x16x2_t pixels = vld2q_u8(at);
+      uint8x8x2_t chroma = vuzp_u8(vget_low_u8(pixels.val[1]), vget_high_u8(pixels.val[1]));
+      vst1q_s16(blocks[0] + y * 8,
+                jpeg_map_level_neon(jpeg_widen_neon(vget_low_u8(pixels.val[0])), luma_map));
+      vst1q_s16(blocks[1] + y * 8,
+                jpeg_map_level_neon(jpeg_widen_neon(vget_high_u8(pixels.val[0])), luma_map));
+      vst1q_s16(blocks[2] + y * 8,
+                jpeg_map_level_neon(jpeg_widen_neon(chroma.val[0]), chroma_map));
+      vst1q_s16(blocks[3] + y * 8,
+                jpeg_map_level_neon(jpeg_widen_neon(chroma.val[1]), chroma_map));
+    }
+  }
+  else
+  {
+    for (u32 y = 0;
+         y < 16;
+         ++y)
+    {
+      const u8 *at = image + (mcu_y * 16 + y) * encoder->stride + mcu_x * 16;
+      uint8x16_t pixels = vld1q_u8(at);
+      vst1q_s16(blocks[(y / 8) * 2] + (y % 8) * 8,
+                jpeg_map_level_neon(jpeg_widen_neon(vget_low_u8(pixels)), luma_map));
+      vst1q_s16(blocks[(y / 8) * 2 + 1] + (y % 8) * 8,
+                jpeg_map_level_neon(jpeg_widen_neon(vget_high_u8(pixels)), luma_map));
+    }
+
+    const u8 *chroma_plane = image + encoder->stride * encoder->height;
+    for (u32 y = 0;
+         y < 8;
+         ++y)
+    {
+      const u8 *at = chroma_plane + (mcu_y * 8 + y) * encoder->stride + mcu_x * 16;
+      uint8x8x2_t pairs = vld2_u8(at);
+      vst1q_s16(blocks[4] + y * 8, jpeg_map_level_neon(jpeg_widen_neon(pairs.val[0]), chroma_map));
+      vst1q_s16(blocks[5] + y * 8, jpeg_map_level_neon(jpeg_widen_neon(pairs.val[1]), chroma_map));
+    }
+  }
+}
+
+// NOTE(Ryan): vqdmulh doubles the product before taking the high half,
+// so this is the same (value * constant) >> 14 as SSE2
+INTERNAL int16x8_t
+jpeg_mul_neon(int16x8_t value, s16 constant)
+{
+  return vqdmulhq_s16(vshlq_n_s16(value, 1), vdupq_n_s16(constant));
+}
+
+INTERNAL void
+jpeg_fdct_pass_neon(int16x8_t *rows)
+{
+  int16x8_t tmp0 = vaddq_s16(rows[0], rows[7]);
+  int16x8_t tmp7 = vsubq_s16(rows[0], rows[7]);
+  int16x8_t tmp1 = vaddq_s16(rows[1], rows[6]);
+  int16x8_t tmp6 = vsubq_s16(rows[1], rows[6]);
+  int16x8_t tmp2 = vaddq_s16(rows[2], rows[5]);
+  int16x8_t tmp5 = vsubq_s16(rows[2], rows[5]);
+  int16x8_t tmp3 = vaddq_s16(rows[3], rows[4]);
+  int16x8_t tmp4 = vsubq_s16(rows[3], rows[4]);
+
+  int16x8_t tmp10 = vaddq_s16(tmp0, tmp3);
+  int16x8_t tmp13 = vsubq_s16(tmp0, tmp3);
+  int16x8_t tmp11 = vaddq_s16(tmp1, tmp2);
+  int16x8_t tmp12 = vsubq_s16(tmp1, tmp2);
+  rows[0] = vaddq_s16(tmp10, tmp11);
+  rows[4] = vsubq_s16(tmp10, tmp11);
+  int16x8_t z1 = jpeg_mul_neon(vaddq_s16(tmp12, tmp13), JPEG_FIX_0_707106781);
+  rows[2] = vaddq_s16(tmp13, z1);
+  rows[6] = vsubq_s16(tmp13, z1);
+
+  tmp10 = vaddq_s16(tmp4, tmp5);
+  tmp11 = vaddq_s16(tmp5, tmp6);
+  tmp12 = vaddq_s16(tmp6, tmp7);
+  int16x8_t z5 = vsubq_s16(jpeg_mul_neon(tmp10, JPEG_FIX_0_382683433),
+                           jpeg_mul_neon(tmp12, JPEG_FIX_0_382683433));
+  int16x8_t z2 = vaddq_s16(jpeg_mul_neon(tmp10, JPEG_FIX_0_541196100), z5);
+  int16x8_t z4 = vaddq_s16(jpeg_mul_neon(tmp12, JPEG_FIX_1_306562965), z5);
+  int16x8_t z3 = jpeg_mul_neon(tmp11, JPEG_FIX_0_707106781);
+  int16x8_t z11 = vaddq_s16(tmp7, z3);
+  int16x8_t z13 = vsubq_s16(tmp7, z3);
+  rows[5] = vaddq_s16(z13, z2);
+  rows[3] = vsubq_s16(z13, z2);
+  rows[1] = vaddq_s16(z11, z4);
+  rows[7] = vsubq_s16(z11, z4);
+}
+
+// NOTE(Ryan): Pairs of 16 bit lanes, then of 32 bit lanes, then of halves
+INTERNAL void
+jpeg_transpose_neon(int16x8_t *rows)
+{
+  int16x8x2_t rows01 = vtrnq_s16(rows[0], rows[1]);
+  int16x8x2_t rows23 = vtrnq_s16(rows[2], rows[3]);
+  int16x8x2_t rows45 = vtrnq_s16(rows[4], rows[5]);
+  int16x8x2_t rows67 = vtrnq_s16(rows[6], rows[7]);
+
+  int32x4x2_t even_top = vtrnq_s32(vreinterpretq_s32_s16(rows01.val[0]),
+                                   vreinterpretq_s32_s16(rows23.val[0]));
+  int32x4x2_t odd_top = vtrnq_s32(vreinterpretq_s32_s16(rows01.val[1]),
+                                  vreinterpretq_s32_s16(rows23.val[1]));
+  int32x4x2_t even_bottom = vtrnq_s32(vreinterpretq_s32_s16(rows45.val[0]),
+                                      vreinterpretq_s32_s16(rows67.val[0]));
+  int32x4x2_t odd_bottom = vtrnq_s32(vreinterpretq_s32_s16(rows45.val[1]),
+                                     vreinterpretq_s32_s16(rows67.val[1]));
+
+  rows[0] = vreinterpretq_s16_s32(vcombine_s32(vget_low_s32(even_top.val[0]),
+                                               vget_low_s32(even_bottom.val[0])));
+  rows[4] = vreinterpretq_s16_s32(vcombine_s32(vget_high_s32(even_top.val[0]),
+                                               vget_high_s32(even_bottom.val[0])));
+  rows[2] = vreinterpretq_s16_s32(vcombine_s32(vget_low_s32(even_top.val[1]),
+                                               vget_low_s32(even_bottom.val[1])));
+  rows[6] = vreinterpretq_s16_s32(vcombine_s32(vget_high_s32(even_top.val[1]),
+                                               vget_high_s32(even_bottom.val[1])));
+  rows[1] = vreinterpretq_s16_s32(vcombine_s32(vget_low_s32(odd_top.val[0]),
+                                               vget_low_s32(odd_bottom.val[0])));
+  rows[5] = vreinterpretq_s16_s32(vcombine_s32(vget_high_s32(odd_top.val[0]),
+                                               vget_high_s32(odd_bottom.val[0])));
+  rows[3] = vreinterpretq_s16_s32(vcombine_s32(vget_low_s32(odd_top.val[1]),
+                                               vget_low_s32(odd_bottom.val[1])));
+  rows[7] = vreinterpretq_s16_s32(vcombine_s32(vget_high_s32(odd_top.val[1]),
+                                               vget_high_s32(odd_bottom.val[1])));
+}
+
+INTERNAL int16x8_t
+jpeg_quantise_neon(int16x8_t value, uint16x8_t divisor, uint16x8_t reciprocal)
+{
+  int16x8_t sign = vshrq_n_s16(value, 15);
+  uint16x8_t magnitude = vreinterpretq_u16_s16(vabsq_s16(value));
+  magnitude = vaddq_u16(magnitude, vshrq_n_u16(divisor, 1));
+  uint32x4_t low = vmull_u16(vget_low_u16(magnitude), vget_low_u16(reciprocal));
+  uint32x4_t high = vmull_u16(vget_high_u16(magnitude), vget_high_u16(reciprocal));
+  int16x8_t result = vreinterpretq_s16_u16(vcombine_u16(vshrn_n_u32(low, 16),
+                                                        vshrn_n_u32(high, 16)));
+  return vsubq_s16(veorq_s16(result, sign), sign);
+}
+
+INTERNAL void
+jpeg_transform_block_neon(const s16 *block, const u16 *divisors, const u16 *reciprocals,
+                          s16 *coefficients)
+{
+  int16x8_t rows[8];
+  for (u32 row_i = 0;
+       row_i < 8;
+       ++row_i)
+  {
+    rows[row_i] = vld1q_s16(block + row_i * 8);
+  }
+
+  jpeg_fdct_pass_neon(rows);
+  jpeg_transpose_neon(rows);
+  jpeg_fdct_pass_neon(rows);
+
+  for (u32 row_i = 0;
+       row_i < 8;
+       ++row_i)
+  {
+    vst1q_s16(coefficients + row_i * 8,
+              jpeg_quantise_neon(rows[row_i], vld1q_u16(divisors + row_i * 8),
+                                 vld1q_u16(reciprocals + row_i * 8)));
+  }
+}
+#endif
+
+INTERNAL void
+jpeg_load_mcu(JPEGEncoder *encoder, const u8 *image, u32 mcu_x, u32 mcu_y, s16 (*blocks)[64])
+{
+  b32 is_inside = ((mcu_x + 1) * encoder->mcu_width <= encoder->width &&
+                   (mcu_y + 1) * encoder->mcu_height <= encoder->height);
+#if defined(__x86_64__)
+  if (is_inside && global_jpeg_simd_level >= JPEG_SIMD_LEVEL_SSE2)
+  {
+    // NOTE(Ryan): Loading is bound by memory, so AVX2 would gain little here
+    jpeg_load_mcu_sse2(encoder, image, mcu_x, mcu_y, blocks);
+    return;
+  }
+#elif defined(__aarch64__)
+  if (is_inside && global_jpeg_simd_level == JPEG_SIMD_LEVEL_NEON)
+  {
+    jpeg_load_mcu_neon(encoder, image, mcu_x, mcu_y, blocks);
+    return;
+  }
+#endif
+  jpeg_load_mcu_scalar(encoder, image, mcu_x, mcu_y, blocks);
+}
+
+INTERNAL void
+jpeg_transform_mcu(JPEGEncoder *encoder, s16 (*blocks)[64], s16 (*coefficients)[64])
+{
+  u32 block_count = encoder->luma_block_count + 2;
+
+#if defined(__x86_64__)
+  if (global_jpeg_simd_level == JPEG_SIMD_LEVEL_AVX2)
+  {
+    // NOTE(Ryan): There is always an even number of luma blocks, so pairs never mix tables
+    for (u32 block_i = 0;
+         block_i < block_count;
+         block_i += 2)
+    {
+      u32 table_i = (block_i < encoder->luma_block_count) ? 0 : 1;
+      jpeg_transform_block_pair_avx2(blocks[block_i], blocks[block_i + 1],
+                                     encoder->divisors[table_i], encoder->reciprocals[table_i],
+                                     coefficients[block_i], coefficients[block_i + 1]);
+    }
+    return;
+  }
+#endif
+
+  for (u32 block_i = 0;
+       block_i < block_count;
+       ++block_i)
+  {
+    u32 table_i = (block_i < encoder->luma_block_count) ? 0 : 1;
+    const u16 *divisors = encoder->divisors[table_i];
+    const u16 *reciprocals = encoder->reciprocals[table_i];
+#if defined(__x86_64__)
+    if (global_jpeg_simd_level == JPEG_SIMD_LEVEL_SSE2)
+    {
+      jpeg_transform_block_sse2(blocks[block_i], divisors, reciprocals, coefficients[block_i]);
+      continue;
+    }
+#elif defined(__aarch64__)
+    if (global_jpeg_simd_level == JPEG_SIMD_LEVEL_NEON)
+    {
+      jpeg_transform_block_neon(blocks[block_i], divisors, reciprocals, coefficients[block_i]);
+      continue;
+    }
+#endif
+    jpeg_transform_block_scalar(blocks[block_i], divisors, reciprocals, coefficients[block_i]);
+  }
+}
+
+INTERNAL u32
+jpeg_category(u32 magnitude)
+{
+  return (magnitude == 0) ? 0 : 32 - (u32)__builtin_clz(magnitude);
+}
+
+INTERNAL void
+jpeg_encode_block(JPEGBitWriter *writer, const s16 *coefficients, s32 *previous_dc,
+                  JPEGHuffmanTable *dc_table, JPEGHuffmanTable *ac_table)
+{
+  s32 diff = coefficients[0] - *previous_dc;
+  *previous_dc = coefficients[0];
+  u32 category = jpeg_category((u32)((diff < 0) ? -diff : diff));
+  jpeg_put_bits(writer, dc_table->codes[category], dc_table->code_lens[category]);
+  if (category > 0)
+  {
+    jpeg_put_bits(writer, (u32)((diff < 0) ? diff - 1 : diff), category);
+  }
+
+  u32 zero_run = 0;
+  for (u32 zigzag_i = 1;
+       zigzag_i < 64;
+       ++zigzag_i)
+  {
+    // NOTE(Ryan): Coefficients are transposed, see jpeg_transform_block_scalar()
+    u32 natural_i = global_jpeg_zigzag[zigzag_i];
+    s32 value = coefficients[(natural_i % 8) * 8 + natural_i / 8];
+    if (value == 0)
+    {
+      zero_run++;
+    }
+    else
+    {
+      while (zero_run >= 16)
+      {
+        jpeg_put_bits(writer, ac_table->codes[0xf0], ac_table->code_lens[0xf0]);
+        zero_run -= 16;
+      }
+
+      // NOTE(Ryan): Rounding the divisors can push the very largest just past what
+      // baseline allows
+      value = (value > 1023) ? 1023 : (value < -1023) ? -1023 : value;
+      category = jpeg_category((u32)((value < 0) ? -value : value));
+      u32 symbol = (zero_run << 4) | category;
+      jpeg_put_bits(writer, ac_table->codes[symbol], ac_table->code_lens[symbol]);
+      jpeg_put_bits(writer, (u32)((value < 0) ? value - 1 : value), category);
+      zero_run = 0;
+    }
+  }
+
+  if (zero_run > 0)
+  {
+    jpeg_put_bits(writer, ac_table->codes[0x00], ac_table->code_lens[0x00]);
+  }
+}
+
+INTERNAL void
+jpeg_encode_slice(JPEGEncoder *encoder, u32 slice_i)
+{
+  s16 blocks[6][64] __attribute__((aligned(32)));
+  s16 coefficients[6][64] __attribute__((aligned(32)));
+
+  JPEGSlice *slice = encoder->slices + slice_i;
+  JPEGBitWriter writer = {slice->data, 0, 0};
+  s32 previous_dc[3] = {0};
+  u32 block_count = encoder->luma_block_count + 2;
+
+  for (u32 mcu_x = 0;
+       mcu_x < encoder->mcu_count_x;
+       ++mcu_x)
+  {
+    jpeg_load_mcu(encoder, encoder->image, mcu_x, slice_i, blocks);
+    jpeg_transform_mcu(encoder, blocks, coefficients);
+
+    for (u32 block_i = 0;
+         block_i < block_count;
+         ++block_i)
+    {
+      u32 component_i = (block_i < encoder->luma_block_count) ?
+                        0 : block_i - encoder->luma_block_count + 1;
+      u32 table_i = (component_i == 0) ? 0 : 2;
+      jpeg_encode_block(&writer, coefficients[block_i], previous_dc + component_i,
+                        encoder->huffman_tables + table_i,
+                        encoder->huffman_tables + table_i + 1);
+    }
+  }
+
+  jpeg_flush_bits(&writer);
+  slice->size = (u32)(writer.at - slice->data);
+}
+
+INTERNAL void
+jpeg_encoder_take_slices(JPEGEncoder *encoder)
+{
+  while (true)
+  {
+    u32 slice_i = __atomic_fetch_add(&encoder->next_slice, 1, __ATOMIC_ACQ_REL);
+    if (slice_i >= encoder->mcu_count_y)
+    {
+      break;
+    }
+    jpeg_encode_slice(encoder, slice_i);
+  }
+}
+
+INTERNAL void *
+jpeg_encoder_run(void *arg)
+{
+  JPEGEncoder *encoder = (JPEGEncoder *)arg;
+  u32 seen_generation = 0;
+
+  pthread_mutex_lock(&encoder->mutex);
+  while (!encoder->is_stopping)
+  {
+    if (encoder->job_generation != seen_generation)
+    {
+      seen_generation = encoder->job_generation;
+      pthread_mutex_unlock(&encoder->mutex);
+
+      jpeg_encoder_take_slices(encoder);
+
+      pthread_mutex_lock(&encoder->mutex);
+      encoder->busy_thread_count--;
+      if (encoder->busy_thread_count == 0)
+      {
+        pthread_cond_signal(&encoder->done_cond);
+      }
+    }
+    else
+    {
+      pthread_cond_wait(&encoder->work_cond, &encoder->mutex);
+    }
+  }
+  pthread_mutex_unlock(&encoder->mutex);
+
+  return NULL;
+}
+
+// NOTE(Ryan): thread_count includes the thread that will call jpeg_encode().
+// Returns false if no extra threads could be started, though encoding still works
+INTERNAL b32
+jpeg_encoder_start(JPEGEncoder *encoder, u32 thread_count)
+{
+  pthread_mutex_init(&encoder->mutex, NULL);
+  pthread_cond_init(&encoder->work_cond, NULL);
+  pthread_cond_init(&encoder->done_cond, NULL);
+
+  thread_count = (thread_count < 1) ? 1 : thread_count;
+  thread_count = (thread_count > MAX_JPEG_THREAD_COUNT) ? MAX_JPEG_THREAD_COUNT : thread_count;
+  encoder->thread_count = 1;
+  for (u32 thread_i = 1;
+       thread_i < thread_count;
+       ++thread_i)
+  {
+    if (pthread_create(encoder->threads + thread_i, NULL, jpeg_encoder_run, encoder) != 0)
+    {
+      break;
+    }
+    encoder->thread_count++;
+  }
+
+  return (encoder->thread_count == thread_count);
+}
+
+INTERNAL void
+jpeg_encoder_free_slices(JPEGEncoder *encoder)
+{
+  free(encoder->slices);
+  free(encoder->slice_memory);
+  encoder->slices = NULL;
+  encoder->slice_memory = NULL;
+  encoder->image_size = 0;
+}
+
+INTERNAL void
+jpeg_encoder_stop(JPEGEncoder *encoder)
+{
+  pthread_mutex_lock(&encoder->mutex);
+  encoder->is_stopping = true;
+  pthread_cond_broadcast(&encoder->work_cond);
+  pthread_mutex_unlock(&encoder->mutex);
+
+  for (u32 thread_i = 1;
+       thread_i < encoder->thread_count;
+       ++thread_i)
+  {
+    pthread_join(encoder->threads[thread_i], NULL);
+  }
+  encoder->thread_count = 0;
+  jpeg_encoder_free_slices(encoder);
+}
+
+INTERNAL u8 *
+jpeg_write_huffman_table(u8 *at, u32 table_id, const u8 *lengths, const u8 *symbols,
+                         JPEGHuffmanTable *table)
+{
+  *at++ = (u8)table_id;
+  memcpy(at, lengths, 16);
+  at += 16;
+
+  // NOTE(Ryan): Canonical codes, counting up within a length and doubling between them
+  u32 code = 0;
+  u32 symbol_i = 0;
+  for (u32 code_len = 1;
+       code_len <= 16;
+       ++code_len)
+  {
+    for (u32 length_i = 0;
+         length_i < lengths[code_len - 1];
+         ++length_i)
+    {
+      u8 symbol = symbols[symbol_i++];
+      table->codes[symbol] = (u16)code++;
+      table->code_lens[symbol] = (u8)code_len;
+      *at++ = symbol;
+    }
+    code <<= 1;
+  }
+
+  return at;
+}
+
+INTERNAL void
+jpeg_encoder_write_header(JPEGEncoder *encoder, u8 (*quant_tables)[64])
+{
+  u8 *at = encoder->header;
+  *at++ = 0xff; *at++ = 0xd8;
+
+  // NOTE(Ryan): JFIF, so decoders take the components as YCbCr
+  *at++ = 0xff; *at++ = 0xe0;
+  at = jpeg_put_u16(at, 16);
+  memcpy(at, "JFIF\0\x01\x01\x00\x00\x01\x00\x01\x00\x00", 14);
+  at += 14;
+
+  *at++ = 0xff; *at++ = 0xdb;
+  at = jpeg_put_u16(at, 2 + 2 * 65);
+  for (u32 table_i = 0;
+       table_i < 2;
+       ++table_i)
+  {
+    *at++ = (u8)table_i;
+    for (u32 zigzag_i = 0;
+         zigzag_i < 64;
+         ++zigzag_i)
+    {
+      *at++ = quant_tables[table_i][global_jpeg_zigzag[zigzag_i]];
+    }
+  }
+
+  *at++ = 0xff; *at++ = 0xc0;
+  at = jpeg_put_u16(at, 17);
+  *at++ = 8;
+  at = jpeg_put_u16(at, encoder->height);
+  at = jpeg_put_u16(at, encoder->width);
+  *at++ = 3;
+  *at++ = 1; *at++ = (encoder->format == PIXEL_FORMAT_YUYV) ? 0x21 : 0x22; *at++ = 0;
+  *at++ = 2; *at++ = 0x11; *at++ = 1;
+  *at++ = 3; *at++ = 0x11; *at++ = 1;
+
+  *at++ = 0xff; *at++ = 0xc4;
+  at = jpeg_put_u16(at, 2 + 4 * 17 + 2 * 12 + 2 * 162);
+  at = jpeg_write_huffman_table(at, 0x00, global_jpeg_luma_dc_lengths, global_jpeg_dc_symbols,
+                                encoder->huffman_tables + 0);
+  at = jpeg_write_huffman_table(at, 0x10, global_jpeg_luma_ac_lengths,
+                                global_jpeg_luma_ac_symbols, encoder->huffman_tables + 1);
+  at = jpeg_write_huffman_table(at, 0x01, global_jpeg_chroma_dc_lengths,
+                                global_jpeg_dc_symbols, encoder->huffman_tables + 2);
+  at = jpeg_write_huffman_table(at, 0x11, global_jpeg_chroma_ac_lengths,
+                                global_jpeg_chroma_ac_symbols, encoder->huffman_tables + 3);
+
+  *at++ = 0xff; *at++ = 0xdd;
+  at = jpeg_put_u16(at, 4);
+  at = jpeg_put_u16(at, encoder->mcu_count_x);
+
+  *at++ = 0xff; *at++ = 0xda;
+  at = jpeg_put_u16(at, 12);
+  *at++ = 3;
+  *at++ = 1; *at++ = 0x00;
+  *at++ = 2; *at++ = 0x11;
+  *at++ = 3; *at++ = 0x11;
+  *at++ = 0; *at++ = 63; *at++ = 0;
+
+  encoder->header_len = (u32)(at - encoder->header);
+}
+
+// NOTE(Ryan): is_video_range for Y in 16 to 235 and Cb Cr in 16 to 240, as V4L2 gives YUYV
+// and NV12 unless it says otherwise. quality is the usual 1 to 100.
+// Returns false for a format or size the encoder cannot take, leaving it unconfigured
+INTERNAL b32
+jpeg_encoder_configure(JPEGEncoder *encoder, PIXEL_FORMAT format, u32 width, u32 height,
+                       u32 stride, b32 is_video_range, u32 quality)
+{
+  jpeg_encoder_free_slices(encoder);
+
+  // NOTE(Ryan): Chroma is shared by pixel pairs, so the SIMD loads assume even sizes
+  b32 is_supported = (width > 0 && width <= JPEG_MAX_DIMENSION && width % 2 == 0 &&
+                      height > 0 && height <= JPEG_MAX_DIMENSION);
+  if (format == PIXEL_FORMAT_YUYV)
+  {
+    is_supported &= (stride >= width * 2);
+  }
+  else if (format == PIXEL_FORMAT_NV12)
+  {
+    is_supported &= (stride >= width && height % 2 == 0);
+  }
+  else
+  {
+    is_supported = false;
+  }
+  if (!is_supported)
+  {
+    return false;
+  }
+
+  encoder->format = format;
+  encoder->width = width;
+  encoder->height = height;
+  encoder->stride = stride;
+  encoder->quality = (quality < 1) ? 1 : (quality > 100) ? 100 : quality;
+  encoder->mcu_width = 16;
+  encoder->mcu_height = (format == PIXEL_FORMAT_YUYV) ? 8 : 16;
+  encoder->luma_block_count = (format == PIXEL_FORMAT_YUYV) ? 2 : 4;
+  encoder->mcu_count_x = (width + encoder->mcu_width - 1) / encoder->mcu_width;
+  encoder->mcu_count_y = (height + encoder->mcu_height - 1) / encoder->mcu_height;
+
+  JPEGLevelMap luma_map = {128, 0, 0};
+  JPEGLevelMap chroma_map = {128, 0, 0};
+  if (is_video_range)
+  {
+    // NOTE(Ryan): 255 / 219 and 255 / 224
+    luma_map.offset = 16;
+    luma_map.gain = 42;
+    luma_map.bias = -128;
+    chroma_map.gain = 36;
+  }
+  encoder->level_maps[0] = luma_map;
+  encoder->level_maps[1] = chroma_map;
+
+  // NOTE(Ryan): The IJG scaling of the Annex K tables
+  u32 scale = (encoder->quality < 50) ? 5000 / encoder->quality : 200 - encoder->quality * 2;
+  u8 quant_tables[2][64];
+  for (u32 table_i = 0;
+       table_i < 2;
+       ++table_i)
+  {
+    const u8 *base_table = (table_i == 0) ? global_jpeg_luma_quant_table :
+                                            global_jpeg_chroma_quant_table;
+    for (u32 v = 0;
+         v < 8;
+         ++v)
+    {
+      for (u32 u = 0;
+           u < 8;
+           ++u)
+      {
+        u32 natural_i = v * 8 + u;
+        u32 quant = (base_table[natural_i] * scale + 50) / 100;
+        quant = (quant < 1) ? 1 : (quant > 255) ? 255 : quant;
+        quant_tables[table_i][natural_i] = (u8)quant;
+
+        // NOTE(Ryan): At least 2, so the reciprocal fits in 16 bits
+        u64 divisor = ((u64)quant * global_jpeg_aan_scales[u] * global_jpeg_aan_scales[v] +
+                       (1 << 24)) >> 25;
+        divisor = (divisor < 2) ? 2 : divisor;
+        encoder->divisors[table_i][u * 8 + v] = (u16)divisor;
+        encoder->reciprocals[table_i][u * 8 + v] = (u16)((65536 + divisor - 1) / divisor);
+      }
+    }
+  }
+  jpeg_encoder_write_header(encoder, quant_tables);
+
+  // NOTE(Ryan): Sized for the worst case, though only a few percent is ever touched
+  encoder->slice_capacity = encoder->mcu_count_x * (encoder->luma_block_count + 2) *
+                            JPEG_MAX_BLOCK_CODED_SIZE;
+  encoder->slice_memory_size = (u64)encoder->slice_capacity * encoder->mcu_count_y;
+  encoder->slice_memory = malloc(encoder->slice_memory_size);
+  encoder->slices = calloc(encoder->mcu_count_y, sizeof(JPEGSlice));
+  if (encoder->slice_memory == NULL || encoder->slices == NULL)
+  {
+    jpeg_encoder_free_slices(encoder);
+    return false;
+  }
+  for (u32 slice_i = 0;
+       slice_i < encoder->mcu_count_y;
+       ++slice_i)
+  {
+    encoder->slices[slice_i].data = encoder->slice_memory +
+                                    (u64)slice_i * encoder->slice_capacity;
+  }
+
+  encoder->image_size = stride * height;
+  if (format == PIXEL_FORMAT_NV12)
+  {
+    encoder->image_size += stride * (height / 2);
+  }
+
+  return true;
+}
+
+// NOTE(Ryan): image is at least image_size bytes. Returns the size of the JPEG,
+// which jpeg_encoder_write() then puts together
+INTERNAL u32
+jpeg_encode(JPEGEncoder *encoder, const u8 *image)
+{
+  u32 result = 0;
+
+  if (encoder->image_size > 0)
+  {
+    pthread_mutex_lock(&encoder->mutex);
+    encoder->image = image;
+    encoder->next_slice = 0;
+    encoder->busy_thread_count = encoder->thread_count - 1;
+    encoder->job_generation++;
+    pthread_cond_broadcast(&encoder->work_cond);
+    pthread_mutex_unlock(&encoder->mutex);
+
+    jpeg_encoder_take_slices(encoder);
+
+    // NOTE(Ryan): Every thread must have finished with the job, not just every slice,
+    // so none can wander into the next one
+    pthread_mutex_lock(&encoder->mutex);
+    while (encoder->busy_thread_count > 0)
+    {
+      pthread_cond_wait(&encoder->done_cond, &encoder->mutex);
+    }
+    pthread_mutex_unlock(&encoder->mutex);
+
+    result = encoder->header_len + 2;
+    for (u32 slice_i = 0;
+         slice_i < encoder->mcu_count_y;
+         ++slice_i)
+    {
+      result += encoder->slices[slice_i].size + 2;
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): out holds the size jpeg_encode() returned
+INTERNAL void
+jpeg_encoder_write(JPEGEncoder *encoder, u8 *out)
+{
+  u8 *at = out;
+  memcpy(at, encoder->header, encoder->header_len);
+  at += encoder->header_len;
+
+  for (u32 slice_i = 0;
+       slice_i < encoder->mcu_count_y;
+       ++slice_i)
+  {
+    JPEGSlice *slice = encoder->slices + slice_i;
+    memcpy(at, slice->data, slice->size);
+    at += slice->size;
+
+    // NOTE(Ryan): Restart markers count 0 to 7, with end of image after the last slice
+    at[0] = 0xff;
+    at[1] = (slice_i + 1 < encoder->mcu_count_y) ? (u8)(0xd0 + slice_i % 8) : 0xd9;
+    at += 2;
+  }
+}
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#pragma once
+
+#include <pthread.h>
+
+#define JPEG_DEFAULT_QUALITY 80
+#define JPEG_MAX_DIMENSION 8192
+// NOTE(Ryan): Including the thread calling jpeg_encode()
+#define MAX_JPEG_THREAD_COUNT 16
+#define JPEG_HEADER_SIZE 1024
+
+typedef enum PIXEL_FORMAT
+{
+  // NOTE(Ryan): Already compressed, e.g. by the camera
+  PIXEL_FORMAT_MJPEG,
+  // NOTE(Ryan): Packed 4:2:2, Y0 Cb Y1 Cr for every two pixels
+  PIXEL_FORMAT_YUYV,
+  // NOTE(Ryan): 4:2:0, the Y plane then a half height plane of Cb Cr pairs, same stride
+  PIXEL_FORMAT_NV12,
+  PIXEL_FORMAT_COUNT,
+} PIXEL_FORMAT;
+
+typedef enum JPEG_SIMD_LEVEL
+{
+  JPEG_SIMD_LEVEL_SCALAR,
+  JPEG_SIMD_LEVEL_SSE2,
+  JPEG_SIMD_LEVEL_AVX2,
+  JPEG_SIMD_LEVEL_NEON,
+  JPEG_SIMD_LEVEL_COUNT,
+} JPEG_SIMD_LEVEL;
+
+typedef struct JPEGHuffmanTable
+{
+  u16 codes[256];
+  u8 code_lens[256];
+} JPEGHuffmanTable;
+
+// NOTE(Ryan): out = clamp(in - offset + ((in - offset) * gain >> 8) + bias, -128, 127),
+// i.e. level shifted and, for video range input, stretched to the full range JPEG expects
+typedef struct JPEGLevelMap
+{
+  s16 offset;
+  s16 gain;
+  s16 bias;
+} JPEGLevelMap;
+
+// NOTE(Ryan): One MCU row, coded as its own restart interval
+typedef struct JPEGSlice
+{
+  u8 *data;
+  u32 size;
+} JPEGSlice;
+
+// NOTE(Ryan): Tables and buffers are set up by jpeg_encoder_configure() for one format and size.
+// The threads share an encode by taking slices in turn, so it scales to as many MCU rows
+// as the image has
+typedef struct JPEGEncoder
+{
+  PIXEL_FORMAT format;
+  u32 width;
+  u32 height;
+  u32 stride;
+  u32 quality;
+  // NOTE(Ryan): Smallest buffer holding a whole image
+  u32 image_size;
+
+  u32 mcu_width;
+  u32 mcu_height;
+  u32 mcu_count_x;
+  u32 mcu_count_y;
+  // NOTE(Ryan): The Y blocks then Cb and Cr
+  u32 luma_block_count;
+
+  JPEGLevelMap level_maps[2];
+  // NOTE(Ryan): For the scaled DCT's output, luma then chroma, in the transposed order
+  // the DCT leaves coefficients in
+  u16 divisors[2][64];
+  u16 reciprocals[2][64];
+  // NOTE(Ryan): DC then AC, luma then chroma
+  JPEGHuffmanTable huffman_tables[4];
+
+  // NOTE(Ryan): Everything up to the entropy coded data, the same for every frame
+  u8 header[JPEG_HEADER_SIZE];
+  u32 header_len;
+
+  JPEGSlice *slices;
+  u8 *slice_memory;
+  u32 slice_capacity;
+  u64 slice_memory_size;
+
+  pthread_t threads[MAX_JPEG_THREAD_COUNT];
+  u32 thread_count;
+  pthread_mutex_t mutex;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+  u32 job_generation;
+  b32 is_stopping;
+  const u8 *image;
+  u32 next_slice;
+  // NOTE(Ryan): Threads other than the caller yet to finish the current encode
+  u32 busy_thread_count;
+} JPEGEncoder;
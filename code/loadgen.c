@@ -0,0 +1,488 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+// NOTE(Ryan): For strcasestr()
+#define _GNU_SOURCE
+#include "types.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+// NOTE(Ryan): Closed loop HTTP load generator for benchmarking the server over loopback.
+// Each connection issues one request, reads until the server closes, then reconnects.
+// With -k, requests are instead repeated over the same connection, framed by Content-Length.
+// Connections are spread over several threads so the client is not the bottleneck.
+
+#define MAX_LOADGEN_CONNECTION_COUNT 4096
+#define MAX_LOADGEN_THREAD_COUNT 64
+#define MAX_LOADGEN_LATENCY_COUNT (1 << 20)
+#define LOADGEN_REQUEST_BUFFER_SIZE 512
+
+#define MIN_U64(a, b) ((a) < (b) ? (a) : (b))
+
+#define LOADGEN_RESPONSE_HEADER_SIZE 1024
+
+typedef struct LoadConnection
+{
+  int fd;
+  u64 start_ns;
+  u32 request_sent;
+  b32 is_connected;
+
+  char response_header[LOADGEN_RESPONSE_HEADER_SIZE];
+  u32 response_header_len;
+  b32 has_response_header;
+  u64 response_body_remaining;
+} LoadConnection;
+
+typedef struct LoadGenerator
+{
+  pthread_t thread;
+  u64 end_ns;
+
+  int epoll_fd;
+  struct sockaddr_in server_addr;
+
+  char request[LOADGEN_REQUEST_BUFFER_SIZE];
+  u32 request_len;
+  b32 is_keep_alive;
+
+  LoadConnection connections[MAX_LOADGEN_CONNECTION_COUNT];
+  u32 connection_count;
+
+  u64 *latencies;
+  u32 latency_count;
+  u64 completed_count;
+  u64 failed_count;
+  u64 bytes_received;
+} LoadGenerator;
+
+INTERNAL u64
+get_monotonic_ns(void)
+{
+  struct timespec ts = {0};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
+INTERNAL int
+compare_u64(const void *a, const void *b)
+{
+  u64 a_val = *(const u64 *)a;
+  u64 b_val = *(const u64 *)b;
+  return (a_val > b_val) - (a_val < b_val);
+}
+
+INTERNAL b32
+open_load_connection(LoadGenerator *generator, LoadConnection *connection)
+{
+  b32 result = false;
+
+  connection->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (connection->fd != -1)
+  {
+    int opt_val = 1;
+    setsockopt(connection->fd, IPPROTO_TCP, TCP_NODELAY, &opt_val, sizeof(opt_val));
+
+    connection->start_ns = get_monotonic_ns();
+    connection->request_sent = 0;
+    connection->is_connected = false;
+    connection->response_header_len = 0;
+    connection->has_response_header = false;
+
+    int connect_status = connect(connection->fd, (struct sockaddr *)&generator->server_addr,
+                                 sizeof(generator->server_addr));
+    if (connect_status == 0 || errno == EINPROGRESS)
+    {
+      struct epoll_event connection_event = {0};
+      connection_event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+      connection_event.data.ptr = connection;
+      if (epoll_ctl(generator->epoll_fd, EPOLL_CTL_ADD, connection->fd, &connection_event) != -1)
+      {
+        result = true;
+      }
+    }
+
+    if (!result)
+    {
+      close(connection->fd);
+      connection->fd = -1;
+    }
+  }
+
+  return result;
+}
+
+INTERNAL void
+recycle_load_connection(LoadGenerator *generator, LoadConnection *connection, b32 succeeded)
+{
+  if (succeeded)
+  {
+    generator->completed_count++;
+    if (generator->latency_count < MAX_LOADGEN_LATENCY_COUNT)
+    {
+      generator->latencies[generator->latency_count++] = get_monotonic_ns() - connection->start_ns;
+    }
+  }
+  else
+  {
+    generator->failed_count++;
+  }
+
+  close(connection->fd);
+  connection->fd = -1;
+  if (!open_load_connection(generator, connection))
+  {
+    generator->failed_count++;
+  }
+}
+
+// NOTE(Ryan): Returns false if the connection was recycled
+INTERNAL b32
+send_load_request(LoadGenerator *generator, LoadConnection *connection)
+{
+  b32 result = true;
+
+  while (connection->request_sent < generator->request_len)
+  {
+    ssize_t bytes_sent = send(connection->fd, generator->request + connection->request_sent,
+                              generator->request_len - connection->request_sent,
+                              MSG_NOSIGNAL);
+    if (bytes_sent > 0)
+    {
+      connection->request_sent += (u32)bytes_sent;
+    }
+    else if (bytes_sent == -1 && errno == EAGAIN)
+    {
+      break;
+    }
+    else
+    {
+      recycle_load_connection(generator, connection, false);
+      result = false;
+      break;
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Returns true once a complete response has been received
+INTERNAL b32
+consume_load_response(LoadConnection *connection, char *data, u32 len)
+{
+  b32 result = false;
+
+  if (!connection->has_response_header)
+  {
+    u32 copy_len = LOADGEN_RESPONSE_HEADER_SIZE - 1 - connection->response_header_len;
+    if (copy_len > len)
+    {
+      copy_len = len;
+    }
+    memcpy(connection->response_header + connection->response_header_len, data, copy_len);
+    u32 previous_len = connection->response_header_len;
+    connection->response_header_len += copy_len;
+    connection->response_header[connection->response_header_len] = '\0';
+
+    char *header_end = strstr(connection->response_header, "\r\n\r\n");
+    if (header_end != NULL)
+    {
+      connection->has_response_header = true;
+      connection->response_body_remaining = 0;
+      char *content_length = strcasestr(connection->response_header, "\r\nContent-Length:");
+      if (content_length != NULL && content_length < header_end)
+      {
+        connection->response_body_remaining = strtoull(content_length + 17, NULL, 10);
+      }
+
+      u32 header_len = (u32)(header_end + 4 - connection->response_header);
+      u32 body_len = len - (header_len - previous_len);
+      connection->response_body_remaining -= MIN_U64(body_len, connection->response_body_remaining);
+    }
+  }
+  else
+  {
+    connection->response_body_remaining -= MIN_U64(len, connection->response_body_remaining);
+  }
+
+  if (connection->has_response_header && connection->response_body_remaining == 0)
+  {
+    result = true;
+  }
+
+  return result;
+}
+
+INTERNAL void
+handle_load_connection(LoadGenerator *generator, LoadConnection *connection, u32 events)
+{
+  if (events & EPOLLERR)
+  {
+    recycle_load_connection(generator, connection, false);
+    return;
+  }
+
+  if (events & EPOLLOUT)
+  {
+    connection->is_connected = true;
+    if (!send_load_request(generator, connection))
+    {
+      return;
+    }
+  }
+
+  if (events & (EPOLLIN | EPOLLHUP))
+  {
+    char buf[KILOBYTES(16)];
+    while (true)
+    {
+      ssize_t bytes_read = recv(connection->fd, buf, sizeof(buf), 0);
+      if (bytes_read > 0)
+      {
+        generator->bytes_received += (u64)bytes_read;
+        if (generator->is_keep_alive && consume_load_response(connection, buf, (u32)bytes_read))
+        {
+          // NOTE(Ryan): Pipelining is not used, so a response never runs into the next one
+          generator->completed_count++;
+          if (generator->latency_count < MAX_LOADGEN_LATENCY_COUNT)
+          {
+            generator->latencies[generator->latency_count++] = 
+              get_monotonic_ns() - connection->start_ns;
+          }
+
+          connection->start_ns = get_monotonic_ns();
+          connection->request_sent = 0;
+          connection->response_header_len = 0;
+          connection->has_response_header = false;
+          if (!send_load_request(generator, connection))
+          {
+            break;
+          }
+        }
+      }
+      else if (bytes_read == 0)
+      {
+        recycle_load_connection(generator, connection,
+                                !generator->is_keep_alive && 
+                                connection->request_sent == generator->request_len);
+        break;
+      }
+      else if (errno == EAGAIN)
+      {
+        break;
+      }
+      else
+      {
+        recycle_load_connection(generator, connection, false);
+        break;
+      }
+    }
+  }
+}
+
+INTERNAL void *
+run_load_generator(void *arg)
+{
+  LoadGenerator *generator = (LoadGenerator *)arg;
+
+  for (u32 connection_i = 0;
+       connection_i < generator->connection_count;
+       ++connection_i)
+  {
+    open_load_connection(generator, generator->connections + connection_i);
+  }
+
+  struct epoll_event events[256] = {0};
+  while (get_monotonic_ns() < generator->end_ns)
+  {
+    int event_count = epoll_wait(generator->epoll_fd, events, 256, 100);
+    for (s32 event_i = 0;
+         event_i < event_count;
+         ++event_i)
+    {
+      LoadConnection *connection = (LoadConnection *)events[event_i].data.ptr;
+      handle_load_connection(generator, connection, events[event_i].events);
+    }
+  }
+
+  for (u32 connection_i = 0;
+       connection_i < generator->connection_count;
+       ++connection_i)
+  {
+    if (generator->connections[connection_i].fd != -1)
+    {
+      close(generator->connections[connection_i].fd);
+    }
+  }
+
+  return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+  u32 port = 18000;
+  u32 connection_count = 64;
+  u32 thread_count = 1;
+  u32 duration_seconds = 5;
+  const char *uri = "/";
+  const char *host = "127.0.0.1";
+  b32 is_keep_alive = false;
+
+  for (s32 arg_i = 1;
+       arg_i < argc;
+       arg_i += 2)
+  {
+    if (strcmp(argv[arg_i], "-k") == 0)
+    {
+      is_keep_alive = true;
+      arg_i--;
+    }
+    else if (arg_i + 1 >= argc)
+    {
+      break;
+    }
+    else if (strcmp(argv[arg_i], "-p") == 0)
+    {
+      port = (u32)atoi(argv[arg_i + 1]);
+    }
+    else if (strcmp(argv[arg_i], "-c") == 0)
+    {
+      connection_count = (u32)atoi(argv[arg_i + 1]);
+    }
+    else if (strcmp(argv[arg_i], "-t") == 0)
+    {
+      thread_count = (u32)atoi(argv[arg_i + 1]);
+    }
+    else if (strcmp(argv[arg_i], "-d") == 0)
+    {
+      duration_seconds = (u32)atoi(argv[arg_i + 1]);
+    }
+    else if (strcmp(argv[arg_i], "-u") == 0)
+    {
+      uri = argv[arg_i + 1];
+    }
+    else if (strcmp(argv[arg_i], "-h") == 0)
+    {
+      host = argv[arg_i + 1];
+    }
+  }
+  if (thread_count < 1)
+  {
+    thread_count = 1;
+  }
+  if (thread_count > MAX_LOADGEN_THREAD_COUNT)
+  {
+    thread_count = MAX_LOADGEN_THREAD_COUNT;
+  }
+  if (connection_count < thread_count)
+  {
+    connection_count = thread_count;
+  }
+  if (connection_count > MAX_LOADGEN_CONNECTION_COUNT * thread_count)
+  {
+    connection_count = MAX_LOADGEN_CONNECTION_COUNT * thread_count;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  LoadGenerator *generators = calloc(thread_count, sizeof(LoadGenerator));
+  if (generators == NULL)
+  {
+    return 1;
+  }
+
+  u64 start_ns = get_monotonic_ns();
+  u64 end_ns = start_ns + (u64)duration_seconds * 1000000000ULL;
+  for (u32 thread_i = 0;
+       thread_i < thread_count;
+       ++thread_i)
+  {
+    LoadGenerator *generator = generators + thread_i;
+    generator->end_ns = end_ns;
+    generator->latencies = malloc(MAX_LOADGEN_LATENCY_COUNT * sizeof(u64));
+    generator->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (generator->latencies == NULL || generator->epoll_fd == -1)
+    {
+      return 1;
+    }
+
+    generator->server_addr.sin_family = AF_INET;
+    generator->server_addr.sin_port = htons(port);
+    inet_pton(AF_INET, host, &generator->server_addr.sin_addr);
+
+    generator->is_keep_alive = is_keep_alive;
+    generator->request_len = (u32)snprintf(generator->request, sizeof(generator->request),
+                                           "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n", uri, host,
+                                           is_keep_alive ? "" : "Connection: close\r\n");
+
+    generator->connection_count = connection_count / thread_count;
+    if (thread_i < connection_count % thread_count)
+    {
+      generator->connection_count++;
+    }
+
+    if (pthread_create(&generator->thread, NULL, run_load_generator, generator) != 0)
+    {
+      return 1;
+    }
+  }
+
+  u32 total_latency_count = 0;
+  u64 completed_count = 0, failed_count = 0, bytes_received = 0;
+  for (u32 thread_i = 0;
+       thread_i < thread_count;
+       ++thread_i)
+  {
+    LoadGenerator *generator = generators + thread_i;
+    pthread_join(generator->thread, NULL);
+    total_latency_count += generator->latency_count;
+    completed_count += generator->completed_count;
+    failed_count += generator->failed_count;
+    bytes_received += generator->bytes_received;
+  }
+  r64 elapsed_seconds = (r64)(get_monotonic_ns() - start_ns) / 1000000000.0;
+
+  u64 *latencies = malloc(((u64)total_latency_count + 1) * sizeof(u64));
+  if (latencies == NULL)
+  {
+    return 1;
+  }
+  u32 latency_count = 0;
+  for (u32 thread_i = 0;
+       thread_i < thread_count;
+       ++thread_i)
+  {
+    LoadGenerator *generator = generators + thread_i;
+    memcpy(latencies + latency_count, generator->latencies, 
+           generator->latency_count * sizeof(u64));
+    latency_count += generator->latency_count;
+  }
+
+  qsort(latencies, latency_count, sizeof(u64), compare_u64);
+  u64 p50 = 0, p99 = 0, max = 0;
+  if (latency_count > 0)
+  {
+    p50 = latencies[(u32)(0.50 * (latency_count - 1))];
+    p99 = latencies[(u32)(0.99 * (latency_count - 1))];
+    max = latencies[latency_count - 1];
+  }
+
+  printf("connections: %u, threads: %u, keep-alive: %s, duration: %.2fs\n", connection_count, 
+         thread_count, is_keep_alive ? "yes" : "no", elapsed_seconds);
+  printf("requests: %lu, failed: %lu, req/s: %.0f, MiB/s: %.2f\n",
+         completed_count, failed_count, completed_count / elapsed_seconds,
+         bytes_received / elapsed_seconds / (1024.0 * 1024.0));
+  printf("latency p50: %.1fus, p99: %.1fus, max: %.1fus\n",
+         p50 / 1000.0, p99 / 1000.0, max / 1000.0);
+
+  return 0;
+}
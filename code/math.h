@@ -14,6 +14,9 @@ __extension__ ({ typeof (a) _a = (a); \
    typeof (b) _b = (b); \
    _a < _b ? _a : _b; })
 
+#define CLAMP(val, min, max) \
+  MIN(MAX((val), (min)), (max))
+
 #define ARRAY_COUNT(arr) \
   (__builtin_choose_expr( \
     __builtin_types_compatible_p( \
@@ -40,6 +43,8 @@ r32 floorf(r32);
 r32 sqrtf(r32);
 r32 cosf(r32);
 r32 sinf(r32);
+r64 sqrt(r64);
+r64 ceil(r64);
 
 INTERNAL u32
 round_r32_to_u32(r32 real32)
@@ -0,0 +1,559 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "motion.h"
+
+// NOTE(Ryan): Frame differencing on the capture thread. Each frame's luma, already halved
+// down the stream ladder, is compared with the last one's as the sum of absolute differences
+// over 16x16 tiles, which SSE2 and NEON do 16 pixels a row at a time. Each tile's SAD is
+// smoothed over frames, so a flicker or a single noisy frame does not count, and an event
+// starts once enough tiles are active. Clips are written by the recorder's own thread
+// from a ring of the last frames, so they include the moments before the event.
+
+INTERNAL u32
+motion_tile_sad_scalar(PIXEL_FORMAT format, const u8 *current, u32 current_stride,
+                       const u8 *previous, u32 previous_stride)
+{
+  u32 result = 0;
+
+  u32 sample_step = (format == PIXEL_FORMAT_YUYV) ? 2 : 1;
+  for (u32 y = 0;
+       y < MOTION_TILE_SIZE;
+       ++y)
+  {
+    for (u32 x = 0;
+         x < MOTION_TILE_SIZE;
+         ++x)
+    {
+      s32 difference = (s32)current[y * current_stride + x * sample_step] -
+                       (s32)previous[y * previous_stride + x * sample_step];
+      result += (u32)((difference < 0) ? -difference : difference);
+    }
+  }
+
+  return result;
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// NOTE(Ryan): YUYV chroma is masked to zero in both, so adds nothing to the sum
+INTERNAL u32
+motion_tile_sad_sse2(PIXEL_FORMAT format, const u8 *current, u32 current_stride,
+                     const u8 *previous, u32 previous_stride)
+{
+  __m128i sums = _mm_setzero_si128();
+  if (format == PIXEL_FORMAT_YUYV)
+  {
+    __m128i luma_mask = _mm_set1_epi16(0x00ff);
+    for (u32 y = 0;
+         y < MOTION_TILE_SIZE;
+         ++y)
+    {
+      const u8 *current_row = current + y * current_stride;
+      const u8 *previous_row = previous + y * previous_stride;
+      for (u32 half_i = 0;
+           half_i < 2;
+           ++half_i)
+      {
+        __m128i current_luma = _mm_and_si128(
+          _mm_loadu_si128((const __m128i *)(current_row + half_i * 16)), luma_mask);
+        __m128i previous_luma = _mm_and_si128(
+          _mm_loadu_si128((const __m128i *)(previous_row + half_i * 16)), luma_mask);
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(current_luma, previous_luma));
+      }
+    }
+  }
+  else
+  {
+    for (u32 y = 0;
+         y < MOTION_TILE_SIZE;
+         ++y)
+    {
+      __m128i current_luma = _mm_loadu_si128((const __m128i *)(current + y * current_stride));
+      __m128i previous_luma = _mm_loadu_si128((const __m128i *)(previous + y * previous_stride));
+      sums = _mm_add_epi64(sums, _mm_sad_epu8(current_luma, previous_luma));
+    }
+  }
+
+  return (u32)_mm_cvtsi128_si32(sums) + (u32)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+}
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+
+INTERNAL u32
+motion_tile_sad_neon(PIXEL_FORMAT format, const u8 *current, u32 current_stride,
+                     const u8 *previous, u32 previous_stride)
+{
+  uint16x8_t sums = vdupq_n_u16(0);
+  for (u32 y = 0;
+       y < MOTION_TILE_SIZE;
+       ++y)
+  {
+    const u8 *current_row = current + y * current_stride;
+    const u8 *previous_row = previous + y * previous_stride;
+    uint8x16_t current_luma, previous_luma;
+    if (format == PIXEL_FORMAT_YUYV)
+    {
+      current_luma = vld2q_u8(current_row).val[0];
+      previous_luma = vld2q_u8(previous_row).val[0];
+    }
+    else
+    {
+      current_luma = vld1q_u8(current_row);
+      previous_luma = vld1q_u8(previous_row);
+    }
+    sums = vpadalq_u8(sums, vabdq_u8(current_luma, previous_luma));
+  }
+
+  return vaddlvq_u16(sums);
+}
+#endif
+
+INTERNAL u32
+motion_tile_sad(PIXEL_FORMAT format, const u8 *current, u32 current_stride,
+                const u8 *previous, u32 previous_stride)
+{
+#if defined(__x86_64__)
+  if (global_jpeg_simd_level >= JPEG_SIMD_LEVEL_SSE2)
+  {
+    return motion_tile_sad_sse2(format, current, current_stride, previous, previous_stride);
+  }
+#elif defined(__aarch64__)
+  if (global_jpeg_simd_level == JPEG_SIMD_LEVEL_NEON)
+  {
+    return motion_tile_sad_neon(format, current, current_stride, previous, previous_stride);
+  }
+#endif
+  return motion_tile_sad_scalar(format, current, current_stride, previous, previous_stride);
+}
+
+INTERNAL void
+motion_notify_subscribers(MotionDetector *motion)
+{
+  u64 one = 1;
+  for (u32 subscriber_i = 0;
+       subscriber_i < motion->subscriber_count;
+       ++subscriber_i)
+  {
+    // NOTE(Ryan): Only fails when the counter is saturated, which still wakes the worker
+    if (write(motion->subscriber_fds[subscriber_i], &one, sizeof(one)) == -1 && errno != EAGAIN)
+    {
+      EBP();
+    }
+  }
+}
+
+// NOTE(Ryan): Returns an eventfd that is written whenever there is new state, or -1.
+// Subscribe every worker before starting the capture thread
+INTERNAL int
+motion_subscribe(MotionDetector *motion)
+{
+  int result = -1;
+
+  if (motion->subscriber_count < MAX_MOTION_SUBSCRIBER_COUNT)
+  {
+    result = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (result != -1)
+    {
+      motion->subscriber_fds[motion->subscriber_count++] = result;
+    }
+    else
+    {
+      EBP();
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Returns false if the file could not be written in full
+INTERNAL b32
+motion_write_all(int fd, const u8 *data, u32 size)
+{
+  b32 result = true;
+
+  u32 written = 0;
+  while (written < size && result)
+  {
+    ssize_t write_result = write(fd, data + written, size - written);
+    if (write_result > 0)
+    {
+      written += (u32)write_result;
+    }
+    else if (write_result == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    else
+    {
+      result = false;
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): A clip is the frames back to back, so it plays as an MJPEG recording with -c
+INTERNAL int
+motion_open_clip(const char *directory)
+{
+  char path[512] = {0};
+  time_t now = time(NULL);
+  struct tm now_utc = {0};
+  gmtime_r(&now, &now_utc);
+  char name[64] = {0};
+  strftime(name, sizeof(name), "motion-%Y%m%d-%H%M%S.mjpeg", &now_utc);
+  snprintf(path, sizeof(path), "%s/%s", directory, name);
+
+  int result = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (result == -1)
+  {
+    EBP();
+  }
+
+  return result;
+}
+
+INTERNAL void *
+motion_recorder_run(void *arg)
+{
+  MotionRecorder *recorder = (MotionRecorder *)arg;
+
+  int clip_fd = -1;
+  pthread_mutex_lock(&recorder->mutex);
+  while (true)
+  {
+    if (recorder->is_clip_open && clip_fd < 0)
+    {
+      // NOTE(Ryan): File operations are never done holding the lock the capture thread takes
+      pthread_mutex_unlock(&recorder->mutex);
+      clip_fd = motion_open_clip(recorder->directory);
+      pthread_mutex_lock(&recorder->mutex);
+      if (clip_fd < 0)
+      {
+        // NOTE(Ryan): Nowhere to write, so give up on this clip
+        recorder->dropped_frame_count += recorder->pushed_count - recorder->write_index;
+        recorder->is_clip_open = false;
+        continue;
+      }
+    }
+
+    u64 end_index = (recorder->clip_end_index < recorder->pushed_count) ?
+                    recorder->clip_end_index : recorder->pushed_count;
+    if (recorder->is_clip_open && recorder->write_index < end_index)
+    {
+      u32 slot = (u32)(recorder->write_index % MOTION_CLIP_RING_SIZE);
+      MotionClipFrame *frame = recorder->frames + slot;
+      recorder->writing_slot = (s32)slot;
+      pthread_mutex_unlock(&recorder->mutex);
+      b32 is_written = motion_write_all(clip_fd, frame->data, frame->size);
+      pthread_mutex_lock(&recorder->mutex);
+      recorder->writing_slot = -1;
+      // NOTE(Ryan): Unless the capture thread skipped past it meanwhile
+      if (recorder->write_index % MOTION_CLIP_RING_SIZE == slot)
+      {
+        recorder->write_index++;
+      }
+      if (is_written)
+      {
+        recorder->written_frame_count++;
+      }
+      else
+      {
+        EBP();
+        recorder->dropped_frame_count++;
+      }
+    }
+    else if (clip_fd >= 0 &&
+             (!recorder->is_clip_open || recorder->write_index >= recorder->clip_end_index))
+    {
+      recorder->is_clip_open = false;
+      recorder->clip_count++;
+      pthread_mutex_unlock(&recorder->mutex);
+      close(clip_fd);
+      clip_fd = -1;
+      pthread_mutex_lock(&recorder->mutex);
+    }
+    else
+    {
+      pthread_cond_wait(&recorder->cond, &recorder->mutex);
+    }
+  }
+
+  return NULL;
+}
+
+// NOTE(Ryan): Copies an encoded frame into the ring. Only ever waits on the recorder
+// for as long as it takes to pick its next frame
+INTERNAL void
+motion_recorder_push(MotionRecorder *recorder, const u8 *data, u32 size)
+{
+  pthread_mutex_lock(&recorder->mutex);
+  u32 slot = (u32)(recorder->pushed_count % MOTION_CLIP_RING_SIZE);
+  if ((s32)slot == recorder->writing_slot)
+  {
+    recorder->dropped_frame_count++;
+  }
+  else
+  {
+    MotionClipFrame *frame = recorder->frames + slot;
+    if (frame->capacity < size)
+    {
+      free(frame->data);
+      frame->capacity = size + size / 4;
+      frame->data = malloc(frame->capacity);
+      frame->capacity = (frame->data != NULL) ? frame->capacity : 0;
+    }
+
+    if (frame->data != NULL)
+    {
+      memcpy(frame->data, data, size);
+      frame->size = size;
+    }
+    else
+    {
+      EBP();
+      frame->size = 0;
+    }
+
+    // NOTE(Ryan): The disk fell a whole ring behind, so the oldest unwritten frame is lost
+    if (recorder->is_clip_open &&
+        recorder->pushed_count - recorder->write_index >= MOTION_CLIP_RING_SIZE)
+    {
+      recorder->write_index++;
+      recorder->dropped_frame_count++;
+    }
+    recorder->pushed_count++;
+    pthread_cond_signal(&recorder->cond);
+  }
+  pthread_mutex_unlock(&recorder->mutex);
+}
+
+// NOTE(Ryan): An event starting while the last clip is still being written carries it on
+INTERNAL void
+motion_recorder_begin_clip(MotionRecorder *recorder)
+{
+  pthread_mutex_lock(&recorder->mutex);
+  if (!recorder->is_clip_open)
+  {
+    u64 pre_roll_count = (recorder->pushed_count < MOTION_PRE_ROLL_FRAME_COUNT) ?
+                         recorder->pushed_count : MOTION_PRE_ROLL_FRAME_COUNT;
+    recorder->write_index = recorder->pushed_count - pre_roll_count;
+    recorder->is_clip_open = true;
+  }
+  recorder->clip_end_index = UINT64_MAX;
+  pthread_cond_signal(&recorder->cond);
+  pthread_mutex_unlock(&recorder->mutex);
+}
+
+INTERNAL void
+motion_recorder_end_clip(MotionRecorder *recorder)
+{
+  pthread_mutex_lock(&recorder->mutex);
+  recorder->clip_end_index = recorder->pushed_count;
+  pthread_cond_signal(&recorder->cond);
+  pthread_mutex_unlock(&recorder->mutex);
+}
+
+// NOTE(Ryan): clip_directory may be NULL to only detect
+INTERNAL void
+motion_init(MotionDetector *motion, const char *clip_directory)
+{
+  motion->is_enabled = true;
+  pthread_mutex_init(&motion->mutex, NULL);
+  motion->version = 1;
+
+  MotionRecorder *recorder = &motion->recorder;
+  recorder->directory = clip_directory;
+  recorder->writing_slot = -1;
+  pthread_mutex_init(&recorder->mutex, NULL);
+  pthread_cond_init(&recorder->cond, NULL);
+}
+
+INTERNAL b32
+motion_start(MotionDetector *motion)
+{
+  b32 result = true;
+
+  MotionRecorder *recorder = &motion->recorder;
+  if (recorder->directory != NULL)
+  {
+    result = (pthread_create(&recorder->thread, NULL, motion_recorder_run, recorder) == 0);
+    if (!result)
+    {
+      BP_MSG(NULL, "Failed to create motion recorder thread");
+      recorder->directory = NULL;
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): For every frame, on luma small enough to compare at full rate.
+// A change of format or size starts over, as there is nothing to compare with
+INTERNAL void
+motion_detect(MotionDetector *motion, PIXEL_FORMAT format, const u8 *image,
+              u32 width, u32 height, u32 stride, u64 now_ns)
+{
+  u64 start_ns = get_ns();
+
+  u32 luma_row_size = (format == PIXEL_FORMAT_YUYV) ? width * 2 : width;
+  u32 luma_size = luma_row_size * height;
+  if (format != motion->format || width != motion->width || height != motion->height)
+  {
+    if (motion->previous_luma_capacity < luma_size)
+    {
+      free(motion->previous_luma);
+      motion->previous_luma = malloc(luma_size);
+      motion->previous_luma_capacity = (motion->previous_luma != NULL) ? luma_size : 0;
+    }
+    pthread_mutex_lock(&motion->mutex);
+    motion->format = format;
+    motion->width = width;
+    motion->height = height;
+    // NOTE(Ryan): A partial tile at the right or bottom edge is left out
+    motion->column_count = width / MOTION_TILE_SIZE;
+    motion->column_count = (motion->column_count < MAX_MOTION_TILE_COLUMN_COUNT) ?
+                           motion->column_count : MAX_MOTION_TILE_COLUMN_COUNT;
+    motion->row_count = height / MOTION_TILE_SIZE;
+    motion->row_count = (motion->row_count < MAX_MOTION_TILE_ROW_COUNT) ?
+                        motion->row_count : MAX_MOTION_TILE_ROW_COUNT;
+    memset(motion->tile_activities, 0, sizeof(motion->tile_activities));
+    pthread_mutex_unlock(&motion->mutex);
+    motion->has_previous_luma = false;
+  }
+  if (motion->previous_luma == NULL)
+  {
+    EBP();
+    return;
+  }
+
+  if (motion->has_previous_luma)
+  {
+    u32 sample_step = (format == PIXEL_FORMAT_YUYV) ? 2 : 1;
+    u32 active_tile_count = 0;
+    pthread_mutex_lock(&motion->mutex);
+    for (u32 row_i = 0;
+         row_i < motion->row_count;
+         ++row_i)
+    {
+      for (u32 column_i = 0;
+           column_i < motion->column_count;
+           ++column_i)
+      {
+        u32 y = row_i * MOTION_TILE_SIZE;
+        u32 x = column_i * MOTION_TILE_SIZE * sample_step;
+        u32 sad = motion_tile_sad(format, image + y * stride + x, stride,
+                                  motion->previous_luma + y * luma_row_size + x, luma_row_size);
+        // NOTE(Ryan): An exponential moving average weighting the new frame by a quarter
+        u16 *activity = motion->tile_activities + row_i * motion->column_count + column_i;
+        *activity = (u16)((*activity * 3u + sad) >> 2);
+        if (*activity >= MOTION_TILE_THRESHOLD)
+        {
+          active_tile_count++;
+        }
+      }
+    }
+    motion->active_tile_count = active_tile_count;
+
+    b32 is_changed = false;
+    if (active_tile_count >= MOTION_MIN_ACTIVE_TILE_COUNT)
+    {
+      motion->last_motion_ns = now_ns;
+      if (!motion->is_motion)
+      {
+        motion->is_motion = true;
+        motion->event_count++;
+        is_changed = true;
+        if (motion->recorder.directory != NULL)
+        {
+          motion_recorder_begin_clip(&motion->recorder);
+        }
+      }
+    }
+    else if (motion->is_motion && now_ns - motion->last_motion_ns > MOTION_HOLD_MS * 1000000ULL)
+    {
+      motion->is_motion = false;
+      is_changed = true;
+      if (motion->recorder.directory != NULL)
+      {
+        motion_recorder_end_clip(&motion->recorder);
+      }
+    }
+
+    motion->detect_ms = (r32)(get_ns() - start_ns) / 1000000.0f;
+    b32 is_map_due = (now_ns - motion->published_ns >= MOTION_MAP_INTERVAL_MS * 1000000ULL);
+    if (is_changed || is_map_due)
+    {
+      motion->version++;
+      motion->published_ns = now_ns;
+    }
+    pthread_mutex_unlock(&motion->mutex);
+
+    if (is_changed || is_map_due)
+    {
+      motion_notify_subscribers(motion);
+    }
+  }
+
+  for (u32 y = 0;
+       y < height;
+       ++y)
+  {
+    memcpy(motion->previous_luma + y * luma_row_size, image + y * stride, luma_row_size);
+  }
+  motion->has_previous_luma = true;
+}
+
+// NOTE(Ryan): buf is best MOTION_STATE_JSON_SIZE. The map is two hex digits a tile, row by row,
+// of its mean luma difference. Returns the length written
+INTERNAL u32
+motion_format_state(MotionDetector *motion, char *buf, u32 buf_size, u64 *version)
+{
+  LOCAL_PERSIST const char hex_digits[16] = "0123456789abcdef";
+  u32 result = 0;
+
+  pthread_mutex_lock(&motion->mutex);
+  *version = motion->version;
+  MotionRecorder *recorder = &motion->recorder;
+  s32 len = snprintf(buf, buf_size,
+                     "{\"type\":\"motion\",\"version\":%lu,\"motion\":%s,\"events\":%lu,"
+                     "\"active_tiles\":%u,\"detect_ms\":%.3f,\"clips\":%lu,"
+                     "\"recorded\":%lu,\"record_dropped\":%lu,\"width\":%u,\"height\":%u,"
+                     "\"columns\":%u,\"rows\":%u,\"map\":\"",
+                     motion->version, motion->is_motion ? "true" : "false",
+                     motion->event_count, motion->active_tile_count, motion->detect_ms,
+                     recorder->clip_count, recorder->written_frame_count,
+                     recorder->dropped_frame_count, motion->width, motion->height,
+                     motion->column_count, motion->row_count);
+  result = (len > 0) ? (u32)len : 0;
+
+  u32 tile_count = motion->column_count * motion->row_count;
+  for (u32 tile_i = 0;
+       tile_i < tile_count && result + 2 < buf_size;
+       ++tile_i)
+  {
+    u32 level = motion->tile_activities[tile_i] / (MOTION_TILE_SIZE * MOTION_TILE_SIZE);
+    buf[result++] = hex_digits[level >> 4];
+    buf[result++] = hex_digits[level & 0xf];
+  }
+  pthread_mutex_unlock(&motion->mutex);
+
+  if (result < buf_size)
+  {
+    len = snprintf(buf + result, buf_size - result, "\"}");
+    result += (len > 0) ? (u32)len : 0;
+  }
+  if (result >= buf_size)
+  {
+    result = buf_size - 1;
+  }
+
+  return result;
+}
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#pragma once
+
+#include <pthread.h>
+
+#include "jpeg_encoder.h"
+
+#define MOTION_TILE_SIZE 16
+#define MAX_MOTION_TILE_COLUMN_COUNT 80
+#define MAX_MOTION_TILE_ROW_COUNT 48
+#define MAX_MOTION_TILE_COUNT (MAX_MOTION_TILE_COLUMN_COUNT * MAX_MOTION_TILE_ROW_COUNT)
+// NOTE(Ryan): Activity is a tile's smoothed SAD, i.e. 256 times its mean luma difference.
+// Sensor noise stays under a few levels, so a tile is active past a mean of 6
+#define MOTION_TILE_THRESHOLD (6 * MOTION_TILE_SIZE * MOTION_TILE_SIZE)
+#define MOTION_MIN_ACTIVE_TILE_COUNT 2
+// NOTE(Ryan): An event lasts this long past the last active frame, which is also the post-roll
+#define MOTION_HOLD_MS 3000
+#define MOTION_MAP_INTERVAL_MS 200
+#define MAX_MOTION_SUBSCRIBER_COUNT 64
+#define MOTION_STATE_JSON_SIZE (512 + MAX_MOTION_TILE_COUNT * 2)
+// NOTE(Ryan): About 2 seconds at 30 fps kept from before an event starts
+#define MOTION_PRE_ROLL_FRAME_COUNT 60
+#define MOTION_CLIP_RING_SIZE 128
+
+typedef struct MotionClipFrame
+{
+  u8 *data;
+  u32 size;
+  u32 capacity;
+} MotionClipFrame;
+
+// NOTE(Ryan): The last frames are always kept in memory, so a clip can start before
+// the event that opened it. Its own thread writes clips out, so the capture thread
+// only ever copies a frame in. A frame is numbered by how many were pushed before it,
+// and kept in the slot of that number modulo MOTION_CLIP_RING_SIZE
+typedef struct MotionRecorder
+{
+  // NOTE(Ryan): NULL when not recording
+  const char *directory;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  MotionClipFrame frames[MOTION_CLIP_RING_SIZE];
+  u64 pushed_count;
+
+  // NOTE(Ryan): While a clip is open, frames from write_index up to clip_end_index are written.
+  // The end is UINT64_MAX until the event is over
+  b32 is_clip_open;
+  u64 write_index;
+  u64 clip_end_index;
+  // NOTE(Ryan): The slot being written, which the capture thread must not copy over, or -1
+  s32 writing_slot;
+
+  u64 clip_count;
+  u64 written_frame_count;
+  // NOTE(Ryan): Frames lost as the disk could not keep up
+  u64 dropped_frame_count;
+} MotionRecorder;
+
+// NOTE(Ryan): Compares each frame's luma with the last one's over a grid of tiles.
+// Workers are woken through their eventfd on every event change and every
+// MOTION_MAP_INTERVAL_MS, and take the state with motion_format_state()
+typedef struct MotionDetector
+{
+  b32 is_enabled;
+  pthread_mutex_t mutex;
+  u64 version;
+
+  PIXEL_FORMAT format;
+  u32 width;
+  u32 height;
+  u32 column_count;
+  u32 row_count;
+  // NOTE(Ryan): The last frame's luma, rows packed together but still interleaved for YUYV
+  u8 *previous_luma;
+  u32 previous_luma_capacity;
+  b32 has_previous_luma;
+  u16 tile_activities[MAX_MOTION_TILE_COUNT];
+  u32 active_tile_count;
+
+  b32 is_motion;
+  u64 event_count;
+  u64 last_motion_ns;
+  u64 published_ns;
+  r32 detect_ms;
+
+  MotionRecorder recorder;
+
+  int subscriber_fds[MAX_MOTION_SUBSCRIBER_COUNT];
+  u32 subscriber_count;
+} MotionDetector;
@@ -6,6 +6,7 @@
 #include "debug.h"
 #include "math.h"
 #include "vector.h"
+#include "camera_preview.h"
 #include "platform.h"
 
 #include <sys/types.h>
@@ -14,6 +15,237 @@
 
 #include "io.c"
 
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <time.h>
+
+INTERNAL u64
+get_ns(void)
+{
+  u64 result = 0;
+
+  struct timespec cur_timespec = {0};
+  if (clock_gettime(CLOCK_MONOTONIC, &cur_timespec) != -1)
+  {
+    result = (u64)cur_timespec.tv_nsec + ((u64)cur_timespec.tv_sec * 1000000000ULL);
+  }
+  else
+  {
+    EBP();
+  }
+
+  return result;
+}
+
+#include "frame_source.c"
+
+// NOTE(Ryan): Raw frames, as there is no decoder for MJPEG. A camera that only gives MJPEG,
+// or no camera at all, shows the synthetic pattern instead
+INTERNAL b32
+open_camera_preview_source(FrameSource *source)
+{
+  b32 result = false;
+
+  if (access(CAMERA_PREVIEW_DEVICE, R_OK | W_OK) == 0)
+  {
+    frame_source_init(source, CAMERA_PREVIEW_DEVICE, PIXEL_FORMAT_YUYV, CAMERA_PREVIEW_WIDTH,
+                      CAMERA_PREVIEW_HEIGHT, CAMERA_PREVIEW_FPS);
+    result = frame_source_open(source);
+    if (!result && source->error != NULL)
+    {
+      BP_MSG(source->error);
+    }
+  }
+
+  if (!result)
+  {
+    frame_source_init(source, "synthetic", PIXEL_FORMAT_YUYV, CAMERA_PREVIEW_WIDTH,
+                      CAMERA_PREVIEW_HEIGHT, CAMERA_PREVIEW_FPS);
+    result = frame_source_open(source);
+    if (!result && source->error != NULL)
+    {
+      BP_MSG(source->error);
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Only copies each frame into the back slot, so the renderer never waits on
+// the camera, and the camera never waits on the renderer
+INTERNAL void *
+run_camera_preview(void *arg)
+{
+  CameraPreview *preview = (CameraPreview *)arg;
+
+  FrameSource source = {0};
+  if (open_camera_preview_source(&source))
+  {
+    u32 row_size = (source.format == PIXEL_FORMAT_YUYV) ? source.width * 2 : source.width;
+    u32 row_count = (source.format == PIXEL_FORMAT_NV12) ? source.height + source.height / 2 :
+                                                           source.height;
+
+    b32 has_slots = true;
+    for (u32 slot_i = 0;
+         slot_i < CAMERA_PREVIEW_SLOT_COUNT;
+         ++slot_i)
+    {
+      preview->slots[slot_i].data = malloc(row_size * row_count);
+      has_slots &= (preview->slots[slot_i].data != NULL);
+    }
+
+    if (has_slots)
+    {
+      preview->source_name = frame_source_type_name(&source);
+      preview->format = source.format;
+      preview->width = source.width;
+      preview->height = source.height;
+      preview->back_index = 0;
+      preview->front_index = 1;
+      preview->ready = 2;
+      __atomic_store_n(&preview->is_open, true, __ATOMIC_RELEASE);
+
+      struct pollfd poll_fds[2] = {0};
+      poll_fds[0].fd = source.fd;
+      poll_fds[0].events = POLLIN;
+      poll_fds[1].fd = preview->wake_fd;
+      poll_fds[1].events = POLLIN;
+      while (!__atomic_load_n(&preview->is_stopping, __ATOMIC_ACQUIRE))
+      {
+        if (poll(poll_fds, ARRAY_COUNT(poll_fds), -1) == -1)
+        {
+          if (errno == EINTR)
+          {
+            continue;
+          }
+          EBP();
+          break;
+        }
+        if (poll_fds[1].revents != 0)
+        {
+          break;
+        }
+        // NOTE(Ryan): The camera was unplugged, so the last frame stays up
+        if (poll_fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+        {
+          break;
+        }
+
+        if (frame_source_dequeue(&source))
+        {
+          CameraPreviewSlot *slot = &preview->slots[preview->back_index];
+          for (u32 row_i = 0;
+               row_i < row_count;
+               ++row_i)
+          {
+            memcpy(slot->data + row_i * row_size, source.held.data + row_i * source.stride,
+                   row_size);
+          }
+          slot->size = row_size * row_count;
+          slot->sequence = source.held.sequence;
+          frame_source_release(&source);
+
+          u32 previous = __atomic_exchange_n(&preview->ready,
+                                             preview->back_index | CAMERA_PREVIEW_FRESH_BIT,
+                                             __ATOMIC_ACQ_REL);
+          if (previous & CAMERA_PREVIEW_FRESH_BIT)
+          {
+            preview->dropped_count++;
+          }
+          preview->back_index = previous & ~CAMERA_PREVIEW_FRESH_BIT;
+          preview->captured_count++;
+        }
+      }
+    }
+    else
+    {
+      EBP();
+    }
+
+    frame_source_close(&source);
+  }
+
+  return NULL;
+}
+
+INTERNAL void
+start_camera_preview(CameraPreview *preview)
+{
+  preview->is_stopping = false;
+  preview->wake_fd = eventfd(0, EFD_CLOEXEC);
+  if (preview->wake_fd != -1)
+  {
+    if (pthread_create(&preview->thread, NULL, run_camera_preview, preview) == 0)
+    {
+      preview->is_running = true;
+    }
+    else
+    {
+      BP_MSG("Failed to start camera preview");
+      close(preview->wake_fd);
+      preview->wake_fd = -1;
+    }
+  }
+  else
+  {
+    EBP();
+  }
+
+  preview->has_start_failed = !preview->is_running;
+}
+
+// NOTE(Ryan): Joins the capture thread, which closes the camera, then frees the slots. 
+// Only between frames, as the renderer must not be holding one
+INTERNAL void
+stop_camera_preview(CameraPreview *preview)
+{
+  if (preview->is_running)
+  {
+    __atomic_store_n(&preview->is_stopping, true, __ATOMIC_RELEASE);
+    u64 wake = 1;
+    if (write(preview->wake_fd, &wake, sizeof(wake)) != sizeof(wake))
+    {
+      EBP();
+    }
+    pthread_join(preview->thread, NULL);
+    close(preview->wake_fd);
+    preview->wake_fd = -1;
+    preview->is_running = false;
+
+    for (u32 slot_i = 0;
+         slot_i < CAMERA_PREVIEW_SLOT_COUNT;
+         ++slot_i)
+    {
+      free(preview->slots[slot_i].data);
+      CameraPreviewSlot zero_slot = {0};
+      preview->slots[slot_i] = zero_slot;
+    }
+    preview->is_open = false;
+    preview->ready = 0;
+    preview->back_index = 0;
+    preview->front_index = 0;
+  }
+}
+
+// NOTE(Ryan): A failed start is only retried once the panel has been turned off and on again
+INTERNAL void
+update_camera_preview(CameraPreview *preview)
+{
+  if (preview->is_wanted)
+  {
+    if (!preview->is_running && !preview->has_start_failed)
+    {
+      start_camera_preview(preview);
+    }
+  }
+  else
+  {
+    stop_camera_preview(preview);
+    preview->has_start_failed = false;
+  }
+}
+
 
 INTERNAL u32
 get_refresh_rate(SDL_Window *window)
@@ -50,6 +282,7 @@ typedef struct LoadableUpdateAndRender
   const char *toggle_file; 
   u64 base_mod_time, toggle_mod_time, current_mod_time;
   void *load_handle;
+  u32 load_count;
   UpdateAndRender update_and_render;
 } LoadableUpdateAndRender;
 
@@ -92,6 +325,7 @@ reload_update_and_render(LoadableUpdateAndRender *loadable_update_and_render)
         loadable_update_and_render->base_mod_time = base_mod_time;
         loadable_update_and_render->toggle_mod_time = toggle_mod_time;
         loadable_update_and_render->update_and_render = update_and_render;
+        loadable_update_and_render->load_count++;
 
         result = update_and_render;
       }
@@ -122,6 +356,401 @@ get_elapsed_seconds(u64 last_timer, u64 current_timer)
   return result;
 }
 
+// NOTE(Ryan): A spike's frames, copied out of the ring so they are written off the frame thread
+typedef struct DebugSpikeCapture
+{
+  char file_name[64];
+  u64 first_frame_counter;
+  u64 spike_frame_counter;
+  u32 frame_count;
+  DebugFrameInfo frames[MAX_DEBUG_FRAME_COUNT];
+  // NOTE(Ryan): Where each frame's events start in events
+  u32 event_offsets[MAX_DEBUG_FRAME_COUNT];
+  DebugEvent *events;
+
+  // NOTE(Ryan): Copied along with their strings, as the static info lives in the shared object
+  // and so can be unloaded before the capture is written
+  DebugBlockStaticInfo *block_static_infos;
+  u32 block_static_info_count;
+  char *block_strings;
+} DebugSpikeCapture;
+
+// NOTE(Ryan): Writes one capture at a time. One arriving while another is still being written
+// is dropped, as spikes that close together show the same thing
+typedef struct DebugSpikeExporter
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t thread;
+  b32 is_running;
+  b32 is_stopping;
+
+  DebugSpikeCapture *pending;
+  u32 dropped_count;
+} DebugSpikeExporter;
+
+INTERNAL void
+free_debug_spike_capture(DebugSpikeCapture *capture)
+{
+  if (capture != NULL)
+  {
+    free(capture->events);
+    free(capture->block_static_infos);
+    free(capture->block_strings);
+    free(capture);
+  }
+}
+
+// NOTE(Ryan): Returns NULL if out of memory
+INTERNAL DebugSpikeCapture *
+copy_debug_spike_capture(DebugEventTable *debug_event_table, u64 first_frame_counter, 
+                         u64 last_frame_counter)
+{
+  DebugSpikeCapture *capture = calloc(1, sizeof(DebugSpikeCapture));
+  if (capture == NULL)
+  {
+    return NULL;
+  }
+
+  capture->first_frame_counter = first_frame_counter;
+  capture->spike_frame_counter = debug_event_table->spike_frame_counter;
+  capture->frame_count = (u32)(last_frame_counter - first_frame_counter + 1);
+
+  u32 event_count = 0;
+  for (u32 frame_i = 0;
+       frame_i < capture->frame_count;
+       ++frame_i)
+  {
+    u32 frame_index = (first_frame_counter + frame_i) % MAX_DEBUG_FRAME_COUNT;
+    capture->frames[frame_i] = debug_event_table->frames[frame_index];
+    capture->event_offsets[frame_i] = event_count;
+    event_count += capture->frames[frame_i].event_count;
+  }
+
+  u32 block_count = debug_event_table->block_static_info_count;
+  u64 block_strings_size = 0;
+  for (u32 block_i = 0;
+       block_i < block_count;
+       ++block_i)
+  {
+    DebugBlockStaticInfo *static_info = debug_event_table->block_static_infos + block_i;
+    block_strings_size += strlen(static_info->block_name) + strlen(static_info->file_name) + 2;
+  }
+
+  capture->events = malloc(MAX(event_count, 1u) * sizeof(DebugEvent));
+  capture->block_static_infos = malloc(MAX(block_count, 1u) * sizeof(DebugBlockStaticInfo));
+  capture->block_strings = malloc(MAX(block_strings_size, 1ul));
+  if (capture->events == NULL || capture->block_static_infos == NULL || 
+      capture->block_strings == NULL)
+  {
+    free_debug_spike_capture(capture);
+    return NULL;
+  }
+
+  for (u32 frame_i = 0;
+       frame_i < capture->frame_count;
+       ++frame_i)
+  {
+    u32 frame_index = (first_frame_counter + frame_i) % MAX_DEBUG_FRAME_COUNT;
+    memcpy(capture->events + capture->event_offsets[frame_i], 
+           debug_event_table->events[frame_index], 
+           capture->frames[frame_i].event_count * sizeof(DebugEvent));
+  }
+
+  char *at = capture->block_strings;
+  for (u32 block_i = 0;
+       block_i < block_count;
+       ++block_i)
+  {
+    DebugBlockStaticInfo *static_info = debug_event_table->block_static_infos + block_i;
+    DebugBlockStaticInfo *copy = capture->block_static_infos + block_i;
+    copy->line_number = static_info->line_number;
+
+    u32 block_name_size = (u32)strlen(static_info->block_name) + 1;
+    memcpy(at, static_info->block_name, block_name_size);
+    copy->block_name = at;
+    at += block_name_size;
+
+    u32 file_name_size = (u32)strlen(static_info->file_name) + 1;
+    memcpy(at, static_info->file_name, file_name_size);
+    copy->file_name = at;
+    at += file_name_size;
+  }
+  capture->block_static_info_count = block_count;
+
+  return capture;
+}
+
+// NOTE(Ryan): Names and paths can hold anything, so quotes, backslashes and control characters
+// are escaped to keep the JSON valid
+INTERNAL void
+write_json_string(FILE *file, const char *str)
+{
+  for (const char *at = str; 
+       *at != '\0'; 
+       ++at)
+  {
+    u8 c = (u8)*at;
+    if (c == '"' || c == '\\')
+    {
+      fputc('\\', file);
+      fputc(c, file);
+    }
+    else if (c < 0x20)
+    {
+      fprintf(file, "\\u%04x", c);
+    }
+    else
+    {
+      fputc(c, file);
+    }
+  }
+}
+
+// NOTE(Ryan): Chrome trace event format, so captures open in chrome://tracing or Perfetto
+INTERNAL void
+export_debug_frames(DebugSpikeCapture *capture)
+{
+  FILE *file = fopen(capture->file_name, "w");
+  if (file != NULL)
+  {
+    // NOTE(Ryan): Derive the TSC rate from the captured frames themselves
+    u64 total_cycles = 0;
+    r64 total_seconds = 0.0;
+    for (u32 frame_i = 0;
+         frame_i < capture->frame_count;
+         ++frame_i)
+    {
+      DebugFrameInfo *frame = capture->frames + frame_i;
+      total_cycles += (frame->end_clock - frame->begin_clock);
+      total_seconds += frame->seconds;
+    }
+    r64 microseconds_per_cycle = 0.0;
+    if (total_cycles > 0)
+    {
+      microseconds_per_cycle = (total_seconds * 1000000.0) / (r64)total_cycles;
+    }
+
+    u64 base_clock = capture->frames[0].begin_clock;
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    b32 is_first_event = true;
+    for (u32 frame_i = 0;
+         frame_i < capture->frame_count;
+         ++frame_i)
+    {
+      u64 frame_counter = capture->first_frame_counter + frame_i;
+      DebugFrameInfo *frame = capture->frames + frame_i;
+
+      fprintf(file, "%s{\"name\":\"frame %lu%s\",\"ph\":\"X\",\"pid\":0,\"tid\":0,"
+              "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"ms\":%.3f}}", 
+              is_first_event ? "" : ",\n", frame_counter, 
+              (frame_counter == capture->spike_frame_counter) ? " (spike)" : "",
+              (r64)(frame->begin_clock - base_clock) * microseconds_per_cycle,
+              (r64)(frame->end_clock - frame->begin_clock) * microseconds_per_cycle,
+              frame->seconds * 1000.0f);
+      is_first_event = false;
+
+      for (u32 event_i = 0;
+           event_i < frame->event_count;
+           ++event_i)
+      {
+        DebugEvent *event = capture->events + capture->event_offsets[frame_i] + event_i;
+        if (event->static_info_index < capture->block_static_info_count)
+        {
+          DebugBlockStaticInfo *static_info = \
+            capture->block_static_infos + event->static_info_index;
+          fprintf(file, ",\n{\"name\":\"");
+          write_json_string(file, static_info->block_name);
+          fprintf(file, "\",\"cat\":\"");
+          write_json_string(file, static_info->file_name);
+          fprintf(file, ":%u\",\"ph\":\"%c\",\"pid\":0,\"tid\":1,\"ts\":%.3f}", 
+                  static_info->line_number, (event->type == DEBUG_EVENT_BEGIN_BLOCK) ? 'B' : 'E',
+                  (r64)(event->clock - base_clock) * microseconds_per_cycle);
+        }
+      }
+    }
+    fprintf(file, "\n]}\n");
+
+    fclose(file);
+  }
+  else
+  {
+    EBP();
+  }
+}
+
+INTERNAL void *
+run_debug_spike_exporter(void *arg)
+{
+  DebugSpikeExporter *exporter = (DebugSpikeExporter *)arg;
+
+  pthread_mutex_lock(&exporter->mutex);
+  while (true)
+  {
+    while (exporter->pending == NULL && !exporter->is_stopping)
+    {
+      pthread_cond_wait(&exporter->cond, &exporter->mutex);
+    }
+    // NOTE(Ryan): A capture already handed over is still written before stopping
+    if (exporter->pending == NULL)
+    {
+      break;
+    }
+
+    DebugSpikeCapture *capture = exporter->pending;
+    pthread_mutex_unlock(&exporter->mutex);
+
+    export_debug_frames(capture);
+    free_debug_spike_capture(capture);
+
+    pthread_mutex_lock(&exporter->mutex);
+    exporter->pending = NULL;
+  }
+  pthread_mutex_unlock(&exporter->mutex);
+
+  return NULL;
+}
+
+INTERNAL b32
+start_debug_spike_exporter(DebugSpikeExporter *exporter)
+{
+  b32 result = false;
+
+  if (pthread_mutex_init(&exporter->mutex, NULL) == 0 && 
+      pthread_cond_init(&exporter->cond, NULL) == 0 &&
+      pthread_create(&exporter->thread, NULL, run_debug_spike_exporter, exporter) == 0)
+  {
+    exporter->is_running = true;
+    result = true;
+  }
+  else
+  {
+    BP_MSG("Failed to start spike exporter");
+  }
+
+  return result;
+}
+
+INTERNAL void
+stop_debug_spike_exporter(DebugSpikeExporter *exporter)
+{
+  if (exporter->is_running)
+  {
+    pthread_mutex_lock(&exporter->mutex);
+    exporter->is_stopping = true;
+    pthread_cond_signal(&exporter->cond);
+    pthread_mutex_unlock(&exporter->mutex);
+
+    pthread_join(exporter->thread, NULL);
+    exporter->is_running = false;
+  }
+}
+
+// NOTE(Ryan): Hands capture over, or frees it if the last is still being written
+INTERNAL b32
+queue_debug_spike_capture(DebugSpikeExporter *exporter, DebugSpikeCapture *capture)
+{
+  b32 result = false;
+
+  if (exporter->is_running)
+  {
+    pthread_mutex_lock(&exporter->mutex);
+    if (exporter->pending == NULL)
+    {
+      exporter->pending = capture;
+      pthread_cond_signal(&exporter->cond);
+      result = true;
+    }
+    else
+    {
+      exporter->dropped_count++;
+    }
+    pthread_mutex_unlock(&exporter->mutex);
+  }
+
+  if (!result)
+  {
+    free_debug_spike_capture(capture);
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Steady state cost is a single comparison against the budget. 
+// Once a spike has enough frames after it, they are copied out for the exporter to write
+INTERNAL void
+end_debug_frame(DebugEventTable *debug_event_table, DebugSpikeExporter *exporter, 
+                u64 end_clock, r32 frame_seconds)
+{
+  DebugFrameInfo *frame = \
+    debug_event_table->frames + (debug_event_table->frame_counter % MAX_DEBUG_FRAME_COUNT);
+  frame->end_clock = end_clock;
+  frame->seconds = frame_seconds;
+
+  if (debug_event_table->is_capturing_spike)
+  {
+    debug_event_table->spike_frames_remaining--;
+  }
+  else if (debug_event_table->spike_capture_on && 
+           frame_seconds > debug_event_table->spike_budget_seconds)
+  {
+    debug_event_table->is_capturing_spike = true;
+    debug_event_table->spike_frame_counter = debug_event_table->frame_counter;
+    debug_event_table->spike_frames_remaining = debug_event_table->spike_frames_after;
+  }
+
+  if (debug_event_table->is_capturing_spike && debug_event_table->spike_frames_remaining == 0)
+  {
+    u32 frames_before = MIN(debug_event_table->spike_frames_before, 
+                            MAX_DEBUG_FRAME_COUNT - 1 - debug_event_table->spike_frames_after);
+    u64 first_frame_counter = 0;
+    if (debug_event_table->spike_frame_counter > frames_before)
+    {
+      first_frame_counter = debug_event_table->spike_frame_counter - frames_before;
+    }
+
+    DebugSpikeCapture *capture = copy_debug_spike_capture(debug_event_table, first_frame_counter,
+                                                          debug_event_table->frame_counter);
+    if (capture != NULL)
+    {
+      // NOTE(Ryan): The count restarts every run, so the pid keeps earlier runs' captures
+      snprintf(capture->file_name, sizeof(capture->file_name), "spike_%d_%04u.json", 
+               (s32)getpid(), debug_event_table->spike_count);
+      if (queue_debug_spike_capture(exporter, capture))
+      {
+        debug_event_table->spike_count++;
+      }
+    }
+    else
+    {
+      EBP();
+    }
+    debug_event_table->is_capturing_spike = false;
+  }
+
+  debug_event_table->frame_counter++;
+  DebugFrameInfo *next_frame = \
+    debug_event_table->frames + (debug_event_table->frame_counter % MAX_DEBUG_FRAME_COUNT);
+  next_frame->event_count = 0;
+}
+
+// IMPORTANT(Ryan): Recorded events index the static info table of the loaded shared object, 
+// so anything recorded before a reload must not be exported after it
+INTERNAL void
+discard_debug_frames(DebugEventTable *debug_event_table)
+{
+  for (u32 frame_i = 0;
+       frame_i < MAX_DEBUG_FRAME_COUNT;
+       ++frame_i)
+  {
+    debug_event_table->frames[frame_i].event_count = 0;
+  }
+  debug_event_table->is_capturing_spike = false;
+  debug_event_table->block_static_infos = NULL;
+  debug_event_table->block_static_info_count = 0;
+}
+
 INTERNAL void
 map_window_mouse_to_render_mouse(SDL_Window *window, SDL_Renderer *renderer, Input *input)
 {
@@ -170,11 +799,29 @@ main(int argc, char *argv[])
 
           u32 memory_size = GIGABYTES(1);
           void *mem = calloc(memory_size, 1);
-          if (mem != NULL)
+          DebugEventTable *debug_event_table = calloc(1, sizeof(DebugEventTable));
+          if (mem != NULL && debug_event_table != NULL)
           {
             Memory memory = {0};
             memory.size = memory_size;
             memory.mem = mem;
+            memory.debug_event_table = debug_event_table;
+
+            // NOTE(Ryan): Its thread runs here rather than in the reloaded code
+            CameraPreview *camera_preview = calloc(1, sizeof(CameraPreview));
+            if (camera_preview != NULL)
+            {
+              camera_preview->wake_fd = -1;
+            }
+            else
+            {
+              EBP();
+            }
+            memory.camera_preview = camera_preview;
+
+            // NOTE(Ryan): Without it spikes are still flagged, only not written
+            DebugSpikeExporter spike_exporter = {0};
+            start_debug_spike_exporter(&spike_exporter);
 
             // TODO(Ryan): Will have to call again if in fullscreen mode
             Input input[2] = {0};
@@ -191,9 +838,16 @@ main(int argc, char *argv[])
                                                         reload_update_and_render(&loadable_update_and_render);
             if (current_update_and_render != NULL)
             {
+              u32 last_load_count = loadable_update_and_render.load_count;
+              u64 performance_frequency = SDL_GetPerformanceFrequency();
+
               b32 want_to_run = true;
               while (want_to_run)
               {
+                u64 frame_start_counter = SDL_GetPerformanceCounter();
+                debug_event_table->frames[debug_event_table->frame_counter % 
+                                          MAX_DEBUG_FRAME_COUNT].begin_clock = __rdtsc();
+
                 SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 
 
@@ -226,9 +880,18 @@ main(int argc, char *argv[])
                 }
 
                 map_window_mouse_to_render_mouse(window, renderer, cur_input);
+                s32 logical_render_width = 0;
+                s32 logical_render_height = 0;
+                SDL_RenderGetLogicalSize(renderer, &logical_render_width, &logical_render_height);
+                cur_input->render_dim = v2((r32)logical_render_width, (r32)logical_render_height);
 
                 current_update_and_render = \
                                             reload_update_and_render(&loadable_update_and_render);
+                if (loadable_update_and_render.load_count != last_load_count)
+                {
+                  discard_debug_frames(debug_event_table);
+                  last_load_count = loadable_update_and_render.load_count;
+                }
 
                 SDL_RenderClear(renderer);
 
@@ -246,6 +909,10 @@ main(int argc, char *argv[])
                 }
 
                 current_update_and_render(renderer, cur_input, &memory);
+                if (camera_preview != NULL)
+                {
+                  update_camera_preview(camera_preview);
+                }
 
                 for (u32 input_button_i = 0;
                     input_button_i < ARRAY_COUNT(cur_input->buttons);
@@ -258,11 +925,25 @@ main(int argc, char *argv[])
                 *prev_input = *cur_input;
 
                 SDL_RenderPresent(renderer);
+
+                u64 frame_end_counter = SDL_GetPerformanceCounter();
+                r32 frame_seconds = \
+                  (r32)(frame_end_counter - frame_start_counter) / (r32)performance_frequency;
+                end_debug_frame(debug_event_table, &spike_exporter, __rdtsc(), frame_seconds);
+              }
+
+              stop_debug_spike_exporter(&spike_exporter);
+              if (camera_preview != NULL)
+              {
+                stop_camera_preview(camera_preview);
+                free(camera_preview);
               }
             }
             else
             {
               BP_MSG(SDL_GetError());
+              stop_debug_spike_exporter(&spike_exporter);
+              free(camera_preview);
               SDL_Quit();
               return 1;
             }
@@ -20,12 +20,18 @@ typedef struct Input
   };
 
   r32 update_dt;
+  // NOTE(Ryan): The renderer's logical size, i.e. what everything is laid out against
+  V2 render_dim;
 } Input;
 
 typedef struct Memory
 {
   u64 size;
   void *mem;
+
+  DebugEventTable *debug_event_table;
+  // NOTE(Ryan): NULL if the capture thread could not be started
+  CameraPreview *camera_preview;
 } Memory;
 
 typedef void (*UpdateAndRender)(SDL_Renderer *, Input *, Memory *);
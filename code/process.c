@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+
+// NOTE(Ryan): get_ns() is the includer's, i.e. server.c's or gui.c's
+#include "process.h"
+
+extern char **environ;
+
+// NOTE(Ryan): stdout and stderr are merged into a single non-blocking pipe,
+// so the caller can drain it every frame without ever waiting on the child.
+// posix_spawn() does not copy the caller's page tables as fork() does,
+// which for the GUI's arena or the server's mappings is most of the cost.
+// directory may be NULL to stay put, and timeout_ms 0 to never time out
+INTERNAL ExecutingProcess
+execute_system_command(const char *directory, const char *command, u32 timeout_ms)
+{
+  ExecutingProcess result = {0};
+  result.pid = -1;
+  result.output_fd = -1;
+  result.exit_fd = -1;
+
+  // NOTE(Ryan): Close on exec, so only the dup2()ed ends reach the child
+  int output_pair[2] = {0};
+  if (pipe2(output_pair, O_CLOEXEC | O_NONBLOCK) != -1)
+  {
+    // NOTE(Ryan): The write end is the child's, which blocks when the pipe is full
+    int output_flags = fcntl(output_pair[1], F_GETFL, 0);
+    fcntl(output_pair[1], F_SETFL, output_flags & ~O_NONBLOCK);
+
+    posix_spawn_file_actions_t file_actions;
+    posix_spawn_file_actions_init(&file_actions);
+    posix_spawn_file_actions_addopen(&file_actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&file_actions, output_pair[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&file_actions, output_pair[1], STDERR_FILENO);
+    if (directory != NULL)
+    {
+      posix_spawn_file_actions_addchdir_np(&file_actions, directory);
+    }
+
+    // NOTE(Ryan): The server ignores SIGPIPE, which would otherwise carry over,
+    // e.g. leaving the left of a '| head' running on
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    sigset_t default_signals;
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attributes, &default_signals);
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+    posix_spawnattr_setsigmask(&attributes, &no_signals);
+    // NOTE(Ryan): In a group of its own, so whatever the shell starts is killed along with it
+    posix_spawnattr_setpgroup(&attributes, 0);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK | 
+                                          POSIX_SPAWN_SETPGROUP);
+
+    pid_t pid = -1;
+    char *argv[] = {"bash", "-c", (char *)command, NULL};
+    int spawn_error = posix_spawn(&pid, "/bin/bash", &file_actions, &attributes, argv, environ);
+
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&file_actions);
+    close(output_pair[1]);
+
+    if (spawn_error == 0)
+    {
+      result.pid = pid;
+      result.output_fd = output_pair[0];
+#if defined(SYS_pidfd_open)
+      result.exit_fd = (int)syscall(SYS_pidfd_open, pid, 0);
+#endif
+      result.start_ns = get_ns();
+      if (timeout_ms > 0)
+      {
+        result.deadline_ns = result.start_ns + (u64)timeout_ms * 1000000ULL;
+      }
+      result.is_running = true;
+    }
+    else
+    {
+      close(output_pair[0]);
+      errno = spawn_error;
+      EBP();
+    }
+  }
+  else
+  {
+    EBP();
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Returns 0 when nothing is available yet
+INTERNAL u32
+read_process_output(ExecutingProcess *process, char *buf, u32 buf_size)
+{
+  u32 result = 0;
+
+  if (process->output_fd != -1)
+  {
+    ssize_t bytes_read = read(process->output_fd, buf, buf_size);
+    if (bytes_read > 0)
+    {
+      result = (u32)bytes_read;
+    }
+    else if (bytes_read == 0)
+    {
+      close(process->output_fd);
+      process->output_fd = -1;
+    }
+    else if (errno != EAGAIN && errno != EINTR)
+    {
+      EBP();
+      close(process->output_fd);
+      process->output_fd = -1;
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Reads all there is into process->output. Returns false once the output has ended
+INTERNAL b32
+collect_process_output(ExecutingProcess *process)
+{
+  while (process->output_fd != -1)
+  {
+    if (process->output_size == process->output_capacity &&
+        process->output_capacity < process->max_output_size)
+    {
+      u32 new_capacity = (process->output_capacity > 0) ? process->output_capacity * 2 : 
+                                                          PROCESS_OUTPUT_INITIAL_CAPACITY;
+      if (new_capacity > process->max_output_size)
+      {
+        new_capacity = process->max_output_size;
+      }
+      u8 *new_output = realloc(process->output, new_capacity);
+      if (new_output != NULL)
+      {
+        process->output = new_output;
+        process->output_capacity = new_capacity;
+      }
+      else
+      {
+        EBP();
+        process->max_output_size = process->output_capacity;
+      }
+    }
+
+    char discard_buf[4096];
+    char *buf = discard_buf;
+    u32 buf_size = sizeof(discard_buf);
+    if (process->output_size < process->output_capacity)
+    {
+      buf = (char *)process->output + process->output_size;
+      buf_size = process->output_capacity - process->output_size;
+    }
+
+    u32 bytes_read = read_process_output(process, buf, buf_size);
+    if (bytes_read == 0)
+    {
+      break;
+    }
+    if (buf == discard_buf)
+    {
+      process->is_output_truncated = true;
+    }
+    else
+    {
+      process->output_size += bytes_read;
+    }
+  }
+
+  return (process->output_fd != -1);
+}
+
+// NOTE(Ryan): Never blocks. Kills the child once past its deadline,
+// then reports it as still running until it has been reaped
+INTERNAL b32
+update_process_state(ExecutingProcess *process)
+{
+  if (process->is_running)
+  {
+    if (process->deadline_ns != 0 && !process->is_timed_out &&
+        get_ns() >= process->deadline_ns)
+    {
+      kill(-process->pid, SIGKILL);
+      process->is_timed_out = true;
+    }
+
+    int status = 0;
+    pid_t waited_pid = waitpid(process->pid, &status, WNOHANG);
+    if (waited_pid == process->pid)
+    {
+      process->is_running = false;
+      process->elapsed_ns = get_ns() - process->start_ns;
+      if (WIFEXITED(status))
+      {
+        process->exit_code = WEXITSTATUS(status);
+      }
+      else
+      {
+        process->exit_code = -1;
+        if (WIFSIGNALED(status))
+        {
+          process->exit_signal = WTERMSIG(status);
+        }
+      }
+    }
+    else if (waited_pid == -1)
+    {
+      EBP();
+      process->is_running = false;
+      process->exit_code = -1;
+    }
+
+    if (!process->is_running && process->exit_fd != -1)
+    {
+      close(process->exit_fd);
+      process->exit_fd = -1;
+    }
+  }
+
+  return process->is_running;
+}
+
+// NOTE(Ryan): Kills the child if still running. Only waits the moment it takes to die
+INTERNAL void
+close_process(ExecutingProcess *process)
+{
+  if (process->is_running)
+  {
+    kill(-process->pid, SIGKILL);
+    while (waitpid(process->pid, NULL, 0) == -1 && errno == EINTR)
+    {
+    }
+    process->is_running = false;
+    process->exit_code = -1;
+    process->exit_signal = SIGKILL;
+  }
+  if (process->exit_fd != -1)
+  {
+    close(process->exit_fd);
+    process->exit_fd = -1;
+  }
+  if (process->output_fd != -1)
+  {
+    close(process->output_fd);
+    process->output_fd = -1;
+  }
+  free(process->output);
+  process->output = NULL;
+  process->output_size = 0;
+  process->output_capacity = 0;
+}
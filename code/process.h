@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#pragma once
+
+#define PROCESS_OUTPUT_INITIAL_CAPACITY KILOBYTES(4)
+
+typedef struct ExecutingProcess
+{
+  pid_t pid;
+  int output_fd;
+  // NOTE(Ryan): A pidfd, readable once the child has exited, so an event loop can wait on it
+  // alongside the output. -1 if the kernel has none, when only polling finds the exit
+  int exit_fd;
+  u64 start_ns;
+  // NOTE(Ryan): The child is killed once past this, 0 for never
+  u64 deadline_ns;
+
+  // NOTE(Ryan): Only filled by collect_process_output(), growing up to max_output_size.
+  // Output past that is read and thrown away, so the child never blocks on a full pipe
+  u8 *output;
+  u32 output_size;
+  u32 output_capacity;
+  u32 max_output_size;
+  b32 is_output_truncated;
+
+  b32 is_running;
+  b32 is_timed_out;
+  // NOTE(Ryan): -1 if killed by a signal, which is then exit_signal
+  s32 exit_code;
+  s32 exit_signal;
+  u64 elapsed_ns;
+} ExecutingProcess;
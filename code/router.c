@@ -0,0 +1,302 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+
+#include "router.h"
+
+// NOTE(Ryan): Routes are registered as method plus pattern, e.g. "/control/:name",
+// into a radix trie. A lookup walks the path once, choosing at each node between
+// children whose first bytes all differ, so its cost follows the path length
+// rather than the number of routes. Static text beats a parameter, which beats a wildcard.
+
+INTERNAL void
+router_init(Router *router)
+{
+  RouteNode zero_node = {0};
+  router->nodes[0] = zero_node;
+  router->node_count = 1;
+}
+
+// NOTE(Ryan): Returns 0 once out of nodes
+INTERNAL u32
+router_push_node(Router *router, u32 parent, ROUTE_NODE_TYPE type,
+                 const char *label, u32 label_len)
+{
+  u32 result = 0;
+
+  if (router->node_count < MAX_ROUTE_NODE_COUNT)
+  {
+    result = router->node_count++;
+    RouteNode *node = router->nodes + result;
+    RouteNode zero_node = {0};
+    *node = zero_node;
+    node->type = type;
+    node->label = label;
+    node->label_len = label_len;
+
+    node->next_sibling = router->nodes[parent].first_child;
+    router->nodes[parent].first_child = result;
+  }
+  else
+  {
+    BP_MSG(NULL, "Out of route nodes");
+  }
+
+  return result;
+}
+
+INTERNAL u32
+router_insert_static(Router *router, u32 parent, const char *text, u32 text_len)
+{
+  u32 result = parent;
+
+  while (text_len > 0)
+  {
+    u32 child = router->nodes[result].first_child;
+    while (child != 0 && (router->nodes[child].type != ROUTE_NODE_TYPE_STATIC ||
+                          router->nodes[child].label[0] != text[0]))
+    {
+      child = router->nodes[child].next_sibling;
+    }
+
+    if (child == 0)
+    {
+      result = router_push_node(router, result, ROUTE_NODE_TYPE_STATIC, text, text_len);
+      break;
+    }
+
+    RouteNode *child_node = router->nodes + child;
+    u32 common_len = 0;
+    while (common_len < child_node->label_len && common_len < text_len &&
+           child_node->label[common_len] == text[common_len])
+    {
+      common_len++;
+    }
+
+    // NOTE(Ryan): Split, the child keeping its index and becoming the shared prefix
+    if (common_len < child_node->label_len)
+    {
+      u32 child_first_child = child_node->first_child;
+      u32 tail = router_push_node(router, child, ROUTE_NODE_TYPE_STATIC,
+                                  child_node->label + common_len,
+                                  child_node->label_len - common_len);
+      if (tail == 0)
+      {
+        result = 0;
+        break;
+      }
+      RouteNode *tail_node = router->nodes + tail;
+      tail_node->first_child = child_first_child;
+      tail_node->next_sibling = 0;
+      memcpy(tail_node->handlers, child_node->handlers, sizeof(child_node->handlers));
+
+      child_node->label_len = common_len;
+      child_node->first_child = tail;
+      memset(child_node->handlers, 0, sizeof(child_node->handlers));
+    }
+
+    result = child;
+    text += common_len;
+    text_len -= common_len;
+  }
+
+  return result;
+}
+
+INTERNAL u32
+router_insert_param(Router *router, u32 parent, ROUTE_NODE_TYPE type,
+                    const char *name, u32 name_len)
+{
+  u32 result = router->nodes[parent].first_child;
+  while (result != 0 && router->nodes[result].type != type)
+  {
+    result = router->nodes[result].next_sibling;
+  }
+
+  if (result == 0)
+  {
+    result = router_push_node(router, parent, type, name, name_len);
+  }
+  else if (router->nodes[result].label_len != name_len ||
+           memcmp(router->nodes[result].label, name, name_len) != 0)
+  {
+    // NOTE(Ryan): One parameter per position, as matching would otherwise be ambiguous
+    BP_MSG(NULL, "Conflicting route parameter names");
+    result = 0;
+  }
+
+  return result;
+}
+
+INTERNAL b32
+router_add(Router *router, HTTP_METHOD method, const char *pattern, RouteHandler handler)
+{
+  u32 node = 0;
+
+  const char *at = pattern;
+  while (at[0] != '\0')
+  {
+    if (at[0] == ':' || at[0] == '*')
+    {
+      ROUTE_NODE_TYPE type = (at[0] == ':') ? ROUTE_NODE_TYPE_PARAM : ROUTE_NODE_TYPE_WILDCARD;
+      const char *name = ++at;
+      while (at[0] != '\0' && at[0] != '/')
+      {
+        at++;
+      }
+      if (type == ROUTE_NODE_TYPE_WILDCARD && at[0] != '\0')
+      {
+        BP_MSG(NULL, "Route wildcard must come last");
+        return false;
+      }
+      node = router_insert_param(router, node, type, name, (u32)(at - name));
+    }
+    else
+    {
+      const char *text = at;
+      while (at[0] != '\0' && at[0] != ':' && at[0] != '*')
+      {
+        at++;
+      }
+      node = router_insert_static(router, node, text, (u32)(at - text));
+    }
+
+    if (node == 0)
+    {
+      return false;
+    }
+  }
+
+  router->nodes[node].handlers[method] = handler;
+  return true;
+}
+
+INTERNAL void
+router_set_fallback(Router *router, HTTP_METHOD method, RouteHandler handler)
+{
+  router->fallbacks[method] = handler;
+}
+
+// NOTE(Ryan): Returns the node the path ends on, or 0.
+// Only falls back to a parameter when the static branch dead ends, which is rare
+INTERNAL u32
+router_match_node(Router *router, u32 node, const u8 *path, u32 path_len, HTTP_METHOD method,
+                  RouteMatch *match)
+{
+  if (path_len == 0 && router->nodes[node].handlers[method] != NULL)
+  {
+    return node;
+  }
+
+  u32 param_child = 0;
+  u32 wildcard_child = 0;
+  for (u32 child = router->nodes[node].first_child;
+       child != 0;
+       child = router->nodes[child].next_sibling)
+  {
+    RouteNode *child_node = router->nodes + child;
+    if (child_node->type == ROUTE_NODE_TYPE_STATIC)
+    {
+      if (path_len >= child_node->label_len && child_node->label[0] == path[0] &&
+          memcmp(child_node->label, path, child_node->label_len) == 0)
+      {
+        u32 result = router_match_node(router, child, path + child_node->label_len,
+                                       path_len - child_node->label_len, method, match);
+        if (result != 0)
+        {
+          return result;
+        }
+      }
+    }
+    else if (child_node->type == ROUTE_NODE_TYPE_PARAM)
+    {
+      param_child = child;
+    }
+    else
+    {
+      wildcard_child = child;
+    }
+  }
+
+  if (param_child != 0 && match->param_count < MAX_ROUTE_PARAM_COUNT)
+  {
+    u32 segment_len = 0;
+    while (segment_len < path_len && path[segment_len] != '/')
+    {
+      segment_len++;
+    }
+
+    if (segment_len > 0)
+    {
+      RouteNode *param_node = router->nodes + param_child;
+      RouteParam *param = match->params + match->param_count++;
+      param->name.str = (u8 *)param_node->label;
+      param->name.size = param_node->label_len;
+      param->value.str = (u8 *)path;
+      param->value.size = segment_len;
+
+      u32 result = router_match_node(router, param_child, path + segment_len,
+                                     path_len - segment_len, method, match);
+      if (result != 0)
+      {
+        return result;
+      }
+      match->param_count--;
+    }
+  }
+
+  if (wildcard_child != 0 && match->param_count < MAX_ROUTE_PARAM_COUNT &&
+      router->nodes[wildcard_child].handlers[method] != NULL)
+  {
+    RouteNode *wildcard_node = router->nodes + wildcard_child;
+    RouteParam *param = match->params + match->param_count++;
+    param->name.str = (u8 *)wildcard_node->label;
+    param->name.size = wildcard_node->label_len;
+    param->value.str = (u8 *)path;
+    param->value.size = path_len;
+    return wildcard_child;
+  }
+
+  return 0;
+}
+
+// NOTE(Ryan): Returns the method's fallback if no route matches, which may be NULL
+INTERNAL RouteHandler
+router_find(Router *router, HTTP_METHOD method, HTTPSlice path, RouteMatch *match)
+{
+  RouteHandler result = NULL;
+
+  match->param_count = 0;
+  if (method < HTTP_METHOD_COUNT)
+  {
+    u32 node = router_match_node(router, 0, path.str, path.size, method, match);
+    if (node != 0)
+    {
+      result = router->nodes[node].handlers[method];
+    }
+    else
+    {
+      match->param_count = 0;
+      result = router->fallbacks[method];
+    }
+  }
+
+  return result;
+}
+
+INTERNAL HTTPSlice
+route_param(RouteMatch *match, const char *name)
+{
+  HTTPSlice result = {0};
+
+  for (u32 param_i = 0;
+       param_i < match->param_count;
+       ++param_i)
+  {
+    if (http_slice_equals(match->params[param_i].name, name))
+    {
+      result = match->params[param_i].value;
+      break;
+    }
+  }
+
+  return result;
+}
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#pragma once
+
+#define MAX_ROUTE_NODE_COUNT 256
+#define MAX_ROUTE_PARAM_COUNT 8
+
+typedef enum ROUTE_NODE_TYPE
+{
+  ROUTE_NODE_TYPE_STATIC,
+  // NOTE(Ryan): ":name", one non-empty path segment
+  ROUTE_NODE_TYPE_PARAM,
+  // NOTE(Ryan): "*name", the rest of the path, possibly empty
+  ROUTE_NODE_TYPE_WILDCARD,
+} ROUTE_NODE_TYPE;
+
+typedef struct RouteParam
+{
+  HTTPSlice name;
+  // NOTE(Ryan): Points into the request, so valid as long as it is
+  HTTPSlice value;
+} RouteParam;
+
+typedef struct RouteMatch
+{
+  RouteParam params[MAX_ROUTE_PARAM_COUNT];
+  u32 param_count;
+} RouteMatch;
+
+// NOTE(Ryan): Defined by the server, which includes this before them
+struct Server;
+struct Connection;
+
+// NOTE(Ryan): arena is cleared once the request is retired,
+// so anything outliving the handler has to be owned by the connection
+typedef void (*RouteHandler)(struct Server *server, struct Connection *connection,
+                             HTTPRequest *request, RouteMatch *match, MemoryArena *arena);
+
+// NOTE(Ryan): Labels point into the registered patterns, which are expected to be literals.
+// Node 0 is the root, so 0 doubles as no node
+typedef struct RouteNode
+{
+  ROUTE_NODE_TYPE type;
+  const char *label;
+  u32 label_len;
+
+  u32 first_child;
+  u32 next_sibling;
+  RouteHandler handlers[HTTP_METHOD_COUNT];
+} RouteNode;
+
+// NOTE(Ryan): Built before the workers start and only read afterwards
+typedef struct Router
+{
+  RouteNode nodes[MAX_ROUTE_NODE_COUNT];
+  u32 node_count;
+  // NOTE(Ryan): For a method with no route for the path
+  RouteHandler fallbacks[HTTP_METHOD_COUNT];
+} Router;
@@ -1,8 +1,11 @@
 // SPDX-License-Identifier: zlib-acknowledgement
+// NOTE(Ryan): For accept4() and CPU affinity
+#define _GNU_SOURCE
 #include "types.h"
 
 #include <ctype.h>
 
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
@@ -10,9 +13,19 @@
 #include <netinet/in.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <linux/videodev2.h>
 #include <sys/ioctl.h>
+#include <linux/sockios.h>
 #include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <linux/errqueue.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 
 #if defined(GUI_INTERNAL)
@@ -45,456 +58,3143 @@
   #define ASSERT(cond)
 #endif
 
-typedef struct Camera
+// NOTE(Ryan): Cleared on SIGINT or SIGTERM. The telemetry timer wakes every worker each
+// interval, so all of them notice without being signalled themselves
+GLOBAL volatile sig_atomic_t global_want_to_run = true;
+
+INTERNAL void
+falsify_global_want_to_run(int signum)
+{
+  (void)signum;
+  global_want_to_run = false;
+}
+
+INTERNAL u64
+get_ns(void)
+{
+  u64 result = 0;
+
+  struct timespec cur_timespec = {0}; 
+  if (clock_gettime(CLOCK_MONOTONIC, &cur_timespec) != -1)
+  {
+    result = (u64)cur_timespec.tv_nsec + ((u64)cur_timespec.tv_sec * 1000000000ULL);
+  }
+  else
+  {
+    EBP();
+  }
+
+  return result;
+}
+
+#include "mem.c"
+#include "http.c"
+#include "compress.c"
+#include "router.c"
+#include "file_cache.c"
+#include "jpeg_encoder.c"
+#include "frame_scale.c"
+#include "frame_source.c"
+#include "motion.c"
+#include "capture.c"
+#include "archive.c"
+#include "websocket.c"
+#include "control.c"
+#include "process.c"
+
+// NOTE(Ryan): io_uring is optional at build time (headers) and at run time (kernel).
+// Zero copy sendmsg needs 6.1 headers, which this flag arrived shortly after
+#if __has_include(<linux/io_uring.h>)
+  #include <linux/io_uring.h>
+#endif
+#if defined(IORING_SEND_ZC_REPORT_USAGE)
+  #define SERVER_HAS_IO_URING 1
+  #include <poll.h>
+  #include "uring.c"
+#else
+  #define SERVER_HAS_IO_URING 0
+#endif
+
+#define SERVER_PORT 18000
+#define MAX_SERVER_WORKER_COUNT 64
+#define SERVER_SCRATCH_ARENA_SIZE KILOBYTES(128)
+// NOTE(Ryan): Mostly idle control channels, so the request buffers stay untouched
+#define MAX_CONNECTION_COUNT 4096
+#define MAX_EPOLL_EVENT_COUNT 256
+#define CONNECTION_REQUEST_BUFFER_SIZE KILOBYTES(16)
+#define URING_ENTRY_COUNT 4096
+#define URING_BUFFER_COUNT 1024
+#define URING_BUFFER_SIZE 4096
+#define RESPONSE_HEADER_BUFFER_SIZE 512
+#define STATIC_ROOT_PATH "www"
+#define STREAM_TARGET_LATENCY_MS 150
+// NOTE(Ryan): -c synthetic or -c recording.mjpeg to stream without a camera
+#define FRAME_SOURCE_PATH "/dev/video0"
+#define FRAME_WIDTH 1280
+#define FRAME_HEIGHT 720
+// NOTE(Ryan): -y yuyv or -y nv12 to have the server encode raw frames
+#define FRAME_PIXEL_FORMAT PIXEL_FORMAT_MJPEG
+#define FRAME_ENCODE_THREAD_COUNT 4
+#define STREAM_PACING_SAMPLE_NS (5ULL * 1000000ULL)
+#define STREAM_STATS_INTERVAL_NS (1000ULL * 1000000ULL)
+#define TELEMETRY_INTERVAL_MS 1000
+#define TELEMETRY_JSON_SIZE 256
+#define STATUS_COMMAND_TIMEOUT_MS 5000
+#define MAX_STATUS_COMMAND_OUTPUT_SIZE KILOBYTES(256)
+
+typedef enum EVENT_SOURCE_TYPE
+{
+  EVENT_SOURCE_TYPE_LISTENER,
+  EVENT_SOURCE_TYPE_CONNECTION,
+  EVENT_SOURCE_TYPE_FRAME,
+  EVENT_SOURCE_TYPE_FILE_WATCH,
+  EVENT_SOURCE_TYPE_CONTROL,
+  EVENT_SOURCE_TYPE_TELEMETRY_TIMER,
+  EVENT_SOURCE_TYPE_MOTION,
+  EVENT_SOURCE_TYPE_COMMAND_OUTPUT,
+  EVENT_SOURCE_TYPE_COMMAND_EXIT,
+} EVENT_SOURCE_TYPE;
+
+// NOTE(Ryan): First member of everything registered with epoll, 
+// so epoll_event.data.ptr can be dispatched on
+typedef struct EventSource
 {
+  EVENT_SOURCE_TYPE type;
   int fd;
-  u8 *buffer;
-  u32 buffer_size;
-  u32 buffer_len;
-} Camera;
-
-INTERNAL Camera
-camera_init(const char *camera_path, u32 aperture_width, u32 aperture_height)
-{
-  Camera result = {0};
-
-  result.fd = open(camera_path, O_RDWR);
-  if (result.fd >= 0)
-  {
-    struct v4l2_format camera_format = {0};
-    camera_format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    camera_format.fmt.pix.width = aperture_width;
-    camera_format.fmt.pix.height = aperture_height;
-    // NOTE(Ryan): Determine with $(v4l2-ctl --list-formats-ext) 
-    camera_format.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
-    camera_format.fmt.pix.field = V4L2_FIELD_NONE;
-    int camera_format_status = ioctl(result.fd, VIDIOC_S_FMT, &camera_format);
-    if (camera_format_status >= 0)
-    {
-      struct v4l2_requestbuffers camera_buffer_request = {0};
-      camera_buffer_request.count = 1;
-      camera_buffer_request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      camera_buffer_request.memory = V4L2_MEMORY_MMAP;
-      int camera_buffer_request_status = ioctl(result.fd, VIDIOC_REQBUFS, 
-                                               &camera_buffer_request);
-      if (camera_buffer_request_status >= 0)
-      {
-        struct v4l2_buffer camera_buffer_info = {0};
-        camera_buffer_info.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        camera_buffer_info.memory = V4L2_MEMORY_MMAP;
-        camera_buffer_info.index = 0;
-        int camera_buffer_info_status = ioctl(result.fd, VIDIOC_QUERYBUF, &camera_buffer_info);
-        if (camera_buffer_info_status >= 0)
+} EventSource;
+
+typedef enum CONNECTION_STATE
+{
+  CONNECTION_STATE_READING_REQUEST,
+  CONNECTION_STATE_WRITING_RESPONSE,
+  CONNECTION_STATE_STREAMING_CAMERA,
+  CONNECTION_STATE_WEBSOCKET,
+  // NOTE(Ryan): Waiting on a status command, whose output is the response
+  CONNECTION_STATE_RUNNING_COMMAND,
+} CONNECTION_STATE;
+
+// NOTE(Ryan): Each is a full snapshot, so a client only ever needs the latest of each
+typedef enum WEBSOCKET_CHANNEL
+{
+  WEBSOCKET_CHANNEL_STATE,
+  WEBSOCKET_CHANNEL_TELEMETRY,
+  WEBSOCKET_CHANNEL_MOTION,
+  WEBSOCKET_CHANNEL_COUNT,
+} WEBSOCKET_CHANNEL;
+
+// NOTE(Ryan): What is known of how fast a streaming client takes frames off the socket.
+// Bytes handed to the socket less SIOCOUTQ is what the client has acknowledged
+typedef struct StreamPacing
+{
+  u64 queued_bytes;
+  u32 queue_depth;
+  u64 sample_ns;
+  u64 sample_acked_bytes;
+  // NOTE(Ryan): Bytes per second, only measured while the socket is backlogged
+  r32 drain_rate;
+
+  u64 sent_frame_count;
+  u64 dropped_frame_count;
+  u64 paced_frame_count;
+  u64 paced_sequence;
+  u64 window_start_ns;
+  u64 window_frame_count;
+
+  // NOTE(Ryan): Sends made from the frame in place, and those of them the kernel 
+  // ended up copying anyway, e.g. over loopback
+  u64 zero_copy_send_count;
+  u64 copied_send_count;
+} StreamPacing;
+
+typedef struct Connection
+{
+  EventSource source;
+  CONNECTION_STATE state;
+
+  // NOTE(Ryan): Holds the request being parsed plus any pipelined after it
+  u8 request_buf[CONNECTION_REQUEST_BUFFER_SIZE];
+  u32 request_len;
+  HTTPParser parser;
+  b32 is_keep_alive;
+  // NOTE(Ryan): A bit per CONTENT_ENCODING, for the request being answered
+  u32 accepted_encodings;
+
+  // NOTE(Ryan): Static data, a cached file, response_header_buf or a frame, 
+  // never owned separately. A frame's data follows as the body, 
+  // so response_sent counts across both
+  const u8 *response;
+  u32 response_len;
+  const u8 *response_body;
+  u32 response_body_len;
+  u32 response_sent;
+
+  // NOTE(Ryan): Files too large to cache go out with sendfile() after the response header
+  u8 response_header_buf[RESPONSE_HEADER_BUFFER_SIZE];
+  int file_fd;
+  u64 file_offset;
+  u64 file_size;
+
+  // NOTE(Ryan): Built for this request alone, so freed once sent
+  HTTPResponse owned_response;
+
+  // NOTE(Ryan): References held until the kernel is done with them
+  CachedFile *cached_file;
+  Frame *frame;
+  u64 frame_sequence;
+
+  s32 viewer_index;
+  u32 stream_index;
+  StreamPacing pacing;
+  // NOTE(Ryan): With epoll, MSG_ZEROCOPY sends are numbered by the kernel in order 
+  // and completions report ranges of them on the socket's error queue
+  b32 has_socket_zero_copy;
+  u32 zero_copy_issued_count;
+  u32 zero_copy_completed_count;
+
+  WebSocketMessage *websocket_message;
+  u64 websocket_sent_versions[WEBSOCKET_CHANNEL_COUNT];
+  // NOTE(Ryan): A pong or close owed to the client, sent ahead of any message
+  b32 has_websocket_reply;
+  WEBSOCKET_OPCODE websocket_reply_opcode;
+  u8 websocket_reply[WEBSOCKET_MAX_CONTROL_PAYLOAD_SIZE];
+  u32 websocket_reply_len;
+  b32 is_websocket_closing;
+
+  // NOTE(Ryan): The command's output and pidfd, registered as sources of their own.
+  // Numbered per worker, so io_uring completions for an earlier command are recognised
+  EventSource command_output;
+  EventSource command_exit;
+  ExecutingProcess command;
+  u32 command_id;
+  b32 is_command_output_polled;
+  b32 is_command_exit_polled;
+
+  // NOTE(Ryan): Bumped on close, so io_uring completions for a previous 
+  // occupant of the slot are recognised and dropped
+  u32 generation;
+  b32 is_send_in_flight;
+  b32 is_zero_copy_pending;
+  // NOTE(Ryan): Closed with a send in flight, so kept off the free list 
+  // along with its references until the send completes
+  b32 is_draining;
+  struct msghdr send_msg;
+  struct iovec send_iov[2];
+
+  struct Connection *next_free;
+  struct Connection *next_streaming;
+  struct Connection *next_websocket;
+  struct Connection *next_command;
+} Connection;
+
+// NOTE(Ryan): One per worker thread. Workers share nothing but the port, 
+// the kernel balancing connections across their SO_REUSEPORT listeners
+typedef struct Server
+{
+  u32 worker_index;
+  s32 cpu_index;
+  u32 port;
+  pthread_t thread;
+
+  int epoll_fd;
+  EventSource listener;
+
+  // NOTE(Ryan): Reset after every request and event, so handlers can use it freely
+  MemoryArena scratch_arena;
+
+  Connection connections[MAX_CONNECTION_COUNT];
+  Connection *first_free_connection;
+  u32 connection_count;
+
+  // NOTE(Ryan): Written by the capture thread for every new frame
+  EventSource frame_event;
+  Connection *first_streaming_connection;
+  u32 stream_target_latency_ms;
+  u64 stream_stats_published_ns;
+
+  FileCache file_cache;
+  EventSource file_watch;
+
+  Compressor compressor;
+
+  // NOTE(Ryan): Written on every control change, and ticking for telemetry
+  EventSource control_event;
+  EventSource telemetry_timer;
+  // NOTE(Ryan): Written on motion events and map updates, only when detecting
+  EventSource motion_event;
+  Connection *first_websocket_connection;
+  u32 websocket_count;
+  WebSocketMessage *websocket_messages[WEBSOCKET_CHANNEL_COUNT];
+  u64 telemetry_version;
+
+  Connection *first_command_connection;
+  u32 last_command_id;
+
+  b32 want_uring;
+  b32 is_using_uring;
+#if SERVER_HAS_IO_URING
+  IoUring ring;
+  u64 zero_copy_send_count;
+  u64 copy_send_count;
+#endif
+} Server;
+
+typedef enum URING_OP_TYPE
+{
+  URING_OP_TYPE_ACCEPT,
+  URING_OP_TYPE_RECV,
+  URING_OP_TYPE_SEND,
+  URING_OP_TYPE_SHUTDOWN,
+  URING_OP_TYPE_FRAME_POLL,
+  URING_OP_TYPE_FILE_WATCH_POLL,
+  URING_OP_TYPE_FILE_POLL,
+  URING_OP_TYPE_CONTROL_POLL,
+  URING_OP_TYPE_TELEMETRY_POLL,
+  URING_OP_TYPE_MOTION_POLL,
+  URING_OP_TYPE_COMMAND_OUTPUT_POLL,
+  URING_OP_TYPE_COMMAND_EXIT_POLL,
+  URING_OP_TYPE_CANCEL,
+} URING_OP_TYPE;
+
+#define URING_USER_DATA(type, index, generation) \
+  ((u64)(type) | ((u64)(index) << 8) | ((u64)(generation) << 32))
+#define URING_USER_DATA_TYPE(user_data) ((u32)((user_data) & 0xff))
+#define URING_USER_DATA_INDEX(user_data) ((u32)(((user_data) >> 8) & 0xffffff))
+#define URING_USER_DATA_GENERATION(user_data) ((u32)((user_data) >> 32))
+
+// NOTE(Ryan): The capture device can only be opened once, so one capture thread
+// serves the streaming clients of every worker
+GLOBAL Capture global_capture;
+
+GLOBAL Archive global_archive;
+
+GLOBAL ControlState global_control_state;
+
+GLOBAL Router global_router;
+
+typedef struct StatusCommand
+{
+  const char *name;
+  const char *command_line;
+} StatusCommand;
+
+// NOTE(Ryan): Only these are run, picked by name, so nothing from a request reaches the shell
+GLOBAL StatusCommand global_status_commands[] = {
+  {"uptime", "uptime"},
+  {"memory", "free -h"},
+  {"disk", "df -h"},
+  {"network", "ip -brief address"},
+  {"processes", "ps -eo pid,pcpu,pmem,rss,comm --sort=-pcpu | head -n 20"},
+  {"camera", "v4l2-ctl --all"},
+};
+
+GLOBAL const char global_index_html[] = {
+  "<style> body { background-color: #efefef; } </style>\r\n"
+  "<h1> Hi There! </h1>\r\n"
+  "<img src='camera.jpeg' />\r\n"
+  "<form method='post'>\r\n"
+  "  <button name='LED1' value='1'> LED ON </button>\r\n"
+  "  <button name='LED2' value='0'> LED OFF </button>\r\n"
+  "</form>\r\n"
+  "<pre id='state'></pre>\r\n"
+  "<pre id='telemetry'></pre>\r\n"
+  "<pre id='motion'></pre>\r\n"
+  "<script>\r\n"
+  "  var control = new WebSocket('ws://' + location.host + '/control');\r\n"
+  "  control.onmessage = function (event) {\r\n"
+  "    var message = JSON.parse(event.data);\r\n"
+  "    document.getElementById(message.type).textContent = event.data;\r\n"
+  "  };\r\n"
+  "  document.querySelector('form').onsubmit = function (event) {\r\n"
+  "    if (control.readyState == WebSocket.OPEN && event.submitter) {\r\n"
+  "      control.send(event.submitter.name + '=' + event.submitter.value);\r\n"
+  "      event.preventDefault();\r\n"
+  "    }\r\n"
+  "  };\r\n"
+  "</script>\r\n"
+};
+
+typedef enum STATIC_RESPONSE
+{
+  STATIC_RESPONSE_INDEX,
+  STATIC_RESPONSE_BAD_REQUEST,
+  STATIC_RESPONSE_NOT_FOUND,
+  STATIC_RESPONSE_PAYLOAD_TOO_LARGE,
+  STATIC_RESPONSE_HEADERS_TOO_LARGE,
+  STATIC_RESPONSE_NOT_IMPLEMENTED,
+  STATIC_RESPONSE_VERSION_NOT_SUPPORTED,
+  STATIC_RESPONSE_COUNT,
+} STATIC_RESPONSE;
+
+// NOTE(Ryan): Built once at startup with complete headers, indexed by is_keep_alive
+// then CONTENT_ENCODING, so sending one is a single write straight from this memory.
+// Only bodies worth it are compressed, other variants being left empty
+GLOBAL HTTPResponse global_static_responses[STATIC_RESPONSE_COUNT][2][CONTENT_ENCODING_COUNT];
+
+GLOBAL const char global_camera_multipart_header[] = {
+  "HTTP/1.1 200 OK\r\n"
+  "Content-Type: multipart/x-mixed-replace; boundary=myboundary\r\n"
+  "Connection: close\r\n\r\n"
+};
+
+INTERNAL HTTPResponse
+build_static_response(const char *status, const char *extra_headers, const char *content_type, 
+                      const char *body, b32 is_keep_alive)
+{
+  HTTPResponse result = http_build_response(status, extra_headers, content_type, (const u8 *)body,
+                                            (u32)strlen(body), is_keep_alive);
+  if (result.data == NULL)
+  {
+    EBP();
+  }
+
+  return result;
+}
+
+INTERNAL void
+init_compressed_static_responses(STATIC_RESPONSE kind, const char *status, 
+                                 const char *content_type, const char *body)
+{
+  for (u32 encoding_i = CONTENT_ENCODING_IDENTITY + 1;
+       encoding_i < CONTENT_ENCODING_COUNT;
+       ++encoding_i)
+  {
+    u8 *compressed_body = NULL;
+    u32 compressed_len = 0;
+    if (compress_once((CONTENT_ENCODING)encoding_i, (u8 *)body, (u32)strlen(body), 
+                      &compressed_body, &compressed_len))
+    {
+      char headers[CONTENT_ENCODING_HEADERS_SIZE] = {0};
+      snprintf(headers, sizeof(headers), "Content-Encoding: %s\r\nVary: Accept-Encoding\r\n",
+               global_content_encoding_names[encoding_i]);
+      for (u32 is_keep_alive = 0;
+           is_keep_alive < 2;
+           ++is_keep_alive)
+      {
+        global_static_responses[kind][is_keep_alive][encoding_i] = 
+          http_build_response(status, headers, content_type, compressed_body, compressed_len, 
+                              is_keep_alive);
+      }
+      free(compressed_body);
+    }
+  }
+}
+
+INTERNAL void
+init_static_responses(void)
+{
+  for (u32 is_keep_alive = 0;
+       is_keep_alive < 2;
+       ++is_keep_alive)
+  {
+    #define STATIC_RESPONSE_AT(kind) \
+      global_static_responses[kind][is_keep_alive][CONTENT_ENCODING_IDENTITY]
+    STATIC_RESPONSE_AT(STATIC_RESPONSE_INDEX) = 
+      build_static_response("200 OK", "Vary: Accept-Encoding\r\n", "text/html; charset=UTF-8", 
+                            global_index_html, is_keep_alive);
+    STATIC_RESPONSE_AT(STATIC_RESPONSE_BAD_REQUEST) = 
+      build_static_response("400 Bad Request", "", "text/plain", "", is_keep_alive);
+    STATIC_RESPONSE_AT(STATIC_RESPONSE_NOT_FOUND) = 
+      build_static_response("404 Not Found", "", "text/plain", "", is_keep_alive);
+    STATIC_RESPONSE_AT(STATIC_RESPONSE_PAYLOAD_TOO_LARGE) = 
+      build_static_response("413 Content Too Large", "", "text/plain", "", is_keep_alive);
+    STATIC_RESPONSE_AT(STATIC_RESPONSE_HEADERS_TOO_LARGE) = 
+      build_static_response("431 Request Header Fields Too Large", "", "text/plain", "", 
+                            is_keep_alive);
+    STATIC_RESPONSE_AT(STATIC_RESPONSE_NOT_IMPLEMENTED) = 
+      build_static_response("501 Not Implemented", "", "text/plain", "", is_keep_alive);
+    STATIC_RESPONSE_AT(STATIC_RESPONSE_VERSION_NOT_SUPPORTED) = 
+      build_static_response("505 HTTP Version Not Supported", "", "text/plain", "", 
+                            is_keep_alive);
+    #undef STATIC_RESPONSE_AT
+  }
+
+  init_compressed_static_responses(STATIC_RESPONSE_INDEX, "200 OK", "text/html; charset=UTF-8",
+                                   global_index_html);
+}
+
+INTERNAL STATIC_RESPONSE
+static_response_for_status(u32 status)
+{
+  STATIC_RESPONSE result = STATIC_RESPONSE_BAD_REQUEST;
+
+  switch (status)
+  {
+    case 413:
+    {
+      result = STATIC_RESPONSE_PAYLOAD_TOO_LARGE;
+    } break;
+    case 431:
+    {
+      result = STATIC_RESPONSE_HEADERS_TOO_LARGE;
+    } break;
+    case 501:
+    {
+      result = STATIC_RESPONSE_NOT_IMPLEMENTED;
+    } break;
+    case 505:
+    {
+      result = STATIC_RESPONSE_VERSION_NOT_SUPPORTED;
+    } break;
+  }
+
+  return result;
+}
+
+INTERNAL u32
+get_response_size(Connection *connection)
+{
+  return connection->response_len + connection->response_body_len;
+}
+
+// NOTE(Ryan): What is left to send of the response and its body
+INTERNAL u32
+fill_response_iov(Connection *connection, struct iovec *iov)
+{
+  u32 result = 0;
+
+  if (connection->response_sent < connection->response_len)
+  {
+    iov[result].iov_base = (void *)(connection->response + connection->response_sent);
+    iov[result].iov_len = connection->response_len - connection->response_sent;
+    result++;
+    if (connection->response_body_len > 0)
+    {
+      iov[result].iov_base = (void *)connection->response_body;
+      iov[result].iov_len = connection->response_body_len;
+      result++;
+    }
+  }
+  else
+  {
+    u32 body_sent = connection->response_sent - connection->response_len;
+    iov[result].iov_base = (void *)(connection->response_body + body_sent);
+    iov[result].iov_len = connection->response_body_len - body_sent;
+    result++;
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): The response is the last thing sent before closing
+INTERNAL b32
+is_final_response(Connection *connection)
+{
+  return (connection->state == CONNECTION_STATE_WRITING_RESPONSE && !connection->is_keep_alive &&
+          connection->file_fd < 0);
+}
+
+#if SERVER_HAS_IO_URING
+INTERNAL void
+uring_arm_recv(Server *server, Connection *connection)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(&server->ring);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = connection->source.fd;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_PROVIDED_BUFFER_GROUP;
+  if (server->ring.has_multishot_recv)
+  {
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+  }
+  sqe->user_data = URING_USER_DATA(URING_OP_TYPE_RECV, connection - server->connections,
+                                   connection->generation);
+}
+
+INTERNAL void
+uring_submit_send(Server *server, Connection *connection)
+{
+  if (connection->is_send_in_flight || connection->response_sent == get_response_size(connection))
+  {
+    return;
+  }
+
+  u32 connection_index = (u32)(connection - server->connections);
+  // NOTE(Ryan): Only frames have a body, and being large and shared they are worth not copying
+  b32 want_zero_copy = server->ring.has_sendmsg_zc && (connection->response_body != NULL);
+
+  struct io_uring_sqe *sqe = uring_get_sqe(&server->ring);
+  sqe->fd = connection->source.fd;
+  sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+  if (connection->response_body != NULL)
+  {
+    // NOTE(Ryan): Read when the send executes, so lives in the connection
+    struct msghdr zero_msg = {0};
+    connection->send_msg = zero_msg;
+    connection->send_msg.msg_iov = connection->send_iov;
+    connection->send_msg.msg_iovlen = fill_response_iov(connection, connection->send_iov);
+
+    sqe->opcode = want_zero_copy ? IORING_OP_SENDMSG_ZC : IORING_OP_SENDMSG;
+    sqe->addr = (u64)&connection->send_msg;
+    sqe->len = 1;
+  }
+  else
+  {
+    sqe->opcode = IORING_OP_SEND;
+    sqe->addr = (u64)(connection->response + connection->response_sent);
+    sqe->len = connection->response_len - connection->response_sent;
+  }
+  sqe->user_data = URING_USER_DATA(URING_OP_TYPE_SEND, connection_index, connection->generation);
+
+  connection->is_send_in_flight = true;
+  if (want_zero_copy)
+  {
+    // NOTE(Ryan): So the notification says whether the kernel had to copy after all
+    sqe->ioprio = IORING_SEND_ZC_REPORT_USAGE;
+    connection->is_zero_copy_pending = true;
+    connection->pacing.zero_copy_send_count++;
+    server->zero_copy_send_count++;
+  }
+  else
+  {
+    server->copy_send_count++;
+  }
+
+  // NOTE(Ryan): A response that ends the connection has a shutdown linked 
+  // to the send, rather than waiting for its completion to issue it
+  if (is_final_response(connection))
+  {
+    sqe->flags |= IOSQE_IO_LINK;
+
+    struct io_uring_sqe *shutdown_sqe = uring_get_sqe(&server->ring);
+    shutdown_sqe->opcode = IORING_OP_SHUTDOWN;
+    shutdown_sqe->fd = connection->source.fd;
+    shutdown_sqe->len = SHUT_RDWR;
+    shutdown_sqe->user_data = URING_USER_DATA(URING_OP_TYPE_SHUTDOWN, connection_index, 
+                                              connection->generation);
+  }
+}
+
+INTERNAL void
+uring_arm_file_poll(Server *server, Connection *connection)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(&server->ring);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = connection->source.fd;
+  sqe->poll32_events = POLLOUT;
+  sqe->user_data = URING_USER_DATA(URING_OP_TYPE_FILE_POLL, connection - server->connections,
+                                   connection->generation);
+}
+
+// NOTE(Ryan): Tagged with the command rather than the connection's generation
+INTERNAL void
+uring_arm_command_poll(Server *server, Connection *connection, URING_OP_TYPE op_type)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(&server->ring);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  if (op_type == URING_OP_TYPE_COMMAND_OUTPUT_POLL)
+  {
+    sqe->fd = connection->command_output.fd;
+    connection->is_command_output_polled = true;
+  }
+  else
+  {
+    sqe->fd = connection->command_exit.fd;
+    connection->is_command_exit_polled = true;
+  }
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = URING_USER_DATA(op_type, connection - server->connections, 
+                                   connection->command_id);
+}
+
+// NOTE(Ryan): A poll holds its own reference to the fd, so would otherwise outlive the command
+// for as long as e.g. a background child of it keeps the output open
+INTERNAL void
+uring_remove_command_polls(Server *server, Connection *connection)
+{
+  u32 connection_index = (u32)(connection - server->connections);
+  URING_OP_TYPE op_types[2] = {URING_OP_TYPE_COMMAND_OUTPUT_POLL, URING_OP_TYPE_COMMAND_EXIT_POLL};
+  b32 is_polled[2] = {connection->is_command_output_polled, connection->is_command_exit_polled};
+  for (u32 poll_i = 0;
+       poll_i < 2;
+       ++poll_i)
+  {
+    if (is_polled[poll_i])
+    {
+      struct io_uring_sqe *sqe = uring_get_sqe(&server->ring);
+      sqe->opcode = IORING_OP_POLL_REMOVE;
+      sqe->addr = URING_USER_DATA(op_types[poll_i], connection_index, connection->command_id);
+      sqe->user_data = URING_USER_DATA(URING_OP_TYPE_CANCEL, 0, 0);
+    }
+  }
+  connection->is_command_output_polled = false;
+  connection->is_command_exit_polled = false;
+}
+#endif
+
+// NOTE(Ryan): Leaves the process to the caller, to respond with or kill
+INTERNAL void
+end_status_command(Server *server, Connection *connection)
+{
+  Connection **command = &server->first_command_connection;
+  while (*command != NULL)
+  {
+    if (*command == connection)
+    {
+      *command = connection->next_command;
+      break;
+    }
+    command = &(*command)->next_command;
+  }
+
+#if SERVER_HAS_IO_URING
+  if (server->is_using_uring)
+  {
+    uring_remove_command_polls(server, connection);
+  }
+#endif
+}
+
+INTERNAL void
+release_connection_references(Connection *connection)
+{
+  file_cache_release(connection->cached_file);
+  connection->cached_file = NULL;
+  frame_release(connection->frame);
+  connection->frame = NULL;
+  free(connection->owned_response.data);
+  connection->owned_response.data = NULL;
+  websocket_message_release(connection->websocket_message);
+  connection->websocket_message = NULL;
+}
+
+INTERNAL void
+close_connection(Server *server, Connection *connection)
+{
+  if (connection->state == CONNECTION_STATE_STREAMING_CAMERA)
+  {
+    Connection **streaming = &server->first_streaming_connection;
+    while (*streaming != NULL)
+    {
+      if (*streaming == connection)
+      {
+        *streaming = connection->next_streaming;
+        break;
+      }
+      streaming = &(*streaming)->next_streaming;
+    }
+
+    capture_remove_viewer(&global_capture, connection->viewer_index);
+  }
+  else if (connection->state == CONNECTION_STATE_WEBSOCKET)
+  {
+    Connection **websocket = &server->first_websocket_connection;
+    while (*websocket != NULL)
+    {
+      if (*websocket == connection)
+      {
+        *websocket = connection->next_websocket;
+        break;
+      }
+      websocket = &(*websocket)->next_websocket;
+    }
+    server->websocket_count--;
+  }
+  else if (connection->state == CONNECTION_STATE_RUNNING_COMMAND)
+  {
+    // NOTE(Ryan): Nobody is left to read what it prints
+    end_status_command(server, connection);
+    close_process(&connection->command);
+  }
+
+  // NOTE(Ryan): Closing the fd also removes it from the epoll set. 
+  // In-flight io_uring requests hold their own reference, so shut it down to end them
+  if (server->is_using_uring)
+  {
+    shutdown(connection->source.fd, SHUT_RDWR);
+  }
+  close(connection->source.fd);
+  if (connection->file_fd >= 0)
+  {
+    close(connection->file_fd);
+  }
+
+  // NOTE(Ryan): io_uring may still be reading the response after the socket is gone
+  b32 is_draining = server->is_using_uring && 
+                    (connection->is_send_in_flight || connection->is_zero_copy_pending);
+  if (!is_draining)
+  {
+    release_connection_references(connection);
+  }
+
+  CachedFile *cached_file = connection->cached_file;
+  Frame *frame = connection->frame;
+  HTTPResponse owned_response = connection->owned_response;
+  WebSocketMessage *websocket_message = connection->websocket_message;
+  b32 is_send_in_flight = connection->is_send_in_flight;
+  b32 is_zero_copy_pending = connection->is_zero_copy_pending;
+  u32 generation = connection->generation + 1;
+
+  Connection zero_connection = {0};
+  *connection = zero_connection;
+  connection->source.fd = -1;
+  connection->file_fd = -1;
+  connection->generation = generation;
+  server->connection_count--;
+
+  if (is_draining)
+  {
+    connection->is_draining = true;
+    connection->cached_file = cached_file;
+    connection->frame = frame;
+    connection->owned_response = owned_response;
+    connection->websocket_message = websocket_message;
+    connection->is_send_in_flight = is_send_in_flight;
+    connection->is_zero_copy_pending = is_zero_copy_pending;
+  }
+  else
+  {
+    connection->next_free = server->first_free_connection;
+    server->first_free_connection = connection;
+  }
+}
+
+// NOTE(Ryan): A zero copy send keeps reading the frame until its notification
+INTERNAL void
+release_sent_frame(Connection *connection)
+{
+  if (connection->response == NULL && !connection->is_zero_copy_pending)
+  {
+    frame_release(connection->frame);
+    connection->frame = NULL;
+  }
+}
+
+INTERNAL void
+deliver_latest_frame(Server *server, Connection *connection);
+
+INTERNAL void
+deliver_websocket_messages(Server *server, Connection *connection);
+
+// NOTE(Ryan): Returns false if the connection was closed
+INTERNAL b32
+finish_response(Server *server, Connection *connection)
+{
+  b32 result = true;
+
+  if ((connection->state == CONNECTION_STATE_WRITING_RESPONSE && !connection->is_keep_alive) ||
+      connection->is_websocket_closing)
+  {
+    close_connection(server, connection);
+    result = false;
+  }
+  else
+  {
+    // NOTE(Ryan): A kept alive connection goes back to reading its next request, 
+    // and a streaming one is now idle and ready for the next frame
+    if (connection->state == CONNECTION_STATE_WRITING_RESPONSE)
+    {
+      connection->state = CONNECTION_STATE_READING_REQUEST;
+    }
+    else if (connection->state == CONNECTION_STATE_STREAMING_CAMERA)
+    {
+      connection->pacing.queued_bytes += get_response_size(connection);
+    }
+    file_cache_release(connection->cached_file);
+    connection->cached_file = NULL;
+    free(connection->owned_response.data);
+    connection->owned_response.data = NULL;
+    websocket_message_release(connection->websocket_message);
+    connection->websocket_message = NULL;
+    connection->response = NULL;
+    connection->response_len = 0;
+    connection->response_body = NULL;
+    connection->response_body_len = 0;
+    connection->response_sent = 0;
+    release_sent_frame(connection);
+
+    if (connection->state == CONNECTION_STATE_STREAMING_CAMERA)
+    {
+      deliver_latest_frame(server, connection);
+    }
+    else if (connection->state == CONNECTION_STATE_WEBSOCKET)
+    {
+      deliver_websocket_messages(server, connection);
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Returns false if the connection was closed
+INTERNAL b32
+flush_file_body(Server *server, Connection *connection)
+{
+  b32 result = true;
+
+  while (connection->file_offset < connection->file_size)
+  {
+    off_t offset = (off_t)connection->file_offset;
+    ssize_t bytes_sent = sendfile(connection->source.fd, connection->file_fd, &offset,
+                                  connection->file_size - connection->file_offset);
+    if (bytes_sent > 0)
+    {
+      connection->file_offset = (u64)offset;
+    }
+    else if (bytes_sent == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    else if (bytes_sent == -1 && errno == EAGAIN)
+    {
+#if SERVER_HAS_IO_URING
+      if (server->is_using_uring)
+      {
+        uring_arm_file_poll(server, connection);
+      }
+#endif
+      // NOTE(Ryan): Otherwise edge triggered EPOLLOUT resumes this
+      break;
+    }
+    else
+    {
+      // NOTE(Ryan): Also when the file was truncated after Content-Length went out
+      close_connection(server, connection);
+      result = false;
+      break;
+    }
+  }
+
+  if (result && connection->file_offset == connection->file_size)
+  {
+    close(connection->file_fd);
+    connection->file_fd = -1;
+    result = finish_response(server, connection);
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Returns false if the connection was closed
+INTERNAL b32
+flush_connection(Server *server, Connection *connection)
+{
+  b32 result = true;
+
+  if (connection->response == NULL)
+  {
+    return result;
+  }
+
+#if SERVER_HAS_IO_URING
+  if (server->is_using_uring)
+  {
+    // NOTE(Ryan): Completion is handled in handle_uring_completion()
+    uring_submit_send(server, connection);
+    return result;
+  }
+#endif
+
+  while (connection->response_sent < get_response_size(connection))
+  {
+    struct iovec iov[2];
+    u32 iov_count = fill_response_iov(connection, iov);
+    ssize_t bytes_sent = -1;
+    if (connection->has_socket_zero_copy && connection->response_body != NULL)
+    {
+      struct msghdr zero_copy_msg = {0};
+      zero_copy_msg.msg_iov = iov;
+      zero_copy_msg.msg_iovlen = iov_count;
+      bytes_sent = sendmsg(connection->source.fd, &zero_copy_msg, MSG_ZEROCOPY | MSG_NOSIGNAL);
+      if (bytes_sent > 0)
+      {
+        connection->zero_copy_issued_count++;
+        connection->is_zero_copy_pending = true;
+        connection->pacing.zero_copy_send_count++;
+      }
+      else if (bytes_sent == -1 && errno == ENOBUFS)
+      {
+        // NOTE(Ryan): Out of memory to track the pinned pages, so copy this once
+        bytes_sent = writev(connection->source.fd, iov, (int)iov_count);
+      }
+    }
+    else
+    {
+      bytes_sent = writev(connection->source.fd, iov, (int)iov_count);
+    }
+
+    if (bytes_sent > 0)
+    {
+      connection->response_sent += (u32)bytes_sent;
+    }
+    else if (bytes_sent == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    else if (bytes_sent == -1 && errno == EAGAIN)
+    {
+      // NOTE(Ryan): Edge triggered EPOLLOUT resumes this once there is room
+      break;
+    }
+    else
+    {
+      close_connection(server, connection);
+      result = false;
+      break;
+    }
+  }
+
+  if (result && connection->response_sent == get_response_size(connection))
+  {
+    if (connection->file_fd >= 0)
+    {
+      result = flush_file_body(server, connection);
+    }
+    else
+    {
+      result = finish_response(server, connection);
+    }
+  }
+
+  return result;
+}
+
+INTERNAL void
+begin_static_response(Server *server, Connection *connection, STATIC_RESPONSE kind)
+{
+  HTTPResponse *variants = global_static_responses[kind][connection->is_keep_alive ? 1 : 0];
+  HTTPResponse *response = 
+    &variants[choose_precompressed_encoding(connection->accepted_encodings, variants)];
+  connection->state = CONNECTION_STATE_WRITING_RESPONSE;
+  connection->response = response->data;
+  connection->response_len = response->size;
+  connection->response_sent = 0;
+  flush_connection(server, connection);
+}
+
+// NOTE(Ryan): ?stream=360p picks the smallest stream at least that tall, 
+// otherwise it is the camera's own size
+INTERNAL void
+begin_camera_stream(Server *server, Connection *connection, HTTPRequest *request)
+{
+  u32 stream_height = 0;
+  HTTPSlice stream_name = http_find_query_param(request, "stream");
+  if (stream_name.size > 1 && stream_name.str[stream_name.size - 1] == 'p')
+  {
+    stream_name.size--;
+    if (!http_slice_to_u32(stream_name, &stream_height))
+    {
+      stream_height = 0;
+    }
+  }
+
+  connection->viewer_index = capture_add_viewer(&global_capture, server->worker_index, 
+                                                stream_height, &connection->stream_index);
+  if (connection->viewer_index >= 0)
+  {
+    StreamPacing zero_pacing = {0};
+    connection->pacing = zero_pacing;
+    connection->pacing.window_start_ns = get_ns();
+
+    connection->next_streaming = server->first_streaming_connection;
+    server->first_streaming_connection = connection;
+
+    // NOTE(Ryan): io_uring has its own zero copy send, so this is only for epoll
+    int one = 1;
+    connection->has_socket_zero_copy = 
+      !server->is_using_uring && 
+      setsockopt(connection->source.fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+
+    connection->state = CONNECTION_STATE_STREAMING_CAMERA;
+    connection->is_keep_alive = false;
+    connection->response = (const u8 *)global_camera_multipart_header;
+    connection->response_len = sizeof(global_camera_multipart_header) - 1;
+    connection->response_sent = 0;
+    flush_connection(server, connection);
+  }
+  else
+  {
+    begin_static_response(server, connection, STATIC_RESPONSE_NOT_FOUND);
+  }
+}
+
+// NOTE(Ryan): The frame's header and data are sent straight from the shared frame
+INTERNAL void
+begin_frame(Server *server, Connection *connection, Frame *frame)
+{
+  if (connection->frame_sequence != 0)
+  {
+    connection->pacing.dropped_frame_count += frame->sequence - connection->frame_sequence - 1;
+  }
+  connection->pacing.sent_frame_count++;
+  connection->frame = frame;
+  connection->frame_sequence = frame->sequence;
+
+  connection->response = frame->header;
+  connection->response_len = frame->header_len;
+  connection->response_body = frame->data;
+  connection->response_body_len = frame->size;
+  connection->response_sent = 0;
+  flush_connection(server, connection);
+}
+
+// NOTE(Ryan): Bytes in the socket not yet acknowledged by the client
+INTERNAL u32
+get_socket_queue_depth(Connection *connection)
+{
+  int result = 0;
+  if (ioctl(connection->source.fd, SIOCOUTQ, &result) == -1)
+  {
+    result = 0;
+  }
+  return (u32)result;
+}
+
+// NOTE(Ryan): Only while idle, as queued_bytes does not count a frame being sent
+INTERNAL void
+sample_stream_pacing(Connection *connection, u64 now_ns)
+{
+  StreamPacing *pacing = &connection->pacing;
+
+  u32 unsent_bytes = get_socket_queue_depth(connection);
+  u64 acked_bytes = pacing->queued_bytes - (u64)unsent_bytes;
+
+  // NOTE(Ryan): Only a backlogged socket drains at the rate of the link, otherwise this 
+  // would be measuring the camera. Acks arrive in bursts as the client's window opens,
+  // so the rate is taken from one advance to the next rather than on a fixed tick
+  u64 elapsed_ns = now_ns - pacing->sample_ns;
+  if (pacing->queue_depth == 0)
+  {
+    pacing->sample_ns = now_ns;
+    pacing->sample_acked_bytes = acked_bytes;
+  }
+  else if (acked_bytes > pacing->sample_acked_bytes && elapsed_ns >= STREAM_PACING_SAMPLE_NS)
+  {
+    r32 drain_rate = (r32)(acked_bytes - pacing->sample_acked_bytes) * 1e9f / (r32)elapsed_ns;
+    // NOTE(Ryan): A socket that emptied may have done so well before now, so is a lower bound
+    if (pacing->drain_rate == 0.0f)
+    {
+      pacing->drain_rate = drain_rate;
+    }
+    else if (unsent_bytes > 0)
+    {
+      pacing->drain_rate = 0.75f * pacing->drain_rate + 0.25f * drain_rate;
+    }
+    else if (drain_rate > pacing->drain_rate)
+    {
+      pacing->drain_rate = drain_rate;
+    }
+
+    pacing->sample_ns = now_ns;
+    pacing->sample_acked_bytes = acked_bytes;
+  }
+  pacing->queue_depth = unsent_bytes;
+}
+
+// NOTE(Ryan): How long what is already queued in the socket will take to reach the client
+INTERNAL r32
+get_stream_queue_latency_ms(Connection *connection)
+{
+  r32 result = 0.0f;
+
+  StreamPacing *pacing = &connection->pacing;
+  if (pacing->queue_depth > 0)
+  {
+    // NOTE(Ryan): Until a rate is known a backlog is assumed to be too much
+    result = (pacing->drain_rate > 0.0f) ? (r32)pacing->queue_depth * 1000.0f / pacing->drain_rate :
+                                           1e9f;
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Latest frame wins. An idle client is given the newest frame it has not sent,
+// unless what it has queued would take longer than the target latency to drain, 
+// in which case it waits for a later frame. So a slow link gets fewer frames, not older ones
+INTERNAL void
+deliver_latest_frame(Server *server, Connection *connection)
+{
+  if (connection->response != NULL || connection->frame != NULL)
+  {
+    return;
+  }
+
+  StreamPacing *pacing = &connection->pacing;
+  sample_stream_pacing(connection, get_ns());
+  if (get_stream_queue_latency_ms(connection) > (r32)server->stream_target_latency_ms)
+  {
+    // NOTE(Ryan): Counted once per frame held back, however often it is looked at
+    u64 latest_sequence = global_capture.streams[connection->stream_index].ring.sequence;
+    if (latest_sequence > connection->frame_sequence && latest_sequence > pacing->paced_sequence)
+    {
+      pacing->paced_frame_count++;
+      pacing->paced_sequence = latest_sequence;
+    }
+    return;
+  }
+
+  FrameRing *ring = &global_capture.streams[connection->stream_index].ring;
+  Frame *frame = frame_ring_acquire_latest(ring, connection->frame_sequence);
+  if (frame != NULL)
+  {
+    begin_frame(server, connection, frame);
+  }
+}
+
+// NOTE(Ryan): Returns false if the connection was closed
+INTERNAL b32
+handle_zero_copy_completions(Server *server, Connection *connection)
+{
+  b32 result = true;
+
+  while (true)
+  {
+    u8 control_buf[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+    struct msghdr error_msg = {0};
+    error_msg.msg_control = control_buf;
+    error_msg.msg_controllen = sizeof(control_buf);
+    if (recvmsg(connection->source.fd, &error_msg, MSG_ERRQUEUE) == -1)
+    {
+      break;
+    }
+
+    for (struct cmsghdr *control = CMSG_FIRSTHDR(&error_msg);
+         control != NULL;
+         control = CMSG_NXTHDR(&error_msg, control))
+    {
+      struct sock_extended_err *error = (struct sock_extended_err *)CMSG_DATA(control);
+      b32 is_socket_error = (control->cmsg_level == SOL_IP && control->cmsg_type == IP_RECVERR) ||
+                            (control->cmsg_level == SOL_IPV6 && control->cmsg_type == IPV6_RECVERR);
+      if (is_socket_error && error->ee_errno == 0 && error->ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+      {
+        // NOTE(Ryan): ee_info to ee_data inclusive
+        u32 completed_count = error->ee_data - error->ee_info + 1;
+        connection->zero_copy_completed_count += completed_count;
+        if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        {
+          connection->pacing.copied_send_count += completed_count;
+        }
+      }
+    }
+  }
+
+  int socket_error = 0;
+  socklen_t socket_error_len = sizeof(socket_error);
+  if (getsockopt(connection->source.fd, SOL_SOCKET, SO_ERROR, &socket_error, 
+                 &socket_error_len) == -1 || socket_error != 0)
+  {
+    close_connection(server, connection);
+    result = false;
+  }
+  else if (connection->is_zero_copy_pending && 
+           connection->zero_copy_completed_count == connection->zero_copy_issued_count)
+  {
+    // NOTE(Ryan): The kernel is done with the frame
+    connection->is_zero_copy_pending = false;
+    release_sent_frame(connection);
+    if (connection->state == CONNECTION_STATE_STREAMING_CAMERA)
+    {
+      deliver_latest_frame(server, connection);
+    }
+  }
+
+  return result;
+}
+
+INTERNAL void
+publish_stream_stats(Server *server, u64 now_ns)
+{
+  for (Connection *connection = server->first_streaming_connection;
+       connection != NULL;
+       connection = connection->next_streaming)
+  {
+    StreamPacing *pacing = &connection->pacing;
+    if (connection->response == NULL && connection->frame == NULL)
+    {
+      sample_stream_pacing(connection, now_ns);
+    }
+    else
+    {
+      pacing->queue_depth = get_socket_queue_depth(connection);
+    }
+
+    CaptureViewerStats stats = {0};
+    stats.worker_index = server->worker_index;
+    u64 window_ns = now_ns - pacing->window_start_ns;
+    if (window_ns > 0)
+    {
+      stats.fps = (r32)(pacing->sent_frame_count - pacing->window_frame_count) * 1e9f / 
+                  (r32)window_ns;
+    }
+    stats.sent_frame_count = pacing->sent_frame_count;
+    stats.dropped_frame_count = pacing->dropped_frame_count;
+    stats.paced_frame_count = pacing->paced_frame_count;
+    stats.queue_depth = pacing->queue_depth;
+    stats.queue_latency_ms = get_stream_queue_latency_ms(connection);
+    stats.drain_rate = pacing->drain_rate;
+    stats.zero_copy_send_count = pacing->zero_copy_send_count;
+    stats.copied_send_count = pacing->copied_send_count;
+    capture_update_viewer_stats(&global_capture, connection->viewer_index, &stats);
+
+    pacing->window_start_ns = now_ns;
+    pacing->window_frame_count = pacing->sent_frame_count;
+  }
+
+  server->stream_stats_published_ns = now_ns;
+}
+
+// NOTE(Ryan): body is copied, so may be in the request arena.
+// Text is compressed as the client allows, with the worker's deflate states
+INTERNAL void
+begin_owned_response_with_status(Server *server, Connection *connection, const char *status,
+                                 const char *extra_headers, const char *content_type, 
+                                 const u8 *body, u32 body_len)
+{
+  const char *headers = extra_headers;
+  u8 *compressed_body = NULL;
+  u32 compressed_len = 0;
+  if (content_type != NULL && is_compressible_content_type(content_type))
+  {
+    CONTENT_ENCODING encoding = choose_dynamic_encoding(connection->accepted_encodings);
+    u32 headers_size = (u32)strlen(extra_headers) + CONTENT_ENCODING_HEADERS_SIZE;
+    char *encoded_headers = MEM_PUSH_ARRAY(&server->scratch_arena, char, headers_size);
+    if (compress_dynamic(&server->compressor, encoding, (u8 *)body, body_len, 
+                         &compressed_body, &compressed_len))
+    {
+      snprintf(encoded_headers, headers_size, "%sContent-Encoding: %s\r\nVary: Accept-Encoding\r\n",
+               extra_headers, global_content_encoding_names[encoding]);
+      body = compressed_body;
+      body_len = compressed_len;
+    }
+    else
+    {
+      snprintf(encoded_headers, headers_size, "%sVary: Accept-Encoding\r\n", extra_headers);
+    }
+    headers = encoded_headers;
+  }
+
+  connection->owned_response = http_build_response(status, headers, content_type, body, 
+                                                   body_len, connection->is_keep_alive);
+  free(compressed_body);
+  if (connection->owned_response.data != NULL)
+  {
+    connection->state = CONNECTION_STATE_WRITING_RESPONSE;
+    connection->response = connection->owned_response.data;
+    connection->response_len = connection->owned_response.size;
+    connection->response_sent = 0;
+    flush_connection(server, connection);
+  }
+  else
+  {
+    close_connection(server, connection);
+  }
+}
+
+INTERNAL void
+begin_owned_response(Server *server, Connection *connection, const char *content_type,
+                     const u8 *body, u32 body_len)
+{
+  begin_owned_response_with_status(server, connection, "200 OK", "Cache-Control: no-store\r\n",
+                                   content_type, body, body_len);
+}
+
+// NOTE(Ryan): An idle client is sent any reply it is owed, then the latest message 
+// of each channel it has not seen. Messages are shared, so a broadcast is one build
+INTERNAL void
+deliver_websocket_messages(Server *server, Connection *connection)
+{
+  if (connection->response != NULL || connection->is_websocket_closing)
+  {
+    return;
+  }
+
+  if (connection->has_websocket_reply)
+  {
+    u32 header_len = websocket_format_frame_header(connection->response_header_buf, 
+                                                   connection->websocket_reply_opcode,
+                                                   connection->websocket_reply_len);
+    memcpy(connection->response_header_buf + header_len, connection->websocket_reply, 
+           connection->websocket_reply_len);
+    connection->has_websocket_reply = false;
+    connection->is_websocket_closing = 
+      (connection->websocket_reply_opcode == WEBSOCKET_OPCODE_CLOSE);
+
+    connection->response = connection->response_header_buf;
+    connection->response_len = header_len + connection->websocket_reply_len;
+    connection->response_sent = 0;
+    flush_connection(server, connection);
+    return;
+  }
+
+  for (u32 channel_i = 0;
+       channel_i < WEBSOCKET_CHANNEL_COUNT;
+       ++channel_i)
+  {
+    WebSocketMessage *message = server->websocket_messages[channel_i];
+    if (message != NULL && message->version > connection->websocket_sent_versions[channel_i])
+    {
+      message->ref_count++;
+      connection->websocket_message = message;
+      connection->websocket_sent_versions[channel_i] = message->version;
+
+      connection->response = message->data;
+      connection->response_len = message->size;
+      connection->response_sent = 0;
+      flush_connection(server, connection);
+      break;
+    }
+  }
+}
+
+INTERNAL void
+publish_websocket_message(Server *server, WEBSOCKET_CHANNEL channel, const u8 *payload, 
+                          u32 payload_len, u64 version)
+{
+  WebSocketMessage *message = websocket_build_message(WEBSOCKET_OPCODE_TEXT, payload, 
+                                                      payload_len, version);
+  if (message == NULL)
+  {
+    EBP();
+    return;
+  }
+  websocket_message_release(server->websocket_messages[channel]);
+  server->websocket_messages[channel] = message;
+
+  Connection *connection = server->first_websocket_connection;
+  while (connection != NULL)
+  {
+    Connection *next_websocket = connection->next_websocket;
+    deliver_websocket_messages(server, connection);
+    connection = next_websocket;
+  }
+}
+
+INTERNAL void
+publish_control_state(Server *server)
+{
+  char json[CONTROL_STATE_JSON_SIZE] = {0};
+  u64 version = 0;
+  u32 json_len = control_format_state(&global_control_state, json, sizeof(json), &version);
+
+  WebSocketMessage *latest = server->websocket_messages[WEBSOCKET_CHANNEL_STATE];
+  if (latest == NULL || version > latest->version)
+  {
+    publish_websocket_message(server, WEBSOCKET_CHANNEL_STATE, (u8 *)json, json_len, version);
+  }
+}
+
+INTERNAL void
+publish_motion_state(Server *server)
+{
+  char *json = MEM_PUSH_ARRAY(&server->scratch_arena, char, MOTION_STATE_JSON_SIZE);
+  u64 version = 0;
+  u32 json_len = motion_format_state(&global_capture.motion, json, MOTION_STATE_JSON_SIZE, 
+                                     &version);
+
+  WebSocketMessage *latest = server->websocket_messages[WEBSOCKET_CHANNEL_MOTION];
+  if (latest == NULL || version > latest->version)
+  {
+    publish_websocket_message(server, WEBSOCKET_CHANNEL_MOTION, (u8 *)json, json_len, version);
+  }
+}
+
+// NOTE(Ryan): Only the latest ping is answered, as each pong need only echo the last one
+INTERNAL void
+queue_websocket_reply(Connection *connection, WEBSOCKET_OPCODE opcode, 
+                      const u8 *payload, u32 payload_len)
+{
+  if (connection->has_websocket_reply && 
+      connection->websocket_reply_opcode == WEBSOCKET_OPCODE_CLOSE)
+  {
+    return;
+  }
+
+  connection->has_websocket_reply = true;
+  connection->websocket_reply_opcode = opcode;
+  connection->websocket_reply_len = payload_len;
+  memcpy(connection->websocket_reply, payload, payload_len);
+}
+
+INTERNAL void
+queue_websocket_close(Connection *connection, u16 status_code)
+{
+  u8 payload[2] = {(u8)(status_code >> 8), (u8)status_code};
+  queue_websocket_reply(connection, WEBSOCKET_OPCODE_CLOSE, payload, sizeof(payload));
+}
+
+// NOTE(Ryan): Commands are acted on as they arrive, even while a message is going out
+INTERNAL void
+process_websocket_frames(Server *server, Connection *connection)
+{
+  u32 frame_start = 0;
+  while (connection->request_len - frame_start > 0)
+  {
+    b32 is_closing = connection->is_websocket_closing || 
+                     (connection->has_websocket_reply && 
+                      connection->websocket_reply_opcode == WEBSOCKET_OPCODE_CLOSE);
+    if (is_closing)
+    {
+      // NOTE(Ryan): Nothing more is read once closing
+      frame_start = connection->request_len;
+      break;
+    }
+
+    WebSocketFrame frame = {0};
+    WEBSOCKET_PARSE_RESULT parse_result = 
+      websocket_parse_frame(connection->request_buf + frame_start, 
+                            connection->request_len - frame_start, 
+                            sizeof(connection->request_buf) - WEBSOCKET_MAX_FRAME_HEADER_SIZE - 4,
+                            &frame);
+    if (parse_result == WEBSOCKET_PARSE_RESULT_INCOMPLETE)
+    {
+      break;
+    }
+    else if (parse_result == WEBSOCKET_PARSE_RESULT_ERROR)
+    {
+      // NOTE(Ryan): Protocol error
+      queue_websocket_close(connection, 1002);
+      continue;
+    }
+    frame_start += frame.size;
+
+    if (frame.opcode == WEBSOCKET_OPCODE_TEXT || frame.opcode == WEBSOCKET_OPCODE_BINARY)
+    {
+      if (frame.is_final)
+      {
+        HTTPSlice command = {frame.payload, frame.payload_len};
+        control_apply_command(&global_control_state, command);
+      }
+      else
+      {
+        // NOTE(Ryan): Unsupported data, commands are never large enough to fragment
+        queue_websocket_close(connection, 1003);
+      }
+    }
+    else if (frame.opcode == WEBSOCKET_OPCODE_PING)
+    {
+      queue_websocket_reply(connection, WEBSOCKET_OPCODE_PONG, frame.payload, frame.payload_len);
+    }
+    else if (frame.opcode == WEBSOCKET_OPCODE_CLOSE)
+    {
+      // NOTE(Ryan): Echo the status code back, then close once it is sent
+      u32 status_len = (frame.payload_len >= 2) ? 2 : 0;
+      queue_websocket_reply(connection, WEBSOCKET_OPCODE_CLOSE, frame.payload, status_len);
+    }
+    else if (frame.opcode != WEBSOCKET_OPCODE_PONG)
+    {
+      queue_websocket_close(connection, 1003);
+    }
+  }
+
+  memmove(connection->request_buf, connection->request_buf + frame_start, 
+          connection->request_len - frame_start);
+  connection->request_len -= frame_start;
+
+  deliver_websocket_messages(server, connection);
+}
+
+INTERNAL void
+begin_websocket(Server *server, Connection *connection, HTTPRequest *request)
+{
+  char accept_key[WEBSOCKET_ACCEPT_KEY_SIZE] = {0};
+  websocket_compute_accept_key(http_find_header(request, "Sec-WebSocket-Key"), accept_key);
+
+  connection->next_websocket = server->first_websocket_connection;
+  server->first_websocket_connection = connection;
+  server->websocket_count++;
+
+  // NOTE(Ryan): Set first, so the handshake is not treated as a final response
+  connection->state = CONNECTION_STATE_WEBSOCKET;
+  s32 response_len = snprintf((char *)connection->response_header_buf, 
+                              sizeof(connection->response_header_buf),
+                              "HTTP/1.1 101 Switching Protocols\r\n"
+                              "Upgrade: websocket\r\n"
+                              "Connection: Upgrade\r\n"
+                              "Sec-WebSocket-Accept: %s\r\n\r\n", accept_key);
+  connection->response = connection->response_header_buf;
+  connection->response_len = (u32)response_len;
+  connection->response_sent = 0;
+  flush_connection(server, connection);
+}
+
+INTERNAL void
+begin_cached_file_response(Server *server, Connection *connection, HTTPRequest *request, 
+                           CachedFile *cached_file)
+{
+  u32 response_i = connection->is_keep_alive ? 1 : 0;
+  CONTENT_ENCODING encoding = choose_precompressed_encoding(connection->accepted_encodings, 
+                                                            cached_file->responses[response_i]);
+  HTTPResponse *response = &cached_file->responses[response_i][encoding];
+  if (is_file_not_modified(request, &cached_file->validators))
+  {
+    response = &cached_file->not_modified_responses[response_i][encoding];
+  }
+
+  cached_file->ref_count++;
+  connection->cached_file = cached_file;
+  connection->state = CONNECTION_STATE_WRITING_RESPONSE;
+  connection->response = response->data;
+  connection->response_len = response->size;
+  connection->response_sent = 0;
+  flush_connection(server, connection);
+}
+
+// NOTE(Ryan): Serves files under the static root, falling back to the built-in index page
+INTERNAL void
+begin_file_response(Server *server, Connection *connection, HTTPRequest *request)
+{
+  FileCache *file_cache = &server->file_cache;
+  STATIC_RESPONSE fallback = http_slice_equals(request->path, "/") ? 
+                             STATIC_RESPONSE_INDEX : STATIC_RESPONSE_NOT_FOUND;
+
+  char file_path[MAX_FILE_PATH_SIZE] = {0};
+  if (file_cache->root_fd < 0 || 
+      !file_path_from_request(request->path, file_path, sizeof(file_path)))
+  {
+    begin_static_response(server, connection, fallback);
+    return;
+  }
+
+  CachedFile *cached_file = file_cache_find(file_cache, file_path);
+  if (cached_file != NULL)
+  {
+    begin_cached_file_response(server, connection, request, cached_file);
+    return;
+  }
+
+  int file_fd = openat(file_cache->root_fd, file_path, O_RDONLY | O_CLOEXEC);
+  if (file_fd == -1)
+  {
+    begin_static_response(server, connection, fallback);
+    return;
+  }
+
+  struct stat file_stat = {0};
+  if (fstat(file_fd, &file_stat) == -1 || !S_ISREG(file_stat.st_mode))
+  {
+    close(file_fd);
+    begin_static_response(server, connection, STATIC_RESPONSE_NOT_FOUND);
+    return;
+  }
+
+  cached_file = file_cache_load(file_cache, file_path, file_fd, &file_stat);
+  if (cached_file != NULL)
+  {
+    close(file_fd);
+    begin_cached_file_response(server, connection, request, cached_file);
+    return;
+  }
+
+  FileValidators validators = {0};
+  file_validators_from_stat(&validators, &file_stat);
+  b32 is_not_modified = is_file_not_modified(request, &validators);
+
+  connection->state = CONNECTION_STATE_WRITING_RESPONSE;
+  connection->response = connection->response_header_buf;
+  connection->response_len = 
+    http_format_response_header(connection->response_header_buf, 
+                                sizeof(connection->response_header_buf),
+                                is_not_modified ? "304 Not Modified" : "200 OK", 
+                                validators.headers, 
+                                is_not_modified ? NULL : content_type_for_path(file_path), 
+                                (u64)file_stat.st_size, connection->is_keep_alive);
+  connection->response_sent = 0;
+  if (is_not_modified)
+  {
+    close(file_fd);
+  }
+  else
+  {
+    connection->file_fd = file_fd;
+    connection->file_offset = 0;
+    connection->file_size = (u64)file_stat.st_size;
+  }
+  flush_connection(server, connection);
+}
+
+INTERNAL void
+handle_camera_stream_route(Server *server, Connection *connection, HTTPRequest *request,
+                           RouteMatch *match, MemoryArena *arena)
+{
+  begin_camera_stream(server, connection, request);
+}
+
+INTERNAL void
+handle_camera_stats_route(Server *server, Connection *connection, HTTPRequest *request,
+                          RouteMatch *match, MemoryArena *arena)
+{
+  char *json = MEM_PUSH_ARRAY(arena, char, CAPTURE_STATS_JSON_SIZE);
+  u32 json_len = capture_format_stats(&global_capture, json, CAPTURE_STATS_JSON_SIZE);
+  begin_owned_response(server, connection, "application/json", (u8 *)json, json_len);
+}
+
+// NOTE(Ryan): ?t=<ms since the epoch> is the last frame recorded at or before then, and
+// ?after=<ms> the first after, so a player steps through with each frame's X-Timestamp.
+// The frame goes out with sendfile() from its segment. Without either, lists the segments
+INTERNAL void
+handle_camera_archive_route(Server *server, Connection *connection, HTTPRequest *request,
+                            RouteMatch *match, MemoryArena *arena)
+{
+  if (global_archive.directory == NULL)
+  {
+    begin_static_response(server, connection, STATIC_RESPONSE_NOT_FOUND);
+    return;
+  }
+
+  HTTPSlice at_param = http_find_query_param(request, "t");
+  HTTPSlice after_param = http_find_query_param(request, "after");
+  b32 is_after = (after_param.str != NULL);
+  u64 timestamp_ms = 0;
+  if (at_param.str == NULL && after_param.str == NULL)
+  {
+    char *json = MEM_PUSH_ARRAY(arena, char, ARCHIVE_STATE_JSON_SIZE);
+    u32 json_len = archive_format_state(&global_archive, json, ARCHIVE_STATE_JSON_SIZE);
+    begin_owned_response(server, connection, "application/json", (u8 *)json, json_len);
+    return;
+  }
+  if (!http_slice_to_u64(is_after ? after_param : at_param, &timestamp_ms))
+  {
+    begin_static_response(server, connection, STATIC_RESPONSE_BAD_REQUEST);
+    return;
+  }
+
+  // NOTE(Ryan): Frames are stamped to the nanosecond, so anywhere within the millisecond
+  ArchiveFrameLocation location = {0};
+  if (!archive_find_frame(&global_archive, timestamp_ms * 1000000ULL + 999999ULL, is_after, 
+                          &location))
+  {
+    begin_static_response(server, connection, STATIC_RESPONSE_NOT_FOUND);
+    return;
+  }
+
+  char headers[128] = {0};
+  snprintf(headers, sizeof(headers), "Cache-Control: no-store\r\nX-Timestamp: %lu.%06lu\r\n",
+           (u64)(location.timestamp_ns / 1000000000ULL), 
+           (u64)((location.timestamp_ns / 1000ULL) % 1000000ULL));
+  connection->state = CONNECTION_STATE_WRITING_RESPONSE;
+  connection->response = connection->response_header_buf;
+  connection->response_len = 
+    http_format_response_header(connection->response_header_buf, 
+                                sizeof(connection->response_header_buf), "200 OK", headers,
+                                "image/jpeg", location.size, connection->is_keep_alive);
+  connection->response_sent = 0;
+  // NOTE(Ryan): file_size is where sending stops, so the frame's end in the segment
+  connection->file_fd = location.fd;
+  connection->file_offset = location.offset;
+  connection->file_size = location.offset + location.size;
+  flush_connection(server, connection);
+}
+
+INTERNAL void
+handle_camera_motion_route(Server *server, Connection *connection, HTTPRequest *request,
+                           RouteMatch *match, MemoryArena *arena)
+{
+  if (global_capture.motion.is_enabled)
+  {
+    char *json = MEM_PUSH_ARRAY(arena, char, MOTION_STATE_JSON_SIZE);
+    u64 version = 0;
+    u32 json_len = motion_format_state(&global_capture.motion, json, MOTION_STATE_JSON_SIZE, 
+                                       &version);
+    begin_owned_response(server, connection, "application/json", (u8 *)json, json_len);
+  }
+  else
+  {
+    begin_static_response(server, connection, STATIC_RESPONSE_NOT_FOUND);
+  }
+}
+
+// NOTE(Ryan): The connection waits without the worker doing so, until the command's pidfd 
+// says it has exited. Its output is drained as it comes, so never fills the pipe
+INTERNAL void
+begin_status_command(Server *server, Connection *connection, const char *command_line)
+{
+  connection->command = execute_system_command(NULL, command_line, STATUS_COMMAND_TIMEOUT_MS);
+  connection->command.max_output_size = MAX_STATUS_COMMAND_OUTPUT_SIZE;
+  if (!connection->command.is_running)
+  {
+    begin_owned_response_with_status(server, connection, "500 Internal Server Error",
+                                     "Cache-Control: no-store\r\n", "text/plain", 
+                                     (const u8 *)"", 0);
+    return;
+  }
+
+  connection->state = CONNECTION_STATE_RUNNING_COMMAND;
+  connection->command_id = ++server->last_command_id;
+  connection->command_output.type = EVENT_SOURCE_TYPE_COMMAND_OUTPUT;
+  connection->command_output.fd = connection->command.output_fd;
+  connection->command_exit.type = EVENT_SOURCE_TYPE_COMMAND_EXIT;
+  connection->command_exit.fd = connection->command.exit_fd;
+  connection->next_command = server->first_command_connection;
+  server->first_command_connection = connection;
+
+  // NOTE(Ryan): Should either fail, the telemetry tick still reaps it, if only at its deadline
+#if SERVER_HAS_IO_URING
+  if (server->is_using_uring)
+  {
+    uring_arm_command_poll(server, connection, URING_OP_TYPE_COMMAND_OUTPUT_POLL);
+    if (connection->command_exit.fd >= 0)
+    {
+      uring_arm_command_poll(server, connection, URING_OP_TYPE_COMMAND_EXIT_POLL);
+    }
+    return;
+  }
+#endif
+  struct epoll_event output_event = {0};
+  output_event.events = EPOLLIN;
+  output_event.data.ptr = &connection->command_output;
+  if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, connection->command_output.fd, 
+                &output_event) == -1)
+  {
+    EBP();
+  }
+  if (connection->command_exit.fd >= 0)
+  {
+    struct epoll_event exit_event = {0};
+    exit_event.events = EPOLLIN;
+    exit_event.data.ptr = &connection->command_exit;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, connection->command_exit.fd, 
+                  &exit_event) == -1)
+    {
+      EBP();
+    }
+  }
+}
+
+// NOTE(Ryan): The command's output as text/plain, e.g. /status/disk
+INTERNAL void
+handle_status_route(Server *server, Connection *connection, HTTPRequest *request,
+                    RouteMatch *match, MemoryArena *arena)
+{
+  HTTPSlice name = route_param(match, "name");
+  for (u32 command_i = 0;
+       command_i < sizeof(global_status_commands) / sizeof(global_status_commands[0]);
+       ++command_i)
+  {
+    if (http_slice_equals(name, global_status_commands[command_i].name))
+    {
+      begin_status_command(server, connection, global_status_commands[command_i].command_line);
+      return;
+    }
+  }
+
+  begin_static_response(server, connection, STATIC_RESPONSE_NOT_FOUND);
+}
+
+INTERNAL void
+handle_control_channel_route(Server *server, Connection *connection, HTTPRequest *request,
+                             RouteMatch *match, MemoryArena *arena)
+{
+  if (websocket_is_upgrade_request(request))
+  {
+    begin_websocket(server, connection, request);
+  }
+  else
+  {
+    begin_static_response(server, connection, STATIC_RESPONSE_BAD_REQUEST);
+  }
+}
+
+INTERNAL void
+handle_control_value_route(Server *server, Connection *connection, HTTPRequest *request,
+                           RouteMatch *match, MemoryArena *arena)
+{
+  HTTPSlice name = route_param(match, "name");
+  s32 value = 0;
+  if (control_get_value(&global_control_state, name, &value))
+  {
+    u32 json_size = name.size + 64;
+    char *json = MEM_PUSH_ARRAY(arena, char, json_size);
+    s32 json_len = snprintf(json, json_size, "{\"name\":\"%.*s\",\"value\":%d}", 
+                            name.size, name.str, value);
+    begin_owned_response(server, connection, "application/json", (u8 *)json, (u32)json_len);
+  }
+  else
+  {
+    begin_static_response(server, connection, STATIC_RESPONSE_NOT_FOUND);
+  }
+}
+
+INTERNAL void
+handle_control_form_route(Server *server, Connection *connection, HTTPRequest *request,
+                          RouteMatch *match, MemoryArena *arena)
+{
+  control_apply_command(&global_control_state, request->body);
+  begin_static_response(server, connection, STATIC_RESPONSE_INDEX);
+}
+
+INTERNAL void
+handle_static_file_route(Server *server, Connection *connection, HTTPRequest *request,
+                         RouteMatch *match, MemoryArena *arena)
+{
+  begin_file_response(server, connection, request);
+}
+
+INTERNAL void
+handle_not_found_route(Server *server, Connection *connection, HTTPRequest *request,
+                       RouteMatch *match, MemoryArena *arena)
+{
+  begin_static_response(server, connection, STATIC_RESPONSE_NOT_FOUND);
+}
+
+INTERNAL b32
+register_routes(Router *router)
+{
+  router_init(router);
+
+  b32 result = true;
+  result &= router_add(router, HTTP_METHOD_GET, "/camera.jpeg", handle_camera_stream_route);
+  result &= router_add(router, HTTP_METHOD_GET, "/camera/stats", handle_camera_stats_route);
+  result &= router_add(router, HTTP_METHOD_GET, "/camera/motion", handle_camera_motion_route);
+  result &= router_add(router, HTTP_METHOD_GET, "/camera/archive", handle_camera_archive_route);
+  result &= router_add(router, HTTP_METHOD_GET, "/control", handle_control_channel_route);
+  result &= router_add(router, HTTP_METHOD_GET, "/control/:name", handle_control_value_route);
+  result &= router_add(router, HTTP_METHOD_GET, "/status/:name", handle_status_route);
+  result &= router_add(router, HTTP_METHOD_POST, "/", handle_control_form_route);
+
+  // NOTE(Ryan): Anything else is a file under the static root, including "/"
+  router_set_fallback(router, HTTP_METHOD_GET, handle_static_file_route);
+  router_set_fallback(router, HTTP_METHOD_POST, handle_not_found_route);
+
+  return result;
+}
+
+INTERNAL void
+handle_request(Server *server, Connection *connection, HTTPRequest *request)
+{
+  RouteMatch match = {0};
+  RouteHandler handler = router_find(&global_router, request->method, request->path, &match);
+  if (handler != NULL)
+  {
+    handler(server, connection, request, &match, &server->scratch_arena);
+  }
+  else
+  {
+    begin_static_response(server, connection, STATIC_RESPONSE_NOT_IMPLEMENTED);
+  }
+}
+
+INTERNAL void
+retire_request(Connection *connection)
+{
+  u32 request_size = connection->parser.request.size;
+  memmove(connection->request_buf, connection->request_buf + request_size,
+          connection->request_len - request_size);
+  connection->request_len -= request_size;
+  http_parser_reset(&connection->parser);
+}
+
+// NOTE(Ryan): Answers buffered requests one at a time, only moving on to a pipelined 
+// request once the previous response has gone out, so responses stay in order
+INTERNAL void
+process_requests(Server *server, Connection *connection)
+{
+  while (connection->source.fd != -1 && 
+         connection->state == CONNECTION_STATE_READING_REQUEST &&
+         connection->request_len > 0)
+  {
+    HTTP_PARSE_RESULT parse_result = http_parse_request(&connection->parser, 
+                                                        connection->request_buf, 
+                                                        connection->request_len,
+                                                        sizeof(connection->request_buf));
+    if (parse_result == HTTP_PARSE_RESULT_INCOMPLETE)
+    {
+      break;
+    }
+    else if (parse_result == HTTP_PARSE_RESULT_ERROR)
+    {
+      connection->is_keep_alive = false;
+      connection->accepted_encodings = (1 << CONTENT_ENCODING_IDENTITY);
+      begin_static_response(server, connection, 
+                            static_response_for_status(connection->parser.error_status));
+      break;
+    }
+    else
+    {
+      connection->is_keep_alive = connection->parser.request.is_keep_alive;
+      connection->accepted_encodings = 
+        parse_accept_encoding(http_find_header(&connection->parser.request, "Accept-Encoding"));
+      handle_request(server, connection, &connection->parser.request);
+      if (connection->source.fd != -1)
+      {
+        retire_request(connection);
+      }
+      reset_mem_arena(&server->scratch_arena);
+    }
+  }
+
+  // NOTE(Ryan): Including frames sent straight after the upgrade request
+  if (connection->source.fd != -1 && connection->state == CONNECTION_STATE_WEBSOCKET)
+  {
+    process_websocket_frames(server, connection);
+  }
+}
+
+INTERNAL void
+handle_connection_readable(Server *server, Connection *connection)
+{
+  // NOTE(Ryan): Requests pipelined behind a response that just finished
+  process_requests(server, connection);
+
+  while (connection->source.fd != -1)
+  {
+    if (connection->state == CONNECTION_STATE_STREAMING_CAMERA)
+    {
+      // NOTE(Ryan): Nothing more is expected from the client, so discard
+      connection->request_len = 0;
+    }
+
+    u32 request_space = sizeof(connection->request_buf) - connection->request_len;
+    if (request_space == 0)
+    {
+      // NOTE(Ryan): Only possible while a response is blocked, whose EPOLLOUT brings us back
+      break;
+    }
+
+    ssize_t bytes_read = recv(connection->source.fd, 
+                              connection->request_buf + connection->request_len, 
+                              request_space, 0);
+    if (bytes_read > 0)
+    {
+      connection->request_len += (u32)bytes_read;
+      process_requests(server, connection);
+    }
+    else if (bytes_read == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    else if (bytes_read == -1 && errno == EAGAIN)
+    {
+      break;
+    }
+    else
+    {
+      // NOTE(Ryan): Orderly shutdown from the client, or a reset
+      close_connection(server, connection);
+      break;
+    }
+  }
+}
+
+// NOTE(Ryan): Returns NULL and closes client_fd when out of connection slots, to shed load
+INTERNAL Connection *
+add_connection(Server *server, int client_fd)
+{
+  Connection *result = server->first_free_connection;
+  if (result != NULL)
+  {
+    server->first_free_connection = result->next_free;
+    server->connection_count++;
+
+    // NOTE(Ryan): Any send from the previous occupant has long completed
+    file_cache_release(result->cached_file);
+    result->cached_file = NULL;
+
+    result->next_free = NULL;
+    result->source.type = EVENT_SOURCE_TYPE_CONNECTION;
+    result->source.fd = client_fd;
+    result->state = CONNECTION_STATE_READING_REQUEST;
+  }
+  else
+  {
+    close(client_fd);
+  }
+
+  return result;
+}
+
+INTERNAL void
+accept_connections(Server *server)
+{
+  while (true)
+  {
+    struct sockaddr_in client_addr = {0}; 
+    socklen_t client_size = sizeof(client_addr);
+    int client_fd = accept4(server->listener.fd, (struct sockaddr *)&client_addr, &client_size,
+                            SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd != -1)
+    {
+      Connection *connection = add_connection(server, client_fd);
+      if (connection != NULL)
+      {
+        struct epoll_event client_event = {0};
+        client_event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        client_event.data.ptr = &connection->source;
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, client_fd, &client_event) == -1)
+        {
+          EBP();
+          close_connection(server, connection);
+        }
+      }
+    }
+    else
+    {
+      if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+      {
+        EBP();
+      }
+      if (errno != EINTR && errno != ECONNABORTED)
+      {
+        break;
+      }
+    }
+  }
+}
+
+INTERNAL void
+handle_frame_event(Server *server)
+{
+  u64 frame_event_count = 0;
+  if (read(server->frame_event.fd, &frame_event_count, sizeof(frame_event_count)) == -1 && 
+      errno != EAGAIN)
+  {
+    EBP();
+  }
+
+  // NOTE(Ryan): A client still sending its previous frame skips this one, 
+  // so one slow client never holds up the others or the capture thread
+  Connection *connection = server->first_streaming_connection;
+  while (connection != NULL)
+  {
+    Connection *next_streaming = connection->next_streaming;
+    deliver_latest_frame(server, connection);
+    connection = next_streaming;
+  }
+
+  u64 now_ns = get_ns();
+  if (now_ns - server->stream_stats_published_ns >= STREAM_STATS_INTERVAL_NS)
+  {
+    publish_stream_stats(server, now_ns);
+  }
+}
+
+INTERNAL void
+handle_control_event(Server *server)
+{
+  u64 control_event_count = 0;
+  if (read(server->control_event.fd, &control_event_count, sizeof(control_event_count)) == -1 && 
+      errno != EAGAIN)
+  {
+    EBP();
+  }
+
+  publish_control_state(server);
+}
+
+INTERNAL void
+handle_motion_event(Server *server)
+{
+  u64 motion_event_count = 0;
+  if (read(server->motion_event.fd, &motion_event_count, sizeof(motion_event_count)) == -1 && 
+      errno != EAGAIN)
+  {
+    EBP();
+  }
+
+  publish_motion_state(server);
+}
+
+// NOTE(Ryan): A failed or killed command still answers with what it printed
+INTERNAL void
+finish_status_command(Server *server, Connection *connection)
+{
+  end_status_command(server, connection);
+  ExecutingProcess command = connection->command;
+
+  const char *status = "200 OK";
+  if (command.is_timed_out)
+  {
+    status = "504 Gateway Timeout";
+  }
+  else if (command.exit_code != 0)
+  {
+    status = "500 Internal Server Error";
+  }
+  char headers[160] = {0};
+  snprintf(headers, sizeof(headers), 
+           "Cache-Control: no-store\r\nX-Exit-Code: %d\r\nX-Elapsed-Ms: %lu\r\n%s", 
+           command.exit_code, (u64)(command.elapsed_ns / 1000000ULL),
+           command.is_output_truncated ? "X-Output-Truncated: 1\r\n" : "");
+
+  // NOTE(Ryan): The response may close the connection, which must not kill the process again
+  connection->state = CONNECTION_STATE_WRITING_RESPONSE;
+  begin_owned_response_with_status(server, connection, status, headers, 
+                                   "text/plain; charset=UTF-8", 
+                                   (command.output != NULL) ? command.output : (const u8 *)"",
+                                   command.output_size);
+  close_process(&command);
+
+  // NOTE(Ryan): Requests pipelined behind it, which no event of the socket's will bring up
+  if (connection->source.fd != -1 && connection->state == CONNECTION_STATE_READING_REQUEST)
+  {
+    process_requests(server, connection);
+  }
+}
+
+// NOTE(Ryan): On either fd being ready, and every telemetry tick for the deadline.
+// Only finished once reaped, as the output can end before the exit
+INTERNAL void
+update_status_command(Server *server, Connection *connection)
+{
+  collect_process_output(&connection->command);
+  if (!update_process_state(&connection->command))
+  {
+    // NOTE(Ryan): What it wrote before exiting. A background child of it is not waited on
+    collect_process_output(&connection->command);
+    finish_status_command(server, connection);
+  }
+}
+
+INTERNAL void
+handle_telemetry_timer(Server *server)
+{
+  u64 expiration_count = 0;
+  if (read(server->telemetry_timer.fd, &expiration_count, sizeof(expiration_count)) == -1 && 
+      errno != EAGAIN)
+  {
+    EBP();
+  }
+
+  // NOTE(Ryan): So deadlines are only kept to within a tick
+  Connection *command_connection = server->first_command_connection;
+  while (command_connection != NULL)
+  {
+    Connection *next_command = command_connection->next_command;
+    update_status_command(server, command_connection);
+    command_connection = next_command;
+  }
+
+  // NOTE(Ryan): Per worker, as each only knows of its own connections
+  if (server->websocket_count > 0)
+  {
+    u32 streaming_count = 0;
+    for (Connection *connection = server->first_streaming_connection;
+         connection != NULL;
+         connection = connection->next_streaming)
+    {
+      streaming_count++;
+    }
+
+    char json[TELEMETRY_JSON_SIZE] = {0};
+    s32 json_len = snprintf(json, sizeof(json),
+                            "{\"type\":\"telemetry\",\"worker\":%u,\"connections\":%u,"
+                            "\"websockets\":%u,\"camera_viewers\":%u,\"cache_hits\":%lu,"
+                            "\"cache_misses\":%lu}", 
+                            server->worker_index, server->connection_count, 
+                            server->websocket_count, streaming_count, 
+                            server->file_cache.hit_count, server->file_cache.miss_count);
+    publish_websocket_message(server, WEBSOCKET_CHANNEL_TELEMETRY, (u8 *)json, (u32)json_len,
+                              ++server->telemetry_version);
+  }
+}
+
+INTERNAL b32
+server_init(Server *server, u32 worker_index, s32 cpu_index, u32 port, int static_root_fd)
+{
+  b32 result = false;
+
+  server->worker_index = worker_index;
+  server->cpu_index = cpu_index;
+  server->port = port;
+  file_cache_init(&server->file_cache, static_root_fd);
+
+  void *scratch_mem = malloc(SERVER_SCRATCH_ARENA_SIZE);
+  if (scratch_mem == NULL)
+  {
+    EBP();
+    return result;
+  }
+  server->scratch_arena = create_mem_arena(scratch_mem, SERVER_SCRATCH_ARENA_SIZE);
+
+  for (s32 connection_i = MAX_CONNECTION_COUNT - 1;
+       connection_i >= 0;
+       --connection_i)
+  {
+    Connection *connection = server->connections + connection_i;
+    connection->source.fd = -1;
+    connection->file_fd = -1;
+    connection->next_free = server->first_free_connection;
+    server->first_free_connection = connection;
+  }
+
+  server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (server->epoll_fd != -1)
+  {
+    int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server_fd != -1)
+    {
+      int opt_val = 1;
+      if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, (void *)&opt_val, sizeof(opt_val)) == -1)
+      {
+        EBP();
+      }
+      // NOTE(Ryan): Each worker binds its own listener to the same port
+      if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, (void *)&opt_val, sizeof(opt_val)) == -1)
+      {
+        EBP();
+      }
+
+      struct sockaddr_in server_addr = {0};
+      server_addr.sin_family = AF_INET;
+      server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+      server_addr.sin_port = htons(port);
+
+      if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) != -1)
+      {
+        if (listen(server_fd, SOMAXCONN) != -1)
+        {
+          server->listener.type = EVENT_SOURCE_TYPE_LISTENER;
+          server->listener.fd = server_fd;
+
+          struct epoll_event listener_event = {0};
+          listener_event.events = EPOLLIN | EPOLLET;
+          listener_event.data.ptr = &server->listener;
+          if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server_fd, &listener_event) != -1)
+          {
+            result = true;
+          }
+          else
+          {
+            EBP();
+          }
+
+          server->frame_event.type = EVENT_SOURCE_TYPE_FRAME;
+          server->frame_event.fd = capture_subscribe(&global_capture);
+          if (server->frame_event.fd >= 0)
+          {
+            struct epoll_event frame_event = {0};
+            frame_event.events = EPOLLIN;
+            frame_event.data.ptr = &server->frame_event;
+            if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->frame_event.fd, 
+                          &frame_event) == -1)
+            {
+              EBP();
+              result = false;
+            }
+          }
+          else
+          {
+            result = false;
+          }
+
+          server->control_event.type = EVENT_SOURCE_TYPE_CONTROL;
+          server->control_event.fd = control_subscribe(&global_control_state);
+          server->telemetry_timer.type = EVENT_SOURCE_TYPE_TELEMETRY_TIMER;
+          server->telemetry_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+          if (server->control_event.fd >= 0 && server->telemetry_timer.fd >= 0)
+          {
+            struct itimerspec telemetry_interval = {0};
+            telemetry_interval.it_interval.tv_sec = TELEMETRY_INTERVAL_MS / 1000;
+            telemetry_interval.it_interval.tv_nsec = (TELEMETRY_INTERVAL_MS % 1000) * 1000000;
+            telemetry_interval.it_value = telemetry_interval.it_interval;
+            if (timerfd_settime(server->telemetry_timer.fd, 0, &telemetry_interval, NULL) == -1)
+            {
+              EBP();
+            }
+
+            struct epoll_event control_event = {0};
+            control_event.events = EPOLLIN;
+            control_event.data.ptr = &server->control_event;
+            struct epoll_event telemetry_event = {0};
+            telemetry_event.events = EPOLLIN;
+            telemetry_event.data.ptr = &server->telemetry_timer;
+            if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->control_event.fd, 
+                          &control_event) == -1 ||
+                epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->telemetry_timer.fd, 
+                          &telemetry_event) == -1)
+            {
+              EBP();
+              result = false;
+            }
+
+            publish_control_state(server);
+          }
+          else
+          {
+            EBP();
+            result = false;
+          }
+
+          server->motion_event.type = EVENT_SOURCE_TYPE_MOTION;
+          server->motion_event.fd = -1;
+          if (global_capture.motion.is_enabled)
+          {
+            server->motion_event.fd = motion_subscribe(&global_capture.motion);
+            struct epoll_event motion_event = {0};
+            motion_event.events = EPOLLIN;
+            motion_event.data.ptr = &server->motion_event;
+            if (server->motion_event.fd < 0 ||
+                epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->motion_event.fd, 
+                          &motion_event) == -1)
+            {
+              EBP();
+              result = false;
+            }
+          }
+
+          // NOTE(Ryan): Without a watch the cache is simply never filled
+          if (server->file_cache.watch_fd >= 0)
+          {
+            server->file_watch.type = EVENT_SOURCE_TYPE_FILE_WATCH;
+            server->file_watch.fd = server->file_cache.watch_fd;
+
+            struct epoll_event file_watch_event = {0};
+            file_watch_event.events = EPOLLIN;
+            file_watch_event.data.ptr = &server->file_watch;
+            if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->file_watch.fd, 
+                          &file_watch_event) == -1)
+            {
+              EBP();
+              close(server->file_cache.watch_fd);
+              server->file_cache.watch_fd = -1;
+            }
+          }
+        }
+        else
+        {
+          EBP();
+        }
+      }
+      else
+      {
+        EBP();
+      }
+    }
+    else
+    {
+      EBP();
+    }
+  }
+  else
+  {
+    EBP();
+  }
+
+  return result;
+}
+
+#if SERVER_HAS_IO_URING
+INTERNAL void
+uring_arm_accept(Server *server)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(&server->ring);
+  sqe->opcode = IORING_OP_ACCEPT;
+  if (server->ring.has_fixed_files)
+  {
+    sqe->fd = 0;
+    sqe->flags = IOSQE_FIXED_FILE;
+  }
+  else
+  {
+    sqe->fd = server->listener.fd;
+  }
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->user_data = URING_USER_DATA(URING_OP_TYPE_ACCEPT, 0, 0);
+}
+
+INTERNAL void
+uring_arm_frame_poll(Server *server)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(&server->ring);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = server->frame_event.fd;
+  sqe->poll32_events = POLLIN;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = URING_USER_DATA(URING_OP_TYPE_FRAME_POLL, 0, 0);
+}
+
+// NOTE(Ryan): A send completion for a slot closed while the send was in flight
+INTERNAL void
+drain_connection(Server *server, Connection *connection, u32 flags)
+{
+  if (flags & IORING_CQE_F_NOTIF)
+  {
+    connection->is_zero_copy_pending = false;
+  }
+  else
+  {
+    connection->is_send_in_flight = false;
+    if (!(flags & IORING_CQE_F_MORE))
+    {
+      connection->is_zero_copy_pending = false;
+    }
+  }
+
+  if (!connection->is_send_in_flight && !connection->is_zero_copy_pending)
+  {
+    release_connection_references(connection);
+    connection->is_draining = false;
+    connection->next_free = server->first_free_connection;
+    server->first_free_connection = connection;
+  }
+}
+
+INTERNAL void
+uring_arm_event_poll(Server *server, EventSource *source, URING_OP_TYPE op_type)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(&server->ring);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = source->fd;
+  sqe->poll32_events = POLLIN;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = URING_USER_DATA(op_type, 0, 0);
+}
+
+INTERNAL void
+uring_arm_file_watch(Server *server)
+{
+  if (server->file_cache.watch_fd >= 0)
+  {
+    struct io_uring_sqe *sqe = uring_get_sqe(&server->ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = server->file_cache.watch_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = URING_USER_DATA(URING_OP_TYPE_FILE_WATCH_POLL, 0, 0);
+  }
+}
+
+INTERNAL void
+handle_uring_completion(Server *server, u64 user_data, s32 res, u32 flags)
+{
+  u32 connection_index = URING_USER_DATA_INDEX(user_data);
+  u32 generation = URING_USER_DATA_GENERATION(user_data);
+  Connection *connection = NULL;
+  if (connection_index < MAX_CONNECTION_COUNT)
+  {
+    connection = server->connections + connection_index;
+    if (connection->is_draining && connection->generation == generation + 1 &&
+        URING_USER_DATA_TYPE(user_data) == URING_OP_TYPE_SEND)
+    {
+      drain_connection(server, connection, flags);
+      return;
+    }
+    if (connection->generation != generation || connection->source.fd == -1)
+    {
+      connection = NULL;
+    }
+  }
+
+  switch (URING_USER_DATA_TYPE(user_data))
+  {
+    case URING_OP_TYPE_ACCEPT:
+    {
+      if (res >= 0)
+      {
+        Connection *new_connection = add_connection(server, res);
+        if (new_connection != NULL)
+        {
+          uring_arm_recv(server, new_connection);
+        }
+      }
+      if (!(flags & IORING_CQE_F_MORE))
+      {
+        uring_arm_accept(server);
+      }
+    } break;
+    case URING_OP_TYPE_RECV:
+    {
+      if (connection != NULL)
+      {
+        if (res > 0)
+        {
+          u32 request_space = sizeof(connection->request_buf) - connection->request_len;
+          if (connection->state == CONNECTION_STATE_STREAMING_CAMERA)
+          {
+            // NOTE(Ryan): Nothing more is expected from the client, so discard
+          }
+          else if ((u32)res > request_space && 
+                   connection->state == CONNECTION_STATE_WRITING_RESPONSE)
+          {
+            // NOTE(Ryan): Pipelined further ahead than can be buffered 
+            // and multishot recv cannot be paused, so give up on the client
+            close_connection(server, connection);
+          }
+          else
+          {
+            // NOTE(Ryan): Anything past capacity is dropped, the parser then fails with 413/431
+            u32 byte_count = ((u32)res < request_space) ? (u32)res : request_space;
+            u16 buffer_id = (u16)(flags >> IORING_CQE_BUFFER_SHIFT);
+            memcpy(connection->request_buf + connection->request_len, 
+                   uring_get_buffer(&server->ring, buffer_id), byte_count);
+            connection->request_len += byte_count;
+            process_requests(server, connection);
+          }
+        }
+        else if (res != -ENOBUFS)
+        {
+          // NOTE(Ryan): Orderly shutdown from the client, or a reset
+          close_connection(server, connection);
+        }
+      }
+
+      // NOTE(Ryan): Stale or not, the buffer has to go back to the kernel
+      if (flags & IORING_CQE_F_BUFFER)
+      {
+        uring_provide_buffer(&server->ring, (u16)(flags >> IORING_CQE_BUFFER_SHIFT));
+      }
+
+      if (connection != NULL && connection->generation == generation && 
+          connection->source.fd != -1 && !(flags & IORING_CQE_F_MORE))
+      {
+        uring_arm_recv(server, connection);
+      }
+    } break;
+    case URING_OP_TYPE_SEND:
+    {
+      if (flags & IORING_CQE_F_NOTIF)
+      {
+        // NOTE(Ryan): The kernel is done with the frame
+        if (connection != NULL)
+        {
+          if ((u32)res & IORING_NOTIF_USAGE_ZC_COPIED)
+          {
+            connection->pacing.copied_send_count++;
+          }
+          connection->is_zero_copy_pending = false;
+          release_sent_frame(connection);
+          if (connection->state == CONNECTION_STATE_STREAMING_CAMERA)
+          {
+            deliver_latest_frame(server, connection);
+          }
+        }
+        break;
+      }
+
+      if (connection != NULL)
+      {
+        connection->is_send_in_flight = false;
+        if (!(flags & IORING_CQE_F_MORE))
+        {
+          connection->is_zero_copy_pending = false;
+        }
+
+        if (res < 0)
+        {
+          close_connection(server, connection);
+          break;
+        }
+
+        b32 has_linked_shutdown = is_final_response(connection);
+        connection->response_sent += (u32)res;
+        if (connection->response_sent < get_response_size(connection))
+        {
+          // NOTE(Ryan): A short send breaks the link, so the shutdown will not follow
+          if (has_linked_shutdown)
+          {
+            close_connection(server, connection);
+          }
+          else
+          {
+            uring_submit_send(server, connection);
+          }
+        }
+        else if (!has_linked_shutdown)
+        {
+          b32 is_open = (connection->file_fd >= 0) ? flush_file_body(server, connection) : 
+                                                     finish_response(server, connection);
+          if (is_open)
+          {
+            process_requests(server, connection);
+          }
+        }
+      }
+    } break;
+    case URING_OP_TYPE_SHUTDOWN:
+    {
+      if (connection != NULL)
+      {
+        close_connection(server, connection);
+      }
+    } break;
+    case URING_OP_TYPE_FRAME_POLL:
+    {
+      handle_frame_event(server);
+      if (!(flags & IORING_CQE_F_MORE))
+      {
+        uring_arm_frame_poll(server);
+      }
+    } break;
+    case URING_OP_TYPE_FILE_POLL:
+    {
+      if (connection != NULL)
+      {
+        if (res < 0)
         {
-          result.buffer = mmap(NULL, camera_buffer_info.length, PROT_READ | PROT_WRITE, 
-                               MAP_SHARED, result.fd, camera_buffer_info.m.offset);
-          if (result.buffer != NULL)
-          {
-            result.buffer_size = camera_buffer_info.length;
-
-            int camera_streamon_status = ioctl(result.fd, VIDIOC_STREAMON, 
-                                               &camera_buffer_info.type);
-            if (camera_streamon_status == -1)
-            {
-              EBP();
-            }
-          }
-          else
-          {
-            EBP();
-          }
+          close_connection(server, connection);
         }
-        else
+        else if (flush_file_body(server, connection))
         {
-          EBP();
+          process_requests(server, connection);
         }
-
       }
-      else
+    } break;
+    case URING_OP_TYPE_FILE_WATCH_POLL:
+    {
+      file_cache_handle_events(&server->file_cache);
+      if (!(flags & IORING_CQE_F_MORE))
       {
-        EBP();
+        uring_arm_file_watch(server);
       }
-    }
-    else
-    {
-      EBP();
-    }
-  }
-  else
-  {
-    EBP();
-  }
-
-  return result;
-}
-
-INTERNAL void
-camera_take_picture(Camera *camera)
-{
-  struct v4l2_buffer camera_capture_buffer = {0};
-  camera_capture_buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  camera_capture_buffer.memory = V4L2_MEMORY_MMAP;
-  camera_capture_buffer.index = 0;
-  int camera_query_capture_buffer_status = ioctl(camera->fd, VIDIOC_QBUF, 
-                                                 &camera_capture_buffer);
-  if (camera_query_capture_buffer_status >= 0)
-  {
-    fd_set camera_fd_set;
-    FD_ZERO(&camera_fd_set);
-    FD_SET(camera->fd, &camera_fd_set);
-
-    struct timeval camera_wait_for_capture_frame_time = {0};
-    camera_wait_for_capture_frame_time.tv_sec = 2;
-    int num_returned_fds = select(camera->fd + 1, &camera_fd_set, NULL, NULL, 
-                                  &camera_wait_for_capture_frame_time);
-    if (num_returned_fds > 0)
+    } break;
+    case URING_OP_TYPE_CONTROL_POLL:
     {
-      int camera_dequeue_capture_buffer_status = ioctl(camera->fd, VIDIOC_DQBUF, 
-                                                       &camera_capture_buffer);
-      if (camera_dequeue_capture_buffer_status >= 0)
+      handle_control_event(server);
+      if (!(flags & IORING_CQE_F_MORE))
       {
-        camera->buffer_len = camera_capture_buffer.bytesused;
+        uring_arm_event_poll(server, &server->control_event, URING_OP_TYPE_CONTROL_POLL);
       }
-      else
+    } break;
+    case URING_OP_TYPE_MOTION_POLL:
+    {
+      handle_motion_event(server);
+      if (!(flags & IORING_CQE_F_MORE))
       {
-        EBP();
+        uring_arm_event_poll(server, &server->motion_event, URING_OP_TYPE_MOTION_POLL);
       }
-    }
-    else if (num_returned_fds == -1)
+    } break;
+    case URING_OP_TYPE_TELEMETRY_POLL:
     {
-      EBP();
-    }
-  }
-  else
-  {
-    EBP();
-  }
-  //int webcam_streamoff_status = ioctl(webcam_fd, VIDIOC_STREAMOFF, &webcam_buffer_info.type);
-  //ASSERT(webcam_streamoff_status != -1);
-}
-
-#define MAX_COMMAND_RESULT_COUNT 4096
-INTERNAL char * 
-read_entire_command(char *command_str)
-{
-  char *result = calloc(MAX_COMMAND_RESULT_COUNT, 1);
-  if (result != NULL)
-  {
-    int stdout_pair[2] = {0};
-
-    if (pipe(stdout_pair) != -1)
+      handle_telemetry_timer(server);
+      if (!(flags & IORING_CQE_F_MORE))
+      {
+        uring_arm_event_poll(server, &server->telemetry_timer, URING_OP_TYPE_TELEMETRY_POLL);
+      }
+    } break;
+    case URING_OP_TYPE_COMMAND_OUTPUT_POLL:
+    case URING_OP_TYPE_COMMAND_EXIT_POLL:
     {
-      // NOTE(Ryan): With forks, can also used shared memory...
-      pid_t pid = vfork();
-      if (pid != -1)
+      // NOTE(Ryan): The command may have finished, and another started on the connection
+      Connection *command_connection = server->connections + connection_index;
+      if (connection_index < MAX_CONNECTION_COUNT &&
+          command_connection->state == CONNECTION_STATE_RUNNING_COMMAND &&
+          command_connection->command_id == generation)
       {
-        if (pid == 0)
+        b32 is_output = (URING_USER_DATA_TYPE(user_data) == URING_OP_TYPE_COMMAND_OUTPUT_POLL);
+        if (is_output)
         {
-          dup2(stdout_pair[1], STDOUT_FILENO);
-          close(stdout_pair[1]);
-          close(stdout_pair[0]);
-
-          execl("/bin/bash", "bash", "-c", command_str, NULL);
-
-          EBP("Execl failed");
-          exit(127);
+          command_connection->is_command_output_polled = false;
         }
         else
         {
-          wait(NULL);
-
-          u32 bytes_read = read(stdout_pair[0], result, MAX_COMMAND_RESULT_COUNT);
-          if (bytes_read != -1)
-          {
-            result[bytes_read] = '\0';
-          }
-          else
-          {
-            EBP("Reading from pipe failed");
-          }
+          command_connection->is_command_exit_polled = false;
+        }
 
-          close(stdout_pair[0]);
-          close(stdout_pair[1]);
+        update_status_command(server, command_connection);
+        if (is_output && command_connection->state == CONNECTION_STATE_RUNNING_COMMAND &&
+            command_connection->command_id == generation && 
+            command_connection->command.output_fd != -1)
+        {
+          uring_arm_command_poll(server, command_connection, URING_OP_TYPE_COMMAND_OUTPUT_POLL);
         }
       }
-      else
-      {
-        close(stdout_pair[0]);
-        close(stdout_pair[1]);
-        EBP("Forking failed");
-      }
-    }
-    else
+    } break;
+    case URING_OP_TYPE_CANCEL:
     {
-      EBP("Creating pipes failed");
-    }
+    } break;
   }
-  else
+}
+
+INTERNAL b32
+server_init_uring(Server *server)
+{
+  b32 result = false;
+
+  if (uring_init(&server->ring, URING_ENTRY_COUNT, URING_BUFFER_COUNT, URING_BUFFER_SIZE))
   {
-    EBP("Calloc failed");
+    server->is_using_uring = true;
+    uring_register_files(&server->ring, &server->listener.fd, 1);
+    uring_arm_accept(server);
+    uring_arm_frame_poll(server);
+    uring_arm_file_watch(server);
+    uring_arm_event_poll(server, &server->control_event, URING_OP_TYPE_CONTROL_POLL);
+    uring_arm_event_poll(server, &server->telemetry_timer, URING_OP_TYPE_TELEMETRY_POLL);
+    if (server->motion_event.fd >= 0)
+    {
+      uring_arm_event_poll(server, &server->motion_event, URING_OP_TYPE_MOTION_POLL);
+    }
+    result = true;
   }
 
-
   return result;
 }
 
-// NOTE(Ryan):
-//  GET /path?query_string HTTP/1.0\r\n
-//  \r\n
-//  ....
-//  POST /path HTTP/1.0\r\n
-//  Content-Type: text/plain\r\n
-//  Content-Length: 12\r\n
-//  \r\n
-//  query_string
-typedef struct HTTPRequestInfo
-{
-  b32 is_get; 
-  char uri[64];
-  u8 *payload;
-  u32 payload_size;
-} HTTPRequestInfo;
-
 INTERNAL void
-consume_whitespace(char **at)
+server_run_uring(Server *server)
 {
-  while (isspace((*at)[0]))
+  while (global_want_to_run)
   {
-    (*at)++;
+    if (uring_submit(&server->ring, 1) < 0 && errno != EINTR && errno != EBUSY)
+    {
+      EBP();
+      break;
+    }
+
+    struct io_uring_cqe *cqe = uring_peek_cqe(&server->ring);
+    while (cqe != NULL)
+    {
+      u64 user_data = cqe->user_data;
+      s32 res = cqe->res;
+      u32 flags = cqe->flags;
+      uring_consume_cqe(&server->ring);
+
+      handle_uring_completion(server, user_data, res, flags);
+      reset_mem_arena(&server->scratch_arena);
+
+      cqe = uring_peek_cqe(&server->ring);
+    }
   }
 }
+#endif
 
-INTERNAL u32
-consume_identifier(char **at)
+// NOTE(Ryan): Each command is in a process group of its own, so would outlive the server
+INTERNAL void
+stop_status_commands(Server *server)
 {
-  u32 result = 0;
-
-  while (isalnum((*at)[0]) || (*at)[0] == ':' || (*at)[0] == '-' || (*at)[0] == '/' ||
-         (*at)[0] == '.')
+  for (Connection *connection = server->first_command_connection;
+       connection != NULL;
+       connection = connection->next_command)
   {
-    (*at)++;
-    result++;
+    close_process(&connection->command);
   }
-
-  return result;
 }
 
-INTERNAL u32
-consume_value(char **at)
+INTERNAL void *
+server_run(void *arg)
 {
-  u32 result = 0;
+  Server *server = (Server *)arg;
 
-  while ((*at)[0] != '\r' && ((*at)[1] != '\0' && (*at)[1] != '\n'))
+  if (server->cpu_index >= 0)
   {
-    (*at)++;
-    result++;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(server->cpu_index, &cpu_set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0)
+    {
+      BP_MSG(NULL, "Failed to pin worker thread");
+    }
   }
 
-  return result;
-}
-
-INTERNAL b32
-end_of_header(char **at)
-{
-  b32 result = false;
+#if SERVER_HAS_IO_URING
+  // NOTE(Ryan): Set up from the worker thread, so the ring is only ever touched by one thread
+  if (server->want_uring)
+  {
+    if (server_init_uring(server))
+    {
+      printf("Worker %u using io_uring (zero copy send: %s)\n", server->worker_index,
+             server->ring.has_sendmsg_zc ? "yes" : "no");
+      fflush(stdout);
+      server_run_uring(server);
+      stop_status_commands(server);
+      return NULL;
+    }
+    printf("Worker %u falling back to epoll, io_uring unavailable\n", server->worker_index);
+    fflush(stdout);
+  }
+#endif
 
-  result = ((*at)[0] == '\r' && 
-           ((*at)[1] != '\0' && (*at)[1] == '\n') &&
-           ((*at)[2] != '\0' && (*at)[2] == '\r') &&
-           ((*at)[3] != '\0' && (*at)[3] == '\n'));
+  struct epoll_event events[MAX_EPOLL_EVENT_COUNT] = {0};
+  while (global_want_to_run)
+  {
+    int event_count = epoll_wait(server->epoll_fd, events, MAX_EPOLL_EVENT_COUNT, -1);
+    if (event_count == -1)
+    {
+      if (errno != EINTR)
+      {
+        EBP();
+        break;
+      }
+      continue;
+    }
 
-  return result;
-}
+    for (s32 event_i = 0;
+         event_i < event_count;
+         ++event_i)
+    {
+      struct epoll_event *event = events + event_i;
+      EventSource *source = (EventSource *)event->data.ptr;
 
-INTERNAL HTTPRequestInfo
-get_http_request_info(int sock_fd)
-{
-  HTTPRequestInfo result = {0};
+      switch (source->type)
+      {
+        case EVENT_SOURCE_TYPE_LISTENER:
+        {
+          accept_connections(server);
+        } break;
+        case EVENT_SOURCE_TYPE_FRAME:
+        {
+          handle_frame_event(server);
+        } break;
+        case EVENT_SOURCE_TYPE_FILE_WATCH:
+        {
+          file_cache_handle_events(&server->file_cache);
+        } break;
+        case EVENT_SOURCE_TYPE_CONTROL:
+        {
+          handle_control_event(server);
+        } break;
+        case EVENT_SOURCE_TYPE_TELEMETRY_TIMER:
+        {
+          handle_telemetry_timer(server);
+        } break;
+        case EVENT_SOURCE_TYPE_MOTION:
+        {
+          handle_motion_event(server);
+        } break;
+        case EVENT_SOURCE_TYPE_COMMAND_OUTPUT:
+        case EVENT_SOURCE_TYPE_COMMAND_EXIT:
+        {
+          // NOTE(Ryan): Both are members of the connection waiting on the command
+          u64 source_offset = (source->type == EVENT_SOURCE_TYPE_COMMAND_OUTPUT) ? 
+                              offsetof(Connection, command_output) : 
+                              offsetof(Connection, command_exit);
+          Connection *connection = (Connection *)((u8 *)source - source_offset);
+          // NOTE(Ryan): An earlier event in this batch may have finished it
+          if (connection->state == CONNECTION_STATE_RUNNING_COMMAND)
+          {
+            update_status_command(server, connection);
+          }
+        } break;
+        case EVENT_SOURCE_TYPE_CONNECTION:
+        {
+          Connection *connection = (Connection *)source;
+          // NOTE(Ryan): An earlier event in this batch may have closed it
+          if (connection->source.fd == -1)
+          {
+            break;
+          }
 
-  char tmp_buf[4096] = {0};
-  int bytes_read = read(sock_fd, tmp_buf, sizeof(tmp_buf));
-  if (bytes_read != -1)
-  { 
-    tmp_buf[bytes_read] = '\0';
+          // NOTE(Ryan): Zero copy completions raise EPOLLERR too
+          if ((event->events & EPOLLERR) && connection->has_socket_zero_copy)
+          {
+            if (!handle_zero_copy_completions(server, connection))
+            {
+              break;
+            }
+          }
+          else if (event->events & (EPOLLERR | EPOLLHUP))
+          {
+            close_connection(server, connection);
+            break;
+          }
 
-    char *at = tmp_buf;
-    
-    consume_whitespace(&at);
-    char *method = at; 
-    u32 method_len = consume_identifier(&at);
-    result.is_get = (strncmp(method, "GET", method_len) == 0);
-    if (!result.is_get)
-    {
-      ASSERT(strncmp(method, "POST", method_len) == 0);
-    }
+          if (event->events & EPOLLOUT)
+          {
+            if (!flush_connection(server, connection))
+            {
+              break;
+            }
+          }
 
-    consume_whitespace(&at);
-    char *uri = at; 
-    u32 uri_len = consume_identifier(&at);
-    memcpy(result.uri, uri, uri_len + 1);
-    result.uri[uri_len] = '\0';
+          // NOTE(Ryan): A response finishing on EPOLLOUT may free up pipelined requests
+          if ((event->events & (EPOLLIN | EPOLLRDHUP)) || 
+              connection->state == CONNECTION_STATE_READING_REQUEST)
+          {
+            handle_connection_readable(server, connection);
+          }
+        } break;
+      }
 
-    consume_whitespace(&at);
-    char *protocol = at; 
-    u32 protocol_len = consume_identifier(&at);
+      reset_mem_arena(&server->scratch_arena);
+    }
+  }
+  stop_status_commands(server);
 
-    //printf("Method: %.*s, URI: %.*s, Protocol: %.*s\n", method_len, method, uri_len, uri, 
-    //                                                    protocol_len, protocol);
+  return NULL;
+}
 
-    while (true)
+int 
+main(int argc, char *argv[])
+{
+  u32 server_port = SERVER_PORT;
+  u32 worker_count = 1;
+  b32 want_cpu_pinning = false;
+  b32 want_uring = false;
+  u32 stream_target_latency_ms = STREAM_TARGET_LATENCY_MS;
+  const char *static_root_path = STATIC_ROOT_PATH;
+  const char *frame_source_path = FRAME_SOURCE_PATH;
+  u32 frame_width = FRAME_WIDTH;
+  u32 frame_height = FRAME_HEIGHT;
+  u32 frame_fps = FRAME_SOURCE_DEFAULT_FPS;
+  PIXEL_FORMAT frame_format = FRAME_PIXEL_FORMAT;
+  u32 frame_quality = JPEG_DEFAULT_QUALITY;
+  u32 encode_thread_count = FRAME_ENCODE_THREAD_COUNT;
+  b32 want_motion = false;
+  const char *motion_clip_path = NULL;
+  const char *archive_path = NULL;
+  for (s32 arg_i = 1;
+       arg_i < argc;
+       ++arg_i)
+  {
+    if (strcmp(argv[arg_i], "-p") == 0 && arg_i + 1 < argc)
     {
-      if (end_of_header(&at))
+      server_port = (u32)atoi(argv[++arg_i]);
+    }
+    else if (strcmp(argv[arg_i], "-w") == 0 && arg_i + 1 < argc)
+    {
+      worker_count = (u32)atoi(argv[++arg_i]);
+    }
+    else if (strcmp(argv[arg_i], "-a") == 0)
+    {
+      want_cpu_pinning = true;
+    }
+    else if (strcmp(argv[arg_i], "-u") == 0)
+    {
+      want_uring = true;
+    }
+    else if (strcmp(argv[arg_i], "-r") == 0 && arg_i + 1 < argc)
+    {
+      static_root_path = argv[++arg_i];
+    }
+    else if (strcmp(argv[arg_i], "-l") == 0 && arg_i + 1 < argc)
+    {
+      stream_target_latency_ms = (u32)atoi(argv[++arg_i]);
+    }
+    else if (strcmp(argv[arg_i], "-c") == 0 && arg_i + 1 < argc)
+    {
+      frame_source_path = argv[++arg_i];
+    }
+    else if (strcmp(argv[arg_i], "-s") == 0 && arg_i + 1 < argc)
+    {
+      if (sscanf(argv[++arg_i], "%ux%u", &frame_width, &frame_height) != 2)
       {
-        result.payload = at + 4;
-        break;
+        frame_width = FRAME_WIDTH;
+        frame_height = FRAME_HEIGHT;
       }
-
-      consume_whitespace(&at);
-      char *key = at;
-      u32 key_len = consume_identifier(&at);
-      consume_whitespace(&at);
-      char *value = at;
-      u32 value_len = consume_value(&at);
-
-      //printf("Key: %.*s, Value: %.*s\n", key_len, key, value_len, value);
-
-      if (strncmp(key, "Content-Length:", key_len) == 0)
+    }
+    else if (strcmp(argv[arg_i], "-f") == 0 && arg_i + 1 < argc)
+    {
+      frame_fps = (u32)atoi(argv[++arg_i]);
+    }
+    else if (strcmp(argv[arg_i], "-y") == 0 && arg_i + 1 < argc)
+    {
+      if (!pixel_format_from_name(argv[++arg_i], &frame_format))
       {
-        char *value_at = value;
-        while (isdigit(value_at[0]))
-        {
-          result.payload_size *= 10; 
-          result.payload_size = value_at[0] - '0';
-          value_at++;
-        }
+        frame_format = FRAME_PIXEL_FORMAT;
       }
     }
+    else if (strcmp(argv[arg_i], "-q") == 0 && arg_i + 1 < argc)
+    {
+      frame_quality = (u32)atoi(argv[++arg_i]);
+    }
+    else if (strcmp(argv[arg_i], "-j") == 0 && arg_i + 1 < argc)
+    {
+      encode_thread_count = (u32)atoi(argv[++arg_i]);
+    }
+    else if (strcmp(argv[arg_i], "-m") == 0)
+    {
+      want_motion = true;
+    }
+    else if (strcmp(argv[arg_i], "-M") == 0 && arg_i + 1 < argc)
+    {
+      want_motion = true;
+      motion_clip_path = argv[++arg_i];
+    }
+    else if (strcmp(argv[arg_i], "-R") == 0 && arg_i + 1 < argc)
+    {
+      archive_path = argv[++arg_i];
+    }
+  }
+  if (worker_count < 1)
+  {
+    worker_count = 1;
+  }
+  if (worker_count > MAX_SERVER_WORKER_COUNT)
+  {
+    worker_count = MAX_SERVER_WORKER_COUNT;
+  }
 
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, falsify_global_want_to_run);
+  signal(SIGTERM, falsify_global_want_to_run);
+  init_static_responses();
+  if (!register_routes(&global_router))
+  {
+    BP_MSG(NULL, "Failed to register routes");
   }
-  else
+  http_init_scanning();
+  jpeg_init_simd();
+
+  // NOTE(Ryan): Shared by every worker, only ever used with openat()
+  int static_root_fd = open(static_root_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (static_root_fd == -1)
   {
-    EBP("Read failed");
+    printf("No static root at %s, serving built-in pages only\n", static_root_path);
   }
-  
 
-  return result;
-}
+  s32 cpu_count = (s32)sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpu_count < 1)
+  {
+    cpu_count = 1;
+  }
 
-int 
-main(int argc, char *argv[])
-{
-  char html[] = {
-    "HTTP/1.1 200 OK\r\n"
-    "Content-Type: text/html; charset=UTF-8\r\n\r\n"
-    "<style> body { background-color: #efefef; } </style>\r\n"
-    "<h1> Hi There! </h1>\r\n"
-    "<img src='camera.jpeg' />\r\n"
-    "<form method='post'>\r\n"
-    "  <button name='LED1' value='1'> LED ON </button>\r\n"
-    "  <button name='LED2' value='0'> LED OFF </button>\r\n"
-    "</form>\r\n"
-  };
+  // NOTE(Ryan): More encode threads than CPUs only adds switching
+  if (encode_thread_count > (u32)cpu_count)
+  {
+    encode_thread_count = (u32)cpu_count;
+  }
+  capture_init(&global_capture, frame_source_path, frame_format, frame_width, frame_height, 
+               frame_fps, frame_quality);
+  // NOTE(Ryan): Before the workers start, as each subscribes to motion events
+  if (want_motion && !capture_enable_motion(&global_capture, motion_clip_path))
+  {
+    printf("Motion detection needs -y yuyv or -y nv12, running without it\n");
+  }
+  if (archive_path != NULL && !archive_init(&global_archive, archive_path, &global_capture))
+  {
+    printf("Cannot record to %s, running without it\n", archive_path);
+  }
+
+  control_init(&global_control_state);
+  control_add(&global_control_state, "LED1", 0, 1);
+  control_add(&global_control_state, "LED2", 0, 1);
+  control_add(&global_control_state, "PWM1", 0, 255);
 
-  int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (server_fd != -1)
+  // NOTE(Ryan): Thousands of idle control channels need more than the default 1024 fds
+  struct rlimit fd_limit = {0};
+  if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur < fd_limit.rlim_max)
   {
-    int opt_val = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, (void *)&opt_val, sizeof(opt_val)) == -1)
+    fd_limit.rlim_cur = fd_limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &fd_limit) == -1)
     {
       EBP();
     }
+  }
 
-    u32 server_port = 18000;
-    struct sockaddr_in server_addr = {0};
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    server_addr.sin_port = htons(server_port);
-
-    if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) != -1)
+  Server *servers = calloc(worker_count, sizeof(Server));
+  if (servers != NULL)
+  {
+    u32 started_count = 0;
+    for (u32 worker_i = 0;
+         worker_i < worker_count;
+         ++worker_i)
     {
-      u32 max_num_connections = 1;
-      if (listen(server_fd, max_num_connections) != -1)
+      Server *server = servers + worker_i;
+      s32 cpu_index = want_cpu_pinning ? (s32)(worker_i % (u32)cpu_count) : -1;
+      server->want_uring = want_uring;
+      server->stream_target_latency_ms = stream_target_latency_ms;
+      if (server_init(server, worker_i, cpu_index, server_port, static_root_fd))
       {
-        while (true)
+        if (pthread_create(&server->thread, NULL, server_run, server) == 0)
         {
-          struct sockaddr_in client_addr = {0}; 
-          u32 client_size = sizeof(client_addr);
-          int client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_size);
-          if (client_fd != -1)
-          {
-            HTTPRequestInfo request_info = get_http_request_info(client_fd); 
-
-            if (request_info.is_get)
-            {
-              if (strcmp(request_info.uri, "/") == 0)
-              {
-                char send_buf[2048] = {0};
-                snprintf(send_buf, sizeof(send_buf), "%s", html);
-                write(client_fd, send_buf, sizeof(send_buf));
-                close(client_fd);
-              }
-              else if (strcmp(request_info.uri, "/camera.jpeg") == 0)
-              {
-                Camera camera = camera_init("/dev/video0", 1280, 720);
-                ASSERT(camera.fd != -1);
-
-                char camera_multipart_header[] = {
-                  "HTTP/1.1 200 OK\r\n"
-                  "Content-Type: multipart/x-mixed-replace; boundary=myboundary\r\n\r\n"
-                };
-                write(client_fd, camera_multipart_header, sizeof(camera_multipart_header));
-
-                u32 camera_picture_boundary_size = camera.buffer_size + 256;
-                char *camera_picture_boundary = malloc(camera_picture_boundary_size);
-                ASSERT(camera_picture_boundary != NULL);
-
-                while (true)
-                {
-                  camera_take_picture(&camera);
-
-                  snprintf(camera_picture_boundary, camera_picture_boundary_size,
-                  "--myboundary\r\nContent-Type: image/jpeg\r\nContent-length: %d\r\n\r\n",
-                  camera.buffer_len);
-
-                  u32 camera_picture_boundary_header_size = strlen(camera_picture_boundary);
-
-                  memcpy(camera_picture_boundary + camera_picture_boundary_header_size,
-                         camera.buffer, camera.buffer_len);
-                  
-                  write(client_fd, camera_picture_boundary, 
-                        camera_picture_boundary_header_size + camera.buffer_len);
-                }
-              }
-            }
-            else
-            {
-              if (strcmp(request_info.uri, "/") == 0)
-              {
-                printf("%.*s\n", request_info.payload_size, request_info.payload);
-                char send_buf[2048] = {0};
-                snprintf(send_buf, sizeof(send_buf), "%s", html);
-                write(client_fd, send_buf, sizeof(send_buf));
-                close(client_fd);
-              }
-            }
-
-          }
-          else
-          {
-            EBP();
-          }
+          started_count++;
+        }
+        else
+        {
+          BP_MSG(NULL, "Failed to create worker thread");
         }
-      }
-      else
-      {
-        EBP();
       }
     }
-    else
+
+    capture_start(&global_capture, encode_thread_count);
+    if (global_archive.directory != NULL)
     {
-      EBP();
+      archive_start(&global_archive);
+    }
+
+    printf("Serving on port %u with %u workers\n", server_port, started_count);
+    fflush(stdout);
+
+    for (u32 worker_i = 0;
+         worker_i < worker_count;
+         ++worker_i)
+    {
+      if (servers[worker_i].thread != 0)
+      {
+        pthread_join(servers[worker_i].thread, NULL);
+      }
     }
 
+    capture_stop(&global_capture);
+    printf("Stopped\n");
   }
   else
   {
@@ -511,20 +3211,3 @@ main(int argc, char *argv[])
 // just wire up the high wire to the relay (however mains, so dangerous...)
 
 // optoisolator in effect just a simple transistor?
-#if 0
-void
-route("/")
-{
-  int fd = open("index.html", O_RDONLY);
-  if (fd == -1)
-  {
-    send_404();
-    sizeof("LED1=");
-    atoi(ptr) ? "on" : "off"
-  }
-  else
-  {
-
-  }
-}
-#endif
@@ -0,0 +1,282 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+// NOTE(Ryan): Talks to the kernel directly rather than through liburing,
+// the same way the camera is driven with raw V4L2 ioctls
+
+INTERNAL int
+uring_setup(u32 entry_count, struct io_uring_params *params)
+{
+  return (int)syscall(__NR_io_uring_setup, entry_count, params);
+}
+
+INTERNAL int
+uring_enter(int fd, u32 submit_count, u32 wait_count, u32 flags)
+{
+  return (int)syscall(__NR_io_uring_enter, fd, submit_count, wait_count, flags, NULL, 0);
+}
+
+INTERNAL int
+uring_register(int fd, u32 opcode, void *arg, u32 arg_count)
+{
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, arg_count);
+}
+
+INTERNAL void
+uring_destroy(IoUring *ring)
+{
+  if (ring->buf_base != NULL)
+  {
+    free(ring->buf_base);
+  }
+  if (ring->buf_ring != NULL)
+  {
+    munmap(ring->buf_ring, ring->buf_ring_size);
+  }
+  if (ring->sqes != NULL)
+  {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring)
+  {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  if (ring->sq_ring != NULL)
+  {
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  }
+  if (ring->fd >= 0)
+  {
+    close(ring->fd);
+  }
+
+  IoUring zero_ring = {0};
+  *ring = zero_ring;
+  ring->fd = -1;
+}
+
+INTERNAL b32
+uring_probe_op(int fd, u32 op)
+{
+  b32 result = false;
+
+  u64 probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = calloc(1, probe_size);
+  if (probe != NULL)
+  {
+    if (uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+    {
+      result = (op <= probe->last_op) && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+  }
+
+  return result;
+}
+
+INTERNAL void
+uring_provide_buffer(IoUring *ring, u16 buffer_id)
+{
+  u16 tail = ring->buf_ring->tail;
+  struct io_uring_buf *buf = &ring->buf_ring->bufs[tail & (ring->buf_count - 1)];
+  buf->addr = (u64)(ring->buf_base + (u64)buffer_id * ring->buf_size);
+  buf->len = ring->buf_size;
+  buf->bid = buffer_id;
+  __atomic_store_n(&ring->buf_ring->tail, (u16)(tail + 1), __ATOMIC_RELEASE);
+}
+
+INTERNAL u8 *
+uring_get_buffer(IoUring *ring, u16 buffer_id)
+{
+  return ring->buf_base + (u64)buffer_id * ring->buf_size;
+}
+
+// NOTE(Ryan): buf_count must be a power of two.
+// Fails on kernels without provided buffer rings (< 5.19), so the caller can fall back to epoll
+INTERNAL b32
+uring_init(IoUring *ring, u32 entry_count, u32 buf_count, u32 buf_size)
+{
+  b32 result = false;
+
+  IoUring zero_ring = {0};
+  *ring = zero_ring;
+  ring->fd = -1;
+
+  struct io_uring_params params = {0};
+  params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+  ring->fd = uring_setup(entry_count, &params);
+  if (ring->fd < 0 && errno == EINVAL)
+  {
+    struct io_uring_params fallback_params = {0};
+    params = fallback_params;
+    ring->fd = uring_setup(entry_count, &params);
+  }
+  if (ring->fd < 0)
+  {
+    return result;
+  }
+
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(params.features & IORING_FEAT_NODROP))
+  {
+    uring_destroy(ring);
+    return result;
+  }
+
+  ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+  u64 cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (cq_ring_size > ring->sq_ring_size)
+  {
+    ring->sq_ring_size = cq_ring_size;
+  }
+  ring->cq_ring_size = ring->sq_ring_size;
+
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED)
+  {
+    ring->sq_ring = NULL;
+    uring_destroy(ring);
+    return result;
+  }
+  ring->cq_ring = ring->sq_ring;
+
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+  {
+    ring->sqes = NULL;
+    uring_destroy(ring);
+    return result;
+  }
+
+  u8 *sq_ring = (u8 *)ring->sq_ring;
+  ring->sq_head = (u32 *)(sq_ring + params.sq_off.head);
+  ring->sq_tail = (u32 *)(sq_ring + params.sq_off.tail);
+  ring->sq_mask = (u32 *)(sq_ring + params.sq_off.ring_mask);
+  ring->sq_array = (u32 *)(sq_ring + params.sq_off.array);
+  ring->sq_entry_count = params.sq_entries;
+  ring->sqe_tail = *ring->sq_tail;
+
+  u8 *cq_ring = (u8 *)ring->cq_ring;
+  ring->cq_head = (u32 *)(cq_ring + params.cq_off.head);
+  ring->cq_tail = (u32 *)(cq_ring + params.cq_off.tail);
+  ring->cq_mask = (u32 *)(cq_ring + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq_ring + params.cq_off.cqes);
+
+  ring->buf_count = buf_count;
+  ring->buf_size = buf_size;
+  ring->buf_ring_size = buf_count * sizeof(struct io_uring_buf);
+  ring->buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ring->buf_base = malloc((u64)buf_count * buf_size);
+  if (ring->buf_ring == MAP_FAILED || ring->buf_base == NULL)
+  {
+    if (ring->buf_ring == MAP_FAILED)
+    {
+      ring->buf_ring = NULL;
+    }
+    uring_destroy(ring);
+    return result;
+  }
+
+  struct io_uring_buf_reg buf_reg = {0};
+  buf_reg.ring_addr = (u64)ring->buf_ring;
+  buf_reg.ring_entries = buf_count;
+  buf_reg.bgid = URING_PROVIDED_BUFFER_GROUP;
+  if (uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &buf_reg, 1) != 0)
+  {
+    uring_destroy(ring);
+    return result;
+  }
+  for (u32 buf_i = 0;
+       buf_i < buf_count;
+       ++buf_i)
+  {
+    uring_provide_buffer(ring, (u16)buf_i);
+  }
+
+  // NOTE(Ryan): Zero copy send and multishot recv both arrived in 6.0,
+  // so one probe covers both
+  ring->has_send_zc = uring_probe_op(ring->fd, IORING_OP_SEND_ZC);
+  ring->has_multishot_recv = ring->has_send_zc;
+  ring->has_sendmsg_zc = uring_probe_op(ring->fd, IORING_OP_SENDMSG_ZC);
+
+  result = true;
+
+  return result;
+}
+
+INTERNAL b32
+uring_register_files(IoUring *ring, int *fds, u32 fd_count)
+{
+  ring->has_fixed_files = (uring_register(ring->fd, IORING_REGISTER_FILES, fds, fd_count) == 0);
+  return ring->has_fixed_files;
+}
+
+INTERNAL int
+uring_submit(IoUring *ring, u32 wait_count)
+{
+  u32 tail = *ring->sq_tail;
+  u32 submit_count = ring->sqe_tail - tail;
+  for (;
+       tail != ring->sqe_tail;
+       ++tail)
+  {
+    ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+  }
+  __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+  int result = 0;
+  if (submit_count > 0 || wait_count > 0)
+  {
+    result = uring_enter(ring->fd, submit_count, wait_count,
+                         (wait_count > 0) ? IORING_ENTER_GETEVENTS : 0);
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Never fails, submitting queued entries first if the ring is full
+INTERNAL struct io_uring_sqe *
+uring_get_sqe(IoUring *ring)
+{
+  u32 head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  while (ring->sqe_tail - head >= ring->sq_entry_count)
+  {
+    uring_submit(ring, 0);
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  }
+
+  struct io_uring_sqe *result = &ring->sqes[ring->sqe_tail & *ring->sq_mask];
+  memset(result, 0, sizeof(*result));
+  ring->sqe_tail++;
+
+  return result;
+}
+
+INTERNAL struct io_uring_cqe *
+uring_peek_cqe(IoUring *ring)
+{
+  struct io_uring_cqe *result = NULL;
+
+  u32 head = *ring->cq_head;
+  if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+  {
+    result = &ring->cqes[head & *ring->cq_mask];
+  }
+
+  return result;
+}
+
+INTERNAL void
+uring_consume_cqe(IoUring *ring)
+{
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
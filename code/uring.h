@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#pragma once
+
+#include <linux/io_uring.h>
+
+#define URING_PROVIDED_BUFFER_GROUP 0
+
+typedef struct IoUring
+{
+  int fd;
+
+  void *sq_ring;
+  u64 sq_ring_size;
+  u32 *sq_head;
+  u32 *sq_tail;
+  u32 *sq_mask;
+  u32 *sq_array;
+  u32 sq_entry_count;
+  // NOTE(Ryan): Entries are filled locally and published on submit
+  u32 sqe_tail;
+
+  struct io_uring_sqe *sqes;
+  u64 sqes_size;
+
+  void *cq_ring;
+  u64 cq_ring_size;
+  u32 *cq_head;
+  u32 *cq_tail;
+  u32 *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  struct io_uring_buf_ring *buf_ring;
+  u64 buf_ring_size;
+  u8 *buf_base;
+  u32 buf_count;
+  u32 buf_size;
+
+  b32 has_send_zc;
+  b32 has_sendmsg_zc;
+  b32 has_multishot_recv;
+  b32 has_fixed_files;
+} IoUring;
@@ -0,0 +1,299 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+
+#include "websocket.h"
+
+// NOTE(Ryan): RFC 6455 framing, only as much as a control and telemetry channel needs.
+// Messages are small, so fragmented client messages are refused rather than reassembled.
+
+INTERNAL u32
+sha1_rotate_left(u32 value, u32 count)
+{
+  return (value << count) | (value >> (32 - count));
+}
+
+INTERNAL void
+sha1_process_block(u32 *state, const u8 *block)
+{
+  u32 words[80] = {0};
+  for (u32 word_i = 0;
+       word_i < 16;
+       ++word_i)
+  {
+    words[word_i] = ((u32)block[word_i * 4] << 24) | ((u32)block[word_i * 4 + 1] << 16) |
+                    ((u32)block[word_i * 4 + 2] << 8) | (u32)block[word_i * 4 + 3];
+  }
+  for (u32 word_i = 16;
+       word_i < 80;
+       ++word_i)
+  {
+    words[word_i] = sha1_rotate_left(words[word_i - 3] ^ words[word_i - 8] ^
+                                     words[word_i - 14] ^ words[word_i - 16], 1);
+  }
+
+  u32 a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+  for (u32 round_i = 0;
+       round_i < 80;
+       ++round_i)
+  {
+    u32 f = 0, k = 0;
+    if (round_i < 20)
+    {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    }
+    else if (round_i < 40)
+    {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    }
+    else if (round_i < 60)
+    {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    }
+    else
+    {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+
+    u32 temp = sha1_rotate_left(a, 5) + f + e + k + words[round_i];
+    e = d;
+    d = c;
+    c = sha1_rotate_left(b, 30);
+    b = a;
+    a = temp;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+INTERNAL void
+sha1(const u8 *data, u32 data_len, u8 *digest)
+{
+  u32 state[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+
+  u32 data_i = 0;
+  for (;
+       data_i + 64 <= data_len;
+       data_i += 64)
+  {
+    sha1_process_block(state, data + data_i);
+  }
+
+  // NOTE(Ryan): The remainder, a 1 bit, zeros then the length in bits, in one or two blocks
+  u8 tail[128] = {0};
+  u32 tail_len = data_len - data_i;
+  memcpy(tail, data + data_i, tail_len);
+  tail[tail_len] = 0x80;
+  u32 tail_size = (tail_len + 1 + 8 <= 64) ? 64 : 128;
+  u64 bit_len = (u64)data_len * 8;
+  for (u32 byte_i = 0;
+       byte_i < 8;
+       ++byte_i)
+  {
+    tail[tail_size - 1 - byte_i] = (u8)(bit_len >> (byte_i * 8));
+  }
+  for (u32 block_i = 0;
+       block_i < tail_size;
+       block_i += 64)
+  {
+    sha1_process_block(state, tail + block_i);
+  }
+
+  for (u32 word_i = 0;
+       word_i < 5;
+       ++word_i)
+  {
+    digest[word_i * 4] = (u8)(state[word_i] >> 24);
+    digest[word_i * 4 + 1] = (u8)(state[word_i] >> 16);
+    digest[word_i * 4 + 2] = (u8)(state[word_i] >> 8);
+    digest[word_i * 4 + 3] = (u8)state[word_i];
+  }
+}
+
+// NOTE(Ryan): out needs room for 4 * ((data_len + 2) / 3) + 1
+INTERNAL u32
+base64_encode(const u8 *data, u32 data_len, char *out)
+{
+  LOCAL_PERSIST const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  u32 result = 0;
+  for (u32 data_i = 0;
+       data_i < data_len;
+       data_i += 3)
+  {
+    u32 remaining = data_len - data_i;
+    u32 group = ((u32)data[data_i] << 16) |
+                ((remaining > 1) ? ((u32)data[data_i + 1] << 8) : 0) |
+                ((remaining > 2) ? (u32)data[data_i + 2] : 0);
+    out[result++] = alphabet[(group >> 18) & 0x3f];
+    out[result++] = alphabet[(group >> 12) & 0x3f];
+    out[result++] = (remaining > 1) ? alphabet[(group >> 6) & 0x3f] : '=';
+    out[result++] = (remaining > 2) ? alphabet[group & 0x3f] : '=';
+  }
+  out[result] = '\0';
+
+  return result;
+}
+
+// NOTE(Ryan): Returns false unless the request asks for a version 13 upgrade
+INTERNAL b32
+websocket_is_upgrade_request(HTTPRequest *request)
+{
+  HTTPSlice key = http_find_header(request, "Sec-WebSocket-Key");
+  return (request->method == HTTP_METHOD_GET && request->version_minor >= 1 &&
+          http_slice_has_token(http_find_header(request, "Connection"), "upgrade") &&
+          http_slice_equals_ignore_case(http_find_header(request, "Upgrade"), "websocket") &&
+          http_slice_equals(http_find_header(request, "Sec-WebSocket-Version"), "13") &&
+          key.size > 0 && key.size <= 64);
+}
+
+// NOTE(Ryan): accept_key needs WEBSOCKET_ACCEPT_KEY_SIZE
+INTERNAL void
+websocket_compute_accept_key(HTTPSlice client_key, char *accept_key)
+{
+  LOCAL_PERSIST const char websocket_guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+  u8 key_buf[64 + sizeof(websocket_guid)] = {0};
+  memcpy(key_buf, client_key.str, client_key.size);
+  memcpy(key_buf + client_key.size, websocket_guid, sizeof(websocket_guid) - 1);
+
+  u8 digest[20] = {0};
+  sha1(key_buf, client_key.size + (u32)sizeof(websocket_guid) - 1, digest);
+  base64_encode(digest, sizeof(digest), accept_key);
+}
+
+// NOTE(Ryan): Client frames are always masked. max_payload_len caps what may be buffered
+INTERNAL WEBSOCKET_PARSE_RESULT
+websocket_parse_frame(u8 *buf, u32 buf_len, u32 max_payload_len, WebSocketFrame *frame)
+{
+  if (buf_len < 2)
+  {
+    return WEBSOCKET_PARSE_RESULT_INCOMPLETE;
+  }
+
+  b32 is_masked = (buf[1] & 0x80) != 0;
+  u64 payload_len = buf[1] & 0x7f;
+  u32 header_len = 2;
+  if (payload_len == 126)
+  {
+    header_len += 2;
+  }
+  else if (payload_len == 127)
+  {
+    header_len += 8;
+  }
+
+  // NOTE(Ryan): Reserved bits without an extension, or an unmasked client frame
+  if ((buf[0] & 0x70) != 0 || !is_masked)
+  {
+    return WEBSOCKET_PARSE_RESULT_ERROR;
+  }
+  if (buf_len < header_len + 4)
+  {
+    return WEBSOCKET_PARSE_RESULT_INCOMPLETE;
+  }
+
+  if (header_len > 2)
+  {
+    payload_len = 0;
+    for (u32 byte_i = 2;
+         byte_i < header_len;
+         ++byte_i)
+    {
+      payload_len = (payload_len << 8) | buf[byte_i];
+    }
+  }
+
+  frame->is_final = (buf[0] & 0x80) != 0;
+  frame->opcode = (WEBSOCKET_OPCODE)(buf[0] & 0x0f);
+  b32 is_control = (frame->opcode & 0x8) != 0;
+  if (payload_len > max_payload_len ||
+      (is_control && (payload_len > WEBSOCKET_MAX_CONTROL_PAYLOAD_SIZE || !frame->is_final)))
+  {
+    return WEBSOCKET_PARSE_RESULT_ERROR;
+  }
+
+  u8 *mask = buf + header_len;
+  u32 frame_size = header_len + 4 + (u32)payload_len;
+  if (buf_len < frame_size)
+  {
+    return WEBSOCKET_PARSE_RESULT_INCOMPLETE;
+  }
+
+  frame->payload = buf + header_len + 4;
+  frame->payload_len = (u32)payload_len;
+  frame->size = frame_size;
+  for (u32 payload_i = 0;
+       payload_i < frame->payload_len;
+       ++payload_i)
+  {
+    frame->payload[payload_i] ^= mask[payload_i & 3];
+  }
+
+  return WEBSOCKET_PARSE_RESULT_FRAME;
+}
+
+// NOTE(Ryan): Server frames are never masked. buf needs WEBSOCKET_MAX_FRAME_HEADER_SIZE
+INTERNAL u32
+websocket_format_frame_header(u8 *buf, WEBSOCKET_OPCODE opcode, u64 payload_len)
+{
+  u32 result = 0;
+
+  buf[result++] = (u8)(0x80 | opcode);
+  if (payload_len < 126)
+  {
+    buf[result++] = (u8)payload_len;
+  }
+  else if (payload_len <= 0xffff)
+  {
+    buf[result++] = 126;
+    buf[result++] = (u8)(payload_len >> 8);
+    buf[result++] = (u8)payload_len;
+  }
+  else
+  {
+    buf[result++] = 127;
+    for (s32 byte_i = 7;
+         byte_i >= 0;
+         --byte_i)
+    {
+      buf[result++] = (u8)(payload_len >> (byte_i * 8));
+    }
+  }
+
+  return result;
+}
+
+// NOTE(Ryan): Returns NULL if out of memory
+INTERNAL WebSocketMessage *
+websocket_build_message(WEBSOCKET_OPCODE opcode, const u8 *payload, u32 payload_len, u64 version)
+{
+  WebSocketMessage *result = malloc(sizeof(WebSocketMessage) +
+                                    WEBSOCKET_MAX_FRAME_HEADER_SIZE + payload_len);
+  if (result != NULL)
+  {
+    result->ref_count = 1;
+    result->version = version;
+    result->size = websocket_format_frame_header(result->data, opcode, payload_len);
+    memcpy(result->data + result->size, payload, payload_len);
+    result->size += payload_len;
+  }
+
+  return result;
+}
+
+INTERNAL void
+websocket_message_release(WebSocketMessage *message)
+{
+  if (message != NULL && --message->ref_count == 0)
+  {
+    free(message);
+  }
+}
@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: zlib-acknowledgement
+#pragma once
+
+#define WEBSOCKET_ACCEPT_KEY_SIZE 29
+#define WEBSOCKET_MAX_FRAME_HEADER_SIZE 10
+#define WEBSOCKET_MAX_CONTROL_PAYLOAD_SIZE 125
+
+typedef enum WEBSOCKET_OPCODE
+{
+  WEBSOCKET_OPCODE_CONTINUATION = 0x0,
+  WEBSOCKET_OPCODE_TEXT = 0x1,
+  WEBSOCKET_OPCODE_BINARY = 0x2,
+  WEBSOCKET_OPCODE_CLOSE = 0x8,
+  WEBSOCKET_OPCODE_PING = 0x9,
+  WEBSOCKET_OPCODE_PONG = 0xa,
+} WEBSOCKET_OPCODE;
+
+typedef enum WEBSOCKET_PARSE_RESULT
+{
+  WEBSOCKET_PARSE_RESULT_INCOMPLETE,
+  WEBSOCKET_PARSE_RESULT_FRAME,
+  WEBSOCKET_PARSE_RESULT_ERROR,
+} WEBSOCKET_PARSE_RESULT;
+
+// NOTE(Ryan): A client frame, unmasked in place. payload points into the connection buffer
+typedef struct WebSocketFrame
+{
+  b32 is_final;
+  WEBSOCKET_OPCODE opcode;
+  u8 *payload;
+  u32 payload_len;
+  // NOTE(Ryan): Bytes of the buffer the frame occupied, including its header
+  u32 size;
+} WebSocketFrame;
+
+// NOTE(Ryan): A complete server frame shared by every connection sending it.
+// Only ever touched by the worker that built it
+typedef struct WebSocketMessage
+{
+  u32 ref_count;
+  u64 version;
+  u32 size;
+  u8 data[];
+} WebSocketMessage;